@@ -79,6 +79,15 @@ void SignalHandler(int signal, siginfo_t * sigInfo, void * context)
     /* If we were in a try block, jump to the exception handler */
     if (gInTry)
     {
+        sigset_t signals;
+
+        /* The signal is blocked while we're handling it, and longjmp() won't
+         * restore the mask. Unblock it, so that this thread can fail again
+         */
+        sigemptyset(&signals);
+        sigaddset(&signals, signal);
+        pthread_sigmask(SIG_UNBLOCK, &signals, 0);
+
         longjmp(gJumpEnv, signal);
     }
 }
@@ -8,6 +8,7 @@
 
 #include <setjmp.h>
 #include <signal.h>
+#include <pthread.h>
 #include <execinfo.h>
 
 extern __thread jmp_buf gJumpEnv;
@@ -34,8 +35,11 @@ void SignalHandler(int signal, siginfo_t * sigInfo, void * context);
 
 /* Manually throw an error when in the try block
  * to get into the except block.
+ * The signal is sent to the calling thread only: any other
+ * thread could handle a signal sent to the process, and would
+ * jump to its own except block instead.
  */
-#define HPCSIM_THROW sigqueue(getpid(), SIGSEGV, gMagicMarker)
+#define HPCSIM_THROW pthread_sigqueue(pthread_self(), SIGSEGV, gMagicMarker)
 
 /* End marker of a try/except block.
  * It is mandatory in any case.
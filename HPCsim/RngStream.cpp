@@ -43,6 +43,21 @@ const double A2p127[3][3] = {
        {    2824425944.0,   32183930.0, 2093834863.0 }
        };
 
+// The same matrices raised to the powers 2^76, used to jump from one
+// SubStream to the next one.
+
+const double A1p76[3][3] = {
+       {      82758667.0, 1871391091.0, 4127413238.0 },
+       {    3672831523.0,   69195019.0, 1871391091.0 },
+       {    3672091415.0, 3528743235.0,   69195019.0 }
+       };
+
+const double A2p76[3][3] = {
+       {    1511326704.0, 3759209742.0, 1610795712.0 },
+       {    4292754251.0, 1511326704.0, 3889917532.0 },
+       {    3859662829.0, 4292754251.0, 3708466080.0 }
+       };
+
 
 
 //-------------------------------------------------------------------------
@@ -87,6 +102,73 @@ void MatVecModM (const double A[3][3], const double s[3], double v[3],
         v[i] = x[i];
 }
 
+
+//-------------------------------------------------------------------------
+// Compute the matrix C = A*B MOD m. Assume that -m < s[i] < m.
+// Works also when C = A or C = B.
+//
+void MatMatModM (const double A[3][3], const double B[3][3],
+                 double C[3][3], double m)
+{
+    int i, j;
+    double V[3], W[3][3];
+
+    for (i = 0; i < 3; ++i) {
+        for (j = 0; j < 3; ++j)
+            V[j] = B[j][i];
+        MatVecModM (A, V, V, m);
+        for (j = 0; j < 3; ++j)
+            W[j][i] = V[j];
+    }
+    for (i = 0; i < 3; ++i)
+        for (j = 0; j < 3; ++j)
+            C[i][j] = W[i][j];
+}
+
+
+//-------------------------------------------------------------------------
+// Compute the matrix B = (A^n Mod m); works even if A = B.
+//
+void MatPowModM (const double A[3][3], double B[3][3], double m,
+                 unsigned long n)
+{
+    int i, j;
+    double W[3][3];
+
+    // initialize: W = A; B = I
+    for (i = 0; i < 3; ++i) {
+        for (j = 0; j < 3; ++j) {
+            W[i][j] = A[i][j];
+            B[i][j] = 0.0;
+        }
+    }
+    for (j = 0; j < 3; ++j)
+        B[j][j] = 1.0;
+
+    // Compute B = A^n mod m using the binary decomposition of n
+    while (n > 0) {
+        if (n % 2) MatMatModM (W, B, B, m);
+        MatMatModM (W, W, W, m);
+        n /= 2;
+    }
+}
+
+
+// Jump from one declared stream to the next one: A1p127 and A2p127,
+// raised to the stride set by SetStride().
+
+double A1Stride[3][3] = {
+       {    2427906178.0, 3580155704.0,  949770784.0 },
+       {     226153695.0, 1230515664.0, 3580155704.0 },
+       {    1988835001.0,  986791581.0, 1230515664.0 }
+       };
+
+double A2Stride[3][3] = {
+       {    1464411153.0,  277697599.0, 1610723613.0 },
+       {      32183930.0, 1464411153.0, 1022607788.0 },
+       {    2824425944.0,   32183930.0, 2093834863.0 }
+       };
+
 } // end of anonymous namespace
 
 
@@ -113,6 +195,16 @@ const double * RngStream::GetNextSeed ()
 }
 
 
+//-------------------------------------------------------------------------
+// Set the next seed, as saved from GetNextSeed()
+//
+void RngStream::SetNextSeed (const double seed[6])
+{
+    for (int i = 0; i < 6; ++i)
+        nextSeed[i] = seed[i];
+}
+
+
 //-------------------------------------------------------------------------
 // constructor
 //
@@ -131,8 +223,29 @@ RngStream::RngStream (const char *s) : name (s)
 
    memcpy(digest, Cg, sizeof(digest));
 
-   MatVecModM (A1p127, nextSeed, nextSeed, m1);
-   MatVecModM (A2p127, &nextSeed[3], &nextSeed[3], m2);
+   MatVecModM (A1Stride, nextSeed, nextSeed, m1);
+   MatVecModM (A2Stride, &nextSeed[3], &nextSeed[3], m2);
+}
+
+
+//-------------------------------------------------------------------------
+// constructor, starting at a substream of the stream identified by id.
+// The digest is the one of the stream, so that the substream still
+// identifies the same event. nextSeed is left untouched.
+//
+RngStream::RngStream (const unsigned char id[ID_FIELD_SIZE], unsigned long substream)
+{
+   double B1[3][3], B2[3][3];
+
+   memcpy(Ig, id, sizeof(Ig));
+   memcpy(digest, id, sizeof(digest));
+
+   MatPowModM (A1p76, B1, m1, substream);
+   MatPowModM (A2p76, B2, m2, substream);
+   MatVecModM (B1, Ig, Bg, m1);
+   MatVecModM (B2, &Ig[3], &Bg[3], m2);
+   for (int i = 0; i < 6; ++i)
+      Cg[i] = Bg[i];
 }
 
 
@@ -141,10 +254,55 @@ RngStream::RngStream (const char *s) : name (s)
 //
 void RngStream::AdvanceStream(unsigned long n)
 {
-   for (unsigned long i = 0; i < n; ++i) {
-      MatVecModM (A1p127, nextSeed, nextSeed, m1);
-      MatVecModM (A2p127, &nextSeed[3], &nextSeed[3], m2);
+   double B1[3][3], B2[3][3];
+
+   MatPowModM (A1Stride, B1, m1, n);
+   MatPowModM (A2Stride, B2, m2, n);
+   MatVecModM (B1, nextSeed, nextSeed, m1);
+   MatVecModM (B2, &nextSeed[3], &nextSeed[3], m2);
+}
+
+
+//-------------------------------------------------------------------------
+// Make the n-th stream of the package (from the default seed, whatever
+// the stride) the next declared one
+//
+void RngStream::SetStream(unsigned long n)
+{
+   double B1[3][3], B2[3][3];
+
+   for (int i = 0; i < 6; ++i) {
+      nextSeed[i] = 12345.0;
    }
+
+   MatPowModM (A1p127, B1, m1, n);
+   MatPowModM (A2p127, B2, m2, n);
+   MatVecModM (B1, nextSeed, nextSeed, m1);
+   MatVecModM (B2, &nextSeed[3], &nextSeed[3], m2);
+}
+
+
+//-------------------------------------------------------------------------
+// Skip n - 1 streams after each declared one (and in AdvanceStream()),
+// so that a process only draws one stream out of n
+//
+void RngStream::SetStride(unsigned long n)
+{
+   MatPowModM (A1p127, A1Stride, m1, n);
+   MatPowModM (A2p127, A2Stride, m2, n);
+}
+
+//-------------------------------------------------------------------------
+// Reset the stream to the beginning of its next SubStream.
+// The digest is kept, so that the SubStream still identifies the same
+// event.
+//
+void RngStream::ResetNextSubstream ()
+{
+   MatVecModM (A1p76, Bg, Bg, m1);
+   MatVecModM (A2p76, &Bg[3], &Bg[3], m2);
+   for (int i = 0; i < 6; ++i)
+      Cg[i] = Bg[i];
 }
 
 //-------------------------------------------------------------------------
@@ -183,3 +341,12 @@ const unsigned char * RngStream::GetDigest() const
 {
     return digest;
 }
+
+//-------------------------------------------------------------------------
+// Get the current state of the stream
+//
+void RngStream::GetState (double seed[6]) const
+{
+   for (int i = 0; i < 6; ++i)
+      seed[i] = Cg[i];
+}
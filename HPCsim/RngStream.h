@@ -18,17 +18,35 @@ public:
 RngStream (const char *name = "");
 
 
+RngStream (const unsigned char id[ID_FIELD_SIZE], unsigned long substream);
+
+
 static void AdvanceStream(unsigned long n);
 
 
+static void SetStride(unsigned long n);
+
+
+static void SetStream(unsigned long n);
+
+
+void ResetNextSubstream ();
+
+
 double RandU01 ();
 
 
 const unsigned char * GetDigest() const;
 
 
+void GetState (double seed[6]) const;
+
+
 static const double * GetNextSeed();
 
+
+static void SetNextSeed(const double seed[6]);
+
 private:
 
 double Cg[6], Bg[6], Ig[6];
@@ -0,0 +1,466 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TAccumulators.cpp
+ * PURPOSE:          User histograms and counters
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "TAccumulators.h"
+#include "TThreadsFactory.h"
+#include "TTopology.h"
+
+#define ACCUMULATORS_MAGIC "HPCsimA1"
+
+/* 2^64, one in fixed point */
+#define FIXED_ONE 18446744073709551616.0
+/* 2^63, conversions saturate there: out of range ones are undefined */
+#define FIXED_LIMIT 9223372036854775808.0
+
+__extension__ typedef __int128 TSignedFixed;
+
+static inline TFixed ToFixed(double value)
+{
+    if (value >= FIXED_LIMIT)
+    {
+        return ~(static_cast<TFixed>(1) << 127);
+    }
+    if (value <= -FIXED_LIMIT)
+    {
+        return static_cast<TFixed>(1) << 127;
+    }
+    /* NaN doesn't count */
+    if (value != value)
+    {
+        return 0;
+    }
+
+    return static_cast<TFixed>(static_cast<TSignedFixed>(value * FIXED_ONE));
+}
+
+static inline double ToDouble(TFixed value)
+{
+    return static_cast<double>(static_cast<TSignedFixed>(value)) / FIXED_ONE;
+}
+
+static inline void AddCell(TAccumulatorCell & to, const TAccumulatorCell & from)
+{
+    to.fEntries += from.fEntries;
+    to.fSum += from.fSum;
+    to.fSum2 += from.fSum2;
+}
+
+TAccumulators::TAccumulators()
+{
+    fCells = 0;
+    fLost = 0;
+    fSealed = false;
+    pthread_mutex_init(&fSharedLock, 0);
+}
+
+TAccumulators::~TAccumulators()
+{
+    for (size_t i = 0; i < fRooms.size(); ++i)
+    {
+        if (fRooms[i] != 0)
+        {
+            TTopology::FreeLocal(fRooms[i], fCells * sizeof(TAccumulatorCell));
+        }
+    }
+
+    pthread_mutex_destroy(&fSharedLock);
+}
+
+TAccumulators * TAccumulators::GetInstance(bool destroyInstance)
+{
+    static TAccumulators * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TAccumulators();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TAccumulators::CheckName(const char * name)
+{
+    /* Names are the keys of the text dump */
+    if (fSealed || name == 0 || name[0] == '\0' || strlen(name) > 255 || strpbrk(name, " \t\r\n") != 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < fHistograms.size(); ++i)
+    {
+        if (fHistograms[i].fName == name)
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < fCounters.size(); ++i)
+    {
+        if (fCounters[i].fName == name)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int TAccumulators::CreateHistogram(const char * name, unsigned int bins, double min, double max)
+{
+    TUserHistogram histogram;
+
+    if (!CheckName(name) || bins == 0 || bins > (1U << 24) || !(min < max))
+    {
+        return -1;
+    }
+
+    histogram.fName = name;
+    histogram.fBins = bins;
+    histogram.fMin = min;
+    histogram.fMax = max;
+    histogram.fScale = bins / (max - min);
+    histogram.fOffset = fCells;
+    fCells += bins + 2;
+    fHistograms.push_back(histogram);
+
+    return fHistograms.size() - 1;
+}
+
+int TAccumulators::CreateCounter(const char * name)
+{
+    TUserCounter counter;
+
+    if (!CheckName(name))
+    {
+        return -1;
+    }
+
+    counter.fName = name;
+    counter.fOffset = fCells;
+    ++fCells;
+    fCounters.push_back(counter);
+
+    return fCounters.size() - 1;
+}
+
+void TAccumulators::Seal(unsigned int threads)
+{
+    fRooms.resize(threads + 1, 0);
+    fPrevious.assign(fCells, TAccumulatorCell());
+    fSealed = true;
+}
+
+TAccumulatorCell * TAccumulators::GetRoom(unsigned int slot)
+{
+    /* Allocated from the thread, so that it's local to it. Anonymous memory is zeroed */
+    if (fRooms[slot] == 0)
+    {
+        fRooms[slot] = reinterpret_cast<TAccumulatorCell *>(TTopology::AllocateLocal(fCells * sizeof(TAccumulatorCell)));
+    }
+
+    return fRooms[slot];
+}
+
+void TAccumulators::Accumulate(unsigned int cell, double value)
+{
+    unsigned int slot = TThreadsFactory::GetCurrentSlot();
+    TAccumulatorCell * cells;
+
+    /* Threads out of the factory (the writer, the main thread) share the last copy */
+    if (slot >= fRooms.size() - 1)
+    {
+        slot = fRooms.size() - 1;
+        pthread_mutex_lock(&fSharedLock);
+    }
+
+    cells = GetRoom(slot);
+    if (cells != 0)
+    {
+        cells[cell].fEntries++;
+        cells[cell].fSum += ToFixed(value);
+        cells[cell].fSum2 += ToFixed(value * value);
+    }
+    else
+    {
+        __sync_add_and_fetch(&fLost, 1);
+    }
+
+    if (slot == fRooms.size() - 1)
+    {
+        pthread_mutex_unlock(&fSharedLock);
+    }
+}
+
+void TAccumulators::Fill(int histogram, double value, double weight)
+{
+    unsigned int bin;
+
+    if (!fSealed || histogram < 0 || static_cast<unsigned int>(histogram) >= fHistograms.size())
+    {
+        return;
+    }
+
+    const TUserHistogram & target = fHistograms[histogram];
+
+    /* Underflow is the bin 0, overflow (and NaN) the last one */
+    if (value >= target.fMin && value < target.fMax)
+    {
+        bin = 1 + static_cast<unsigned int>((value - target.fMin) * target.fScale);
+        /* Rounding, right below the upper edge */
+        if (bin > target.fBins)
+        {
+            bin = target.fBins;
+        }
+    }
+    else
+    {
+        bin = (value < target.fMin ? 0 : target.fBins + 1);
+    }
+
+    Accumulate(target.fOffset + bin, weight);
+}
+
+void TAccumulators::Add(int counter, double value)
+{
+    if (!fSealed || counter < 0 || static_cast<unsigned int>(counter) >= fCounters.size())
+    {
+        return;
+    }
+
+    Accumulate(fCounters[counter].fOffset, value);
+}
+
+static bool WriteName(FILE * file, const std::string & name)
+{
+    uint32_t length = name.size();
+
+    return fwrite(&length, sizeof(length), 1, file) == 1 && fwrite(name.data(), 1, length, file) == length;
+}
+
+static bool ReadName(FILE * file, const std::string & expected)
+{
+    uint32_t length;
+    char name[256];
+
+    if (fread(&length, sizeof(length), 1, file) != 1 || length != expected.size() || length > sizeof(name))
+    {
+        return false;
+    }
+
+    return fread(name, 1, length, file) == length && expected.compare(0, length, name, length) == 0;
+}
+
+static bool WriteCells(FILE * file, const TAccumulatorCell * cells, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        /* Low then high quad word of the sums */
+        uint64_t cell[5] = { cells[i].fEntries,
+                             static_cast<uint64_t>(cells[i].fSum), static_cast<uint64_t>(cells[i].fSum >> 64),
+                             static_cast<uint64_t>(cells[i].fSum2), static_cast<uint64_t>(cells[i].fSum2 >> 64) };
+
+        if (fwrite(cell, sizeof(cell), 1, file) != 1)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ReadCells(FILE * file, TAccumulatorCell * cells, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        uint64_t cell[5];
+
+        if (fread(cell, sizeof(cell), 1, file) != 1)
+        {
+            return false;
+        }
+
+        cells[i].fEntries = cell[0];
+        cells[i].fSum = (static_cast<TFixed>(cell[2]) << 64) | cell[1];
+        cells[i].fSum2 = (static_cast<TFixed>(cell[4]) << 64) | cell[3];
+    }
+
+    return true;
+}
+
+bool TAccumulators::Load(const char * path)
+{
+    std::vector<TAccumulatorCell> cells(fCells);
+    char magic[sizeof(ACCUMULATORS_MAGIC) - 1];
+    uint32_t count[2];
+    bool matching;
+    FILE * file;
+
+    file = fopen(path, "rb");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    /* Only a dump of the very same declarations can be merged */
+    matching = (fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, ACCUMULATORS_MAGIC, sizeof(magic)) == 0 &&
+                fread(count, sizeof(count), 1, file) == 1 && count[0] == fHistograms.size() && count[1] == fCounters.size());
+
+    for (size_t i = 0; matching && i < fHistograms.size(); ++i)
+    {
+        const TUserHistogram & histogram = fHistograms[i];
+        uint32_t bins;
+        double range[2];
+
+        matching = (ReadName(file, histogram.fName) &&
+                    fread(&bins, sizeof(bins), 1, file) == 1 && bins == histogram.fBins &&
+                    fread(range, sizeof(range), 1, file) == 1 && range[0] == histogram.fMin && range[1] == histogram.fMax &&
+                    ReadCells(file, &cells[histogram.fOffset], bins + 2));
+    }
+
+    for (size_t i = 0; matching && i < fCounters.size(); ++i)
+    {
+        matching = (ReadName(file, fCounters[i].fName) && ReadCells(file, &cells[fCounters[i].fOffset], 1));
+    }
+
+    fclose(file);
+
+    if (!matching)
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < fCells; ++i)
+    {
+        AddCell(fPrevious[i], cells[i]);
+    }
+
+    return true;
+}
+
+static void WriteText(FILE * file, const char * what, double low, double high, const TAccumulatorCell & cell)
+{
+    fprintf(file, "%s\t%.17g\t%.17g\t%llu\t%.17g\t%.17g\n", what, low, high, cell.fEntries, ToDouble(cell.fSum), ToDouble(cell.fSum2));
+}
+
+void TAccumulators::ClearLoaded(void)
+{
+    fPrevious.assign(fCells, TAccumulatorCell());
+}
+
+void TAccumulators::Clear(void)
+{
+    for (size_t i = 0; i < fRooms.size(); ++i)
+    {
+        if (fRooms[i] != 0)
+        {
+            memset(fRooms[i], 0, fCells * sizeof(TAccumulatorCell));
+        }
+    }
+
+    fPrevious.assign(fCells, TAccumulatorCell());
+    fLost = 0;
+}
+
+bool TAccumulators::Write(const char * path)
+{
+    std::vector<TAccumulatorCell> cells(fPrevious);
+    std::string temporary = std::string(path) + ".tmp";
+    std::string textPath = std::string(path) + ".txt";
+    uint32_t count[2] = { static_cast<uint32_t>(fHistograms.size()), static_cast<uint32_t>(fCounters.size()) };
+    bool written;
+    FILE * file;
+
+    /* Integer sums, the order of the rooms doesn't matter */
+    for (size_t room = 0; room < fRooms.size(); ++room)
+    {
+        if (fRooms[room] == 0)
+        {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < fCells; ++i)
+        {
+            AddCell(cells[i], fRooms[room][i]);
+        }
+    }
+
+    /* The binary dump replaces the previous one at once, it may have to be merged by a checkpoint */
+    file = fopen(temporary.c_str(), "wb");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    written = (fwrite(ACCUMULATORS_MAGIC, sizeof(ACCUMULATORS_MAGIC) - 1, 1, file) == 1 && fwrite(count, sizeof(count), 1, file) == 1);
+    for (size_t i = 0; written && i < fHistograms.size(); ++i)
+    {
+        const TUserHistogram & histogram = fHistograms[i];
+        uint32_t bins = histogram.fBins;
+        double range[2] = { histogram.fMin, histogram.fMax };
+
+        written = (WriteName(file, histogram.fName) && fwrite(&bins, sizeof(bins), 1, file) == 1 &&
+                   fwrite(range, sizeof(range), 1, file) == 1 && WriteCells(file, &cells[histogram.fOffset], bins + 2));
+    }
+    for (size_t i = 0; written && i < fCounters.size(); ++i)
+    {
+        written = (WriteName(file, fCounters[i].fName) && WriteCells(file, &cells[fCounters[i].fOffset], 1));
+    }
+
+    if (fclose(file) != 0 || !written || rename(temporary.c_str(), path) != 0)
+    {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    file = fopen(textPath.c_str(), "w");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    fprintf(file, "# lost fills: %llu\n", fLost);
+    for (size_t i = 0; i < fHistograms.size(); ++i)
+    {
+        const TUserHistogram & histogram = fHistograms[i];
+        double width = (histogram.fMax - histogram.fMin) / histogram.fBins;
+
+        fprintf(file, "histogram %s %u %.17g %.17g\n# bin\tlow\thigh\tentries\tsum\tsum2\n", histogram.fName.c_str(), histogram.fBins, histogram.fMin, histogram.fMax);
+        WriteText(file, "underflow", -HUGE_VAL, histogram.fMin, cells[histogram.fOffset]);
+        for (unsigned int bin = 0; bin < histogram.fBins; ++bin)
+        {
+            char name[16];
+
+            snprintf(name, sizeof(name), "%u", bin);
+            WriteText(file, name, histogram.fMin + bin * width, (bin + 1 == histogram.fBins ? histogram.fMax : histogram.fMin + (bin + 1) * width),
+                      cells[histogram.fOffset + 1 + bin]);
+        }
+        WriteText(file, "overflow", histogram.fMax, HUGE_VAL, cells[histogram.fOffset + histogram.fBins + 1]);
+    }
+
+    for (size_t i = 0; i < fCounters.size(); ++i)
+    {
+        const TAccumulatorCell & cell = cells[fCounters[i].fOffset];
+
+        fprintf(file, "counter %s\t%llu\t%.17g\t%.17g\n", fCounters[i].fName.c_str(), cell.fEntries, ToDouble(cell.fSum), ToDouble(cell.fSum2));
+    }
+
+    return fclose(file) == 0;
+}
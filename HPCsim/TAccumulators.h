@@ -0,0 +1,196 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TAccumulators.h
+ * PURPOSE:          User histograms and counters
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TACCUMULATORS_H__
+#define __TACCUMULATORS_H__
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/**
+ * Sums are kept in 64.64 fixed point, as two's complement. Integer additions don't depend
+ * on their order, so the merged sums don't depend on which thread ran which event.
+ */
+__extension__ typedef unsigned __int128 TFixed;
+
+/**
+ * A bin of a histogram, or a counter
+ */
+struct TAccumulatorCell
+{
+    unsigned long long fEntries;
+    /**
+     * Sum of the weights (values for counters)
+     */
+    TFixed fSum;
+    /**
+     * Sum of the squared weights
+     */
+    TFixed fSum2;
+};
+
+struct TUserHistogram
+{
+    std::string fName;
+    unsigned int fBins;
+    double fMin;
+    double fMax;
+    /**
+     * Bins per unit of value
+     */
+    double fScale;
+    /**
+     * First cell of the histogram: the underflow bin, then the bins, then the overflow bin
+     */
+    unsigned int fOffset;
+};
+
+struct TUserCounter
+{
+    std::string fName;
+    unsigned int fOffset;
+};
+
+class TAccumulators
+{
+public:
+    /**
+     * This function declares a histogram, with equal width bins.
+     * It has to be called before the event loop starts (in SimulationInit() or RunInit()).
+     * @param name Name of the histogram, unique, without blanks, up to 255 characters
+     * @param bins Amount of bins, min 1
+     * @param min Lower edge of the first bin
+     * @param max Upper edge of the last bin
+     * @return The handle of the histogram, -1 on failure
+     */
+    int CreateHistogram(const char * name, unsigned int bins, double min, double max);
+    /**
+     * This function declares a counter.
+     * It has to be called before the event loop starts (in SimulationInit() or RunInit()).
+     * @param name Name of the counter, unique, without blanks, up to 255 characters
+     * @return The handle of the counter, -1 on failure
+     */
+    int CreateCounter(const char * name);
+    /**
+     * This function adds a value to a histogram, in the copy of the calling thread room.
+     * @param histogram Handle returned by CreateHistogram()
+     * @param value Value, out of range values go to the underflow and overflow bins
+     * @param weight Weight of the value
+     */
+    void Fill(int histogram, double value, double weight);
+    /**
+     * This function adds a value to a counter, in the copy of the calling thread room.
+     * @param counter Handle returned by CreateCounter()
+     * @param value Value to add
+     */
+    void Add(int counter, double value);
+    /**
+     * This function denies any further declaration, and allows filling.
+     * It's called by HPCsim right before the event loop.
+     * @param threads Amount of rooms in the threads factory
+     */
+    void Seal(unsigned int threads);
+    /**
+     * This function tells whether the simulation declared anything.
+     * @return true if there's at least a histogram or a counter
+     */
+    inline bool IsUsed(void)
+    {
+        return !fHistograms.empty() || !fCounters.empty();
+    }
+    /**
+     * This function adds the content of a previous dump, for the checkpoint.
+     * It has to be called after Seal().
+     * @param path Path of the binary dump
+     * @return true if it was merged, false if missing or not matching the declarations
+     */
+    bool Load(const char * path);
+    /**
+     * This function drops what Load() added, so that a worker process only dumps its own fills.
+     * Its parent keeps them.
+     */
+    void ClearLoaded(void);
+    /**
+     * This function empties all the histograms and counters, for the next run of a simulation kept loaded.
+     * No thread can be filling them.
+     */
+    void Clear(void);
+    /**
+     * This function merges the copies of all the rooms, and writes the binary dump and its text version.
+     * It has to be called once all the threads, including the writer, are done.
+     * @param path Path of the binary dump. The text version is written to the same path, with .txt appended
+     * @return true on success, false otherwise
+     */
+    bool Write(const char * path);
+    /**
+     * This is the static function to have the accumulators. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the accumulators class.
+     */
+    static TAccumulators * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It releases the copies.
+     */
+    ~TAccumulators();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TAccumulators();
+    /**
+     * Checks a name for a new histogram or counter.
+     * @param name The name
+     * @return true if it can be used
+     */
+    bool CheckName(const char * name);
+    /**
+     * Adds a value to a cell, in the copy of the calling thread room.
+     * @param cell Index of the cell
+     * @param value The value
+     */
+    void Accumulate(unsigned int cell, double value);
+    /**
+     * Returns the copy of a room, allocating it on first use.
+     * @param slot The room
+     * @return The copy, 0 if out of memory
+     */
+    TAccumulatorCell * GetRoom(unsigned int slot);
+
+    std::vector<TUserHistogram> fHistograms;
+    std::vector<TUserCounter> fCounters;
+    /**
+     * Cells of all the histograms and counters, in a copy
+     */
+    unsigned int fCells;
+    /**
+     * Copy of each room. The extra last one is shared by the threads out of the factory
+     */
+    std::vector<TAccumulatorCell *> fRooms;
+    /**
+     * Protects the shared copy
+     */
+    pthread_mutex_t fSharedLock;
+    /**
+     * Cells of the previous runs, for the checkpoint
+     */
+    std::vector<TAccumulatorCell> fPrevious;
+    /**
+     * Fills lost for lack of memory
+     */
+    unsigned long long fLost;
+    /**
+     * Set once the event loop started
+     */
+    bool fSealed;
+};
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TDaemon.cpp
+ * PURPOSE:          Resident daemon, running the requests of its clients on a warm simulation
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "TDaemon.h"
+#include "TEventServer.h"
+
+/* Lines of the protocol, one per message:
+ * - client: RUN first events output [options], daemon: QUEUED ahead (requests to run before it), then
+ *   RUNNING once started, then DONE events bytes seconds, STOPPED events requested (the daemon was stopped
+ *   during the run), or FAILED reason
+ * - client: STATS, daemon: STATS runs events bytes seconds (since the daemon started)
+ * - client: SHUTDOWN, daemon: BYE, then it leaves once the requests queued are done
+ * Anything else gets ERROR reason
+ */
+/* How often a stop is checked, in ms */
+#define SERVE_SLICE 1000
+
+/* Lines over that size are a broken client */
+#define MAX_LINE (64 * 1024)
+
+TDaemon::TDaemon()
+{
+    fSocket = -1;
+    fHPCsim = 0;
+    fShutdown = false;
+    fServed = 0;
+    fFailed = 0;
+}
+
+TDaemon::~TDaemon()
+{
+    std::map<int, std::string>::iterator client;
+
+    for (client = fClients.begin(); client != fClients.end(); ++client)
+    {
+        close(client->first);
+    }
+
+    if (fSocket != -1)
+    {
+        close(fSocket);
+        unlink(fPath.c_str());
+    }
+}
+
+TDaemon * TDaemon::GetInstance(bool destroyInstance)
+{
+    static TDaemon * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TDaemon();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TDaemon::Start(const char * path)
+{
+    /* Clients write wherever the daemon can: they have to be local */
+    if (strchr(path, '/') == 0 && strchr(path, ':') != 0)
+    {
+        fprintf(stderr, "The daemon only listens on a Unix socket, not on %s\n", path);
+        return false;
+    }
+
+    fSocket = TEventServer::OpenSocket(path, true);
+    if (fSocket == -1)
+    {
+        return false;
+    }
+    fPath = path;
+
+    /* And they have to be its user */
+    if (chmod(path, S_IRUSR | S_IWUSR) == -1)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool TDaemon::Send(int socket, const char * line)
+{
+    size_t length = strlen(line);
+
+    /* Lines are tiny, they fit in the socket buffer at once */
+    return send(socket, line, length, MSG_NOSIGNAL) == static_cast<ssize_t>(length);
+}
+
+void TDaemon::Drop(int socket)
+{
+    std::deque<TDaemonRequest>::iterator request = fQueue.begin();
+
+    if (fClients.count(socket) == 0)
+    {
+        return;
+    }
+
+    /* Nobody would know how its requests went */
+    while (request != fQueue.end())
+    {
+        if (request->fClient == socket)
+        {
+            request = fQueue.erase(request);
+        }
+        else
+        {
+            ++request;
+        }
+    }
+
+    close(socket);
+    fClients.erase(socket);
+}
+
+bool TDaemon::Handle(int socket, const std::string & line)
+{
+    char reply[128];
+    THPCsimStats stats;
+    TDaemonRequest request;
+    int consumed = 0;
+    char output[4096];
+
+    if (line.compare(0, 4, "RUN ") == 0)
+    {
+        if (fShutdown)
+        {
+            return Send(socket, "ERROR shutting down\n");
+        }
+
+        if (sscanf(line.c_str(), "RUN %lu %lu %4095s %n", &request.fFirst, &request.fEvents, output, &consumed) != 3 || consumed == 0)
+        {
+            return Send(socket, "ERROR expected RUN first events output [options]\n");
+        }
+
+        request.fClient = socket;
+        request.fOutput = output;
+        request.fOptions = line.substr(consumed);
+        fQueue.push_back(request);
+
+        snprintf(reply, sizeof(reply), "QUEUED %lu\n", static_cast<unsigned long>(fQueue.size() - 1));
+        return Send(socket, reply);
+    }
+
+    if (line == "STATS")
+    {
+        memset(&stats, 0, sizeof(stats));
+        hpcsim_stats(fHPCsim, &stats);
+        snprintf(reply, sizeof(reply), "STATS %lu %llu %llu %.3f\n", stats.fRuns, stats.fTotalEvents, stats.fTotalWritten, stats.fTotalSeconds);
+        return Send(socket, reply);
+    }
+
+    if (line == "SHUTDOWN")
+    {
+        fShutdown = true;
+        return Send(socket, "BYE\n");
+    }
+
+    return Send(socket, "ERROR unknown request\n");
+}
+
+void TDaemon::Run(const TDaemonRequest & request)
+{
+    THPCsimRange range;
+    THPCsimStats stats;
+    char reply[128];
+
+    Send(request.fClient, "RUNNING\n");
+
+    range.fFirstEvent = request.fFirst;
+    range.fEvents = request.fEvents;
+    range.fOutput = request.fOutput.c_str();
+    range.fUserOpts = (request.fOptions.empty() ? 0 : request.fOptions.c_str());
+
+    if (hpcsim_run(fHPCsim, &range) != 0)
+    {
+        ++fFailed;
+        Send(request.fClient, "FAILED run, see the log of the daemon\n");
+        return;
+    }
+
+    ++fServed;
+    memset(&stats, 0, sizeof(stats));
+    hpcsim_stats(fHPCsim, &stats);
+    if (stats.fEvents < request.fEvents)
+    {
+        snprintf(reply, sizeof(reply), "STOPPED %lu %lu\n", stats.fEvents, request.fEvents);
+    }
+    else
+    {
+        snprintf(reply, sizeof(reply), "DONE %lu %llu %.3f\n", stats.fEvents, stats.fWritten, stats.fSeconds);
+    }
+    Send(request.fClient, reply);
+}
+
+bool TDaemon::Serve(THPCsim * hpcsim, bool (* stopRequested)(void))
+{
+    fHPCsim = hpcsim;
+
+    while (!stopRequested() && !(fShutdown && fQueue.empty()))
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<int> dropped;
+        std::map<int, std::string>::iterator client;
+        struct pollfd fd;
+
+        fd.fd = fSocket;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        fds.push_back(fd);
+        for (client = fClients.begin(); client != fClients.end(); ++client)
+        {
+            fd.fd = client->first;
+            fds.push_back(fd);
+        }
+
+        /* Requests waiting don't wait for the clients: only look at what's there already */
+        if (poll(&fds[0], fds.size(), (fQueue.empty() ? SERVE_SLICE : 0)) == -1 && errno != EINTR)
+        {
+            return false;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int socket = accept4(fSocket, 0, 0, SOCK_CLOEXEC);
+
+            if (socket != -1)
+            {
+                fClients[socket] = std::string();
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); ++i)
+        {
+            std::string & input = fClients[fds[i].fd];
+            char buffer[4096];
+            ssize_t received;
+            size_t end;
+
+            if (fds[i].revents == 0)
+            {
+                continue;
+            }
+
+            received = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+            {
+                dropped.push_back(fds[i].fd);
+                continue;
+            }
+
+            input.append(buffer, received);
+            while ((end = input.find('\n')) != std::string::npos)
+            {
+                std::string line = input.substr(0, end);
+
+                input.erase(0, end + 1);
+                if (!Handle(fds[i].fd, line))
+                {
+                    dropped.push_back(fds[i].fd);
+                    break;
+                }
+            }
+
+            if (input.size() > MAX_LINE)
+            {
+                dropped.push_back(fds[i].fd);
+            }
+        }
+
+        for (size_t i = 0; i < dropped.size(); ++i)
+        {
+            Drop(dropped[i]);
+        }
+
+        /* One at a time, they share the simulation and its threads */
+        if (!fQueue.empty())
+        {
+            TDaemonRequest request = fQueue.front();
+
+            fQueue.pop_front();
+            Run(request);
+        }
+    }
+
+    /* The ones left were never started */
+    while (!fQueue.empty())
+    {
+        Send(fQueue.front().fClient, "FAILED daemon stopped\n");
+        fQueue.pop_front();
+    }
+
+    return true;
+}
+
+void TDaemon::Report(std::ostream & stream)
+{
+    stream << "Requests: " << fServed << " served, " << fFailed << " failed" << std::endl;
+}
@@ -0,0 +1,120 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TDaemon.h
+ * PURPOSE:          Resident daemon, running the requests of its clients on a warm simulation
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TDAEMON_H__
+#define __TDAEMON_H__
+
+#include <string>
+#include <map>
+#include <deque>
+#include <ostream>
+#include "hpcsim.h"
+
+/**
+ * A run asked by a client, waiting for its turn
+ */
+struct TDaemonRequest
+{
+    /**
+     * Socket of the client, where its status goes
+     */
+    int fClient;
+    unsigned long fFirst;
+    unsigned long fEvents;
+    std::string fOutput;
+    /**
+     * Options of the run, empty for the ones of the daemon
+     */
+    std::string fOptions;
+};
+
+class TDaemon
+{
+public:
+    /**
+     * This function creates the socket of the daemon. Only its user can connect to it.
+     * @param path Path of a Unix socket
+     * @return true on success, false otherwise
+     */
+    bool Start(const char * path);
+    /**
+     * This function serves the requests of the clients, running them one after the other with
+     * the simulation, until asked to shut down or stopped.
+     * @param hpcsim The simulation, opened already
+     * @param stopRequested Tells whether the daemon has to stop. The run in progress stops too
+     * @return true once shut down or stopped, false on failure
+     */
+    bool Serve(THPCsim * hpcsim, bool (* stopRequested)(void));
+    /**
+     * This function writes the requests served to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This is the static function to have the daemon. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the daemon class.
+     */
+    static TDaemon * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It closes the sockets, and removes the one of the daemon.
+     */
+    ~TDaemon();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TDaemon();
+    /**
+     * Handles a line received from a client.
+     * @param socket Socket of the client
+     * @param line The line, without its end
+     * @return false if the client has to be dropped
+     */
+    bool Handle(int socket, const std::string & line);
+    /**
+     * Runs a request, and tells its client how it went.
+     * @param request The request
+     */
+    void Run(const TDaemonRequest & request);
+    /**
+     * Disconnects a client, its requests waiting are dropped.
+     * @param socket Socket of the client
+     */
+    void Drop(int socket);
+    /**
+     * Sends a line to a client.
+     * @param socket Socket of the client
+     * @param line The line, with its end
+     * @return true on success, false otherwise
+     */
+    bool Send(int socket, const char * line);
+
+    int fSocket;
+    std::string fPath;
+    THPCsim * fHPCsim;
+    /**
+     * Lines received from each client, up to the last complete one
+     */
+    std::map<int, std::string> fClients;
+    /**
+     * Requests waiting for their turn, first come first served
+     */
+    std::deque<TDaemonRequest> fQueue;
+    /**
+     * Set by a SHUTDOWN request, the daemon leaves once the queue is empty
+     */
+    bool fShutdown;
+    unsigned long fServed;
+    unsigned long fFailed;
+};
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TEventClient.cpp
+ * PURPOSE:          Worker pulling chunks of events from a coordinator
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <string>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "TEventClient.h"
+#include "TEventServer.h"
+#include "TStatistics.h"
+#include "RngStream.h"
+#include "TThreadsFactory.h"
+
+/* How often the stop is checked while waiting for a chunk, in ms */
+#define RESERVE_SLICE 100
+
+TEventClient::TEventClient()
+{
+    fSocket = -1;
+    fHeartbeat = 0;
+    fSink = 0;
+    fStop = 0;
+    fWakeUp[0] = -1;
+    fWakeUp[1] = -1;
+    fEnded = false;
+    fCurrent = 0;
+    fCompleted = 0;
+    fEvents = 0;
+    fLastSent = 0;
+    pthread_mutex_init(&fLock, 0);
+    pthread_cond_init(&fReceived, 0);
+    pthread_mutex_init(&fSendLock, 0);
+}
+
+TEventClient::~TEventClient()
+{
+    /* Stop receiving */
+    if (fWakeUp[1] != -1)
+    {
+        UNUSED_RETURN(write(fWakeUp[1], "", 1));
+        pthread_join(fReceiveThread, 0);
+        close(fWakeUp[0]);
+        close(fWakeUp[1]);
+    }
+
+    /* Chunks not started are handed to other workers once disconnected */
+    if (fSocket != -1)
+    {
+        close(fSocket);
+    }
+
+    for (size_t i = 0; i < fChunks.size(); ++i)
+    {
+        delete fChunks[i];
+    }
+
+    /* Only there if some of its events were never dispatched, it cannot be completed */
+    delete fCurrent;
+
+    pthread_mutex_destroy(&fLock);
+    pthread_cond_destroy(&fReceived);
+    pthread_mutex_destroy(&fSendLock);
+}
+
+TEventClient * TEventClient::GetInstance(bool destroyInstance)
+{
+    static TEventClient * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TEventClient();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+void TEventClient::Send(const char * line)
+{
+    size_t length = strlen(line);
+
+    pthread_mutex_lock(&fSendLock);
+    /* A lost coordinator is seen by the receiving thread */
+    UNUSED_RETURN(send(fSocket, line, length, MSG_NOSIGNAL));
+    fLastSent = TStatistics::Now();
+    pthread_mutex_unlock(&fSendLock);
+}
+
+bool TEventClient::Connect(const char * address, const char * output, TMarkerSink * sink, TStopCheck * stop, unsigned long & first, unsigned long & events)
+{
+    std::string line = std::string("HELLO ") + output + "\n";
+    char reply[128];
+    size_t received = 0;
+    unsigned long long heartbeat;
+
+    fSocket = TEventServer::OpenSocket(address, false);
+    if (fSocket == -1)
+    {
+        return false;
+    }
+    fSink = sink;
+    fStop = stop;
+
+    /* Get the run, before anything else is received */
+    Send(line.c_str());
+    while (received == 0 || reply[received - 1] != '\n')
+    {
+        ssize_t got = recv(fSocket, reply + received, sizeof(reply) - 1 - received, 0);
+
+        if (got <= 0 || received + got == sizeof(reply) - 1)
+        {
+            return false;
+        }
+        received += got;
+    }
+    reply[received] = 0;
+    if (sscanf(reply, "RUN %lu %lu %llu", &first, &events, &heartbeat) != 3)
+    {
+        return false;
+    }
+    fHeartbeat = static_cast<int>(heartbeat);
+
+    if (pipe(fWakeUp) == -1)
+    {
+        fWakeUp[0] = fWakeUp[1] = -1;
+        return false;
+    }
+    if (pthread_create(&fReceiveThread, 0, ReceiveThread, this) != 0)
+    {
+        close(fWakeUp[0]);
+        close(fWakeUp[1]);
+        fWakeUp[0] = fWakeUp[1] = -1;
+        return false;
+    }
+
+    /* The first chunk, and the next one */
+    for (unsigned int i = 0; i < PULL_PREFETCH; ++i)
+    {
+        Send("PULL\n");
+    }
+
+    return true;
+}
+
+void * TEventClient::ReceiveThread(void * client)
+{
+    TEventClient * self = reinterpret_cast<TEventClient *>(client);
+    std::string input;
+
+    while (true)
+    {
+        struct pollfd fds[2];
+        char buffer[4096];
+        ssize_t received;
+        size_t end;
+
+        fds[0].fd = self->fSocket;
+        fds[0].events = POLLIN;
+        fds[1].fd = self->fWakeUp[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, (self->fHeartbeat != 0 ? self->fHeartbeat : -1)) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+
+        /* Still alive, even while running a long chunk */
+        if (self->fHeartbeat != 0 && TStatistics::Now() - self->fLastSent >= self->fHeartbeat * 1000000ULL)
+        {
+            self->Send("ALIVE\n");
+        }
+
+        if (fds[0].revents == 0)
+        {
+            continue;
+        }
+
+        received = recv(self->fSocket, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+            break;
+        }
+
+        input.append(buffer, received);
+        while ((end = input.find('\n')) != std::string::npos)
+        {
+            std::string line = input.substr(0, end);
+            unsigned long first;
+            unsigned int count;
+
+            input.erase(0, end + 1);
+            if (sscanf(line.c_str(), "CHUNK %lu %u", &first, &count) == 2 && count != 0)
+            {
+                TPulledChunk * chunk = new TPulledChunk;
+
+                chunk->fFirst = first;
+                chunk->fCount = count;
+                chunk->fDispatched = 0;
+                chunk->fLeft = count;
+
+                pthread_mutex_lock(&self->fLock);
+                self->fChunks.push_back(chunk);
+                pthread_cond_broadcast(&self->fReceived);
+                pthread_mutex_unlock(&self->fLock);
+            }
+            else if (line == "END")
+            {
+                pthread_mutex_lock(&self->fLock);
+                self->fEnded = true;
+                pthread_cond_broadcast(&self->fReceived);
+                pthread_mutex_unlock(&self->fLock);
+            }
+        }
+    }
+
+    /* Coordinator gone, or done: no more chunks */
+    pthread_mutex_lock(&self->fLock);
+    self->fEnded = true;
+    pthread_cond_broadcast(&self->fReceived);
+    pthread_mutex_unlock(&self->fLock);
+
+    return 0;
+}
+
+bool TEventClient::Reserve(unsigned int max, unsigned int & count)
+{
+    sem_t * initLock = TThreadsFactory::GetInstance()->GetInitLock();
+
+    /* Current chunk fully dispatched, take the next one */
+    while (fCurrent == 0)
+    {
+        struct timespec deadline;
+
+        pthread_mutex_lock(&fLock);
+        if (!fChunks.empty() && !fStop())
+        {
+            fCurrent = fChunks.front();
+            fChunks.pop_front();
+            pthread_mutex_unlock(&fLock);
+
+            /* Keep the next one coming */
+            Send("PULL\n");
+            RngStream::SetStream(fCurrent->fFirst);
+            break;
+        }
+
+        if (fEnded || fStop())
+        {
+            pthread_mutex_unlock(&fLock);
+            return false;
+        }
+
+        /* Events still running may need the init lock to end, and complete their chunk */
+        sem_post(initLock);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += RESERVE_SLICE * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&fReceived, &fLock, &deadline);
+        pthread_mutex_unlock(&fLock);
+
+        /* Another thread may have taken a chunk meanwhile */
+        TThreadsFactory::Wait(initLock);
+    }
+
+    count = fCurrent->fCount - fCurrent->fDispatched;
+    if (count > max)
+    {
+        count = max;
+    }
+
+    return true;
+}
+
+TPulledChunk * TEventClient::Dispatch(unsigned int count)
+{
+    TPulledChunk * chunk = fCurrent;
+
+    /* Once fully dispatched, it belongs to its events: the last one to end releases it */
+    chunk->fDispatched += count;
+    if (chunk->fDispatched == chunk->fCount)
+    {
+        fCurrent = 0;
+    }
+
+    return chunk;
+}
+
+void TEventClient::Ended(TPulledChunk * chunk, unsigned int count)
+{
+    TResult marker;
+
+    /* Events left out by a stop never end, the chunk is then never completed */
+    if (__sync_sub_and_fetch(&chunk->fLeft, count) != 0)
+    {
+        return;
+    }
+
+    /* Results of all its events are queued already, the marker comes after them */
+    marker.fResultLength = CHUNK_MARKER;
+    memcpy(marker.fId, &chunk->fFirst, sizeof(chunk->fFirst));
+    memcpy(marker.fId + sizeof(chunk->fFirst), &chunk->fCount, sizeof(chunk->fCount));
+    fSink(&marker);
+
+    delete chunk;
+}
+
+void TEventClient::Written(const TResult * marker)
+{
+    unsigned long first;
+    unsigned int count;
+    char line[64];
+
+    memcpy(&first, marker->fId, sizeof(first));
+    memcpy(&count, marker->fId + sizeof(first), sizeof(count));
+
+    snprintf(line, sizeof(line), "DONE %lu %u\n", first, count);
+    Send(line);
+    ++fCompleted;
+    fEvents += count;
+}
+
+void TEventClient::Report(std::ostream & stream)
+{
+    stream << "Pulled: " << fCompleted << " chunks completed, " << fEvents << " events" << std::endl;
+}
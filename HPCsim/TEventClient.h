@@ -0,0 +1,170 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TEventClient.h
+ * PURPOSE:          Worker pulling chunks of events from a coordinator
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TEVENTCLIENT_H__
+#define __TEVENTCLIENT_H__
+
+#include <deque>
+#include <ostream>
+#include <pthread.h>
+#include "simulation.h"
+
+/**
+ * Length of the marker result telling the writer a chunk is completed. No result is that long
+ */
+#define CHUNK_MARKER 0xFFFFFFFFU
+/**
+ * Chunks asked in advance, so that the next one is there when the current one is dispatched
+ */
+#define PULL_PREFETCH 2
+
+/**
+ * Function queuing a result to the writer
+ */
+typedef void (TMarkerSink)(TResult * result);
+/**
+ * Function telling whether the run is stopping
+ */
+typedef bool (TStopCheck)(void);
+
+/**
+ * A chunk handed by the coordinator
+ */
+struct TPulledChunk
+{
+    unsigned long fFirst;
+    unsigned int fCount;
+    /**
+     * Events handed to the threads so far
+     */
+    unsigned int fDispatched;
+    /**
+     * Events not ended yet. The chunk is completed once it reaches 0
+     */
+    volatile unsigned int fLeft;
+};
+
+class TEventClient
+{
+public:
+    /**
+     * This function connects to the coordinator, and gets the events of the run.
+     * @param address Address of the coordinator, see TEventServer::OpenSocket()
+     * @param output Path of the output of the worker, recorded by the coordinator for the merge
+     * @param sink Function queuing the markers to the writer, they have to be written in order with the results
+     * @param stop Function telling whether the run is stopping, while waiting for a chunk
+     * @param first Output variable, receiving the first event of the run
+     * @param events Output variable, receiving the amount of events of the run
+     * @return true on success, false otherwise
+     */
+    bool Connect(const char * address, const char * output, TMarkerSink * sink, TStopCheck * stop, unsigned long & first, unsigned long & events);
+    /**
+     * This function gets the next events to dispatch, waiting for a chunk if needed.
+     * The stream of the first one is made the next one. It has to be called with the init lock held,
+     * which is released while waiting.
+     * @param max Maximum amount of events
+     * @param count Output variable, receiving the amount of consecutive events, up to max
+     * @return false once there are no events left (or the run is stopping)
+     */
+    bool Reserve(unsigned int max, unsigned int & count);
+    /**
+     * This function accounts events handed to a thread, out of the ones reserved.
+     * It has to be called with the init lock held.
+     * @param count Amount of events
+     * @return The chunk of the events, for Ended()
+     */
+    TPulledChunk * Dispatch(unsigned int count);
+    /**
+     * This function accounts events that ended, once their results are queued.
+     * Once all the events of the chunk ended, a marker is queued to the writer.
+     * @param chunk Chunk returned by Dispatch()
+     * @param count Amount of events
+     */
+    void Ended(TPulledChunk * chunk, unsigned int count);
+    /**
+     * This function tells whether a result read by the writer is a marker.
+     * @param result The result
+     * @return true if it's a marker
+     */
+    static inline bool IsMarker(const TResult * result)
+    {
+        return result->fResultLength == CHUNK_MARKER;
+    }
+    /**
+     * This function tells the coordinator a chunk is completed. It's called by the writer
+     * once it has written all the results before the marker.
+     * @param marker The marker
+     */
+    void Written(const TResult * marker);
+    /**
+     * This function writes the chunks completed by the worker to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This is the static function to have the client. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the client class.
+     */
+    static TEventClient * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It disconnects from the coordinator.
+     */
+    ~TEventClient();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TEventClient();
+    /**
+     * Sends a line to the coordinator.
+     * @param line The line, with its end
+     */
+    void Send(const char * line);
+    /**
+     * Entry point of the thread receiving the chunks, and sending the heartbeats.
+     * @param client The client class
+     */
+    static void * ReceiveThread(void * client);
+
+    int fSocket;
+    /**
+     * Heartbeat period, in ms. 0 for none
+     */
+    int fHeartbeat;
+    TMarkerSink * fSink;
+    TStopCheck * fStop;
+    pthread_t fReceiveThread;
+    int fWakeUp[2];
+    /**
+     * Protects the chunks received, and the end of the run
+     */
+    pthread_mutex_t fLock;
+    pthread_cond_t fReceived;
+    std::deque<TPulledChunk *> fChunks;
+    bool fEnded;
+    /**
+     * Chunk being dispatched, only used with the init lock held. 0 once fully dispatched
+     */
+    TPulledChunk * fCurrent;
+    /**
+     * Serializes the lines sent
+     */
+    pthread_mutex_t fSendLock;
+    /**
+     * Last time a line was sent, see TStatistics::Now()
+     */
+    volatile unsigned long long fLastSent;
+    unsigned long fCompleted;
+    unsigned long long fEvents;
+};
+
+#endif
@@ -0,0 +1,537 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TEventServer.cpp
+ * PURPOSE:          Coordinator handing out chunks of events to workers
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "TEventServer.h"
+#include "TStatistics.h"
+
+/* Lines of the protocol, one per message:
+ * - worker: HELLO output, coordinator: RUN first events heartbeat, heartbeat being in ms (0 for none)
+ * - worker: PULL, coordinator: CHUNK first count (as soon as one is pending) or END (all completed)
+ * - worker: DONE first count, once the results of the chunk are written
+ * - worker: ALIVE, every heartbeat
+ */
+/* How often timeouts are checked, in ms */
+#define SERVE_SLICE 1000
+
+/* Lines over that size are a broken worker */
+#define MAX_LINE (PATH_MAX + 64)
+
+TEventServer::TEventServer()
+{
+    fSocket = -1;
+    fJournal = 0;
+    fFirst = 0;
+    fEvents = 0;
+    fChunkSize = 1;
+    fTimeout = 0;
+    fDone = 0;
+    fReassigned = 0;
+    fResumed = 0;
+}
+
+TEventServer::~TEventServer()
+{
+    std::map<int, TPullWorker>::iterator worker;
+
+    for (worker = fWorkers.begin(); worker != fWorkers.end(); ++worker)
+    {
+        close(worker->first);
+    }
+
+    if (fSocket != -1)
+    {
+        close(fSocket);
+        if (!fPath.empty())
+        {
+            unlink(fPath.c_str());
+        }
+    }
+
+    if (fJournal != 0)
+    {
+        fclose(fJournal);
+    }
+}
+
+TEventServer * TEventServer::GetInstance(bool destroyInstance)
+{
+    static TEventServer * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TEventServer();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+int TEventServer::OpenSocket(const char * address, bool listening)
+{
+    const char * port = strrchr(address, ':');
+    int fd;
+
+    /* host:port, without any slash, is TCP */
+    if (port != 0 && strchr(address, '/') == 0)
+    {
+        std::string host(address, port - address);
+        struct addrinfo hints, * addresses, * current;
+        int enable = 1;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = (listening ? AI_PASSIVE : 0);
+        if (getaddrinfo((host.empty() || host == "*") ? 0 : host.c_str(), port + 1, &hints, &addresses) != 0)
+        {
+            return -1;
+        }
+
+        fd = -1;
+        for (current = addresses; current != 0 && fd == -1; current = current->ai_next)
+        {
+            fd = socket(current->ai_family, current->ai_socktype | SOCK_CLOEXEC, current->ai_protocol);
+            if (fd == -1)
+            {
+                continue;
+            }
+
+            if (listening)
+            {
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+                if (bind(fd, current->ai_addr, current->ai_addrlen) == 0 && listen(fd, 64) == 0)
+                {
+                    break;
+                }
+            }
+            else if (connect(fd, current->ai_addr, current->ai_addrlen) == 0)
+            {
+                break;
+            }
+
+            close(fd);
+            fd = -1;
+        }
+
+        freeaddrinfo(addresses);
+        return fd;
+    }
+    else
+    {
+        struct sockaddr_un unixAddress;
+        struct stat pathStat;
+
+        if (strlen(address) >= sizeof(unixAddress.sun_path))
+        {
+            return -1;
+        }
+
+        /* A previous coordinator may have left its socket, but don't remove anything else */
+        if (listening && stat(address, &pathStat) == 0 && S_ISSOCK(pathStat.st_mode))
+        {
+            unlink(address);
+        }
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        strcpy(unixAddress.sun_path, address);
+        if (listening)
+        {
+            if (bind(fd, reinterpret_cast<struct sockaddr *>(&unixAddress), sizeof(unixAddress)) == -1 || listen(fd, 64) == -1)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+        else if (connect(fd, reinterpret_cast<struct sockaddr *>(&unixAddress), sizeof(unixAddress)) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+}
+
+bool TEventServer::LoadJournal(const char * journal)
+{
+    FILE * previous = fopen(journal, "r");
+    char line[MAX_LINE];
+    long valid;
+
+    if (previous != 0)
+    {
+        char magic[sizeof(JOURNAL_MAGIC)];
+        unsigned long first, events;
+        unsigned int chunk;
+
+        /* Same run only, chunks would be different otherwise */
+        if (fscanf(previous, "%8s %lu %lu %u\n", magic, &first, &events, &chunk) != 4 ||
+            strcmp(magic, JOURNAL_MAGIC) != 0 || first != fFirst || events != fEvents || chunk != fChunkSize)
+        {
+            fprintf(stderr, "Journal %s belongs to another run\n", journal);
+            fclose(previous);
+            return false;
+        }
+
+        valid = ftell(previous);
+        while (fgets(line, sizeof(line), previous) != 0)
+        {
+            unsigned long chunkFirst;
+            unsigned int count;
+            unsigned long index;
+
+            /* A torn last line is a chunk to run again */
+            if (strchr(line, '\n') == 0)
+            {
+                break;
+            }
+            valid = ftell(previous);
+            if (sscanf(line, "%lu %u", &chunkFirst, &count) != 2 || chunkFirst < fFirst)
+            {
+                continue;
+            }
+
+            index = (chunkFirst - fFirst) / fChunkSize;
+            if (index < fChunks.size() && fChunks[index].fState != CHUNK_DONE)
+            {
+                fChunks[index].fState = CHUNK_DONE;
+                fPending.erase(index);
+                ++fDone;
+                ++fResumed;
+            }
+        }
+
+        fclose(previous);
+
+        /* New chunks are appended after the last complete line */
+        if (truncate(journal, valid) == -1)
+        {
+            return false;
+        }
+        fJournal = fopen(journal, "a");
+        return fJournal != 0;
+    }
+
+    fJournal = fopen(journal, "w");
+    if (fJournal == 0)
+    {
+        return false;
+    }
+    fprintf(fJournal, "%s %lu %lu %u\n", JOURNAL_MAGIC, fFirst, fEvents, fChunkSize);
+    fflush(fJournal);
+
+    return true;
+}
+
+bool TEventServer::Start(const char * address, const char * journal, unsigned long first, unsigned long events, unsigned int chunk, unsigned int timeout)
+{
+    TServedChunk pending;
+
+    if (chunk == 0)
+    {
+        return false;
+    }
+
+    fFirst = first;
+    fEvents = events;
+    fChunkSize = chunk;
+    fTimeout = timeout * 1000000000ULL;
+
+    pending.fState = CHUNK_PENDING;
+    pending.fWorker = -1;
+    fChunks.assign((events + chunk - 1) / chunk, pending);
+    for (unsigned long index = 0; index < fChunks.size(); ++index)
+    {
+        fPending.insert(fPending.end(), index);
+    }
+
+    if (!LoadJournal(journal))
+    {
+        return false;
+    }
+
+    fSocket = OpenSocket(address, true);
+    if (fSocket == -1)
+    {
+        return false;
+    }
+    if (strchr(address, '/') != 0 || strchr(address, ':') == 0)
+    {
+        fPath = address;
+    }
+
+    return true;
+}
+
+bool TEventServer::Send(int socket, const char * line)
+{
+    size_t length = strlen(line);
+
+    /* Lines are tiny, they fit in the socket buffer at once */
+    return send(socket, line, length, MSG_NOSIGNAL) == static_cast<ssize_t>(length);
+}
+
+void TEventServer::Drop(int socket)
+{
+    std::map<int, TPullWorker>::iterator worker = fWorkers.find(socket);
+    std::set<unsigned long>::iterator chunk;
+
+    if (worker == fWorkers.end())
+    {
+        return;
+    }
+
+    /* What it was running is up to the others now */
+    for (chunk = worker->second.fChunks.begin(); chunk != worker->second.fChunks.end(); ++chunk)
+    {
+        fChunks[*chunk].fState = CHUNK_PENDING;
+        fChunks[*chunk].fWorker = -1;
+        fPending.insert(*chunk);
+        ++fReassigned;
+    }
+
+    close(socket);
+    fWorkers.erase(worker);
+}
+
+bool TEventServer::Handle(int socket, const std::string & line)
+{
+    TPullWorker & worker = fWorkers[socket];
+    char reply[128];
+    unsigned long first;
+    unsigned int count;
+
+    if (line.compare(0, 6, "HELLO ") == 0)
+    {
+        worker.fOutput = line.substr(6);
+        snprintf(reply, sizeof(reply), "RUN %lu %lu %llu\n", fFirst, fEvents, fTimeout / 3000000ULL);
+        return Send(socket, reply);
+    }
+
+    /* Nothing can be run before saying where results go */
+    if (worker.fOutput.empty())
+    {
+        return false;
+    }
+
+    if (line == "PULL")
+    {
+        ++worker.fPulls;
+        return true;
+    }
+
+    if (line == "ALIVE")
+    {
+        return true;
+    }
+
+    if (sscanf(line.c_str(), "DONE %lu %u", &first, &count) == 2 && first >= fFirst)
+    {
+        unsigned long index = (first - fFirst) / fChunkSize;
+
+        if (index >= fChunks.size())
+        {
+            return false;
+        }
+
+        /* Only the first worker to complete it counts, results of the others are ignored by the merge */
+        if (fChunks[index].fState != CHUNK_DONE)
+        {
+            if (fChunks[index].fState == CHUNK_ASSIGNED && fWorkers.count(fChunks[index].fWorker) != 0)
+            {
+                fWorkers[fChunks[index].fWorker].fChunks.erase(index);
+            }
+            fPending.erase(index);
+            fChunks[index].fState = CHUNK_DONE;
+            fChunks[index].fWorker = -1;
+            ++fDone;
+
+            fprintf(fJournal, "%lu %u %s\n", first, count, worker.fOutput.c_str());
+            fflush(fJournal);
+            fdatasync(fileno(fJournal));
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void TEventServer::Assign(void)
+{
+    std::map<int, TPullWorker>::iterator worker;
+    std::vector<int> failed;
+    char reply[128];
+
+    for (worker = fWorkers.begin(); worker != fWorkers.end(); ++worker)
+    {
+        /* Everything is completed, workers can leave */
+        if (fDone == fChunks.size())
+        {
+            if (worker->second.fPulls != 0)
+            {
+                Send(worker->first, "END\n");
+                worker->second.fPulls = 0;
+            }
+            continue;
+        }
+
+        while (worker->second.fPulls != 0 && !fPending.empty())
+        {
+            unsigned long index = *fPending.begin();
+            unsigned long first = index * fChunkSize;
+            unsigned long count = (fEvents - first < fChunkSize ? fEvents - first : fChunkSize);
+
+            snprintf(reply, sizeof(reply), "CHUNK %lu %lu\n", fFirst + first, count);
+            if (!Send(worker->first, reply))
+            {
+                failed.push_back(worker->first);
+                break;
+            }
+
+            fPending.erase(fPending.begin());
+            fChunks[index].fState = CHUNK_ASSIGNED;
+            fChunks[index].fWorker = worker->first;
+            worker->second.fChunks.insert(index);
+            --worker->second.fPulls;
+        }
+    }
+
+    for (size_t i = 0; i < failed.size(); ++i)
+    {
+        Drop(failed[i]);
+    }
+}
+
+bool TEventServer::Serve(void)
+{
+    while (true)
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<int> dropped;
+        std::map<int, TPullWorker>::iterator worker;
+        unsigned long long now;
+        struct pollfd fd;
+
+        /* Once all completed, the workers waiting for a chunk are told to leave */
+        Assign();
+        if (fDone == fChunks.size())
+        {
+            break;
+        }
+
+        fd.fd = fSocket;
+        fd.events = POLLIN;
+        fd.revents = 0;
+        fds.push_back(fd);
+        for (worker = fWorkers.begin(); worker != fWorkers.end(); ++worker)
+        {
+            fd.fd = worker->first;
+            fds.push_back(fd);
+        }
+
+        if (poll(&fds[0], fds.size(), SERVE_SLICE) == -1 && errno != EINTR)
+        {
+            return false;
+        }
+
+        now = TStatistics::Now();
+        if (fds[0].revents & POLLIN)
+        {
+            int client = accept4(fSocket, 0, 0, SOCK_CLOEXEC);
+
+            if (client != -1)
+            {
+                fWorkers[client].fLastSeen = now;
+                fWorkers[client].fPulls = 0;
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); ++i)
+        {
+            TPullWorker & current = fWorkers[fds[i].fd];
+            char buffer[4096];
+            ssize_t received;
+            size_t end;
+
+            if (fds[i].revents == 0)
+            {
+                /* Silent for too long, it's considered dead */
+                if (fTimeout != 0 && now - current.fLastSeen > fTimeout)
+                {
+                    dropped.push_back(fds[i].fd);
+                }
+                continue;
+            }
+
+            received = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+            {
+                dropped.push_back(fds[i].fd);
+                continue;
+            }
+
+            current.fLastSeen = now;
+            current.fInput.append(buffer, received);
+            while ((end = current.fInput.find('\n')) != std::string::npos)
+            {
+                std::string line = current.fInput.substr(0, end);
+
+                current.fInput.erase(0, end + 1);
+                if (!Handle(fds[i].fd, line))
+                {
+                    dropped.push_back(fds[i].fd);
+                    break;
+                }
+            }
+
+            if (current.fInput.size() > MAX_LINE)
+            {
+                dropped.push_back(fds[i].fd);
+            }
+        }
+
+        for (size_t i = 0; i < dropped.size(); ++i)
+        {
+            Drop(dropped[i]);
+        }
+    }
+
+    return true;
+}
+
+void TEventServer::Report(std::ostream & stream)
+{
+    stream << "Chunks: " << fDone << " completed out of " << fChunks.size() << " (" << fResumed << " from the journal), " << fReassigned << " reassigned" << std::endl;
+}
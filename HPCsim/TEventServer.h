@@ -0,0 +1,168 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TEventServer.h
+ * PURPOSE:          Coordinator handing out chunks of events to workers
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TEVENTSERVER_H__
+#define __TEVENTSERVER_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ostream>
+
+/**
+ * First line of a journal: magic, first event, events and events per chunk.
+ * Then a line per completed chunk: first event, events and output of the worker
+ */
+#define JOURNAL_MAGIC "HPCsimJ1"
+
+/**
+ * What became of a chunk of events
+ */
+enum TChunkState
+{
+    CHUNK_PENDING,
+    CHUNK_ASSIGNED,
+    CHUNK_DONE
+};
+
+struct TServedChunk
+{
+    unsigned char fState;
+    /**
+     * Socket of the worker running it, when assigned
+     */
+    int fWorker;
+};
+
+/**
+ * A worker connected to the coordinator
+ */
+struct TPullWorker
+{
+    /**
+     * Lines received, up to the last complete one
+     */
+    std::string fInput;
+    /**
+     * Output of the worker, where its chunks results are
+     */
+    std::string fOutput;
+    /**
+     * Last time something was received from it, see TStatistics::Now()
+     */
+    unsigned long long fLastSeen;
+    /**
+     * Chunks asked for, and not handed yet
+     */
+    unsigned int fPulls;
+    /**
+     * Chunks it's running
+     */
+    std::set<unsigned long> fChunks;
+};
+
+class TEventServer
+{
+public:
+    /**
+     * This function creates the socket, and loads the journal of a previous coordinator of the same run.
+     * @param address Path of a Unix socket, or host:port for TCP (empty host or * for any)
+     * @param journal Path of the journal, where each completed chunk is written with the output of its worker
+     * @param first First event of the run
+     * @param events Amount of events of the run
+     * @param chunk Amount of events per chunk
+     * @param timeout Seconds without any news from a worker before it's dropped and its chunks reassigned, 0 to only drop disconnected ones
+     * @return true on success, false otherwise
+     */
+    bool Start(const char * address, const char * journal, unsigned long first, unsigned long events, unsigned int chunk, unsigned int timeout);
+    /**
+     * This function hands out the chunks, until they're all completed.
+     * @return true once all the chunks are completed, false on failure
+     */
+    bool Serve(void);
+    /**
+     * This function writes the chunks completed and reassigned to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This function opens a socket for the coordinator or for its workers.
+     * @param address Path of a Unix socket, or host:port for TCP
+     * @param listening Whether to listen on it (coordinator) or to connect to it (worker)
+     * @return The socket, -1 on failure
+     */
+    static int OpenSocket(const char * address, bool listening);
+    /**
+     * This is the static function to have the coordinator. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the coordinator class.
+     */
+    static TEventServer * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It closes the sockets and the journal.
+     */
+    ~TEventServer();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TEventServer();
+    /**
+     * Marks the chunks found in the journal as completed, or starts a new journal.
+     * @param journal Path of the journal
+     * @return true on success, false if it belongs to another run
+     */
+    bool LoadJournal(const char * journal);
+    /**
+     * Handles a line received from a worker.
+     * @param socket Socket of the worker
+     * @param line The line, without its end
+     * @return false if the worker has to be dropped
+     */
+    bool Handle(int socket, const std::string & line);
+    /**
+     * Hands the pending chunks to the workers which asked for some, or tells them it's over.
+     */
+    void Assign(void);
+    /**
+     * Disconnects a worker, its chunks are pending again.
+     * @param socket Socket of the worker
+     */
+    void Drop(int socket);
+    /**
+     * Sends a line to a worker.
+     * @param socket Socket of the worker
+     * @param line The line, with its end
+     * @return true on success, false otherwise
+     */
+    bool Send(int socket, const char * line);
+
+    int fSocket;
+    std::string fPath;
+    FILE * fJournal;
+    unsigned long fFirst;
+    unsigned long fEvents;
+    unsigned int fChunkSize;
+    unsigned long long fTimeout;
+    std::vector<TServedChunk> fChunks;
+    /**
+     * Chunks to hand out, lowest first
+     */
+    std::set<unsigned long> fPending;
+    std::map<int, TPullWorker> fWorkers;
+    unsigned long fDone;
+    unsigned long fReassigned;
+    unsigned long fResumed;
+};
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TInputMapper.cpp
+ * PURPOSE:          Shared read-only input datasets
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "TInputMapper.h"
+#include "TTopology.h"
+#include "simulation.h"
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+TInputMapper::TInputMapper()
+{
+    fSealed = false;
+}
+
+TInputMapper::~TInputMapper()
+{
+    for (size_t i = 0; i < fMappings.size(); ++i)
+    {
+        for (size_t replica = 0; replica < fMappings[i].fReplicas.size(); ++replica)
+        {
+            munmap(fMappings[i].fReplicas[replica], fMappings[i].fMappedSize);
+        }
+    }
+}
+
+TInputMapper * TInputMapper::GetInstance(bool destroyInstance)
+{
+    static TInputMapper * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TInputMapper();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+char * TInputMapper::Copy(int fd, int policy, unsigned long nodeMask, TInputMapping & mapping)
+{
+    void * address = MAP_FAILED;
+    unsigned long done = 0;
+
+    /* Try huge pages first, if asked to */
+    if (mapping.fFlags & HPCSIM_MAP_HUGETLB)
+    {
+        mapping.fMappedSize = (mapping.fSize + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        address = mmap(0, mapping.fMappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (address != MAP_FAILED)
+        {
+            mapping.fBacking = "huge pages";
+        }
+        else
+        {
+            /* No huge page reserved, fallback to transparent ones */
+            address = mmap(0, mapping.fMappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (address != MAP_FAILED)
+            {
+                madvise(address, mapping.fMappedSize, MADV_HUGEPAGE);
+                mapping.fBacking = "transparent huge pages";
+            }
+        }
+    }
+    else
+    {
+        mapping.fMappedSize = mapping.fSize;
+        address = mmap(0, mapping.fMappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        mapping.fBacking = "anonymous memory";
+    }
+
+    if (address == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    /* Place the pages before touching them */
+    if (policy != 0)
+    {
+        TTopology::BindMemory(address, mapping.fMappedSize, policy, nodeMask);
+    }
+
+    /* And load the file */
+    while (done < mapping.fSize)
+    {
+        ssize_t chunk = pread(fd, reinterpret_cast<char *>(address) + done, mapping.fSize - done, done);
+        if (chunk <= 0)
+        {
+            munmap(address, mapping.fMappedSize);
+            return 0;
+        }
+
+        done += chunk;
+    }
+
+    /* Now, it's read-only for everyone */
+    mprotect(address, mapping.fMappedSize, PROT_READ);
+
+    return reinterpret_cast<char *>(address);
+}
+
+const void * TInputMapper::Map(const char * path, unsigned int flags, unsigned long * size)
+{
+    int fd;
+    struct stat fileStat;
+    struct timespec start, end;
+    TInputMapping mapping;
+    std::vector<unsigned int> nodes;
+    unsigned long onlineMask = 0;
+
+    /* Events are running, too late! */
+    if (fSealed)
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+
+    if (fstat(fd, &fileStat) == -1 || fileStat.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    mapping.fPath = path;
+    mapping.fSize = fileStat.st_size;
+    mapping.fMappedSize = fileStat.st_size;
+    mapping.fFlags = flags;
+    mapping.fBacking = "file";
+
+    /* NUMA placement only makes sense with several nodes */
+    nodes = TTopology::GetOnlineNodes();
+    if (nodes.size() == 1)
+    {
+        mapping.fFlags &= ~(HPCSIM_MAP_INTERLEAVE | HPCSIM_MAP_REPLICATE);
+    }
+    mapping.fNodeReplica.resize(nodes.back() + 1, 0);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        mapping.fNodeReplica[nodes[i]] = ((mapping.fFlags & HPCSIM_MAP_REPLICATE) ? i : 0);
+        onlineMask |= (1UL << nodes[i]);
+    }
+
+    if (mapping.fFlags & HPCSIM_MAP_REPLICATE)
+    {
+        /* One copy per node, bound to it */
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            char * replica = Copy(fd, MPOL_BIND, 1UL << nodes[i], mapping);
+            if (replica == 0)
+            {
+                break;
+            }
+
+            mapping.fReplicas.push_back(replica);
+        }
+
+        if (mapping.fReplicas.size() != nodes.size())
+        {
+            for (size_t i = 0; i < mapping.fReplicas.size(); ++i)
+            {
+                munmap(mapping.fReplicas[i], mapping.fMappedSize);
+            }
+            mapping.fReplicas.clear();
+        }
+    }
+    else if (mapping.fFlags & (HPCSIM_MAP_HUGETLB | HPCSIM_MAP_INTERLEAVE))
+    {
+        char * copy = Copy(fd, ((mapping.fFlags & HPCSIM_MAP_INTERLEAVE) ? MPOL_INTERLEAVE : 0), onlineMask, mapping);
+        if (copy != 0)
+        {
+            mapping.fReplicas.push_back(copy);
+        }
+    }
+    else
+    {
+        /* Plain mapping of the file, shared with the page cache */
+        void * address = mmap(0, mapping.fSize, PROT_READ, MAP_PRIVATE | ((flags & HPCSIM_MAP_POPULATE) ? MAP_POPULATE : 0), fd, 0);
+        if (address != MAP_FAILED)
+        {
+            mapping.fReplicas.push_back(reinterpret_cast<char *>(address));
+        }
+    }
+
+    close(fd);
+
+    if (mapping.fReplicas.empty())
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    mapping.fLoadTime = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    fMappings.push_back(mapping);
+
+    if (size != 0)
+    {
+        *size = mapping.fSize;
+    }
+
+    /* Give the caller its local copy */
+    return Local(mapping.fReplicas[0]);
+}
+
+const void * TInputMapper::Local(const void * input)
+{
+    const char * address = reinterpret_cast<const char *>(input);
+
+    for (size_t i = 0; i < fMappings.size(); ++i)
+    {
+        TInputMapping & mapping = fMappings[i];
+
+        /* Nothing to translate */
+        if (mapping.fReplicas.size() == 1)
+        {
+            continue;
+        }
+
+        for (size_t replica = 0; replica < mapping.fReplicas.size(); ++replica)
+        {
+            if (address >= mapping.fReplicas[replica] && address < mapping.fReplicas[replica] + mapping.fSize)
+            {
+                unsigned int node = TTopology::GetCurrentNode();
+
+                if (node >= mapping.fNodeReplica.size())
+                {
+                    return input;
+                }
+
+                return mapping.fReplicas[mapping.fNodeReplica[node]] + (address - mapping.fReplicas[replica]);
+            }
+        }
+    }
+
+    return input;
+}
+
+void TInputMapper::Seal(void)
+{
+    fSealed = true;
+}
+
+void TInputMapper::Report(std::ostream & stream)
+{
+    for (size_t i = 0; i < fMappings.size(); ++i)
+    {
+        TInputMapping & mapping = fMappings[i];
+
+        stream << "Input " << mapping.fPath << ": " << mapping.fSize << " bytes, backed by " << mapping.fBacking;
+        if (mapping.fFlags & HPCSIM_MAP_INTERLEAVE)
+        {
+            stream << ", interleaved";
+        }
+        if (mapping.fFlags & HPCSIM_MAP_REPLICATE)
+        {
+            stream << ", " << mapping.fReplicas.size() << " replicas";
+        }
+        if (mapping.fFlags & HPCSIM_MAP_POPULATE)
+        {
+            stream << ", populated";
+        }
+        stream << ", loaded in " << mapping.fLoadTime << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TInputMapper.h
+ * PURPOSE:          Shared read-only input datasets
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TINPUTMAPPER_H__
+#define __TINPUTMAPPER_H__
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+struct TInputMapping
+{
+    /**
+     * Path of the mapped file
+     */
+    std::string fPath;
+    /**
+     * Size of the file, as seen by the simulation
+     */
+    unsigned long fSize;
+    /**
+     * Size of each mapping, rounded to the page size in use
+     */
+    unsigned long fMappedSize;
+    /**
+     * HPCSIM_MAP_* flags that were actually honored
+     */
+    unsigned int fFlags;
+    /**
+     * What the mapping is backed by (the file, anonymous memory, huge pages...)
+     */
+    const char * fBacking;
+    /**
+     * Time it took to map (and load, if copied) the file, in ms
+     */
+    double fLoadTime;
+    /**
+     * The mappings. There's one per NUMA node if replicated, only one otherwise
+     */
+    std::vector<char *> fReplicas;
+    /**
+     * For each NUMA node, index of its replica in fReplicas
+     */
+    std::vector<unsigned int> fNodeReplica;
+};
+
+class TInputMapper
+{
+public:
+    /**
+     * This function maps a file read-only for the simulation. It has to be called before the
+     * event loop starts (in SimulationInit() or RunInit()), mappings are then shared by all the events.
+     * @param path Path of the file to map
+     * @param flags HPCSIM_MAP_* flags
+     * @param size Optional output variable, receiving the size of the file
+     * @return The address of the mapping, 0 on failure
+     */
+    const void * Map(const char * path, unsigned int flags, unsigned long * size);
+    /**
+     * This function returns the replica of a mapping that is local to the NUMA node the caller runs on.
+     * @param input Any address inside a mapping returned by Map()
+     * @return The same address, in the local replica. input itself if the mapping isn't replicated
+     */
+    const void * Local(const void * input);
+    /**
+     * This function denies any further mapping. It's called by HPCsim right before the event loop.
+     */
+    void Seal(void);
+    /**
+     * This function writes a line per mapping to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This is the static function to have the mapper. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the mapper class.
+     */
+    static TInputMapper * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It unmaps everything.
+     */
+    ~TInputMapper();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TInputMapper();
+    /**
+     * Copies the file into anonymous memory, for the flags that cannot be honored
+     * with a file backed mapping.
+     * @param fd The opened file
+     * @param policy NUMA policy (MPOL_*) to apply to the copy, 0 for the default one
+     * @param nodeMask NUMA nodes the policy applies to
+     * @param mapping The mapping being built
+     * @return The address of the copy, 0 on failure
+     */
+    char * Copy(int fd, int policy, unsigned long nodeMask, TInputMapping & mapping);
+
+    /**
+     * All the mappings done so far
+     */
+    std::vector<TInputMapping> fMappings;
+    /**
+     * Set once the event loop started
+     */
+    bool fSealed;
+};
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TOutputSet.cpp
+ * PURPOSE:          Outputs made of several segments, sharded over writers and rotated by size
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "TOutputSet.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 0x1000
+#endif
+
+TOutputSet::TOutputSet()
+{
+    fShards = 0;
+    fRotate = 0;
+    fWriting = false;
+    for (unsigned int shard = 0; shard < MAX_OUTPUT_SHARDS; ++shard)
+    {
+        fWriters[shard].fFD = -1;
+        fWriters[shard].fSegment = 0;
+        fWriters[shard].fSize = 0;
+        fNext[shard] = 0;
+    }
+    pthread_mutex_init(&fLock, 0);
+    fCurrent = 0;
+    fFD = -1;
+}
+
+TOutputSet::~TOutputSet()
+{
+    if (fWriting)
+    {
+        Close();
+    }
+
+    if (fFD != -1)
+    {
+        close(fFD);
+    }
+
+    pthread_mutex_destroy(&fLock);
+}
+
+static void SplitPath(const char * path, std::string & directory, std::string & name)
+{
+    const char * slash = strrchr(path, '/');
+
+    directory = ((slash != 0) ? std::string(path, slash + 1 - path) : "");
+    name = ((slash != 0) ? slash + 1 : path);
+}
+
+bool TOutputSet::GetLayout(const char * path, unsigned int & shards, unsigned long long & rotate)
+{
+    char magic[sizeof(OUTPUT_SET_MAGIC)];
+    FILE * file;
+    bool manifest;
+
+    file = fopen(path, "r");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    /* A single file output starts with the ID of a result instead */
+    manifest = (fread(magic, sizeof(magic) - 1, 1, file) == 1 && memcmp(magic, OUTPUT_SET_MAGIC, sizeof(magic) - 1) == 0 &&
+                fscanf(file, " %u %llu\n", &shards, &rotate) == 2);
+    fclose(file);
+
+    return manifest;
+}
+
+bool TOutputSet::Load(const char * path)
+{
+    char line[PATH_MAX + 64];
+    std::string name;
+    FILE * file;
+
+    if (!GetLayout(path, fShards, fRotate))
+    {
+        return false;
+    }
+
+    file = fopen(path, "r");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    fPath = path;
+    SplitPath(path, fDirectory, name);
+    fSegments.clear();
+
+    /* Skip the layout, then a segment per line: shard, size, state and name */
+    UNUSED_RETURN(fgets(line, sizeof(line), file));
+    while (fgets(line, sizeof(line), file) != 0)
+    {
+        TOutputSegment segment;
+        char state[8];
+        int offset;
+        char * end = strchr(line, '\n');
+
+        if (end == 0 || sscanf(line, "%u %llu %7s %n", &segment.fShard, &segment.fSize, state, &offset) != 3 || segment.fShard >= MAX_OUTPUT_SHARDS)
+        {
+            continue;
+        }
+        *end = 0;
+
+        segment.fName = line + offset;
+        segment.fClosed = (strcmp(state, "closed") == 0);
+        fSegments.push_back(segment);
+    }
+    fclose(file);
+
+    return true;
+}
+
+bool TOutputSet::Open(const char * path)
+{
+    struct stat status;
+
+    fCurrent = 0;
+    if (Load(path))
+    {
+        return true;
+    }
+
+    /* A single file is its only segment */
+    if (stat(path, &status) == -1)
+    {
+        return false;
+    }
+
+    TOutputSegment segment;
+    std::string name;
+
+    fPath = path;
+    SplitPath(path, fDirectory, name);
+    segment.fName = name;
+    segment.fShard = 0;
+    segment.fSize = status.st_size;
+    segment.fClosed = true;
+    fSegments.assign(1, segment);
+
+    return true;
+}
+
+std::string TOutputSet::GetSegmentPath(size_t segment) const
+{
+    return fDirectory + fSegments[segment].fName;
+}
+
+ssize_t TOutputSet::Read(void * data, size_t length)
+{
+    while (fCurrent < fSegments.size())
+    {
+        ssize_t done;
+
+        if (fFD == -1)
+        {
+            fFD = open(GetSegmentPath(fCurrent).c_str(), O_RDONLY | O_CLOEXEC);
+            /* A segment removed by its consumer: the results in it are gone */
+            if (fFD == -1)
+            {
+                ++fCurrent;
+                continue;
+            }
+        }
+
+        done = read(fFD, data, length);
+        if (done != 0)
+        {
+            return done;
+        }
+
+        /* End of the segment, go on with the next one */
+        close(fFD);
+        fFD = -1;
+        ++fCurrent;
+    }
+
+    return 0;
+}
+
+bool TOutputSet::Skip(unsigned long long length)
+{
+    return fFD != -1 && lseek(fFD, length, SEEK_CUR) != -1;
+}
+
+bool TOutputSet::Seek(unsigned long long offset)
+{
+    if (fFD != -1)
+    {
+        close(fFD);
+        fFD = -1;
+    }
+
+    for (fCurrent = 0; fCurrent < fSegments.size(); ++fCurrent)
+    {
+        struct stat status;
+
+        if (stat(GetSegmentPath(fCurrent).c_str(), &status) == -1)
+        {
+            continue;
+        }
+
+        /* The end of a segment is the start of the next one */
+        if (offset < static_cast<unsigned long long>(status.st_size))
+        {
+            fFD = open(GetSegmentPath(fCurrent).c_str(), O_RDONLY | O_CLOEXEC);
+            return fFD != -1 && lseek(fFD, offset, SEEK_SET) != -1;
+        }
+
+        offset -= status.st_size;
+    }
+
+    return offset == 0;
+}
+
+unsigned long long TOutputSet::GetSize(void)
+{
+    unsigned long long size = 0;
+
+    /* Segments written at the same time, or left open by a crash, are as large as their file */
+    for (size_t segment = 0; segment < fSegments.size(); ++segment)
+    {
+        struct stat status;
+
+        if (stat(GetSegmentPath(segment).c_str(), &status) == 0)
+        {
+            size += status.st_size;
+        }
+    }
+
+    return size;
+}
+
+void TOutputSet::RemoveSegments(const char * path)
+{
+    TOutputSet previous;
+
+    if (!previous.Load(path))
+    {
+        return;
+    }
+
+    for (size_t segment = 0; segment < previous.fSegments.size(); ++segment)
+    {
+        unlink(previous.GetSegmentPath(segment).c_str());
+    }
+}
+
+bool TOutputSet::Save(void)
+{
+    std::string temporary = fPath + ".tmp";
+    FILE * file;
+    bool saved;
+
+    file = fopen(temporary.c_str(), "w");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    fprintf(file, "%s %u %llu\n", OUTPUT_SET_MAGIC, fShards, fRotate);
+    for (size_t segment = 0; segment < fSegments.size(); ++segment)
+    {
+        /* The size of a segment still written is only known from its file */
+        fprintf(file, "%u %llu %s %s\n", fSegments[segment].fShard, (fSegments[segment].fClosed ? fSegments[segment].fSize : 0ULL),
+                (fSegments[segment].fClosed ? "closed" : "open"), fSegments[segment].fName.c_str());
+    }
+
+    saved = (fflush(file) == 0);
+    fclose(file);
+
+    /* Consumers watching the manifest see the previous one or this one, never a part of it */
+    return saved && rename(temporary.c_str(), fPath.c_str()) == 0;
+}
+
+bool TOutputSet::StartSegment(unsigned int shard)
+{
+    TOutputSegment segment;
+    std::string name;
+    char suffix[32];
+
+    SplitPath(fPath.c_str(), fDirectory, name);
+    snprintf(suffix, sizeof(suffix), ".%u.%05u", shard, fNext[shard]);
+    ++fNext[shard];
+
+    segment.fName = name + suffix;
+    segment.fShard = shard;
+    segment.fSize = 0;
+    segment.fClosed = false;
+
+    fWriters[shard].fFD = open((fDirectory + segment.fName).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fWriters[shard].fFD == -1)
+    {
+        fprintf(stderr, "Failed creating output segment %s%s\n", fDirectory.c_str(), segment.fName.c_str());
+        return false;
+    }
+
+    fWriters[shard].fSegment = fSegments.size();
+    fWriters[shard].fSize = 0;
+    fSegments.push_back(segment);
+
+    return true;
+}
+
+void TOutputSet::EndSegment(unsigned int shard)
+{
+    TOutputShard & writer = fWriters[shard];
+
+    if (writer.fFD == -1)
+    {
+        return;
+    }
+
+    close(writer.fFD);
+    writer.fFD = -1;
+    fSegments[writer.fSegment].fSize = writer.fSize;
+    fSegments[writer.fSegment].fClosed = true;
+}
+
+bool TOutputSet::Create(const char * path, unsigned int shards, unsigned long long rotate, bool append)
+{
+    fSegments.clear();
+
+    /* Keep the segments written before, the shards go on with new ones */
+    if (append && Load(path))
+    {
+        for (size_t segment = 0; segment < fSegments.size(); ++segment)
+        {
+            struct stat status;
+
+            /* The ones left open by a stop or a crash are done */
+            if (!fSegments[segment].fClosed)
+            {
+                fSegments[segment].fSize = ((stat(GetSegmentPath(segment).c_str(), &status) == 0) ? status.st_size : 0);
+                fSegments[segment].fClosed = true;
+            }
+            ++fNext[fSegments[segment].fShard];
+        }
+    }
+    else
+    {
+        RemoveSegments(path);
+        fSegments.clear();
+    }
+
+    fPath = path;
+    fShards = shards;
+    fRotate = rotate;
+    fWriting = true;
+
+    for (unsigned int shard = 0; shard < shards; ++shard)
+    {
+        if (!StartSegment(shard))
+        {
+            return false;
+        }
+    }
+
+    if (!Save())
+    {
+        fprintf(stderr, "Failed writing output manifest %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+unsigned long TOutputSet::Write(unsigned int shard, const TResult * result)
+{
+    TOutputShard & writer = fWriters[shard];
+    size_t length = offsetof(TResult, fResult) + result->fResultLength;
+    ssize_t written;
+
+    /* The segment is full, it can be consumed: go on with the next one */
+    if (fRotate != 0 && writer.fSize != 0 && writer.fSize + length > fRotate)
+    {
+        pthread_mutex_lock(&fLock);
+        EndSegment(shard);
+        StartSegment(shard);
+        Save();
+        pthread_mutex_unlock(&fLock);
+    }
+
+    written = write(writer.fFD, result, length);
+    if (written <= 0)
+    {
+        return 0;
+    }
+
+    writer.fSize += written;
+    return written;
+}
+
+void TOutputSet::Close(void)
+{
+    pthread_mutex_lock(&fLock);
+    for (unsigned int shard = 0; shard < fShards; ++shard)
+    {
+        size_t segment = fWriters[shard].fSegment;
+
+        if (fWriters[shard].fFD == -1)
+        {
+            continue;
+        }
+
+        EndSegment(shard);
+        /* A shard which got nothing since its last segment doesn't leave an empty one */
+        if (fSegments[segment].fSize == 0)
+        {
+            unlink(GetSegmentPath(segment).c_str());
+            fSegments[segment].fName.clear();
+        }
+    }
+
+    for (size_t segment = fSegments.size(); segment != 0; --segment)
+    {
+        if (fSegments[segment - 1].fName.empty())
+        {
+            fSegments.erase(fSegments.begin() + segment - 1);
+        }
+    }
+
+    Save();
+    fWriting = false;
+    pthread_mutex_unlock(&fLock);
+}
@@ -0,0 +1,194 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TOutputSet.h
+ * PURPOSE:          Outputs made of several segments, sharded over writers and rotated by size
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TOUTPUTSET_H__
+#define __TOUTPUTSET_H__
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include "simulation.h"
+
+/**
+ * First word of a manifest, and version of its format
+ */
+#define OUTPUT_SET_MAGIC "HPCsimO1"
+
+/**
+ * Maximum amount of shards, written in parallel
+ */
+#define MAX_OUTPUT_SHARDS 64
+
+/**
+ * A file of the output
+ */
+struct TOutputSegment
+{
+    /**
+     * Name of the file, in the directory of the manifest
+     */
+    std::string fName;
+    unsigned int fShard;
+    /**
+     * Size of the segment once closed
+     */
+    unsigned long long fSize;
+    /**
+     * Whether its writer is done with it, it can be consumed then
+     */
+    bool fClosed;
+};
+
+/**
+ * Segment being written by a shard
+ */
+struct TOutputShard
+{
+    int fFD;
+    size_t fSegment;
+    unsigned long long fSize;
+};
+
+class TOutputSet
+{
+public:
+    /**
+     * This function opens an output for reading: the segments listed in its manifest, one after
+     * the other, or the output itself if it's a single file.
+     * @param path Path of the output
+     * @return true on success, false otherwise
+     */
+    bool Open(const char * path);
+    /**
+     * This function reads from the output, going through its segments as if they were one file.
+     * Results never span two segments.
+     * @param data Buffer receiving the data
+     * @param length Amount of bytes to read
+     * @return Amount of bytes read, 0 at the end of the output, -1 on error
+     */
+    ssize_t Read(void * data, size_t length);
+    /**
+     * This function moves in the output, as if its segments were one file.
+     * @param offset Offset from the start of the output
+     * @return true on success, false if it's past its end
+     */
+    bool Seek(unsigned long long offset);
+    /**
+     * This function skips the rest of a result in the output.
+     * @param length Amount of bytes to skip, they're in the segment read
+     * @return true on success, false otherwise
+     */
+    bool Skip(unsigned long long length);
+    /**
+     * This function returns the size of the output, the one of all its segments.
+     * @return Size in bytes
+     */
+    unsigned long long GetSize(void);
+    /**
+     * This function returns the amount of segments of the output, 1 for a single file.
+     * @return Amount of segments
+     */
+    inline size_t GetSegments(void) const
+    {
+        return fSegments.size();
+    }
+    /**
+     * This function returns the path of a segment of the output.
+     * @param segment The segment
+     * @return Its path
+     */
+    std::string GetSegmentPath(size_t segment) const;
+    /**
+     * This function creates an output written by shards, each with its own segments.
+     * @param path Path of the output, where its manifest is written
+     * @param shards Amount of shards, from 1 to MAX_OUTPUT_SHARDS
+     * @param rotate Size over which a segment is closed for the next one, 0 for never
+     * @param append Whether the segments of the output are kept, as with checkpoint. The shards
+     * then start new segments, with the layout of the output
+     * @return true on success, false otherwise
+     */
+    bool Create(const char * path, unsigned int shards, unsigned long long rotate, bool append);
+    /**
+     * This function writes a result to the current segment of a shard. Each shard has to be written
+     * by a single thread, shards can be written in parallel.
+     * @param shard The shard
+     * @param result The result
+     * @return Amount of bytes written
+     */
+    unsigned long Write(unsigned int shard, const TResult * result);
+    /**
+     * This function closes the segments written, once all the shards are done.
+     */
+    void Close(void);
+    /**
+     * This function tells whether an output is a manifest, and gets its layout.
+     * @param path Path of the output
+     * @param shards Output variable, receiving its amount of shards
+     * @param rotate Output variable, receiving its rotation size
+     * @return true if it's a manifest, false otherwise
+     */
+    static bool GetLayout(const char * path, unsigned int & shards, unsigned long long & rotate);
+    /**
+     * This function removes the segments of an output, if it's a manifest. The manifest is kept.
+     * @param path Path of the output
+     */
+    static void RemoveSegments(const char * path);
+    /**
+     * Constructor.
+     */
+    TOutputSet();
+    /**
+     * Destructor. It closes the output, the segments written are closed first.
+     */
+    ~TOutputSet();
+
+private:
+    /**
+     * Reads the segments listed in a manifest.
+     */
+    bool Load(const char * path);
+    /**
+     * Writes the manifest, with the state of the segments. It replaces the previous one at once.
+     */
+    bool Save(void);
+    /**
+     * Starts the next segment of a shard.
+     */
+    bool StartSegment(unsigned int shard);
+    /**
+     * Closes the segment of a shard, and lists it as closed.
+     */
+    void EndSegment(unsigned int shard);
+
+    std::string fPath;
+    std::string fDirectory;
+    std::vector<TOutputSegment> fSegments;
+    unsigned int fShards;
+    unsigned long long fRotate;
+    /**
+     * Whether the output is written, there's a manifest then
+     */
+    bool fWriting;
+    TOutputShard fWriters[MAX_OUTPUT_SHARDS];
+    /**
+     * Next index of the segments of each shard
+     */
+    unsigned int fNext[MAX_OUTPUT_SHARDS];
+    /**
+     * Serializes the shards starting and ending segments, and the manifest
+     */
+    pthread_mutex_t fLock;
+    /**
+     * Segment read, and its file
+     */
+    size_t fCurrent;
+    int fFD;
+};
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TOutputSink.cpp
+ * PURPOSE:          Output sinks, streaming the results to a consumer process during the run
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "TOutputSink.h"
+#include "TEventServer.h"
+#include "TStatistics.h"
+
+/* How long the writer waits for the consumer at once, in ms */
+#define SINK_SLICE 100
+
+/* The lag of a FIFO or a socket costs a system call: it's only checked every that many results */
+#define LAG_PERIOD 256
+
+TOutputSink::TOutputSink()
+{
+    fKind = SINK_SHM;
+    fPolicy = SINK_BLOCK;
+    fFD = -1;
+    fListening = -1;
+    fCreated = false;
+    fBuffer = 0;
+    fShared = 0;
+    fRing = 0;
+    fMapped = 0;
+    fSpillFD = -1;
+    fStopRequested = 0;
+    fAbandoned = false;
+    fGone = false;
+    fStreamed = 0;
+    fStreamedBytes = 0;
+    fDropped = 0;
+    fSpilled = 0;
+    fBlocked = 0;
+    fLag = 0;
+    fMaxLag = 0;
+}
+
+TOutputSink::~TOutputSink()
+{
+    if (fShared != 0)
+    {
+        sem_destroy(&fShared->fAvailable);
+        sem_destroy(&fShared->fFreed);
+        munmap(fShared, fMapped);
+    }
+
+    if (fFD != -1)
+    {
+        close(fFD);
+    }
+
+    if (fListening != -1)
+    {
+        close(fListening);
+        unlink(fPath.c_str());
+    }
+
+    if (fCreated)
+    {
+        unlink(fPath.c_str());
+    }
+
+    if (fSpillFD != -1)
+    {
+        close(fSpillFD);
+    }
+}
+
+TOutputSink * TOutputSink::GetInstance(bool destroyInstance)
+{
+    static TOutputSink * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TOutputSink();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TOutputSink::GetPolicy(const char * name, TSinkPolicy & policy)
+{
+    if (strcmp(name, "block") == 0)
+    {
+        policy = SINK_BLOCK;
+    }
+    else if (strcmp(name, "drop") == 0)
+    {
+        policy = SINK_DROP;
+    }
+    else if (strcmp(name, "spill") == 0)
+    {
+        policy = SINK_SPILL;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool TOutputSink::Open(const char * uri, TSinkPolicy policy, unsigned long long buffer, const char * spillFile)
+{
+    fUri = uri;
+    fPolicy = policy;
+    fBuffer = buffer;
+    fSpillFile = spillFile;
+
+    /* Spills of a previous run would be taken as the ones of this run */
+    unlink(spillFile);
+
+    if (strncmp(uri, "shm:", 4) == 0)
+    {
+        int fd;
+
+        fKind = SINK_SHM;
+        fPath = ((uri[4] == '/') ? std::string(uri + 4) : "/" + std::string(uri + 4));
+        fBuffer = (buffer + 7) & ~static_cast<unsigned long long>(7);
+        fMapped = SINK_HEADER_SIZE + fBuffer;
+
+        /* A consumer still attached to the ring of a previous run keeps it */
+        shm_unlink(fPath.c_str());
+        fd = shm_open(fPath.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            fprintf(stderr, "Failed creating shared memory %s\n", fPath.c_str());
+            return false;
+        }
+
+        if (ftruncate(fd, fMapped) == -1)
+        {
+            fprintf(stderr, "Failed sizing shared memory %s to %zu bytes\n", fPath.c_str(), fMapped);
+            close(fd);
+            shm_unlink(fPath.c_str());
+            return false;
+        }
+
+        fShared = reinterpret_cast<TSinkShared *>(mmap(0, fMapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        close(fd);
+        if (fShared == MAP_FAILED)
+        {
+            fShared = 0;
+            shm_unlink(fPath.c_str());
+            return false;
+        }
+
+        fRing = reinterpret_cast<uint8_t *>(fShared) + SINK_HEADER_SIZE;
+        fShared->fSize = fBuffer;
+        fShared->fEnded = 0;
+        fShared->fAttached = 0;
+        fShared->fHead = 0;
+        fShared->fTail = 0;
+        sem_init(&fShared->fAvailable, 1, 0);
+        sem_init(&fShared->fFreed, 1, 0);
+        fShared->fVersion = SINK_VERSION;
+        /* The consumer only looks at the ring once it's complete */
+        __sync_synchronize();
+        fShared->fMagic = SINK_MAGIC;
+
+        return true;
+    }
+
+    /* A consumer leaving mustn't kill the run */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (strncmp(uri, "fifo:", 5) == 0)
+    {
+        struct stat pathStat;
+
+        fKind = SINK_FIFO;
+        fPath = uri + 5;
+
+        if (mkfifo(fPath.c_str(), S_IRUSR | S_IWUSR) == 0)
+        {
+            fCreated = true;
+        }
+        else if (stat(fPath.c_str(), &pathStat) == -1 || !S_ISFIFO(pathStat.st_mode))
+        {
+            fprintf(stderr, "Failed creating FIFO %s\n", fPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    if (strncmp(uri, "unix:", 5) == 0)
+    {
+        fKind = SINK_SOCKET;
+        fPath = uri + 5;
+
+        /* Results are only for local consumers */
+        if (strchr(fPath.c_str(), '/') == 0 && strchr(fPath.c_str(), ':') != 0)
+        {
+            fprintf(stderr, "The sink only listens on a Unix socket, not on %s\n", fPath.c_str());
+            return false;
+        }
+
+        fListening = TEventServer::OpenSocket(fPath.c_str(), true);
+        if (fListening == -1)
+        {
+            fprintf(stderr, "Failed creating sink socket %s\n", fPath.c_str());
+            return false;
+        }
+
+        /* And for its user */
+        if (chmod(fPath.c_str(), S_IRUSR | S_IWUSR) == -1)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    fprintf(stderr, "Invalid sink %s: expected shm:name, fifo:path or unix:path\n", uri);
+    return false;
+}
+
+bool TOutputSink::Connect(bool (* stopRequested)(void))
+{
+    int size = ((fBuffer < 0x7fffffff) ? static_cast<int>(fBuffer) : 0x7fffffff);
+
+    fStopRequested = stopRequested;
+    if (fKind == SINK_SHM)
+    {
+        return true;
+    }
+
+    fprintf(stderr, "Waiting for the consumer of %s\n", fUri.c_str());
+    while (fFD == -1)
+    {
+        if (stopRequested())
+        {
+            return false;
+        }
+
+        if (fKind == SINK_FIFO)
+        {
+            /* There's no reader yet while it fails */
+            fFD = open(fPath.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fFD == -1)
+            {
+                if (errno != ENXIO)
+                {
+                    return false;
+                }
+                usleep(SINK_SLICE * 1000);
+            }
+        }
+        else
+        {
+            struct pollfd listening;
+
+            listening.fd = fListening;
+            listening.events = POLLIN;
+            if (poll(&listening, 1, SINK_SLICE) == 1)
+            {
+                fFD = accept4(fListening, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            }
+        }
+    }
+
+    /* The buffer absorbs the bursts of results. It can be capped by the system */
+    if (fKind == SINK_FIFO)
+    {
+        UNUSED_RETURN(fcntl(fFD, F_SETPIPE_SZ, size));
+    }
+    else
+    {
+        setsockopt(fFD, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+
+    return true;
+}
+
+void TOutputSink::WaitConsumer(void)
+{
+    unsigned long long start = TStatistics::Now();
+
+    if (fKind == SINK_SHM)
+    {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SINK_SLICE * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        sem_timedwait(&fShared->fFreed, &deadline);
+    }
+    else
+    {
+        struct pollfd consumer;
+
+        consumer.fd = fFD;
+        consumer.events = POLLOUT;
+        poll(&consumer, 1, SINK_SLICE);
+    }
+
+    fBlocked += TStatistics::Now() - start;
+}
+
+bool TOutputSink::WriteRing(const TResult * result, size_t length)
+{
+    uint64_t head = fShared->fHead;
+    uint64_t size = SINK_RECORD_SIZE(result->fResultLength);
+
+    /* The consumer is behind, wait for it if asked to */
+    while (fShared->fSize - (head - fShared->fTail) < size)
+    {
+        if (fPolicy != SINK_BLOCK || IsStopping() || size > fShared->fSize)
+        {
+            return false;
+        }
+
+        WaitConsumer();
+    }
+
+    SinkCopyToRing(fRing, fShared->fSize, head, result, length);
+
+    /* The consumer only sees complete results */
+    __sync_synchronize();
+    fShared->fHead = head + size;
+    sem_post(&fShared->fAvailable);
+
+    fLag = fShared->fHead - fShared->fTail;
+    if (fLag > fMaxLag)
+    {
+        fMaxLag = fLag;
+    }
+
+    return true;
+}
+
+bool TOutputSink::WriteStream(const TResult * result, size_t length)
+{
+    const uint8_t * data = reinterpret_cast<const uint8_t *>(result);
+    size_t done = 0;
+
+    while (done < length)
+    {
+        ssize_t written = ((fKind == SINK_SOCKET) ? send(fFD, data + done, length - done, MSG_NOSIGNAL) : write(fFD, data + done, length - done));
+
+        if (written > 0)
+        {
+            done += written;
+            continue;
+        }
+
+        if (written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        /* The consumer left */
+        if (written == -1 && errno != EAGAIN)
+        {
+            fGone = true;
+            return false;
+        }
+
+        /* A result not started can be given up. Once started, it has to go through, or the stream is broken */
+        if (done == 0 && (fPolicy != SINK_BLOCK || IsStopping()))
+        {
+            return false;
+        }
+        if (fAbandoned)
+        {
+            fGone = true;
+            return false;
+        }
+
+        WaitConsumer();
+    }
+
+    if ((fStreamed % LAG_PERIOD) == 0)
+    {
+        UpdateLag();
+    }
+
+    return true;
+}
+
+void TOutputSink::UpdateLag(void)
+{
+    int pending = 0;
+
+    /* Bytes not read from the FIFO, or not acknowledged by the consumer of the socket */
+    if (ioctl(fFD, (fKind == SINK_FIFO ? FIONREAD : TIOCOUTQ), &pending) == 0)
+    {
+        fLag = pending;
+        if (fLag > fMaxLag)
+        {
+            fMaxLag = fLag;
+        }
+    }
+}
+
+unsigned long TOutputSink::Lose(const TResult * result, size_t length)
+{
+    ssize_t written;
+
+    /* With SINK_BLOCK, they're only lost once the run stops or the consumer leaves: keep them */
+    if (fPolicy == SINK_DROP)
+    {
+        ++fDropped;
+        return 0;
+    }
+
+    if (fSpillFD == -1)
+    {
+        fSpillFD = open(fSpillFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fSpillFD == -1)
+        {
+            fprintf(stderr, "Failed creating spill file %s, dropping the results instead\n", fSpillFile.c_str());
+            fPolicy = SINK_DROP;
+            ++fDropped;
+            return 0;
+        }
+    }
+
+    written = write(fSpillFD, result, length);
+    ++fSpilled;
+
+    return ((written > 0) ? written : 0);
+}
+
+unsigned long TOutputSink::Write(const TResult * result)
+{
+    size_t length = SINK_RECORD_HEADER_SIZE + result->fResultLength;
+    bool streamed;
+
+    if (fGone)
+    {
+        return Lose(result, length);
+    }
+
+    streamed = ((fKind == SINK_SHM) ? WriteRing(result, length) : WriteStream(result, length));
+    if (!streamed)
+    {
+        return Lose(result, length);
+    }
+
+    ++fStreamed;
+    fStreamedBytes += length;
+
+    return length;
+}
+
+void TOutputSink::End(void)
+{
+    if (fShared != 0)
+    {
+        fShared->fEnded = 1;
+        sem_post(&fShared->fAvailable);
+        return;
+    }
+
+    if (fFD != -1)
+    {
+        UpdateLag();
+        close(fFD);
+        fFD = -1;
+    }
+
+    if (fSpillFD != -1)
+    {
+        close(fSpillFD);
+        fSpillFD = -1;
+    }
+}
+
+bool TOutputSink::IsStopping(void)
+{
+    /* Running events could never end while waiting for an absent consumer */
+    return fAbandoned || (fStopRequested != 0 && fStopRequested());
+}
+
+void TOutputSink::Abandon(void)
+{
+    fAbandoned = true;
+}
+
+void TOutputSink::Report(std::ostream & stream)
+{
+    stream << "Sink " << fUri << ": " << fStreamed << " results (" << fStreamedBytes << " bytes) streamed";
+    if (fDropped != 0)
+    {
+        stream << ", " << fDropped << " dropped";
+    }
+    if (fSpilled != 0)
+    {
+        stream << ", " << fSpilled << " spilled to " << fSpillFile;
+    }
+    stream << ", blocked " << (fBlocked / 1000000000.0) << " s, consumer lag up to " << fMaxLag << " bytes (" << fLag << " at the end)" << std::endl;
+
+    if (fShared != 0 && fShared->fAttached == 0)
+    {
+        stream << "No consumer attached to " << fPath << ", the results are left in it" << std::endl;
+    }
+    if (fGone)
+    {
+        stream << "The consumer left before the end of the run" << std::endl;
+    }
+}
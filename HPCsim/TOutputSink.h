@@ -0,0 +1,258 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TOutputSink.h
+ * PURPOSE:          Output sinks, streaming the results to a consumer process during the run
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TOUTPUTSINK_H__
+#define __TOUTPUTSINK_H__
+
+#include <string>
+#include <ostream>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+#include <semaphore.h>
+#include "simulation.h"
+
+/**
+ * Marks a shared memory ring of HPCsim, and the version of its layout
+ */
+#define SINK_MAGIC 0x4b4e4953
+#define SINK_VERSION 1
+
+/**
+ * The data of a shared memory ring starts on its own page, after its state
+ */
+#define SINK_HEADER_SIZE 4096
+
+/**
+ * Size of the header of a result: ID and length
+ */
+#define SINK_RECORD_HEADER_SIZE (offsetof(TResult, fResult))
+
+/**
+ * Results are kept aligned in the rings
+ */
+#define SINK_RECORD_SIZE(length) ((SINK_RECORD_HEADER_SIZE + (length) + 7) & ~static_cast<uint64_t>(7))
+
+/**
+ * State of a shared memory ring, shared by the writer and the consumer. The writer only moves
+ * the head, the consumer only moves the tail: they're on their own cache lines
+ */
+struct TSinkShared
+{
+    uint32_t fMagic;
+    uint32_t fVersion;
+    /**
+     * Size of the data of the ring, in bytes
+     */
+    uint64_t fSize;
+    /**
+     * Set by the writer once all the results are in the ring
+     */
+    volatile uint32_t fEnded;
+    /**
+     * Set by the consumer once attached
+     */
+    volatile uint32_t fAttached;
+    /**
+     * Posted by the writer for each result (and at the end), by the consumer for each result read
+     */
+    sem_t fAvailable;
+    sem_t fFreed;
+    char fPadding1[64];
+    volatile uint64_t fHead;
+    char fPadding2[64 - sizeof(uint64_t)];
+    volatile uint64_t fTail;
+    char fPadding3[64 - sizeof(uint64_t)];
+};
+
+/**
+ * How results are handled when the consumer is behind
+ */
+enum TSinkPolicy
+{
+    /**
+     * The writer waits for the consumer, and the events for the writer. Once the run stops, the
+     * results left are spilled
+     */
+    SINK_BLOCK,
+    /**
+     * They are lost, and counted
+     */
+    SINK_DROP,
+    /**
+     * They are written to a file next to the output, for the consumer to read after the run
+     */
+    SINK_SPILL
+};
+
+enum TSinkKind
+{
+    SINK_SHM,
+    SINK_FIFO,
+    SINK_SOCKET,
+    /**
+     * Output written by a run, only read by libhpcsim_sink
+     */
+    SINK_FILE
+};
+
+/**
+ * Copies to a ring, wrapping at its end
+ */
+static inline void SinkCopyToRing(uint8_t * ring, uint64_t size, uint64_t position, const void * data, size_t length)
+{
+    size_t offset = position % size;
+    size_t first = ((length < size - offset) ? length : size - offset);
+
+    memcpy(ring + offset, data, first);
+    memcpy(ring, reinterpret_cast<const uint8_t *>(data) + first, length - first);
+}
+
+/**
+ * Copies from a ring, wrapping at its end
+ */
+static inline void SinkCopyFromRing(const uint8_t * ring, uint64_t size, uint64_t position, void * data, size_t length)
+{
+    size_t offset = position % size;
+    size_t first = ((length < size - offset) ? length : size - offset);
+
+    memcpy(data, ring + offset, first);
+    memcpy(reinterpret_cast<uint8_t *>(data) + first, ring, length - first);
+}
+
+class TOutputSink
+{
+public:
+    /**
+     * This function creates the sink: a shared memory ring (shm:name), a FIFO (fifo:path, created
+     * if needed) or a Unix socket (unix:path) a single consumer reads the results from.
+     * @param uri The sink
+     * @param policy What to do with the results when the consumer is behind
+     * @param buffer Size of the ring, or of the buffer of the FIFO or of the socket, in bytes
+     * @param spillFile Where results are spilled with SINK_SPILL, or when the consumer leaves
+     * @return true on success, false otherwise
+     */
+    bool Open(const char * uri, TSinkPolicy policy, unsigned long long buffer, const char * spillFile);
+    /**
+     * This function waits for the consumer of a FIFO or of a socket. The consumer of a ring can
+     * attach at any time.
+     * @param stopRequested Tells whether the run has to stop, the wait is given up then. The writer
+     * doesn't wait for the consumer anymore either
+     * @return true once connected, false otherwise
+     */
+    bool Connect(bool (* stopRequested)(void));
+    /**
+     * This function hands a result to the consumer, or drops or spills it if it's behind.
+     * Only the writer calls it.
+     * @param result The result
+     * @return Amount of bytes streamed or spilled
+     */
+    unsigned long Write(const TResult * result);
+    /**
+     * This function tells the consumer there are no more results.
+     */
+    void End(void);
+    /**
+     * This function stops waiting for the consumer: the results left are dropped or spilled.
+     * It can be called from any thread.
+     */
+    void Abandon(void);
+    /**
+     * This function writes the results streamed, dropped and spilled, the time blocked and the
+     * lag of the consumer to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This function parses a policy.
+     * @param name block, drop or spill
+     * @param policy Output variable, receiving the policy
+     * @return true on success, false otherwise
+     */
+    static bool GetPolicy(const char * name, TSinkPolicy & policy);
+    /**
+     * This is the static function to have the sink. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the sink class.
+     */
+    static TOutputSink * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It releases the sink.
+     */
+    ~TOutputSink();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TOutputSink();
+    /**
+     * Puts a record in the ring.
+     * @return true if it was, false if the consumer is behind (and the writer doesn't wait)
+     */
+    bool WriteRing(const TResult * result, size_t length);
+    /**
+     * Writes a record to the FIFO or the socket. A record started is always completed.
+     * @return true if it was, false if the consumer is behind (and the writer doesn't wait) or gone
+     */
+    bool WriteStream(const TResult * result, size_t length);
+    /**
+     * Drops or spills a record which couldn't be streamed.
+     * @return Amount of bytes spilled
+     */
+    unsigned long Lose(const TResult * result, size_t length);
+    /**
+     * Waits for the consumer, up to a slice, accounting the time blocked.
+     */
+    void WaitConsumer(void);
+    /**
+     * Gets how far behind the consumer is.
+     */
+    void UpdateLag(void);
+    /**
+     * Tells whether the writer has to stop waiting for the consumer: the run is stopping, or abandoned.
+     */
+    bool IsStopping(void);
+
+    TSinkKind fKind;
+    TSinkPolicy fPolicy;
+    std::string fUri;
+    std::string fPath;
+    std::string fSpillFile;
+    /**
+     * FIFO, or socket of the consumer
+     */
+    int fFD;
+    int fListening;
+    /**
+     * Whether the FIFO was created by the sink, it's removed at the end then
+     */
+    bool fCreated;
+    unsigned long long fBuffer;
+    TSinkShared * fShared;
+    uint8_t * fRing;
+    size_t fMapped;
+    int fSpillFD;
+    bool (* fStopRequested)(void);
+    volatile bool fAbandoned;
+    /**
+     * Set once the consumer left, nothing can be streamed anymore
+     */
+    bool fGone;
+    unsigned long fStreamed;
+    unsigned long long fStreamedBytes;
+    unsigned long fDropped;
+    unsigned long fSpilled;
+    unsigned long long fBlocked;
+    unsigned long long fLag;
+    unsigned long long fMaxLag;
+};
+
+#endif
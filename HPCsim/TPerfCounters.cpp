@@ -0,0 +1,507 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TPerfCounters.cpp
+ * PURPOSE:          Hardware performance counters per event phase
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "TPerfCounters.h"
+#include "TThreadsFactory.h"
+#include "TTopology.h"
+
+static const char * gPhaseNames[PHASE_MAX] = { "init", "run", "clear" };
+
+static const struct
+{
+    const char * fName;
+    unsigned int fType;
+    unsigned long long fConfig;
+} gCounters[PERF_MAX] =
+{
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    /* The kernel maps it to the last level cache misses */
+    { "llcMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branchMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "taskClock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "pageFaults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+};
+
+TPerfCounters::TPerfCounters()
+{
+    fEventsFile = 0;
+    pthread_mutex_init(&fEventsLock, 0);
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        fAvailable[counter] = false;
+    }
+}
+
+TPerfCounters::~TPerfCounters()
+{
+    for (size_t i = 0; i < fThreads.size(); ++i)
+    {
+        if (fThreads[i] != 0)
+        {
+            TTopology::FreeLocal(fThreads[i], sizeof(TPerfThread));
+        }
+    }
+
+    if (fEventsFile != 0)
+    {
+        fclose(fEventsFile);
+    }
+
+    pthread_mutex_destroy(&fEventsLock);
+}
+
+TPerfCounters * TPerfCounters::GetInstance(bool destroyInstance)
+{
+    static TPerfCounters * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TPerfCounters();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+int TPerfCounters::OpenCounter(TPerfCounter counter, int leader)
+{
+    struct perf_event_attr attributes;
+
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = gCounters[counter].fType;
+    attributes.config = gCounters[counter].fConfig;
+    attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* Only the simulation matters, and it's what perf_event_paranoid 2 allows */
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    /* Calling thread, on any CPU */
+    return syscall(SYS_perf_event_open, &attributes, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+}
+
+bool TPerfCounters::Start(const char * path, const char * eventsPath, unsigned int threads)
+{
+    std::string denied, missing;
+    bool available = false;
+
+    /* Make sure we'll be able to write, before the run */
+    if (path != 0)
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            return false;
+        }
+        file.close();
+
+        fPath = path;
+    }
+
+    fThreads.resize(threads + 1, 0);
+
+    /* Find out what the kernel (and the CPU) let us count */
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        int fd = OpenCounter(static_cast<TPerfCounter>(counter), -1);
+
+        if (fd != -1)
+        {
+            close(fd);
+            fAvailable[counter] = true;
+            available = true;
+            continue;
+        }
+
+        std::string & list = ((errno == EACCES || errno == EPERM) ? denied : missing);
+        list += (list.empty() ? "" : ", ");
+        list += gCounters[counter].fName;
+    }
+
+    if (!denied.empty())
+    {
+        std::ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+        std::string level;
+
+        paranoid >> level;
+        fReason = denied + " denied (perf_event_paranoid is " + (level.empty() ? "unknown" : level) + ")";
+    }
+    if (!missing.empty())
+    {
+        fReason += (fReason.empty() ? "" : ", ");
+        fReason += missing + " not supported";
+    }
+
+    /* Don't fail the run for counters */
+    if (!fReason.empty())
+    {
+        std::cerr << "Performance counters " << (available ? "partially " : "") << "unavailable: " << fReason << std::endl;
+    }
+
+    if (eventsPath != 0)
+    {
+        fEventsFile = fopen(eventsPath, "w");
+        if (fEventsFile == 0)
+        {
+            return false;
+        }
+
+        fprintf(fEventsFile, "id");
+        for (unsigned int phase = 0; phase < PHASE_MAX; ++phase)
+        {
+            for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+            {
+                if (fAvailable[counter])
+                {
+                    fprintf(fEventsFile, ",%s.%s", gPhaseNames[phase], gCounters[counter].fName);
+                }
+            }
+        }
+        fprintf(fEventsFile, "\n");
+    }
+
+    return true;
+}
+
+void TPerfCounters::Stop(void)
+{
+    for (size_t i = 0; i < fThreads.size(); ++i)
+    {
+        if (fThreads[i] != 0)
+        {
+            Flush(fThreads[i]);
+        }
+    }
+
+    if (fEventsFile != 0)
+    {
+        fclose(fEventsFile);
+        fEventsFile = 0;
+    }
+
+    if (!fPath.empty())
+    {
+        std::ofstream file(fPath.c_str());
+
+        Report(file);
+    }
+}
+
+TPerfThread * TPerfCounters::GetThread(void)
+{
+    static TPerfThread gLostCounters;
+    unsigned int slot = TThreadsFactory::GetCurrentSlot();
+
+    /* Threads out of the factory share the last counters */
+    if (slot >= fThreads.size() - 1)
+    {
+        slot = fThreads.size() - 1;
+    }
+
+    if (fThreads[slot] == 0)
+    {
+        /* Anonymous memory is zeroed, the counters are ready for use */
+        fThreads[slot] = reinterpret_cast<TPerfThread *>(TTopology::AllocateLocal(sizeof(TPerfThread)));
+        if (fThreads[slot] == 0)
+        {
+            /* Don't fail the run for counters, they'll just be wrong */
+            return &gLostCounters;
+        }
+    }
+
+    return fThreads[slot];
+}
+
+void TPerfCounters::Open(TPerfGroup & group)
+{
+    group.fLeader = -1;
+    group.fCount = 0;
+    group.fThread = GetThread();
+
+    /* A single group, so that the counters are scheduled (and multiplexed) together */
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        group.fFds[counter] = -1;
+        group.fIndex[counter] = -1;
+
+        if (!fAvailable[counter])
+        {
+            continue;
+        }
+
+        group.fFds[counter] = OpenCounter(static_cast<TPerfCounter>(counter), group.fLeader);
+        if (group.fFds[counter] == -1)
+        {
+            continue;
+        }
+
+        if (group.fLeader == -1)
+        {
+            group.fLeader = group.fFds[counter];
+        }
+        group.fIndex[counter] = group.fCount++;
+    }
+}
+
+void TPerfCounters::Close(TPerfGroup & group)
+{
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        if (group.fFds[counter] != -1)
+        {
+            close(group.fFds[counter]);
+            group.fFds[counter] = -1;
+        }
+    }
+
+    group.fLeader = -1;
+}
+
+bool TPerfCounters::Read(TPerfGroup & group, unsigned long long values[PERF_MAX])
+{
+    /* Amount of counters, time enabled, time running, and then the counters */
+    unsigned long long buffer[3 + PERF_MAX];
+    ssize_t size = (3 + group.fCount) * sizeof(unsigned long long);
+
+    if (read(group.fLeader, buffer, sizeof(buffer)) != size || buffer[2] == 0)
+    {
+        return false;
+    }
+
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        if (group.fIndex[counter] == -1)
+        {
+            values[counter] = 0;
+            continue;
+        }
+
+        values[counter] = buffer[3 + group.fIndex[counter]];
+        /* The group didn't always have the PMU, extrapolate */
+        if (buffer[2] < buffer[1])
+        {
+            values[counter] = static_cast<unsigned long long>(static_cast<double>(values[counter]) * buffer[1] / buffer[2]);
+        }
+    }
+
+    if (buffer[2] < buffer[1])
+    {
+        ++group.fThread->fScaled;
+    }
+
+    return true;
+}
+
+void TPerfCounters::Begin(TPerfGroup & group)
+{
+    if (group.fLeader == -1)
+    {
+        return;
+    }
+
+    memset(group.fEvent.fValues, 0, sizeof(group.fEvent.fValues));
+    if (!Read(group, group.fLast))
+    {
+        memset(group.fLast, 0, sizeof(group.fLast));
+    }
+}
+
+void TPerfCounters::Phase(TPerfGroup & group, TPhase phase)
+{
+    unsigned long long values[PERF_MAX];
+
+    if (group.fLeader == -1 || !Read(group, values))
+    {
+        return;
+    }
+
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        /* Scaling can make a counter go backward */
+        unsigned long long delta = (values[counter] > group.fLast[counter] ? values[counter] - group.fLast[counter] : 0);
+
+        group.fThread->fTotals[phase][counter] += delta;
+        group.fEvent.fValues[phase][counter] += delta;
+        group.fLast[counter] = values[counter];
+    }
+}
+
+void TPerfCounters::End(TPerfGroup & group, unsigned int count, const unsigned char * id)
+{
+    TPerfThread * thread = group.fThread;
+
+    thread->fEvents += count;
+
+    if (fEventsFile == 0 || id == 0 || group.fLeader == -1)
+    {
+        return;
+    }
+
+    memcpy(group.fEvent.fId, id, sizeof(group.fEvent.fId));
+    thread->fRecords[thread->fRecordsCount++] = group.fEvent;
+    if (thread->fRecordsCount == PERF_RECORDS)
+    {
+        Flush(thread);
+    }
+}
+
+void TPerfCounters::Flush(TPerfThread * thread)
+{
+    if (fEventsFile == 0 || thread->fRecordsCount == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&fEventsLock);
+    for (unsigned int record = 0; record < thread->fRecordsCount; ++record)
+    {
+        const TPerfRecord & event = thread->fRecords[record];
+
+        /* Same ID as in the output file, in hexadecimal */
+        for (unsigned int i = 0; i < sizeof(event.fId); ++i)
+        {
+            fprintf(fEventsFile, "%02x", event.fId[i]);
+        }
+
+        for (unsigned int phase = 0; phase < PHASE_MAX; ++phase)
+        {
+            for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+            {
+                if (fAvailable[counter])
+                {
+                    fprintf(fEventsFile, ",%llu", event.fValues[phase][counter]);
+                }
+            }
+        }
+        fprintf(fEventsFile, "\n");
+    }
+    pthread_mutex_unlock(&fEventsLock);
+
+    thread->fRecordsCount = 0;
+}
+
+static void ReportPhase(std::ostream & stream, const unsigned long long values[PERF_MAX], const bool available[PERF_MAX])
+{
+    stream << "{";
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        stream << (counter != 0 ? ", " : "") << "\"" << gCounters[counter].fName << "\": ";
+        if (available[counter])
+        {
+            stream << values[counter];
+        }
+        else
+        {
+            stream << "null";
+        }
+    }
+
+    /* Instructions per cycle, the first thing to look at */
+    if (available[PERF_CYCLES] && available[PERF_INSTRUCTIONS] && values[PERF_CYCLES] != 0)
+    {
+        stream << ", \"ipc\": " << static_cast<double>(values[PERF_INSTRUCTIONS]) / values[PERF_CYCLES];
+    }
+    stream << "}";
+}
+
+void TPerfCounters::Report(std::ostream & stream)
+{
+    unsigned long long totals[PHASE_MAX][PERF_MAX];
+    unsigned long long events = 0, scaled = 0;
+    bool available = false;
+
+    memset(totals, 0, sizeof(totals));
+    for (size_t i = 0; i < fThreads.size(); ++i)
+    {
+        if (fThreads[i] == 0)
+        {
+            continue;
+        }
+
+        events += fThreads[i]->fEvents;
+        scaled += fThreads[i]->fScaled;
+        for (unsigned int phase = 0; phase < PHASE_MAX; ++phase)
+        {
+            for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+            {
+                totals[phase][counter] += fThreads[i]->fTotals[phase][counter];
+            }
+        }
+    }
+
+    stream << "{" << std::endl;
+    stream << "  \"counters\": {";
+    for (unsigned int counter = 0; counter < PERF_MAX; ++counter)
+    {
+        stream << (counter != 0 ? ", " : "") << "\"" << gCounters[counter].fName << "\": " << (fAvailable[counter] ? "true" : "false");
+        available = available || fAvailable[counter];
+    }
+    stream << "}," << std::endl;
+    stream << "  \"available\": " << (available ? "true" : "false") << "," << std::endl;
+    if (!fReason.empty())
+    {
+        stream << "  \"reason\": \"" << fReason << "\"," << std::endl;
+    }
+    stream << "  \"events\": " << events << "," << std::endl;
+    /* Reads extrapolated because the counters were multiplexed with others */
+    stream << "  \"scaledReads\": " << scaled << "," << std::endl;
+
+    stream << "  \"phases\": {" << std::endl;
+    for (unsigned int phase = 0; phase < PHASE_MAX; ++phase)
+    {
+        stream << "    \"" << gPhaseNames[phase] << "\": ";
+        ReportPhase(stream, totals[phase], fAvailable);
+        stream << (phase + 1 < PHASE_MAX ? "," : "") << std::endl;
+    }
+    stream << "  }," << std::endl;
+
+    stream << "  \"perThread\": [";
+    for (size_t i = 0, written = 0; i < fThreads.size(); ++i)
+    {
+        TPerfThread * thread = fThreads[i];
+
+        if (thread == 0)
+        {
+            continue;
+        }
+
+        stream << (written++ != 0 ? "," : "") << std::endl << "    {\"slot\": ";
+        if (i + 1 < fThreads.size())
+        {
+            stream << i;
+        }
+        else
+        {
+            stream << "\"other\"";
+        }
+        stream << ", \"events\": " << thread->fEvents << ", \"phases\": {";
+        for (unsigned int phase = 0; phase < PHASE_MAX; ++phase)
+        {
+            stream << (phase != 0 ? ", " : "") << "\"" << gPhaseNames[phase] << "\": ";
+            ReportPhase(stream, thread->fTotals[phase], fAvailable);
+        }
+        stream << "}}";
+    }
+    stream << std::endl << "  ]" << std::endl;
+    stream << "}" << std::endl;
+}
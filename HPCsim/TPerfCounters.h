@@ -0,0 +1,235 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TPerfCounters.h
+ * PURPOSE:          Hardware performance counters per event phase
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TPERFCOUNTERS_H__
+#define __TPERFCOUNTERS_H__
+
+#include <cstdio>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "TStatistics.h"
+
+/**
+ * Amount of per event records a room keeps before writing them
+ */
+#define PERF_RECORDS 256
+
+/**
+ * Counters read around the event phases
+ */
+enum TPerfCounter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_TASK_CLOCK,
+    PERF_PAGE_FAULTS,
+    PERF_MAX
+};
+
+/**
+ * Counters of an event, by phase
+ */
+struct TPerfRecord
+{
+    /**
+     * ID of the event
+     */
+    unsigned char fId[48];
+    /**
+     * Value of each counter, for each phase
+     */
+    unsigned long long fValues[PHASE_MAX][PERF_MAX];
+};
+
+/**
+ * Counters of a room of the threads factory. They are only updated by the thread in the room.
+ */
+struct TPerfThread
+{
+    /**
+     * Amount of events completed
+     */
+    unsigned long long fEvents;
+    /**
+     * Value of each counter, for each phase
+     */
+    unsigned long long fTotals[PHASE_MAX][PERF_MAX];
+    /**
+     * Amount of reads done while the counters were multiplexed, and thus scaled
+     */
+    unsigned long long fScaled;
+    /**
+     * Per event records not written yet
+     */
+    unsigned int fRecordsCount;
+    TPerfRecord fRecords[PERF_RECORDS];
+};
+
+/**
+ * Counters opened by a thread. They only count that thread, so each thread
+ * needs its own, and has to close them before it exits.
+ */
+struct TPerfGroup
+{
+    /**
+     * Descriptor of each counter, -1 if not opened. The first one opened leads the group
+     */
+    int fFds[PERF_MAX];
+    /**
+     * Group leader, -1 if nothing could be opened
+     */
+    int fLeader;
+    /**
+     * Position of each counter in the group read, -1 if not opened
+     */
+    int fIndex[PERF_MAX];
+    /**
+     * Amount of counters opened
+     */
+    unsigned int fCount;
+    /**
+     * Values read on the previous read
+     */
+    unsigned long long fLast[PERF_MAX];
+    /**
+     * Counters of the current event
+     */
+    TPerfRecord fEvent;
+    /**
+     * Counters of the room of the thread
+     */
+    TPerfThread * fThread;
+};
+
+class TPerfCounters
+{
+public:
+    /**
+     * This function checks which counters can be used, and starts collecting them. It has to
+     * be called once the threads factory is configured and before any thread is started.
+     * If the kernel denies all the counters (see perf_event_paranoid), a warning is printed
+     * and the report only says why.
+     * @param path Path of the JSON file to write the totals to, or 0
+     * @param eventsPath Path of the CSV file to write the counters of each event to, or 0
+     * @param threads Amount of rooms in the threads factory
+     * @return true on success, false if the files cannot be written
+     */
+    bool Start(const char * path, const char * eventsPath, unsigned int threads);
+    /**
+     * This function stops collecting the counters and writes them. It has to be called
+     * once all the threads are done.
+     */
+    void Stop(void);
+    /**
+     * This function opens the counters for the calling thread.
+     * @param group Output variable, receiving the counters. If nothing can be counted, its leader is -1
+     */
+    void Open(TPerfGroup & group);
+    /**
+     * This function closes the counters of the calling thread.
+     * @param group The counters
+     */
+    void Close(TPerfGroup & group);
+    /**
+     * This function starts a new event (or a batch of events).
+     * @param group The counters of the calling thread
+     */
+    void Begin(TPerfGroup & group);
+    /**
+     * This function accounts what was counted since the previous read to a phase.
+     * @param group The counters of the calling thread
+     * @param phase The phase which just ended
+     */
+    void Phase(TPerfGroup & group, TPhase phase);
+    /**
+     * This function ends the event (or the batch of events).
+     * @param group The counters of the calling thread
+     * @param count Amount of events
+     * @param id ID of the event, to record its counters. 0 not to record it (batches)
+     */
+    void End(TPerfGroup & group, unsigned int count, const unsigned char * id);
+    /**
+     * This is the static function to have the counters. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the counters class.
+     */
+    static TPerfCounters * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor.
+     */
+    ~TPerfCounters();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TPerfCounters();
+    /**
+     * Opens a counter for the calling thread.
+     * @param counter The counter
+     * @param leader Group leader, -1 to lead a new group
+     * @return The descriptor, -1 on failure (with errno set)
+     */
+    static int OpenCounter(TPerfCounter counter, int leader);
+    /**
+     * Reads the counters of the calling thread, scaling them if they were multiplexed.
+     * @param group The counters
+     * @param values Output variable, receiving the values
+     * @return true on success, false otherwise
+     */
+    bool Read(TPerfGroup & group, unsigned long long values[PERF_MAX]);
+    /**
+     * Returns the counters of the room of the calling thread.
+     * @return The counters. It cannot fail
+     */
+    TPerfThread * GetThread(void);
+    /**
+     * Writes the per event records of a room.
+     * @param thread The room
+     */
+    void Flush(TPerfThread * thread);
+    /**
+     * Writes the totals, as JSON.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+
+    /**
+     * Path of the JSON file, empty if none
+     */
+    std::string fPath;
+    /**
+     * Per event records, 0 if not recording
+     */
+    FILE * fEventsFile;
+    /**
+     * Serializes the writes to fEventsFile
+     */
+    pthread_mutex_t fEventsLock;
+    /**
+     * Counters of each room. The extra last one is for threads out of the factory
+     */
+    std::vector<TPerfThread *> fThreads;
+    /**
+     * Whether each counter is available
+     */
+    bool fAvailable[PERF_MAX];
+    /**
+     * Why counters are missing, empty if they are all there
+     */
+    std::string fReason;
+};
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TPipeline.cpp
+ * PURPOSE:          Simulation pipelines, the results of a stage being the events of the next one
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <ctime>
+#include <cerrno>
+#ifndef HPCSIM_STATIC_SIMULATION
+#include <dlfcn.h>
+#endif
+
+#include "TPipeline.h"
+
+/* Blanks between the library and the options of a stage */
+#define BLANKS " \t\r\n"
+
+/* Substreams of a stream, and the ones reserved to each result of an event, per stage */
+#define SUBSTREAM_BITS 51
+#define STAGE_RESULT_BITS 10
+
+TPipeline::TPipeline()
+{
+    pthread_mutex_init(&fLock, 0);
+    sem_init(&fChanged, 0, 0);
+    fItems = 0;
+    fSources = 0;
+    fCapacity = 1;
+    fDiscarding = false;
+    fDropped = 0;
+    fDiscarded = 0;
+}
+
+TPipeline::~TPipeline()
+{
+    for (unsigned int stage = 0; stage < MAX_STAGES - 1; ++stage)
+    {
+        while (!fQueues[stage].empty())
+        {
+            delete fQueues[stage].front();
+            fQueues[stage].pop_front();
+        }
+    }
+
+#ifndef HPCSIM_STATIC_SIMULATION
+    for (size_t i = 0; i < fStages.size(); ++i)
+    {
+        dlclose(fStages[i].fLibrary);
+    }
+#endif
+
+    sem_destroy(&fChanged);
+    pthread_mutex_destroy(&fLock);
+}
+
+TPipeline * TPipeline::GetInstance(bool destroyInstance)
+{
+    static TPipeline * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TPipeline();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+/* Stages are shared libraries: they can't follow statically linked simulations */
+#ifndef HPCSIM_STATIC_SIMULATION
+bool TPipeline::Load(const char * spec)
+{
+    TPipelineStage stage;
+    std::string text(spec);
+    size_t start;
+    size_t end;
+
+    if (fStages.size() == MAX_STAGES - 1)
+    {
+        fprintf(stderr, "Too many stages, at most %u can follow the simulation\n", MAX_STAGES - 1);
+        return false;
+    }
+
+    start = text.find_first_not_of(BLANKS);
+    if (start == std::string::npos)
+    {
+        fprintf(stderr, "Stage %u has no library\n", static_cast<unsigned int>(fStages.size() + 1));
+        return false;
+    }
+
+    end = text.find_first_of(BLANKS, start);
+    stage.fPath = text.substr(start, end - start);
+    start = text.find_first_not_of(BLANKS, end);
+    if (start != std::string::npos)
+    {
+        stage.fOptions = text.substr(start, text.find_last_not_of(BLANKS) + 1 - start);
+    }
+
+    stage.fLibrary = dlopen(stage.fPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (stage.fLibrary == 0)
+    {
+        fprintf(stderr, "Failed loading stage %s, with error %s\n", stage.fPath.c_str(), dlerror());
+        return false;
+    }
+
+    stage.fSimulationInit = reinterpret_cast<TSimulationInit *>(dlsym(stage.fLibrary, "SimulationInit"));
+    stage.fRunInit = reinterpret_cast<TRunInit *>(dlsym(stage.fLibrary, "RunInit"));
+    stage.fEventInit = reinterpret_cast<TEventInit *>(dlsym(stage.fLibrary, "EventInit"));
+    stage.fEventRun = reinterpret_cast<TEventRun *>(dlsym(stage.fLibrary, "EventRun"));
+    stage.fEventClear = reinterpret_cast<TEventClear *>(dlsym(stage.fLibrary, "EventClear"));
+    stage.fReduceResult = reinterpret_cast<TReduceResult *>(dlsym(stage.fLibrary, "ReduceResult"));
+    stage.fRunClear = reinterpret_cast<TRunClear *>(dlsym(stage.fLibrary, "RunClear"));
+    stage.fSimulationUnload = reinterpret_cast<TSimulationUnload *>(dlsym(stage.fLibrary, "SimulationUnload"));
+
+    /* Each result is an event of its own, they cannot be batched */
+    if (stage.fEventRun == 0)
+    {
+        fprintf(stderr, "No EventRun() entry point present in stage %s\n", stage.fPath.c_str());
+        dlclose(stage.fLibrary);
+        return false;
+    }
+
+    stage.fContext = 0;
+    stage.fInitialized = false;
+    stage.fRunning = false;
+    stage.fEvents = 0;
+    stage.fFailed = 0;
+    fStages.push_back(stage);
+
+    return true;
+}
+#endif
+
+void TPipeline::SetCapacity(unsigned int capacity)
+{
+    fCapacity = ((capacity != 0) ? capacity : 1);
+}
+
+void TPipeline::Push(TStageEvent * parent, const TResult * result)
+{
+    TStageItem * item = new TStageItem;
+
+    item->fEvent.fStage = parent->fStage + 1;
+    item->fEvent.fContext = GetStage(item->fEvent.fStage).fContext;
+    item->fEvent.fInput = &item->fInput;
+    item->fEvent.fPassed = 0;
+    item->fEvent.fHeld = 0;
+    memcpy(&item->fInput, result, offsetof(TResult, fResult) + result->fResultLength);
+
+    /* The index of a result of a subtask would depend on the ones its siblings queued so far */
+    if (parent->fHeld != 0)
+    {
+        parent->fHeld->push_back(item);
+        return;
+    }
+
+    Queue(parent, item);
+}
+
+void TPipeline::Release(TStageEvent * parent, std::vector<TStageItem *> & held)
+{
+    for (size_t i = 0; i < held.size(); ++i)
+    {
+        Queue(parent, held[i]);
+    }
+    held.clear();
+}
+
+void TPipeline::Queue(TStageEvent * parent, TStageItem * item)
+{
+    unsigned int index = parent->fPassed++;
+
+    /* Its substream would be the one of a sibling */
+    if (index >= MAX_STAGE_RESULTS)
+    {
+        __sync_fetch_and_add(&fDropped, 1);
+        delete item;
+        return;
+    }
+
+    item->fEvent.fSubstream = parent->fSubstream + (static_cast<unsigned long>(index + 1) << (SUBSTREAM_BITS - STAGE_RESULT_BITS * item->fEvent.fStage));
+
+    pthread_mutex_lock(&fLock);
+    if (fDiscarding)
+    {
+        ++fDiscarded;
+        pthread_mutex_unlock(&fLock);
+        delete item;
+        return;
+    }
+    fQueues[item->fEvent.fStage - 1].push_back(item);
+    ++fItems;
+    pthread_mutex_unlock(&fLock);
+
+    sem_post(&fChanged);
+}
+
+TStageItem * TPipeline::Pop(void)
+{
+    TStageItem * item = 0;
+
+    pthread_mutex_lock(&fLock);
+    for (unsigned int stage = fStages.size(); stage != 0; --stage)
+    {
+        if (!fQueues[stage - 1].empty())
+        {
+            item = fQueues[stage - 1].front();
+            fQueues[stage - 1].pop_front();
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fLock);
+
+    return item;
+}
+
+void TPipeline::Started(void)
+{
+    pthread_mutex_lock(&fLock);
+    ++fSources;
+    pthread_mutex_unlock(&fLock);
+}
+
+void TPipeline::Ended(TStageItem * item)
+{
+    pthread_mutex_lock(&fLock);
+    if (item != 0)
+    {
+        --fItems;
+    }
+    else
+    {
+        --fSources;
+    }
+    pthread_mutex_unlock(&fLock);
+
+    delete item;
+    sem_post(&fChanged);
+}
+
+bool TPipeline::IsBehind(void)
+{
+    bool behind;
+
+    pthread_mutex_lock(&fLock);
+    behind = (fItems >= fCapacity);
+    pthread_mutex_unlock(&fLock);
+
+    return behind;
+}
+
+bool TPipeline::IsIdle(void)
+{
+    bool idle;
+
+    pthread_mutex_lock(&fLock);
+    idle = (fItems == 0 && fSources == 0);
+    pthread_mutex_unlock(&fLock);
+
+    return idle;
+}
+
+void TPipeline::Wait(unsigned int timeout)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (sem_timedwait(&fChanged, &deadline) == -1 && errno == EINTR);
+}
+
+void TPipeline::Discard(void)
+{
+    pthread_mutex_lock(&fLock);
+    fDiscarding = true;
+    for (unsigned int stage = 0; stage < fStages.size(); ++stage)
+    {
+        while (!fQueues[stage].empty())
+        {
+            delete fQueues[stage].front();
+            fQueues[stage].pop_front();
+            --fItems;
+            ++fDiscarded;
+        }
+    }
+    pthread_mutex_unlock(&fLock);
+}
+
+void TPipeline::Report(std::ostream & stream)
+{
+    for (size_t i = 0; i < fStages.size(); ++i)
+    {
+        stream << "Stage " << (i + 1) << " (" << fStages[i].fPath << "): " << fStages[i].fEvents << " events";
+        if (fStages[i].fFailed != 0)
+        {
+            stream << ", " << fStages[i].fFailed << " failed";
+        }
+        stream << std::endl;
+    }
+
+    if (fDropped != 0)
+    {
+        stream << fDropped << " results were dropped: an event can only hand " << MAX_STAGE_RESULTS << " results to the next stage" << std::endl;
+    }
+    if (fDiscarded != 0)
+    {
+        stream << fDiscarded << " results were discarded by the stop, before the next stage ran them" << std::endl;
+    }
+}
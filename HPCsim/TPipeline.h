@@ -0,0 +1,267 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TPipeline.h
+ * PURPOSE:          Simulation pipelines, the results of a stage being the events of the next one
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TPIPELINE_H__
+#define __TPIPELINE_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <ostream>
+#include <pthread.h>
+#include <semaphore.h>
+#include "simulation.h"
+
+/**
+ * Maximum amount of stages, the simulation included
+ */
+#define MAX_STAGES 5
+
+/**
+ * Maximum amount of results an event of a stage can hand to the next one
+ */
+#define MAX_STAGE_RESULTS 1023
+
+/**
+ * A simulation library run on the results of the previous stage
+ */
+struct TPipelineStage
+{
+    std::string fPath;
+    /**
+     * Options given to SimulationInit(), empty for none
+     */
+    std::string fOptions;
+    void * fLibrary;
+    TSimulationInit * fSimulationInit;
+    TRunInit * fRunInit;
+    TEventInit * fEventInit;
+    TEventRun * fEventRun;
+    TEventClear * fEventClear;
+    TReduceResult * fReduceResult;
+    TRunClear * fRunClear;
+    TSimulationUnload * fSimulationUnload;
+    /**
+     * Context allocated by its SimulationInit()
+     */
+    void * fContext;
+    /**
+     * Whether its SimulationInit() went through, it has to be unloaded then
+     */
+    bool fInitialized;
+    /**
+     * Whether its RunInit() went through, its run has to be cleared then
+     */
+    bool fRunning;
+    /**
+     * Events run, and the ones which failed
+     */
+    volatile unsigned long fEvents;
+    volatile unsigned long fFailed;
+};
+
+struct TStageItem;
+
+/**
+ * The event running in the current thread, at any stage of the pipeline
+ */
+struct TStageEvent
+{
+    /**
+     * Stage of the event, 0 for the events of the simulation
+     */
+    unsigned int fStage;
+    /**
+     * Substream of the stream of the event its numbers are drawn from, 0 in the simulation
+     */
+    unsigned long fSubstream;
+    /**
+     * Context of its stage
+     */
+    void * fContext;
+    /**
+     * Result of the previous stage the event is run on, 0 in the simulation
+     */
+    const TResult * fInput;
+    /**
+     * Results handed to the next stage so far, only counted by the thread of the event
+     */
+    unsigned int fPassed;
+    /**
+     * Results a subtask of the event handed to the next stage, held till the subtasks are waited for. 0 for the event itself
+     */
+    std::vector<TStageItem *> * fHeld;
+};
+
+/**
+ * A result waiting to be run by the next stage
+ */
+struct TStageItem
+{
+    TStageEvent fEvent;
+    TResult fInput;
+};
+
+class TPipeline
+{
+public:
+#ifndef HPCSIM_STATIC_SIMULATION
+    /**
+     * This function loads a stage, appended after the ones loaded already.
+     * @param spec Path of the shared library of the stage, then, after blanks, its options
+     * @return true on success, false otherwise
+     */
+    bool Load(const char * spec);
+#endif
+    /**
+     * This function returns the amount of stages, the simulation included.
+     * @return Amount of stages
+     */
+    inline unsigned int GetSize(void) const
+    {
+        return fStages.size() + 1;
+    }
+    /**
+     * This function returns a stage following the simulation.
+     * @param stage Index of the stage, from 1
+     * @return The stage
+     */
+    inline TPipelineStage & GetStage(unsigned int stage)
+    {
+        return fStages[stage - 1];
+    }
+    /**
+     * This function tells whether a stage is the last one, whose results are written.
+     * @param stage Index of the stage, 0 for the simulation
+     * @return true if it's the last one, false otherwise
+     */
+    inline bool IsLast(unsigned int stage) const
+    {
+        return stage == fStages.size();
+    }
+    /**
+     * This function sets how many results (queued, or being run by the stages) there can be
+     * before no new event of the simulation is started.
+     * @param capacity Amount of results
+     */
+    void SetCapacity(unsigned int capacity);
+    /**
+     * This function queues a result for the next stage. It never blocks.
+     * The k-th result of an event is run on the k-th substream reserved to it, so that
+     * the numbers don't depend on the thread running it. The result of a subtask is held
+     * by it instead, see Release().
+     * @param parent The event which queued it
+     * @param result The result, with its ID set already
+     */
+    void Push(TStageEvent * parent, const TResult * result);
+    /**
+     * This function queues the results a subtask held, once it's done. The event releases its
+     * subtasks in spawn order, so that their results get the same substreams whatever the
+     * threads which ran them.
+     * @param parent The event which spawned the subtask
+     * @param held The results of the subtask, emptied
+     */
+    void Release(TStageEvent * parent, std::vector<TStageItem *> & held);
+    /**
+     * This function takes the next result to run, from the last stages first so that
+     * they drain the pipeline. It has to be freed with Ended() once run.
+     * @return The result, 0 if none is queued
+     */
+    TStageItem * Pop(void);
+    /**
+     * This function accounts an event of the simulation about to be started.
+     */
+    void Started(void);
+    /**
+     * This function accounts the end of an event, with its item if it was run by a stage.
+     * @param item The item of the event, 0 for an event of the simulation
+     */
+    void Ended(TStageItem * item);
+    /**
+     * This function tells whether the stages are behind: no new event of the simulation
+     * should be started then.
+     * @return true if they're behind, false otherwise
+     */
+    bool IsBehind(void);
+    /**
+     * This function tells whether all the events of the pipeline are done.
+     * @return true if they're done, false otherwise
+     */
+    bool IsIdle(void);
+    /**
+     * This function waits for a result queued or an event ended.
+     * @param timeout Maximum time to wait, in ms
+     */
+    void Wait(unsigned int timeout);
+    /**
+     * This function drops the results queued, and the ones queued from now on, as the run is stopping.
+     */
+    void Discard(void);
+    /**
+     * This function tells whether no result was discarded by a stop.
+     * @return true if none was, false otherwise
+     */
+    inline bool IsComplete(void) const
+    {
+        return fDiscarded == 0;
+    }
+    /**
+     * This function writes the events run by each stage, and the results dropped, to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This is the static function to have the pipeline. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the pipeline class.
+     */
+    static TPipeline * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It frees the results left and unloads the libraries of the stages.
+     */
+    ~TPipeline();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TPipeline();
+    /**
+     * Queues a result as the next one of its event, dropping it past MAX_STAGE_RESULTS.
+     * @param parent The event which queued it
+     * @param item The result, its substream is set from its index
+     */
+    void Queue(TStageEvent * parent, TStageItem * item);
+
+    std::vector<TPipelineStage> fStages;
+    /**
+     * Results waiting for each stage following the simulation
+     */
+    std::deque<TStageItem *> fQueues[MAX_STAGES - 1];
+    pthread_mutex_t fLock;
+    /**
+     * Posted when a result is queued or an event ends
+     */
+    sem_t fChanged;
+    /**
+     * Results queued or being run, and events of the simulation running
+     */
+    unsigned long fItems;
+    unsigned long fSources;
+    unsigned int fCapacity;
+    bool fDiscarding;
+    /**
+     * Results over MAX_STAGE_RESULTS of an event, and results discarded by a stop
+     */
+    unsigned long fDropped;
+    unsigned long fDiscarded;
+};
+
+#endif
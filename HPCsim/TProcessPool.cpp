@@ -0,0 +1,318 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TProcessPool.cpp
+ * PURPOSE:          Worker processes, forked once the simulation is initialized
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <csignal>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "TProcessPool.h"
+#include "TThreadsFactory.h"
+#include "TStatistics.h"
+#include "RngStream.h"
+
+/* Size of the header of a result: ID and length */
+#define RECORD_HEADER_SIZE (offsetof(TResult, fResult))
+
+/* Results are kept aligned in the rings */
+#define RECORD_SIZE(length) ((RECORD_HEADER_SIZE + (length) + 7) & ~static_cast<uint64_t>(7))
+
+/* How often the workers are checked for exit, in ms */
+#define REAP_SLICE 10
+
+static void CopyToRing(TProcessRing * ring, uint64_t position, const void * data, size_t size)
+{
+    size_t offset = position % PROCESS_RING_SIZE;
+    size_t first = ((size < PROCESS_RING_SIZE - offset) ? size : PROCESS_RING_SIZE - offset);
+
+    memcpy(ring->fData + offset, data, first);
+    memcpy(ring->fData, reinterpret_cast<const uint8_t *>(data) + first, size - first);
+}
+
+static void CopyFromRing(const TProcessRing * ring, uint64_t position, void * data, size_t size)
+{
+    size_t offset = position % PROCESS_RING_SIZE;
+    size_t first = ((size < PROCESS_RING_SIZE - offset) ? size : PROCESS_RING_SIZE - offset);
+
+    memcpy(data, ring->fData + offset, first);
+    memcpy(reinterpret_cast<uint8_t *>(data) + first, ring->fData, size - first);
+}
+
+TProcessPool::TProcessPool()
+{
+    fShared = 0;
+    fRings = 0;
+    fSize = 0;
+    fEvents = 0;
+    fWorker = -1;
+    fPosition = 0;
+    fNextRing = 0;
+}
+
+TProcessPool::~TProcessPool()
+{
+    if (fShared != 0)
+    {
+        sem_destroy(&fShared->fAvailable);
+        FreeShared(fShared, fSize);
+    }
+}
+
+TProcessPool * TProcessPool::GetInstance(bool destroyInstance)
+{
+    static TProcessPool * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TProcessPool();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+void * TProcessPool::AllocateShared(size_t size)
+{
+    void * memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    return ((memory == MAP_FAILED) ? 0 : memory);
+}
+
+void TProcessPool::FreeShared(void * memory, size_t size)
+{
+    munmap(memory, size);
+}
+
+std::string TProcessPool::GetHistogramsFile(const char * outputFile, unsigned int worker)
+{
+    char suffix[32];
+
+    snprintf(suffix, sizeof(suffix), ".process%u.hist", worker);
+    return std::string(outputFile) + suffix;
+}
+
+bool TProcessPool::Create(unsigned int processes, unsigned long events)
+{
+    /* Rings start on their own page, after the shared state */
+    size_t header = (sizeof(TProcessShared) + 4095) & ~static_cast<size_t>(4095);
+
+    fSize = header + processes * sizeof(TProcessRing);
+    fShared = reinterpret_cast<TProcessShared *>(AllocateShared(fSize));
+    if (fShared == 0)
+    {
+        return false;
+    }
+
+    if (sem_init(&fShared->fAvailable, 1, 0) == -1)
+    {
+        FreeShared(fShared, fSize);
+        fShared = 0;
+        return false;
+    }
+
+    fRings = reinterpret_cast<TProcessRing *>(reinterpret_cast<uint8_t *>(fShared) + header);
+    fEvents = events;
+    fWorkers.assign(processes, 0);
+
+    return true;
+}
+
+bool TProcessPool::Fork(void)
+{
+    bool started = false;
+
+    for (unsigned int worker = 0; worker < fWorkers.size(); ++worker)
+    {
+        pid_t pid = fork();
+
+        if (pid == 0)
+        {
+            /* Signals of the terminal are for the parent, which forwards them once */
+            setpgid(0, 0);
+            fWorker = worker;
+            return true;
+        }
+
+        if (pid == -1)
+        {
+            fprintf(stderr, "Failed forking worker process %u, the others run its events\n", worker);
+            continue;
+        }
+
+        fWorkers[worker] = pid;
+        started = true;
+    }
+
+    return started;
+}
+
+bool TProcessPool::Reserve(unsigned int max, unsigned long & first, unsigned int & count)
+{
+    first = __sync_fetch_and_add(&fShared->fNext, max);
+    if (first >= fEvents)
+    {
+        return false;
+    }
+
+    count = ((fEvents - first < max) ? fEvents - first : max);
+
+    /* Skip the streams of the events run by the other workers */
+    RngStream::AdvanceStream(first - fPosition);
+    fPosition = first + count;
+
+    return true;
+}
+
+void TProcessPool::Push(const TResult * result)
+{
+    TProcessRing * ring = &fRings[fWorker];
+    uint64_t head = ring->fHead;
+    uint64_t size = RECORD_SIZE(result->fResultLength);
+
+    /* The writer is late, let it catch up */
+    while (PROCESS_RING_SIZE - (head - ring->fTail) < size)
+    {
+        sched_yield();
+    }
+
+    CopyToRing(ring, head, result, RECORD_HEADER_SIZE + result->fResultLength);
+
+    /* The writer only sees complete results */
+    __sync_synchronize();
+    ring->fHead = head + size;
+    sem_post(&fShared->fAvailable);
+}
+
+bool TProcessPool::Pop(TResult * result)
+{
+    while (true)
+    {
+        /* Once ended, only what's left is read: a killed worker may not have told about its last result */
+        if (!fShared->fEnded)
+        {
+            TThreadsFactory::Wait(&fShared->fAvailable);
+        }
+
+        for (unsigned int i = 0; i < fWorkers.size(); ++i)
+        {
+            unsigned int index = (fNextRing + i) % fWorkers.size();
+            TProcessRing * ring = &fRings[index];
+            uint64_t tail = ring->fTail;
+
+            if (ring->fHead == tail)
+            {
+                continue;
+            }
+
+            __sync_synchronize();
+            CopyFromRing(ring, tail, result, RECORD_HEADER_SIZE);
+            CopyFromRing(ring, tail + RECORD_HEADER_SIZE, result->fResult, result->fResultLength);
+
+            /* The worker can reuse the room once the result is copied */
+            __sync_synchronize();
+            ring->fTail = tail + RECORD_SIZE(result->fResultLength);
+            fNextRing = index + 1;
+
+            return true;
+        }
+
+        if (fShared->fEnded)
+        {
+            return false;
+        }
+    }
+}
+
+void TProcessPool::End(void)
+{
+    if (fShared->fEnded)
+    {
+        return;
+    }
+
+    fShared->fEnded = 1;
+    sem_post(&fShared->fAvailable);
+}
+
+bool TProcessPool::WaitForWorkers(unsigned int timeout)
+{
+    unsigned long long deadline = TStatistics::Now() + timeout * 1000000ULL;
+
+    while (true)
+    {
+        bool running = false;
+
+        for (unsigned int worker = 0; worker < fWorkers.size(); ++worker)
+        {
+            pid_t pid;
+            int status;
+
+            if (fWorkers[worker] == 0)
+            {
+                continue;
+            }
+
+            pid = waitpid(fWorkers[worker], &status, WNOHANG);
+            if (pid == 0)
+            {
+                running = true;
+                continue;
+            }
+
+            /* Its events in flight are missing, as when a run is abandoned */
+            if (pid > 0 && WIFSIGNALED(status))
+            {
+                fprintf(stderr, "Worker process %u was killed by signal %d\n", worker, WTERMSIG(status));
+            }
+            else if (pid > 0 && WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "Worker process %u exited with status %d\n", worker, WEXITSTATUS(status));
+            }
+            fWorkers[worker] = 0;
+        }
+
+        if (!running)
+        {
+            return true;
+        }
+
+        if (TStatistics::Now() >= deadline)
+        {
+            return false;
+        }
+
+        usleep(REAP_SLICE * 1000);
+    }
+}
+
+void TProcessPool::Signal(int signal)
+{
+    for (unsigned int worker = 0; worker < fWorkers.size(); ++worker)
+    {
+        if (fWorkers[worker] != 0)
+        {
+            kill(fWorkers[worker], signal);
+        }
+    }
+}
+
+unsigned long TProcessPool::GetDispatched(void)
+{
+    /* Workers ask for more than what's left at the end */
+    return ((fShared->fNext < fEvents) ? fShared->fNext : fEvents);
+}
@@ -0,0 +1,189 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TProcessPool.h
+ * PURPOSE:          Worker processes, forked once the simulation is initialized
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TPROCESSPOOL_H__
+#define __TPROCESSPOOL_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include "simulation.h"
+
+/**
+ * Size of the ring of results of each worker, in bytes
+ */
+#define PROCESS_RING_SIZE (4 * 1024 * 1024)
+
+/**
+ * State shared by the parent and its workers
+ */
+struct TProcessShared
+{
+    /**
+     * Next event to hand out, from the first one of the run
+     */
+    volatile unsigned long fNext;
+    /**
+     * Set by the parent once all the workers are gone
+     */
+    volatile int fEnded;
+    /**
+     * Results in the rings, for the writer
+     */
+    sem_t fAvailable;
+};
+
+/**
+ * Results of a worker, on their way to the writer of the parent. The worker only moves
+ * the head, the writer only moves the tail: they're on their own cache lines
+ */
+struct TProcessRing
+{
+    volatile uint64_t fHead;
+    char fPadding1[64 - sizeof(uint64_t)];
+    volatile uint64_t fTail;
+    char fPadding2[64 - sizeof(uint64_t)];
+    uint8_t fData[PROCESS_RING_SIZE];
+};
+
+class TProcessPool
+{
+public:
+    /**
+     * This function allocates the memory shared with the workers.
+     * @param processes Amount of workers
+     * @param events Amount of events of the run
+     * @return true on success, false otherwise
+     */
+    bool Create(unsigned int processes, unsigned long events);
+    /**
+     * This function forks the workers. They share everything initialized so far, copy-on-write,
+     * and return from it as workers (see IsWorker()).
+     * @return true if at least a worker was started, false otherwise
+     */
+    bool Fork(void);
+    /**
+     * This function tells whether the calling process is a worker.
+     * @return true in a worker, false in the parent
+     */
+    inline bool IsWorker(void) const
+    {
+        return fWorker >= 0;
+    }
+    /**
+     * This function returns the index of the calling worker.
+     * @return The index, from 0
+     */
+    inline unsigned int GetWorker(void) const
+    {
+        return static_cast<unsigned int>(fWorker);
+    }
+    /**
+     * This function hands the next events to the calling worker, and makes the stream of the
+     * first one the next one. It has to be called with the init lock held.
+     * @param max Maximum amount of events
+     * @param first Output variable, receiving the first event, from the first one of the run
+     * @param count Output variable, receiving the amount of consecutive events, up to max
+     * @return false once there are no events left
+     */
+    bool Reserve(unsigned int max, unsigned long & first, unsigned int & count);
+    /**
+     * This function queues a result of the calling worker to the writer of the parent.
+     * It waits while the ring is full.
+     * @param result The result
+     */
+    void Push(const TResult * result);
+    /**
+     * This function gets the next result queued by any worker, waiting for one.
+     * @param result Output variable, receiving the result
+     * @return false once End() was called and all the results were read
+     */
+    bool Pop(TResult * result);
+    /**
+     * This function tells the writer there won't be any other result.
+     */
+    void End(void);
+    /**
+     * This function waits for the workers to exit, and reports the ones that didn't exit cleanly.
+     * @param timeout Maximum time to wait, in ms
+     * @return true once all of them exited, false on timeout
+     */
+    bool WaitForWorkers(unsigned int timeout);
+    /**
+     * This function sends a signal to all the workers still running.
+     * @param signal The signal
+     */
+    void Signal(int signal);
+    /**
+     * This function returns the amount of events handed to the workers.
+     * @return Amount of events
+     */
+    unsigned long GetDispatched(void);
+    /**
+     * This function returns where a worker dumps its histograms, for its parent to merge them.
+     * @param outputFile Output of the run
+     * @param worker Index of the worker
+     * @return Path of the dump
+     */
+    static std::string GetHistogramsFile(const char * outputFile, unsigned int worker);
+    /**
+     * This function allocates memory shared with the workers forked later on. It's zeroed.
+     * @param size Size to allocate
+     * @return The memory, 0 on failure
+     */
+    static void * AllocateShared(size_t size);
+    /**
+     * This function releases memory allocated with AllocateShared().
+     * @param memory The memory
+     * @param size Its size
+     */
+    static void FreeShared(void * memory, size_t size);
+    /**
+     * This is the static function to have the pool. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the pool class.
+     */
+    static TProcessPool * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It releases the shared memory.
+     */
+    ~TProcessPool();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TProcessPool();
+
+    TProcessShared * fShared;
+    TProcessRing * fRings;
+    size_t fSize;
+    unsigned long fEvents;
+    /**
+     * Process IDs of the workers, 0 once exited
+     */
+    std::vector<pid_t> fWorkers;
+    /**
+     * Index of the calling worker, -1 in the parent
+     */
+    int fWorker;
+    /**
+     * Next stream of the worker, from the first event of the run
+     */
+    unsigned long fPosition;
+    /**
+     * Ring the writer looks at first, so that none is starved
+     */
+    unsigned int fNextRing;
+};
+
+#endif
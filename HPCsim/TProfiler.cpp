@@ -0,0 +1,383 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TProfiler.cpp
+ * PURPOSE:          Sampling profiler
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <map>
+#include <set>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <sys/syscall.h>
+
+#include "TProfiler.h"
+#include "TTopology.h"
+#include "simulation.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/* Frames of the signal handler itself, and of the signal trampoline */
+#define PROFILE_SKIP 2
+
+TProfiler * TProfiler::fActive = 0;
+/* Samples of the room of the thread, 0 when it isn't sampled */
+static __thread TProfileRoom * volatile tRoom = 0;
+static __thread timer_t tTimer;
+/* CPU time of the thread at its previous sample */
+static __thread unsigned long long tLastSample;
+
+static unsigned long long GetThreadTime(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+TProfiler::TProfiler()
+{
+    fPeriod = 0;
+}
+
+TProfiler::~TProfiler()
+{
+    if (fActive == this)
+    {
+        Stop();
+    }
+
+    for (size_t i = 0; i < fRooms.size(); ++i)
+    {
+        if (fRooms[i] != 0)
+        {
+            TTopology::FreeLocal(fRooms[i], sizeof(TProfileRoom));
+        }
+    }
+}
+
+TProfiler * TProfiler::GetInstance(bool destroyInstance)
+{
+    static TProfiler * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TProfiler();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TProfiler::Start(unsigned int hz, unsigned int threads)
+{
+    struct sigaction sigHandling;
+    void * frames[PROFILE_DEPTH];
+
+    if (hz == 0 || hz > 1000000)
+    {
+        return false;
+    }
+
+    /* The first backtrace() loads libgcc, which cannot be done in a signal handler */
+    backtrace(frames, PROFILE_DEPTH);
+
+    memset(&sigHandling, 0, sizeof(struct sigaction));
+    sigHandling.sa_handler = Sample;
+    sigemptyset(&sigHandling.sa_mask);
+    sigHandling.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &sigHandling, NULL) == -1)
+    {
+        return false;
+    }
+
+    fRooms.resize(threads + 1, 0);
+    fPeriod = 1000000000ULL / hz;
+    fActive = this;
+
+    return true;
+}
+
+void TProfiler::Stop(void)
+{
+    struct sigaction sigHandling;
+
+    fActive = 0;
+
+    /* A late sample could still be pending */
+    memset(&sigHandling, 0, sizeof(struct sigaction));
+    sigHandling.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &sigHandling, NULL);
+}
+
+void TProfiler::Arm(unsigned int room)
+{
+    struct sigevent event;
+    struct itimerspec period;
+    unsigned long long first;
+
+    if (room >= fRooms.size())
+    {
+        room = fRooms.size() - 1;
+    }
+
+    /* Allocated from the thread, so that it's local to it */
+    if (fRooms[room] == 0)
+    {
+        fRooms[room] = reinterpret_cast<TProfileRoom *>(TTopology::AllocateLocal(sizeof(TProfileRoom)));
+        if (fRooms[room] == 0)
+        {
+            return;
+        }
+    }
+
+    /* Only this thread, on its own CPU time */
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &tTimer) == -1)
+    {
+        return;
+    }
+
+    /* Carry on the period of the previous thread in the room: events shorter
+     * than the period would never be sampled otherwise
+     */
+    first = (fRooms[room]->fPending < fPeriod ? fPeriod - fRooms[room]->fPending : 1);
+    period.it_value.tv_sec = first / 1000000000ULL;
+    period.it_value.tv_nsec = first % 1000000000ULL;
+    period.it_interval.tv_sec = fPeriod / 1000000000ULL;
+    period.it_interval.tv_nsec = fPeriod % 1000000000ULL;
+
+    tLastSample = GetThreadTime();
+    tRoom = fRooms[room];
+    if (timer_settime(tTimer, 0, &period, 0) == -1)
+    {
+        tRoom = 0;
+        timer_delete(tTimer);
+    }
+}
+
+void TProfiler::Disarm(void)
+{
+    TProfileRoom * room = tRoom;
+
+    if (room == 0)
+    {
+        return;
+    }
+
+    timer_delete(tTimer);
+    tRoom = 0;
+    room->fPending += GetThreadTime() - tLastSample;
+}
+
+void TProfiler::Sample(int signal)
+{
+    TProfileRoom * room = tRoom;
+    void * frames[PROFILE_DEPTH + PROFILE_SKIP];
+    unsigned long long hash = 14695981039346656037ULL;
+    unsigned long long now, elapsed;
+    unsigned int depth, index, weight;
+    int savedErrno = errno;
+
+    UNUSED_PARAMETER(signal);
+
+    if (room == 0 || fActive == 0)
+    {
+        return;
+    }
+
+    depth = backtrace(frames, PROFILE_DEPTH + PROFILE_SKIP);
+    depth = (depth > PROFILE_SKIP ? depth - PROFILE_SKIP : 0);
+    for (unsigned int frame = 0; frame < depth; ++frame)
+    {
+        hash = (hash ^ reinterpret_cast<uintptr_t>(frames[PROFILE_SKIP + frame])) * 1099511628211ULL;
+    }
+
+    /* CPU timers only expire on scheduler ticks, so weight the sample with
+     * the CPU time since the previous one (in this room), in periods
+     */
+    now = GetThreadTime();
+    elapsed = now - tLastSample + room->fPending;
+    tLastSample = now;
+    room->fPending = 0;
+    weight = (elapsed + fActive->fPeriod / 2) / fActive->fPeriod;
+    if (weight == 0)
+    {
+        weight = 1;
+    }
+    room->fSamples += weight;
+
+    /* Same stacks are counted together, so that memory doesn't depend on the run length */
+    index = hash & (PROFILE_STACKS - 1);
+    for (unsigned int probe = 0; probe < PROFILE_STACKS; ++probe, index = (index + 1) & (PROFILE_STACKS - 1))
+    {
+        TProfileStack & stack = room->fStacks[index];
+
+        if (stack.fCount == 0)
+        {
+            stack.fHash = hash;
+            stack.fDepth = depth;
+            memcpy(stack.fFrames, &frames[PROFILE_SKIP], depth * sizeof(void *));
+            stack.fCount = weight;
+            errno = savedErrno;
+            return;
+        }
+
+        if (stack.fHash == hash && stack.fDepth == depth && memcmp(stack.fFrames, &frames[PROFILE_SKIP], depth * sizeof(void *)) == 0)
+        {
+            stack.fCount += weight;
+            errno = savedErrno;
+            return;
+        }
+    }
+
+    room->fDropped += weight;
+    errno = savedErrno;
+}
+
+static std::string Symbolize(void * address, std::map<void *, std::string> & cache)
+{
+    std::map<void *, std::string>::iterator known = cache.find(address);
+    Dl_info info;
+    std::string name;
+    const char * module;
+    char buffer[64];
+
+    if (known != cache.end())
+    {
+        return known->second;
+    }
+
+    if (dladdr(address, &info) == 0)
+    {
+        snprintf(buffer, sizeof(buffer), "%p", address);
+        name = buffer;
+    }
+    else
+    {
+        module = (info.dli_fname != 0 ? strrchr(info.dli_fname, '/') : 0);
+        module = (module != 0 ? module + 1 : info.dli_fname);
+
+        if (info.dli_sname != 0)
+        {
+            int status;
+            char * demangled = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+
+            name = (status == 0 ? demangled : info.dli_sname);
+            free(demangled);
+        }
+        else
+        {
+            /* Not exported (static), only the offset in the module can be given */
+            snprintf(buffer, sizeof(buffer), "+0x%lx", static_cast<unsigned long>(reinterpret_cast<uintptr_t>(address) - reinterpret_cast<uintptr_t>(info.dli_fbase)));
+            name = buffer;
+        }
+
+        name += " (";
+        name += (module != 0 ? module : "?");
+        name += ")";
+    }
+
+    cache[address] = name;
+    return name;
+}
+
+static bool BySamples(const std::pair<std::string, unsigned long long> & left, const std::pair<std::string, unsigned long long> & right)
+{
+    return left.second > right.second || (left.second == right.second && left.first < right.first);
+}
+
+static void ReportProfile(std::ostream & stream, const char * title, std::map<std::string, unsigned long long> & functions, unsigned long long samples)
+{
+    std::vector<std::pair<std::string, unsigned long long> > sorted(functions.begin(), functions.end());
+    char line[32];
+
+    std::sort(sorted.begin(), sorted.end(), BySamples);
+
+    stream << title << std::endl;
+    for (size_t i = 0; i < sorted.size() && i < PROFILE_REPORT; ++i)
+    {
+        snprintf(line, sizeof(line), "%7.2f%% %10llu  ", 100.0 * sorted[i].second / samples, sorted[i].second);
+        stream << line << sorted[i].first << std::endl;
+    }
+}
+
+void TProfiler::Report(std::ostream & stream)
+{
+    std::map<void *, std::string> symbols;
+    std::map<std::string, unsigned long long> flat, cumulative;
+    unsigned long long samples = 0, dropped = 0;
+
+    for (size_t i = 0; i < fRooms.size(); ++i)
+    {
+        TProfileRoom * room = fRooms[i];
+
+        if (room == 0)
+        {
+            continue;
+        }
+
+        samples += room->fSamples;
+        dropped += room->fDropped;
+
+        for (unsigned int index = 0; index < PROFILE_STACKS; ++index)
+        {
+            const TProfileStack & stack = room->fStacks[index];
+            std::set<std::string> seen;
+
+            if (stack.fCount == 0 || stack.fDepth == 0)
+            {
+                continue;
+            }
+
+            for (unsigned int frame = 0; frame < stack.fDepth; ++frame)
+            {
+                /* Callers are known by their return address, which can be past their end */
+                void * address = reinterpret_cast<char *>(stack.fFrames[frame]) - (frame != 0 ? 1 : 0);
+                std::string name = Symbolize(address, symbols);
+
+                if (frame == 0)
+                {
+                    flat[name] += stack.fCount;
+                }
+
+                /* Recursion only counts once */
+                if (seen.insert(name).second)
+                {
+                    cumulative[name] += stack.fCount;
+                }
+            }
+        }
+    }
+
+    stream << "Profile: " << samples << " samples (" << samples * (fPeriod / 1e9) << " s of CPU), " << dropped << " dropped" << std::endl;
+    if (samples == 0)
+    {
+        return;
+    }
+
+    ReportProfile(stream, "Flat profile:", flat, samples);
+    ReportProfile(stream, "Cumulative profile:", cumulative, samples);
+}
@@ -0,0 +1,137 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TProfiler.h
+ * PURPOSE:          Sampling profiler
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TPROFILER_H__
+#define __TPROFILER_H__
+
+#include <vector>
+#include <ostream>
+
+/**
+ * Deepest stack recorded
+ */
+#define PROFILE_DEPTH 32
+/**
+ * Distinct stacks a room can record, as a power of two
+ */
+#define PROFILE_STACKS 4096
+/**
+ * Functions listed in the report
+ */
+#define PROFILE_REPORT 25
+
+/**
+ * A stack, and how many times it was sampled
+ */
+struct TProfileStack
+{
+    unsigned long long fHash;
+    unsigned int fCount;
+    unsigned int fDepth;
+    void * fFrames[PROFILE_DEPTH];
+};
+
+/**
+ * Samples of a room of the threads factory. They are only written by the signal handler,
+ * in the thread which is in the room, so they need no lock.
+ */
+struct TProfileRoom
+{
+    /**
+     * Amount of samples
+     */
+    unsigned long long fSamples;
+    /**
+     * Samples lost because the stacks table was full
+     */
+    unsigned long long fDropped;
+    /**
+     * CPU time not sampled yet, kept from one thread of the room to the next one, in ns
+     */
+    unsigned long long fPending;
+    /**
+     * Stacks sampled, as an open addressing hash table
+     */
+    TProfileStack fStacks[PROFILE_STACKS];
+};
+
+class TProfiler
+{
+public:
+    /**
+     * This function installs the SIGPROF handler. It has to be called once the threads factory
+     * is configured and before any thread is started.
+     * @param hz Samples per second of CPU time, per thread
+     * @param threads Amount of rooms in the threads factory
+     * @return true on success, false otherwise
+     */
+    bool Start(unsigned int hz, unsigned int threads);
+    /**
+     * This function stops sampling. It has to be called once all the threads, including the writer, are done.
+     */
+    void Stop(void);
+    /**
+     * This function returns the profiler, if profiling.
+     * @return The profiler, 0 if not profiling
+     */
+    static inline TProfiler * GetActive(void)
+    {
+        return fActive;
+    }
+    /**
+     * This function starts sampling the calling thread.
+     * @param room Room of the thread. Threads out of the threads factory (the writer) use the amount of rooms
+     */
+    void Arm(unsigned int room);
+    /**
+     * This function stops sampling the calling thread. It must be called before the thread exits.
+     */
+    void Disarm(void);
+    /**
+     * This function writes the flat and cumulative profiles.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This is the static function to have the profiler. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the profiler class.
+     */
+    static TProfiler * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It releases the samples.
+     */
+    ~TProfiler();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TProfiler();
+    /**
+     * The SIGPROF handler, recording the stack of the thread.
+     */
+    static void Sample(int signal);
+
+    /**
+     * The profiler, while profiling
+     */
+    static TProfiler * fActive;
+    /**
+     * Samples of each room. The extra last one is for the writer
+     */
+    std::vector<TProfileRoom *> fRooms;
+    /**
+     * Sampling period, in ns of CPU time
+     */
+    unsigned long long fPeriod;
+};
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TRankMerger.cpp
+ * PURPOSE:          Merge of the outputs of the ranks of a run
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <climits>
+#include <map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "TRankMerger.h"
+#include "TEventServer.h"
+#include "TOutputSet.h"
+
+/* Size of the header of a result in an output: ID and length */
+#define RECORD_HEADER_SIZE (offsetof(TResult, fResult))
+/* Offset of a record: its segment in the upper bits, its offset in the segment in the others */
+#define RECORD_SEGMENT_SHIFT 48
+#define RECORD_OFFSET_MASK ((1ULL << RECORD_SEGMENT_SHIFT) - 1)
+
+static uint64_t HashId(const uint8_t * id)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (unsigned int i = 0; i < ID_FIELD_SIZE; ++i)
+    {
+        hash = (hash ^ id[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+TRankMerger::TRankMerger()
+{
+    fRanks = 0;
+    fInterleaved = false;
+    fBlock = 0;
+    fLarger = 0;
+    fIndexed = 0;
+    fMerged = 0;
+}
+
+TRankMerger::~TRankMerger()
+{
+    for (size_t i = 0; i < fOutputs.size(); ++i)
+    {
+        for (size_t segment = 0; segment < fOutputs[i].fSegments.size(); ++segment)
+        {
+            if (fOutputs[i].fSegments[segment].fData != 0)
+            {
+                munmap(const_cast<uint8_t *>(fOutputs[i].fSegments[segment].fData), fOutputs[i].fSegments[segment].fSize);
+            }
+        }
+    }
+}
+
+TRankMerger * TRankMerger::GetInstance(bool destroyInstance)
+{
+    static TRankMerger * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TRankMerger();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+std::string TRankMerger::GetRankOutput(const char * outputFile, unsigned int rank)
+{
+    char suffix[32];
+
+    snprintf(suffix, sizeof(suffix), ".rank%u", rank);
+    return std::string(outputFile) + suffix;
+}
+
+bool TRankMerger::Index(TRankOutput & output)
+{
+    TOutputSet set;
+
+    /* A rank writing shards or rotating has several segments, listed by its manifest */
+    if (!set.Open(output.fPath.c_str()))
+    {
+        return false;
+    }
+
+    output.fSegments.resize(set.GetSegments());
+    for (size_t segment = 0; segment < set.GetSegments(); ++segment)
+    {
+        output.fSegments[segment].fData = 0;
+        output.fSegments[segment].fSize = 0;
+
+        if (!IndexSegment(output, segment, set.GetSegmentPath(segment)))
+        {
+            return false;
+        }
+    }
+
+    /* Results of the same event stay in the order they were written */
+    std::sort(output.fRecords.begin(), output.fRecords.end());
+    fIndexed += output.fRecords.size();
+
+    return true;
+}
+
+bool TRankMerger::IndexSegment(TRankOutput & output, size_t index, const std::string & path)
+{
+    TRankSegment & segment = output.fSegments[index];
+    struct stat status;
+    uint64_t offset = 0;
+    void * data;
+    int fd;
+
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    if (fstat(fd, &status) == -1)
+    {
+        close(fd);
+        return false;
+    }
+
+    segment.fSize = status.st_size;
+    /* A rank may have had nothing to write */
+    if (segment.fSize == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    data = mmap(0, segment.fSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    segment.fData = reinterpret_cast<const uint8_t *>(data);
+    madvise(data, segment.fSize, MADV_SEQUENTIAL);
+
+    /* Walk the results, a truncated one ends the segment */
+    while (segment.fSize - offset >= RECORD_HEADER_SIZE)
+    {
+        TRankRecord record;
+        uint32_t length;
+
+        memcpy(&length, segment.fData + offset + ID_FIELD_SIZE, sizeof(length));
+        if (length > sizeof(TResult::fResult) || segment.fSize - offset - RECORD_HEADER_SIZE < length)
+        {
+            break;
+        }
+
+        /* Later segments of a shard were written after, the order of the results holds */
+        record.fHash = HashId(segment.fData + offset);
+        record.fOffset = (static_cast<uint64_t>(index) << RECORD_SEGMENT_SHIFT) | offset;
+        output.fRecords.push_back(record);
+
+        offset += RECORD_HEADER_SIZE + length;
+    }
+
+    if (offset != segment.fSize)
+    {
+        fprintf(stderr, "%s: truncated at offset %llu, the end is ignored\n", path.c_str(), static_cast<unsigned long long>(offset));
+    }
+
+    madvise(data, segment.fSize, MADV_RANDOM);
+
+    return true;
+}
+
+bool TRankMerger::Open(const char * outputFile, unsigned int ranks, bool interleaved, unsigned long events)
+{
+    fRanks = ranks;
+    fInterleaved = interleaved;
+    fBlock = events / ranks;
+    fLarger = events % ranks;
+    fOutputs.resize(ranks);
+
+    for (unsigned int rank = 0; rank < ranks; ++rank)
+    {
+        fOutputs[rank].fPath = GetRankOutput(outputFile, rank);
+
+        if (!Index(fOutputs[rank]))
+        {
+            fprintf(stderr, "Failed reading output of rank %u: %s\n", rank, fOutputs[rank].fPath.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ByFirst(const TJournalChunk & left, const TJournalChunk & right)
+{
+    return left.fFirst < right.fFirst;
+}
+
+bool TRankMerger::OpenJournal(const char * outputFile, unsigned long & first, unsigned long & events)
+{
+    std::string journal = std::string(outputFile) + ".journal";
+    std::map<std::string, unsigned int> outputs;
+    char magic[sizeof(JOURNAL_MAGIC)];
+    char line[PATH_MAX + 64];
+    unsigned int chunk;
+    unsigned long covered = 0;
+    FILE * file;
+
+    file = fopen(journal.c_str(), "r");
+    if (file == 0)
+    {
+        fprintf(stderr, "No ranks given, and no journal found in %s\n", journal.c_str());
+        return false;
+    }
+
+    if (fscanf(file, "%8s %lu %lu %u\n", magic, &first, &events, &chunk) != 4 || strcmp(magic, JOURNAL_MAGIC) != 0)
+    {
+        fprintf(stderr, "Invalid journal %s\n", journal.c_str());
+        fclose(file);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file) != 0)
+    {
+        TJournalChunk completed;
+        unsigned long chunkFirst;
+        unsigned int count;
+        int path;
+        char * end = strchr(line, '\n');
+
+        if (end == 0 || sscanf(line, "%lu %u %n", &chunkFirst, &count, &path) != 2 || chunkFirst < first)
+        {
+            continue;
+        }
+        *end = 0;
+
+        /* Each output once, whatever the amount of its chunks */
+        if (outputs.find(line + path) == outputs.end())
+        {
+            unsigned int index = outputs.size();
+
+            outputs[line + path] = index;
+            fOutputs.resize(index + 1);
+            fOutputs[index].fPath = line + path;
+        }
+
+        completed.fFirst = chunkFirst - first;
+        completed.fOutput = outputs[line + path];
+        fChunks.push_back(completed);
+    }
+    fclose(file);
+
+    /* The chunks have to cover the whole run */
+    std::sort(fChunks.begin(), fChunks.end(), ByFirst);
+    for (size_t i = 0; i < fChunks.size(); ++i)
+    {
+        if (fChunks[i].fFirst != covered)
+        {
+            break;
+        }
+        covered += chunk;
+    }
+    if (covered < events)
+    {
+        fprintf(stderr, "Journal %s: event %lu was never completed, run more workers before merging\n", journal.c_str(), first + covered);
+        return false;
+    }
+
+    for (size_t output = 0; output < fOutputs.size(); ++output)
+    {
+        if (!Index(fOutputs[output]))
+        {
+            fprintf(stderr, "Failed reading output of worker: %s\n", fOutputs[output].fPath.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+unsigned int TRankMerger::GetOutput(unsigned long event)
+{
+    std::vector<TJournalChunk>::const_iterator chunk;
+    TJournalChunk key;
+
+    /* Chunk holding the event */
+    if (fRanks == 0)
+    {
+        key.fFirst = event;
+        chunk = std::upper_bound(fChunks.begin(), fChunks.end(), key, ByFirst);
+        return (chunk - 1)->fOutput;
+    }
+
+    /* The first blocks have an extra event */
+    if (fInterleaved)
+    {
+        return event % fRanks;
+    }
+    else if (event < fLarger * (fBlock + 1))
+    {
+        return event / (fBlock + 1);
+    }
+
+    return fLarger + (event - fLarger * (fBlock + 1)) / fBlock;
+}
+
+unsigned int TRankMerger::Replay(unsigned int index, const uint8_t * id, TMergeSink * sink)
+{
+    TRankOutput & output = fOutputs[index];
+    TRankRecord key;
+    std::vector<TRankRecord>::const_iterator record;
+    unsigned int replayed = 0;
+    TResult result;
+
+    key.fHash = HashId(id);
+    key.fOffset = 0;
+
+    for (record = std::lower_bound(output.fRecords.begin(), output.fRecords.end(), key);
+         record != output.fRecords.end() && record->fHash == key.fHash; ++record)
+    {
+        const uint8_t * data = output.fSegments[record->fOffset >> RECORD_SEGMENT_SHIFT].fData + (record->fOffset & RECORD_OFFSET_MASK);
+
+        /* Colliding hash of another event */
+        if (memcmp(data, id, ID_FIELD_SIZE) != 0)
+        {
+            continue;
+        }
+
+        memcpy(&result, data, RECORD_HEADER_SIZE);
+        memcpy(result.fResult, data + RECORD_HEADER_SIZE, result.fResultLength);
+        sink(&result);
+        ++replayed;
+    }
+
+    fMerged += replayed;
+    return replayed;
+}
+
+void TRankMerger::Report(std::ostream & stream)
+{
+    stream << "Merged " << fMerged << " results of " << fOutputs.size() << (fRanks != 0 ? " ranks" : " workers") << std::endl;
+    if (fMerged != fIndexed && fRanks != 0)
+    {
+        stream << (fIndexed - fMerged) << " results of the ranks don't belong to the events of the run, check --first, --events and --partition" << std::endl;
+    }
+    else if (fMerged != fIndexed)
+    {
+        stream << (fIndexed - fMerged) << " results of the workers were ignored, their chunks were completed by other workers" << std::endl;
+    }
+}
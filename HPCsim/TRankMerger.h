@@ -0,0 +1,191 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TRankMerger.h
+ * PURPOSE:          Merge of the outputs of the ranks of a run
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TRANKMERGER_H__
+#define __TRANKMERGER_H__
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdint.h>
+#include "simulation.h"
+
+/**
+ * Function receiving the results of an event, in the order they were written
+ */
+typedef void (TMergeSink)(TResult * result);
+
+/**
+ * A result in the output of a rank
+ */
+struct TRankRecord
+{
+    /**
+     * Hash of the ID of its event
+     */
+    uint64_t fHash;
+    /**
+     * Offset of the result in the output: its segment, in the upper bits, and its offset in it
+     */
+    uint64_t fOffset;
+
+    inline bool operator<(const TRankRecord & other) const
+    {
+        return fHash < other.fHash || (fHash == other.fHash && fOffset < other.fOffset);
+    }
+};
+
+/**
+ * A segment of the output of a rank, mapped in memory
+ */
+struct TRankSegment
+{
+    const uint8_t * fData;
+    uint64_t fSize;
+};
+
+/**
+ * The output of a rank, with all its segments when it's sharded or rotated
+ */
+struct TRankOutput
+{
+    std::string fPath;
+    std::vector<TRankSegment> fSegments;
+    /**
+     * Its results, by ID
+     */
+    std::vector<TRankRecord> fRecords;
+};
+
+/**
+ * A chunk of events completed by a worker, as found in the journal of the coordinator
+ */
+struct TJournalChunk
+{
+    /**
+     * First event of the chunk, from the first one of the run
+     */
+    unsigned long fFirst;
+    unsigned int fOutput;
+};
+
+class TRankMerger
+{
+public:
+    /**
+     * This function opens the outputs of all the ranks, and indexes their results.
+     * @param outputFile Output of the run, the output of rank i is outputFile.ranki
+     * @param ranks Amount of ranks
+     * @param interleaved Whether the events were interleaved over the ranks, or split in blocks
+     * @param events Amount of events of the run
+     * @return true on success, false otherwise
+     */
+    bool Open(const char * outputFile, unsigned int ranks, bool interleaved, unsigned long events);
+    /**
+     * This function opens the outputs of the workers of a coordinator, as found in its journal,
+     * and indexes their results.
+     * @param outputFile Output of the run, the journal is outputFile.journal
+     * @param first Output variable, receiving the first event of the run
+     * @param events Output variable, receiving the amount of events of the run
+     * @return true on success, false otherwise (or if some chunks were never completed)
+     */
+    bool OpenJournal(const char * outputFile, unsigned long & first, unsigned long & events);
+    /**
+     * This function returns the output holding the results of an event.
+     * @param event The event, from the first one of the run
+     * @return The output, for Replay()
+     */
+    unsigned int GetOutput(unsigned long event);
+    /**
+     * This function hands the results of an event to the sink, in the order they were written.
+     * @param output The output holding them
+     * @param id ID of the event
+     * @param sink The function to receive the results
+     * @return Amount of results
+     */
+    unsigned int Replay(unsigned int output, const uint8_t * id, TMergeSink * sink);
+    /**
+     * This function returns the amount of outputs merged.
+     * @return Amount of outputs
+     */
+    inline unsigned int GetOutputs(void) const
+    {
+        return fOutputs.size();
+    }
+    /**
+     * This function returns the path of an output merged.
+     * @param output The output
+     * @return Its path
+     */
+    inline const std::string & GetPath(unsigned int output) const
+    {
+        return fOutputs[output].fPath;
+    }
+    /**
+     * This function writes the amount of results merged to the given stream, and warns about
+     * the ones left over (not matching any event of the run, or of a chunk completed by another worker).
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This function returns the output of a rank.
+     * @param outputFile Output of the run
+     * @param rank The rank
+     * @return The output of the rank
+     */
+    static std::string GetRankOutput(const char * outputFile, unsigned int rank);
+    /**
+     * This is the static function to have the merger. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the merger class.
+     */
+    static TRankMerger * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It unmaps the outputs.
+     */
+    ~TRankMerger();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TRankMerger();
+    /**
+     * Maps the segments of the output of a rank, and indexes their results.
+     * @param output The output, with its path set
+     * @return true on success, false otherwise
+     */
+    bool Index(TRankOutput & output);
+    /**
+     * Maps a segment of the output of a rank, and adds its results to the ones of the output.
+     * @param output The output
+     * @param index The segment in the output
+     * @param path Path of the segment
+     * @return true on success, false otherwise
+     */
+    bool IndexSegment(TRankOutput & output, size_t index, const std::string & path);
+
+    std::vector<TRankOutput> fOutputs;
+    /**
+     * Partition of the events over the ranks, 0 ranks for a journal
+     */
+    unsigned int fRanks;
+    bool fInterleaved;
+    unsigned long fBlock;
+    unsigned long fLarger;
+    /**
+     * Chunks of the journal, by first event
+     */
+    std::vector<TJournalChunk> fChunks;
+    unsigned long long fIndexed;
+    unsigned long long fMerged;
+};
+
+#endif
@@ -0,0 +1,420 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TResultCache.cpp
+ * PURPOSE:          Cross-run cache of the events results
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "TResultCache.h"
+#include "simulation.h"
+
+#define CACHE_MAGIC "HPCsimC1"
+/* The slots start on the page after the header */
+#define CACHE_HEADER_SIZE 4096
+/* Smallest segment, and amount of cache per bucket of the index */
+#define CACHE_MIN_SEGMENT (1024 * 1024)
+#define CACHE_BUCKET_SIZE (CACHE_WAYS * 4096)
+
+static inline uint64_t Hash(const void * data, size_t length, uint64_t hash = 14695981039346656037ULL)
+{
+    const unsigned char * bytes = reinterpret_cast<const unsigned char *>(data);
+
+    /* FNV-1a */
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static bool HashFile(const char * path, uint64_t * hash)
+{
+    char buffer[0x10000];
+    ssize_t length;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    *hash = 14695981039346656037ULL;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        *hash = Hash(buffer, length, *hash);
+    }
+
+    close(fd);
+    return length == 0;
+}
+
+TResultCache::TResultCache()
+{
+    fBuildHash = 0;
+    fOptionsHash = 0;
+    fMaxSize = 0;
+    fIndex = -1;
+    fHeader = 0;
+    fSlots = 0;
+    fIndexSize = 0;
+    fLast = -1;
+    fHits = 0;
+    fMisses = 0;
+    fStored = 0;
+    fEvicted = 0;
+    pthread_mutex_init(&fLock, 0);
+}
+
+TResultCache::~TResultCache()
+{
+    for (std::map<uint32_t, int>::iterator it = fSegments.begin(); it != fSegments.end(); ++it)
+    {
+        close(it->second);
+    }
+
+    if (fLast != -1)
+    {
+        close(fLast);
+    }
+
+    if (fHeader != 0)
+    {
+        munmap(fHeader, fIndexSize);
+    }
+
+    /* Closing the index releases the lock on the cache */
+    if (fIndex != -1)
+    {
+        close(fIndex);
+    }
+
+    pthread_mutex_destroy(&fLock);
+}
+
+TResultCache * TResultCache::GetInstance(bool destroyInstance)
+{
+    static TResultCache * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TResultCache();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+std::string TResultCache::GetSegmentPath(uint32_t segment)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "/segment.%u", segment);
+    return fDirectory + name;
+}
+
+bool TResultCache::Open(const char * directory, unsigned long long maxSize, const char * simulation, const char * userOpts, unsigned char isPilot)
+{
+    std::string indexPath = std::string(directory) + "/index";
+    TCacheHeader header;
+    struct stat indexStat;
+    off_t lastSize;
+    bool fresh;
+
+    /* A new build or new options give new results */
+    if (!HashFile(simulation, &fBuildHash))
+    {
+        return false;
+    }
+    fOptionsHash = Hash(&isPilot, sizeof(isPilot));
+    if (userOpts != 0)
+    {
+        fOptionsHash = Hash(userOpts, strlen(userOpts), fOptionsHash);
+    }
+
+    if (mkdir(directory, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1 && errno != EEXIST)
+    {
+        return false;
+    }
+
+    fDirectory = directory;
+    fMaxSize = maxSize;
+
+    fIndex = open(indexPath.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fIndex == -1)
+    {
+        return false;
+    }
+
+    /* Runs sharing a cache would overwrite each other entries */
+    if (flock(fIndex, LOCK_EX | LOCK_NB) == -1 || fstat(fIndex, &indexStat) == -1)
+    {
+        return false;
+    }
+
+    /* The geometry is set when the cache is created, a broken index starts a new cache */
+    fresh = (pread(fIndex, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.fMagic, CACHE_MAGIC, sizeof(header.fMagic)) != 0 ||
+             header.fWays != CACHE_WAYS || header.fBuckets == 0 ||
+             static_cast<unsigned long long>(indexStat.st_size) != CACHE_HEADER_SIZE + static_cast<unsigned long long>(header.fBuckets) * CACHE_WAYS * sizeof(TCacheSlot));
+    if (fresh)
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.fMagic, CACHE_MAGIC, sizeof(header.fMagic));
+        header.fWays = CACHE_WAYS;
+        header.fBuckets = (maxSize / CACHE_BUCKET_SIZE > 1024 ? maxSize / CACHE_BUCKET_SIZE : 1024);
+        header.fSegmentSize = (maxSize / CACHE_SEGMENTS > CACHE_MIN_SEGMENT ? maxSize / CACHE_SEGMENTS : CACHE_MIN_SEGMENT);
+
+        /* Slots are zeroed, so empty */
+        if (ftruncate(fIndex, 0) == -1 || ftruncate(fIndex, CACHE_HEADER_SIZE + static_cast<off_t>(header.fBuckets) * CACHE_WAYS * sizeof(TCacheSlot)) == -1 ||
+            pwrite(fIndex, &header, sizeof(header), 0) != sizeof(header))
+        {
+            return false;
+        }
+    }
+
+    fIndexSize = CACHE_HEADER_SIZE + static_cast<size_t>(header.fBuckets) * CACHE_WAYS * sizeof(TCacheSlot);
+    fHeader = reinterpret_cast<TCacheHeader *>(mmap(0, fIndexSize, PROT_READ | PROT_WRITE, MAP_SHARED, fIndex, 0));
+    if (fHeader == MAP_FAILED)
+    {
+        fHeader = 0;
+        return false;
+    }
+    fSlots = reinterpret_cast<TCacheSlot *>(reinterpret_cast<char *>(fHeader) + CACHE_HEADER_SIZE);
+
+    /* A new segment always starts empty, there may be leftovers of a previous cache */
+    fLast = open(GetSegmentPath(fHeader->fLastSegment).c_str(), O_RDWR | O_CREAT | (fresh ? O_TRUNC : 0), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fLast == -1)
+    {
+        return false;
+    }
+
+    /* Entries are appended before the index knows them, drop what a killed run left behind */
+    lastSize = lseek(fLast, 0, SEEK_END);
+    if (lastSize < static_cast<off_t>(fHeader->fLastSize))
+    {
+        fHeader->fLastSize = lastSize;
+    }
+    else if (lastSize > static_cast<off_t>(fHeader->fLastSize))
+    {
+        UNUSED_RETURN(ftruncate(fLast, fHeader->fLastSize));
+    }
+
+    /* The size may have been lowered since the previous run */
+    Evict();
+
+    return true;
+}
+
+uint32_t TResultCache::GetKey(const uint8_t * id, uint8_t * key)
+{
+    memcpy(key, &fBuildHash, sizeof(fBuildHash));
+    memcpy(key + sizeof(fBuildHash), &fOptionsHash, sizeof(fOptionsHash));
+    memcpy(key + 2 * sizeof(uint64_t), id, CACHE_KEY_SIZE - 2 * sizeof(uint64_t));
+
+    return Hash(key, CACHE_KEY_SIZE) % fHeader->fBuckets;
+}
+
+int TResultCache::GetSegment(uint32_t segment)
+{
+    std::map<uint32_t, int>::iterator known = fSegments.find(segment);
+    int fd;
+
+    if (known != fSegments.end())
+    {
+        return known->second;
+    }
+
+    fd = open(GetSegmentPath(segment).c_str(), O_RDONLY);
+    if (fd != -1)
+    {
+        fSegments[segment] = fd;
+    }
+
+    return fd;
+}
+
+void TResultCache::Evict(void)
+{
+    /* The last segment is never evicted, even if the cache is too small for it */
+    while (fHeader->fFirstSegment != fHeader->fLastSegment &&
+           static_cast<unsigned long long>(fHeader->fLastSegment - fHeader->fFirstSegment + 1) * fHeader->fSegmentSize > fMaxSize)
+    {
+        std::map<uint32_t, int>::iterator known = fSegments.find(fHeader->fFirstSegment);
+
+        if (known != fSegments.end())
+        {
+            close(known->second);
+            fSegments.erase(known);
+        }
+
+        /* Its slots are now stale */
+        unlink(GetSegmentPath(fHeader->fFirstSegment).c_str());
+        ++fHeader->fFirstSegment;
+        ++fEvicted;
+    }
+}
+
+bool TResultCache::Append(const uint8_t * key, const char * records, uint32_t length, TCacheSlot * slot)
+{
+    uint32_t total = CACHE_KEY_SIZE + sizeof(length) + length;
+    char entry[CACHE_KEY_SIZE + sizeof(length)];
+
+    if (total > fHeader->fSegmentSize)
+    {
+        return false;
+    }
+
+    /* Full segment, start the next one */
+    if (fHeader->fLastSize + total > fHeader->fSegmentSize)
+    {
+        int next = open(GetSegmentPath(fHeader->fLastSegment + 1).c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+        if (next == -1)
+        {
+            return false;
+        }
+
+        close(fLast);
+        fLast = next;
+        ++fHeader->fLastSegment;
+        fHeader->fLastSize = 0;
+        Evict();
+    }
+
+    memcpy(entry, key, CACHE_KEY_SIZE);
+    memcpy(entry + CACHE_KEY_SIZE, &length, sizeof(length));
+    if (pwrite(fLast, entry, sizeof(entry), fHeader->fLastSize) != sizeof(entry) ||
+        pwrite(fLast, records, length, fHeader->fLastSize + sizeof(entry)) != static_cast<ssize_t>(length))
+    {
+        return false;
+    }
+
+    /* Entry first, then the index: a killed run only leaves an unreachable entry */
+    memcpy(slot->fKey, key, CACHE_KEY_SIZE);
+    slot->fSegment = fHeader->fLastSegment;
+    slot->fOffset = fHeader->fLastSize;
+    slot->fLength = total;
+    fHeader->fLastSize += total;
+
+    return true;
+}
+
+bool TResultCache::Find(const uint8_t * id, std::vector<char> & records)
+{
+    uint8_t key[CACHE_KEY_SIZE];
+    TCacheSlot * bucket;
+    bool found = false;
+
+    pthread_mutex_lock(&fLock);
+    bucket = &fSlots[GetKey(id, key) * CACHE_WAYS];
+
+    for (unsigned int way = 0; way < CACHE_WAYS && !found; ++way)
+    {
+        TCacheSlot * slot = &bucket[way];
+        uint32_t length;
+        int fd;
+
+        if (slot->fLength == 0 || slot->fSegment < fHeader->fFirstSegment || memcmp(slot->fKey, key, CACHE_KEY_SIZE) != 0)
+        {
+            continue;
+        }
+
+        /* The entry repeats its key, the index cannot point to a wrong one */
+        records.resize(slot->fLength);
+        fd = (slot->fSegment == fHeader->fLastSegment ? fLast : GetSegment(slot->fSegment));
+        if (fd == -1 || pread(fd, &records[0], slot->fLength, slot->fOffset) != static_cast<ssize_t>(slot->fLength) ||
+            memcmp(&records[0], key, CACHE_KEY_SIZE) != 0)
+        {
+            slot->fLength = 0;
+            continue;
+        }
+
+        memcpy(&length, &records[CACHE_KEY_SIZE], sizeof(length));
+        if (length != slot->fLength - CACHE_KEY_SIZE - sizeof(length))
+        {
+            slot->fLength = 0;
+            continue;
+        }
+
+        /* Entries still used are moved out of the older half of the cache, so that they survive eviction */
+        if (slot->fSegment - fHeader->fFirstSegment < (fHeader->fLastSegment - fHeader->fFirstSegment) / 2)
+        {
+            Append(key, &records[CACHE_KEY_SIZE + sizeof(length)], length, slot);
+        }
+
+        records.erase(records.begin(), records.begin() + CACHE_KEY_SIZE + sizeof(length));
+        found = true;
+    }
+
+    if (found)
+    {
+        ++fHits;
+    }
+    else
+    {
+        ++fMisses;
+    }
+    pthread_mutex_unlock(&fLock);
+
+    return found;
+}
+
+void TResultCache::Store(const uint8_t * id, const TCacheCapture & capture)
+{
+    uint8_t key[CACHE_KEY_SIZE];
+    TCacheSlot * bucket;
+    TCacheSlot * victim = 0;
+
+    if (capture.fDiscard)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&fLock);
+    bucket = &fSlots[GetKey(id, key) * CACHE_WAYS];
+
+    /* Same key, or a free way, or the way in the oldest segment */
+    for (unsigned int way = 0; way < CACHE_WAYS; ++way)
+    {
+        TCacheSlot * slot = &bucket[way];
+
+        if (slot->fLength == 0 || slot->fSegment < fHeader->fFirstSegment || memcmp(slot->fKey, key, CACHE_KEY_SIZE) == 0)
+        {
+            victim = slot;
+            break;
+        }
+
+        if (victim == 0 || slot->fSegment < victim->fSegment)
+        {
+            victim = slot;
+        }
+    }
+
+    if (Append(key, (capture.fRecords.empty() ? 0 : &capture.fRecords[0]), capture.fRecords.size(), victim))
+    {
+        ++fStored;
+    }
+    pthread_mutex_unlock(&fLock);
+}
+
+void TResultCache::Report(std::ostream & stream)
+{
+    stream << "Cache " << fDirectory << ": " << fHits << " hits, " << fMisses << " misses, " << fStored << " stored, "
+           << fEvicted << " segments evicted, " << (fHeader->fLastSegment - fHeader->fFirstSegment) * fHeader->fSegmentSize + fHeader->fLastSize << " bytes" << std::endl;
+}
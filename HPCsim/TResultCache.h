@@ -0,0 +1,205 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TResultCache.h
+ * PURPOSE:          Cross-run cache of the events results
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TRESULTCACHE_H__
+#define __TRESULTCACHE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <cstring>
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * Size of a key: hash of the simulation build, hash of the options, and ID of the event
+ */
+#define CACHE_KEY_SIZE (2 * sizeof(uint64_t) + 6 * sizeof(double))
+/**
+ * Entries per bucket of the index. A full bucket evicts its oldest entry
+ */
+#define CACHE_WAYS 8
+/**
+ * Segments the cache is split into: eviction drops the oldest one at once
+ */
+#define CACHE_SEGMENTS 16
+
+/**
+ * Header of the index file
+ */
+struct TCacheHeader
+{
+    char fMagic[8];
+    uint32_t fBuckets;
+    uint32_t fWays;
+    /**
+     * Oldest segment still on disk, and segment being appended to
+     */
+    uint32_t fFirstSegment;
+    uint32_t fLastSegment;
+    /**
+     * Size of the last segment, and size a segment cannot go over
+     */
+    uint64_t fLastSize;
+    uint64_t fSegmentSize;
+};
+
+/**
+ * An entry of the index. It's empty if fLength is 0, and stale if its segment was evicted
+ */
+struct TCacheSlot
+{
+    uint8_t fKey[CACHE_KEY_SIZE];
+    uint32_t fSegment;
+    uint32_t fLength;
+    uint64_t fOffset;
+};
+
+/**
+ * Results queued by an event, as they'll be stored in the cache: length and data of each result
+ */
+struct TCacheCapture
+{
+    std::vector<char> fRecords;
+    /**
+     * Set if the event cannot be replayed from its results (it forked subtasks)
+     */
+    bool fDiscard;
+};
+
+class TResultCache
+{
+public:
+    /**
+     * This function opens (or creates) the cache. Only one run at a time can use a cache directory.
+     * @param directory Directory of the cache
+     * @param maxSize Size of the cache, in bytes. Oldest segments are evicted over it
+     * @param simulation Path of the simulation build, whose content is part of the key
+     * @param userOpts Options of the simulation, part of the key
+     * @param isPilot Whether events are run by pilots, part of the key
+     * @return true on success, false otherwise
+     */
+    bool Open(const char * directory, unsigned long long maxSize, const char * simulation, const char * userOpts, unsigned char isPilot);
+    /**
+     * This function looks for the results of an event.
+     * @param id ID of the event
+     * @param records Output variable, receiving the results as stored by Store()
+     * @return true if the event is known
+     */
+    bool Find(const uint8_t * id, std::vector<char> & records);
+    /**
+     * This function stores the results of an event.
+     * @param id ID of the event
+     * @param capture Results queued by the event
+     */
+    void Store(const uint8_t * id, const TCacheCapture & capture);
+    /**
+     * This function writes the hits and misses of the run to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This function adds a result to the results of an event.
+     * @param capture Results queued by the event so far
+     * @param length Length of the result
+     * @param result The result
+     */
+    static inline void Capture(TCacheCapture & capture, uint32_t length, const void * result)
+    {
+        size_t size = capture.fRecords.size();
+
+        capture.fRecords.resize(size + sizeof(length) + length);
+        memcpy(&capture.fRecords[size], &length, sizeof(length));
+        memcpy(&capture.fRecords[size + sizeof(length)], result, length);
+    }
+    /**
+     * This is the static function to have the cache. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the cache class.
+     */
+    static TResultCache * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It closes the cache.
+     */
+    ~TResultCache();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TResultCache();
+    /**
+     * Builds the key of an event.
+     * @param id ID of the event
+     * @param key Output buffer of CACHE_KEY_SIZE bytes
+     * @return The bucket of the key
+     */
+    uint32_t GetKey(const uint8_t * id, uint8_t * key);
+    /**
+     * Returns the path of a segment.
+     * @param segment The segment
+     * @return Its path
+     */
+    std::string GetSegmentPath(uint32_t segment);
+    /**
+     * Returns a descriptor to read a segment, kept opened for the next reads.
+     * @param segment The segment
+     * @return The descriptor, -1 on failure
+     */
+    int GetSegment(uint32_t segment);
+    /**
+     * Appends an entry to the last segment, starting a new one (and evicting the oldest ones) if full.
+     * The cache lock must be held.
+     * @param key Key of the entry
+     * @param records Results of the entry
+     * @param length Length of the results
+     * @param slot The index slot to point to the entry
+     * @return true on success, false otherwise
+     */
+    bool Append(const uint8_t * key, const char * records, uint32_t length, TCacheSlot * slot);
+    /**
+     * Evicts the oldest segments until the cache is under its size. The cache lock must be held.
+     */
+    void Evict(void);
+
+    std::string fDirectory;
+    /**
+     * Hashes of the simulation build and of its options
+     */
+    uint64_t fBuildHash;
+    uint64_t fOptionsHash;
+    unsigned long long fMaxSize;
+    /**
+     * The index file, and its mapping
+     */
+    int fIndex;
+    TCacheHeader * fHeader;
+    TCacheSlot * fSlots;
+    size_t fIndexSize;
+    /**
+     * Descriptor of the last segment, to append to
+     */
+    int fLast;
+    /**
+     * Descriptors of the segments read so far
+     */
+    std::map<uint32_t, int> fSegments;
+    /**
+     * Protects the index and the segments
+     */
+    pthread_mutex_t fLock;
+    unsigned long long fHits;
+    unsigned long long fMisses;
+    unsigned long long fStored;
+    unsigned long long fEvicted;
+};
+
+#endif
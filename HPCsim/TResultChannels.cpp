@@ -0,0 +1,426 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TResultChannels.cpp
+ * PURPOSE:          Named result channels, each with its own writer and output
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "TResultChannels.h"
+#include "Exceptions.h"
+
+/* Size of the header of a result: ID and length. A null one ends a channel */
+#define CHANNEL_HEADER_SIZE (offsetof(TResult, fResult))
+
+static const uint8_t gEndHeader[CHANNEL_HEADER_SIZE] = { 0 };
+
+/**
+ * Reads exactly length bytes from the queue of a channel.
+ */
+static bool ReadPipe(int fd, void * data, size_t length)
+{
+    size_t done = 0;
+
+    while (done < length)
+    {
+        ssize_t got = read(fd, reinterpret_cast<uint8_t *>(data) + done, length - done);
+
+        if (got > 0)
+        {
+            done += got;
+        }
+        else if (got == 0 || errno != EINTR)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes a batch to an output, false if it can't take it anymore.
+ */
+static bool WriteOutput(int fd, const uint8_t * data, size_t length)
+{
+    size_t done = 0;
+
+    while (done < length)
+    {
+        ssize_t written = write(fd, data + done, length - done);
+
+        if (written > 0)
+        {
+            done += written;
+        }
+        else if (written == 0 || errno != EINTR)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TResultChannels::TResultChannels()
+{
+    fSealed = false;
+    fStarted = false;
+    fAppend = false;
+    fSimulationContext = 0;
+}
+
+TResultChannels::~TResultChannels()
+{
+    End();
+}
+
+TResultChannels * TResultChannels::GetInstance(bool destroyInstance)
+{
+    static TResultChannels * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TResultChannels();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+int TResultChannels::Create(const char * name, unsigned int flags, unsigned long buffer, TReduceResult * reduce)
+{
+    TResultChannel channel;
+    size_t length;
+
+    if (fSealed || name == 0 || (flags & ~HPCSIM_CHANNEL_PAYLOAD) != 0)
+    {
+        return -1;
+    }
+
+    /* The name ends the one of its output */
+    length = strlen(name);
+    if (length == 0 || length > MAX_CHANNEL_NAME || strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_") != length)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < fChannels.size(); ++i)
+    {
+        if (fChannels[i].fName == name)
+        {
+            return -1;
+        }
+    }
+
+    channel.fName = name;
+    channel.fFlags = flags;
+    channel.fBuffer = ((buffer != 0) ? buffer : DEFAULT_CHANNEL_BUFFER);
+    channel.fReduceResult = reduce;
+    channel.fPipe[0] = -1;
+    channel.fPipe[1] = -1;
+    channel.fResults = 0;
+    channel.fBytes = 0;
+    channel.fLost = 0;
+    fChannels.push_back(channel);
+
+    return fChannels.size() - 1;
+}
+
+bool TResultChannels::SetOutput(const char * spec)
+{
+    const char * equal = strchr(spec, '=');
+
+    if (equal == 0 || equal == spec || equal[1] == 0)
+    {
+        return false;
+    }
+
+    fOutputs[std::string(spec, equal - spec)] = equal + 1;
+    return true;
+}
+
+bool TResultChannels::Start(const char * outputFile, bool append, void * simContext)
+{
+    std::map<std::string, std::string>::const_iterator output;
+
+    fSealed = true;
+    fAppend = append;
+    fSimulationContext = simContext;
+
+    /* A consumer of a FIFO leaving mustn't kill the run */
+    signal(SIGPIPE, SIG_IGN);
+
+    for (output = fOutputs.begin(); output != fOutputs.end(); ++output)
+    {
+        bool declared = false;
+
+        for (size_t i = 0; i < fChannels.size(); ++i)
+        {
+            declared = (declared || fChannels[i].fName == output->first);
+        }
+
+        if (!declared)
+        {
+            fprintf(stderr, "Channel %s isn't declared by the simulation, ignoring its output %s\n", output->first.c_str(), output->second.c_str());
+        }
+    }
+
+    for (size_t i = 0; i < fChannels.size(); ++i)
+    {
+        TResultChannel & channel = fChannels[i];
+
+        output = fOutputs.find(channel.fName);
+        channel.fOutput = ((output != fOutputs.end()) ? output->second : std::string(outputFile) + "." + channel.fName);
+
+        if (pipe2(channel.fPipe, O_CLOEXEC) == -1)
+        {
+            fprintf(stderr, "Failed creating pipes for channel %s\n", channel.fName.c_str());
+            fStarted = true;
+            End();
+            return false;
+        }
+
+        /* The queue absorbs the bursts of results. It can be capped by the system */
+        UNUSED_RETURN(fcntl(channel.fPipe[1], F_SETPIPE_SZ, channel.fBuffer));
+
+        if (pthread_create(&channel.fWriter, 0, WriteChannel, &channel) != 0)
+        {
+            fprintf(stderr, "Failed creating writing thread for channel %s\n", channel.fName.c_str());
+            close(channel.fPipe[0]);
+            close(channel.fPipe[1]);
+            channel.fPipe[0] = -1;
+            channel.fPipe[1] = -1;
+            fStarted = true;
+            End();
+            return false;
+        }
+    }
+
+    fStarted = true;
+    return true;
+}
+
+void TResultChannels::Push(int channel, const TResult * result)
+{
+    /* A result of at most the size of TResult is written at once, whatever the other threads write */
+    if (result->fResultLength > sizeof(result->fResult))
+    {
+        __sync_fetch_and_add(&fChannels[channel].fLost, 1);
+        return;
+    }
+
+    UNUSED_RETURN(write(fChannels[channel].fPipe[1], result, CHANNEL_HEADER_SIZE + result->fResultLength));
+}
+
+void TResultChannels::End(void)
+{
+    if (!fStarted)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < fChannels.size(); ++i)
+    {
+        TResultChannel & channel = fChannels[i];
+        void * ret;
+
+        /* Its writer never started */
+        if (channel.fPipe[1] == -1)
+        {
+            continue;
+        }
+
+        UNUSED_RETURN(write(channel.fPipe[1], gEndHeader, sizeof(gEndHeader)));
+        pthread_join(channel.fWriter, &ret);
+        close(channel.fPipe[0]);
+        close(channel.fPipe[1]);
+        channel.fPipe[0] = -1;
+        channel.fPipe[1] = -1;
+    }
+
+    fStarted = false;
+}
+
+bool TResultChannels::ReadChannel(TResultChannel & channel, TResult * result)
+{
+    if (!ReadPipe(channel.fPipe[0], result, CHANNEL_HEADER_SIZE) || memcmp(result, gEndHeader, CHANNEL_HEADER_SIZE) == 0)
+    {
+        return false;
+    }
+
+    /* Written at once with its header */
+    return ReadPipe(channel.fPipe[0], result->fResult, result->fResultLength);
+}
+
+void TResultChannels::DropRecords(TResultChannel & channel)
+{
+    TResult result;
+
+    while (ReadChannel(channel, &result))
+    {
+        ++channel.fLost;
+    }
+}
+
+void TResultChannels::WriteRecords(TResultChannel & channel)
+{
+    std::vector<uint8_t> buffer(channel.fBuffer);
+    unsigned long buffered = 0;
+    size_t used = 0;
+    bool failed = false;
+    TResult result;
+    int fd;
+
+    /* A FIFO waits here for its consumer, the events wait once the queue is full */
+    fd = open(channel.fOutput.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (fAppend ? O_APPEND : O_TRUNC), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Failed opening output of channel %s: %s\n", channel.fName.c_str(), channel.fOutput.c_str());
+        DropRecords(channel);
+        return;
+    }
+
+    while (!failed)
+    {
+        const uint8_t * data = reinterpret_cast<const uint8_t *>(&result);
+        size_t length;
+        int pending = 0;
+
+        /* Nothing queued for now: the output gets what's batched before waiting */
+        if (used != 0 && ioctl(channel.fPipe[0], FIONREAD, &pending) == 0 && pending == 0)
+        {
+            failed = !WriteOutput(fd, &buffer[0], used);
+            used = (failed ? used : 0);
+            buffered = (failed ? buffered : 0);
+            continue;
+        }
+
+        if (!ReadChannel(channel, &result))
+        {
+            break;
+        }
+
+        /* The payload alone makes records of the size the simulation gives them */
+        length = CHANNEL_HEADER_SIZE + result.fResultLength;
+        if ((channel.fFlags & HPCSIM_CHANNEL_PAYLOAD) != 0)
+        {
+            data = result.fResult;
+            length = result.fResultLength;
+        }
+
+        if (used + length > buffer.size())
+        {
+            failed = !WriteOutput(fd, &buffer[0], used);
+            used = (failed ? used : 0);
+            buffered = (failed ? buffered : 0);
+        }
+
+        /* Larger than the buffer, it goes on its own */
+        if (!failed && length > buffer.size())
+        {
+            failed = !WriteOutput(fd, data, length);
+        }
+        else if (!failed)
+        {
+            memcpy(&buffer[used], data, length);
+            used += length;
+            ++buffered;
+        }
+
+        if (failed)
+        {
+            ++channel.fLost;
+            break;
+        }
+
+        ++channel.fResults;
+        channel.fBytes += length;
+    }
+
+    if (!failed && used != 0)
+    {
+        failed = !WriteOutput(fd, &buffer[0], used);
+    }
+
+    /* What was batched is lost, and the results left are read so that the events don't wait */
+    if (failed)
+    {
+        fprintf(stderr, "Failed writing output of channel %s: %s\n", channel.fName.c_str(), channel.fOutput.c_str());
+        channel.fResults -= buffered;
+        channel.fLost += buffered;
+        DropRecords(channel);
+    }
+
+    close(fd);
+}
+
+void TResultChannels::ReduceRecords(TResultChannel & channel)
+{
+    TResult result;
+
+    while (ReadChannel(channel, &result))
+    {
+        channel.fReduceResult(fSimulationContext, channel.fOutput.c_str(), result.fId, result.fResultLength, result.fResult);
+        ++channel.fResults;
+        channel.fBytes += result.fResultLength;
+    }
+}
+
+void * TResultChannels::WriteChannel(void * Arg)
+{
+    TResultChannel * channel = reinterpret_cast<TResultChannel *>(Arg);
+
+    if (channel->fReduceResult == 0)
+    {
+        GetInstance()->WriteRecords(*channel);
+        return 0;
+    }
+
+    /* Same as ReduceResult() on the output */
+    HPCSIM_TRY
+    {
+        GetInstance()->ReduceRecords(*channel);
+    }
+    HPCSIM_EXCEPT
+    {
+        fprintf(stderr, "Reducer of channel %s failed, the results left are lost\n", channel->fName.c_str());
+        ++channel->fLost;
+        GetInstance()->DropRecords(*channel);
+    }
+    HPCSIM_END
+
+    return 0;
+}
+
+void TResultChannels::Report(std::ostream & stream)
+{
+    for (size_t i = 0; i < fChannels.size(); ++i)
+    {
+        const TResultChannel & channel = fChannels[i];
+
+        stream << "Channel " << channel.fName << ": " << channel.fResults << " results, " << channel.fBytes << " bytes "
+               << (channel.fReduceResult != 0 ? "reduced" : "written to ") << (channel.fReduceResult != 0 ? "" : channel.fOutput);
+        if (channel.fLost != 0)
+        {
+            stream << ", " << channel.fLost << " lost";
+        }
+        stream << std::endl;
+    }
+}
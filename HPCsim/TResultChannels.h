@@ -0,0 +1,175 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TResultChannels.h
+ * PURPOSE:          Named result channels, each with its own writer and output
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TRESULTCHANNELS_H__
+#define __TRESULTCHANNELS_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <pthread.h>
+#include "simulation.h"
+
+/**
+ * Bytes of results queued for the writer of a channel, and batched in its writes, when not given
+ */
+#define DEFAULT_CHANNEL_BUFFER (1024 * 1024)
+
+/**
+ * Longest name of a channel, it's part of the name of its output
+ */
+#define MAX_CHANNEL_NAME 64
+
+struct TResultChannel
+{
+    std::string fName;
+    /**
+     * HPCSIM_CHANNEL_* flags, for the format of the output
+     */
+    unsigned int fFlags;
+    unsigned long fBuffer;
+    /**
+     * Receives the results instead of the output, 0 to write them
+     */
+    TReduceResult * fReduceResult;
+    std::string fOutput;
+    /**
+     * Queue of the writer: results are written to it at once, as they're smaller than PIPE_BUF
+     */
+    int fPipe[2];
+    pthread_t fWriter;
+    unsigned long long fResults;
+    unsigned long long fBytes;
+    /**
+     * Results the output couldn't take, or the reducer failed on
+     */
+    unsigned long long fLost;
+};
+
+class TResultChannels
+{
+public:
+    /**
+     * This function declares a channel.
+     * It has to be called before the run starts (in SimulationInit()).
+     * @param name Name of the channel, unique, made of letters, digits, - and _, up to MAX_CHANNEL_NAME characters
+     * @param flags HPCSIM_CHANNEL_* flags
+     * @param buffer Bytes of results queued for its writer, and batched in its writes. 0 for DEFAULT_CHANNEL_BUFFER
+     * @param reduce Optional reducer, receiving the results instead of the output
+     * @return The handle of the channel, -1 on failure or once sealed
+     */
+    int Create(const char * name, unsigned int flags, unsigned long buffer, TReduceResult * reduce);
+    /**
+     * This function sets the output of a channel, instead of the output of the run with its name appended.
+     * @param spec name=path, the path can be a FIFO
+     * @return true on success, false if it's not name=path
+     */
+    bool SetOutput(const char * spec);
+    /**
+     * This function denies any further declaration.
+     */
+    inline void Seal(void)
+    {
+        fSealed = true;
+    }
+    /**
+     * This function tells whether the simulation declared channels.
+     * @return true if there's at least one
+     */
+    inline bool IsUsed(void) const
+    {
+        return !fChannels.empty();
+    }
+    /**
+     * This function tells whether a handle is a channel which results can be queued to.
+     * @param channel Handle returned by Create()
+     * @return true if it's a channel, and its writer runs
+     */
+    inline bool IsStarted(int channel) const
+    {
+        return fStarted && channel >= 0 && static_cast<size_t>(channel) < fChannels.size();
+    }
+    /**
+     * This function seals the channels, and starts their writers. The outputs are opened by the
+     * writers, so that a FIFO waiting for its consumer doesn't hold the run.
+     * @param outputFile Output of the run, the one of a channel is outputFile.name
+     * @param append Whether the outputs are appended to, as with checkpoint, instead of replaced
+     * @param simContext Context given to the reducers
+     * @return true on success, false otherwise
+     */
+    bool Start(const char * outputFile, bool append, void * simContext);
+    /**
+     * This function queues a result to the writer of a channel. It can be called by any thread.
+     * @param channel The channel, started
+     * @param result The result, with its ID
+     */
+    void Push(int channel, const TResult * result);
+    /**
+     * This function tells the writers there are no more results, and waits for them.
+     * No event can be queueing results anymore.
+     */
+    void End(void);
+    /**
+     * This function writes the results written to each channel to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This is the static function to have the channels. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the channels class.
+     */
+    static TResultChannels * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It ends the writers still running.
+     */
+    ~TResultChannels();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TResultChannels();
+    /**
+     * Writer of a channel.
+     * @param Arg The channel
+     */
+    static void * WriteChannel(void * Arg);
+    /**
+     * Gets the next result of a channel.
+     * @return true for a result, false once the run ended
+     */
+    bool ReadChannel(TResultChannel & channel, TResult * result);
+    /**
+     * Writes the results of a channel to its output, batched.
+     */
+    void WriteRecords(TResultChannel & channel);
+    /**
+     * Hands the results of a channel to its reducer.
+     */
+    void ReduceRecords(TResultChannel & channel);
+    /**
+     * Reads the results left, they're lost.
+     */
+    void DropRecords(TResultChannel & channel);
+
+    std::vector<TResultChannel> fChannels;
+    /**
+     * Outputs given by the command line, by channel
+     */
+    std::map<std::string, std::string> fOutputs;
+    bool fSealed;
+    bool fStarted;
+    bool fAppend;
+    void * fSimulationContext;
+};
+
+#endif
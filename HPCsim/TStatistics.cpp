@@ -0,0 +1,426 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TStatistics.cpp
+ * PURPOSE:          Run statistics
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+
+#include "TStatistics.h"
+#include "TThreadsFactory.h"
+#include "TTopology.h"
+
+static const char * gPhaseNames[PHASE_MAX] = { "init", "run", "clear" };
+
+void THistogram::Merge(const THistogram & histogram)
+{
+    if (histogram.fCount == 0)
+    {
+        return;
+    }
+
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        fCounts[i] += histogram.fCounts[i];
+    }
+
+    fCount += histogram.fCount;
+    fSum += histogram.fSum;
+    if (histogram.fMax > fMax)
+    {
+        fMax = histogram.fMax;
+    }
+    if (fMin == 0 || (histogram.fMin != 0 && histogram.fMin < fMin))
+    {
+        fMin = histogram.fMin;
+    }
+}
+
+unsigned long long THistogram::GetPercentile(double percentile) const
+{
+    unsigned long long target = static_cast<unsigned long long>(ceil(percentile / 100.0 * fCount));
+    unsigned long long seen = 0;
+
+    if (target == 0)
+    {
+        target = 1;
+    }
+
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += fCounts[i];
+        if (seen >= target)
+        {
+            unsigned long long highest;
+
+            if (i < HISTOGRAM_SUB_BUCKETS)
+            {
+                highest = i;
+            }
+            else
+            {
+                unsigned int exponent = i / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+                unsigned long long lowest = static_cast<unsigned long long>(HISTOGRAM_SUB_BUCKETS + i % HISTOGRAM_SUB_BUCKETS) << (exponent - HISTOGRAM_SUB_BITS);
+
+                highest = lowest + (1ULL << (exponent - HISTOGRAM_SUB_BITS)) - 1;
+            }
+
+            /* Don't report more than what was really seen */
+            return (highest > fMax ? fMax : highest);
+        }
+    }
+
+    return fMax;
+}
+
+void THistogram::Report(std::ostream & stream) const
+{
+    stream << "{\"count\": " << fCount;
+    if (fCount != 0)
+    {
+        stream << ", \"min\": " << fMin << ", \"mean\": " << fSum / fCount
+               << ", \"p50\": " << GetPercentile(50.0) << ", \"p90\": " << GetPercentile(90.0)
+               << ", \"p99\": " << GetPercentile(99.0) << ", \"p999\": " << GetPercentile(99.9)
+               << ", \"max\": " << fMax;
+    }
+    stream << "}";
+}
+
+TStatistics::TStatistics()
+{
+    memset(&fWriter, 0, sizeof(fWriter));
+    fQueueDepth = 0;
+    fMaxQueueDepth = 0;
+    fStart = 0;
+    fEnd = 0;
+    fEvents = 0;
+    fInterval = 0;
+    fStopping = false;
+    pthread_mutex_init(&fSnapshotLock, 0);
+    pthread_cond_init(&fSnapshotStop, 0);
+}
+
+TStatistics::~TStatistics()
+{
+    for (size_t i = 0; i < fThreads.size(); ++i)
+    {
+        if (fThreads[i] != 0)
+        {
+            TTopology::FreeLocal(fThreads[i], sizeof(TThreadStatistics));
+        }
+    }
+
+    pthread_cond_destroy(&fSnapshotStop);
+    pthread_mutex_destroy(&fSnapshotLock);
+}
+
+TStatistics * TStatistics::GetInstance(bool destroyInstance)
+{
+    static TStatistics * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TStatistics();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TStatistics::Start(const char * path, unsigned int threads, unsigned int interval)
+{
+    /* Make sure we'll be able to write, before the run */
+    std::ofstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+    file.close();
+
+    fPath = path;
+    fThreads.resize(threads + 1, 0);
+    fInterval = interval;
+    fStart = Now();
+
+    if (fInterval != 0)
+    {
+        if (pthread_create(&fSnapshotThread, 0, SnapshotThread, this) != 0)
+        {
+            fInterval = 0;
+        }
+    }
+
+    return true;
+}
+
+void TStatistics::Stop(unsigned long events)
+{
+    fEnd = Now();
+    fEvents = events;
+
+    /* Stop the snapshots */
+    if (fInterval != 0)
+    {
+        void * ret;
+
+        pthread_mutex_lock(&fSnapshotLock);
+        fStopping = true;
+        pthread_cond_signal(&fSnapshotStop);
+        pthread_mutex_unlock(&fSnapshotLock);
+
+        pthread_join(fSnapshotThread, &ret);
+    }
+
+    WriteFile(true);
+}
+
+TThreadStatistics * TStatistics::GetThread(void)
+{
+    unsigned int slot = TThreadsFactory::GetCurrentSlot();
+
+    /* Threads out of the factory share the last statistics */
+    if (slot >= fThreads.size() - 1)
+    {
+        slot = fThreads.size() - 1;
+    }
+
+    if (fThreads[slot] == 0)
+    {
+        return AllocateThread(slot);
+    }
+
+    return fThreads[slot];
+}
+
+TThreadStatistics * TStatistics::AllocateThread(unsigned int slot)
+{
+    static TThreadStatistics gLostStatistics;
+
+    /* Anonymous memory is zeroed, the statistics are ready for use */
+    fThreads[slot] = reinterpret_cast<TThreadStatistics *>(TTopology::AllocateLocal(sizeof(TThreadStatistics)));
+    if (fThreads[slot] == 0)
+    {
+        /* Don't fail the run for statistics, they'll just be wrong */
+        return &gLostStatistics;
+    }
+
+    return fThreads[slot];
+}
+
+void TStatistics::Queued(unsigned long long wait, unsigned long bytes)
+{
+    TThreadStatistics * statistics = GetThread();
+    long depth = __sync_add_and_fetch(&fQueueDepth, 1);
+
+    /* Pipe lock is held, nobody else can raise the depth */
+    if (depth > fMaxQueueDepth)
+    {
+        fMaxQueueDepth = depth;
+    }
+
+    statistics->fPipeLockWait += wait;
+    ++statistics->fResults;
+    statistics->fBytes += bytes;
+}
+
+void TStatistics::Dequeued(unsigned long long start, unsigned long bytes)
+{
+    unsigned long long end = Now();
+
+    /* Since the previous read, we were writing */
+    if (fWriter.fLastRead != 0)
+    {
+        fWriter.fBusy += start - fWriter.fLastRead;
+    }
+    fWriter.fIdle += end - start;
+    fWriter.fLastRead = end;
+
+    /* Depth, including the result we just read */
+    fWriter.fQueueDepth.Record(__sync_fetch_and_sub(&fQueueDepth, 1));
+    ++fWriter.fResults;
+    fWriter.fBytes += bytes;
+}
+
+void TStatistics::TakeSnapshot(TSnapshot & snapshot)
+{
+    /* Counters are read on the fly, this is only an approximation */
+    memset(&snapshot, 0, sizeof(TSnapshot));
+    snapshot.fTime = (Now() - fStart) / 1e9;
+    for (size_t i = 0; i < fThreads.size(); ++i)
+    {
+        TThreadStatistics * statistics = fThreads[i];
+
+        if (statistics != 0)
+        {
+            snapshot.fEvents += statistics->fEvents;
+            snapshot.fBusy += statistics->fBusy;
+        }
+    }
+    snapshot.fResults = fWriter.fResults;
+    snapshot.fBytes = fWriter.fBytes;
+    snapshot.fQueueDepth = fQueueDepth;
+}
+
+void TStatistics::Report(std::ostream & stream, bool final)
+{
+    unsigned long long elapsed = (final ? fEnd : Now()) - fStart;
+    unsigned long long events = 0;
+    THistogram * phases = new THistogram[PHASE_MAX]();
+    TThreadsFactory * factory = TThreadsFactory::GetInstance();
+
+    for (size_t i = 0; i < fThreads.size(); ++i)
+    {
+        if (fThreads[i] != 0)
+        {
+            events += fThreads[i]->fEvents;
+            for (unsigned int phase = 0; phase < PHASE_MAX; ++phase)
+            {
+                phases[phase].Merge(fThreads[i]->fPhases[phase]);
+            }
+        }
+    }
+
+    stream << "{" << std::endl;
+    stream << "  \"final\": " << (final ? "true" : "false") << "," << std::endl;
+    stream << "  \"threads\": " << fThreads.size() - 1 << "," << std::endl;
+    stream << "  \"events\": " << (final ? fEvents : events) << "," << std::endl;
+    stream << "  \"completedEvents\": " << events << "," << std::endl;
+    stream << "  \"elapsed\": " << elapsed / 1e9 << "," << std::endl;
+
+    /* Timings are in ns, totals in s */
+    stream << "  \"phases\": {" << std::endl;
+    for (unsigned int phase = 0; phase < PHASE_MAX; ++phase)
+    {
+        stream << "    \"" << gPhaseNames[phase] << "\": ";
+        phases[phase].Report(stream);
+        stream << (phase + 1 < PHASE_MAX ? "," : "") << std::endl;
+    }
+    stream << "  }," << std::endl;
+    delete[] phases;
+
+    stream << "  \"factory\": {\"creationLimiterWait\": " << factory->GetCreationLimiterWait() / 1e9
+           << ", \"initLockWait\": " << factory->GetInitLockWait() / 1e9 << "}," << std::endl;
+
+    stream << "  \"perThread\": [";
+    for (size_t i = 0, written = 0; i < fThreads.size(); ++i)
+    {
+        TThreadStatistics * statistics = fThreads[i];
+        unsigned long long waits, idle;
+
+        if (statistics == 0)
+        {
+            continue;
+        }
+
+        /* Busy time includes the waits on the pipe lock, from the simulation */
+        waits = statistics->fInitLockWait;
+        idle = (elapsed > statistics->fBusy + waits ? elapsed - statistics->fBusy - waits : 0);
+
+        stream << (written++ != 0 ? "," : "") << std::endl << "    {\"slot\": ";
+        if (i + 1 < fThreads.size())
+        {
+            stream << i;
+        }
+        else
+        {
+            stream << "\"other\"";
+        }
+        stream << ", \"events\": " << statistics->fEvents
+               << ", \"busy\": " << statistics->fBusy / 1e9
+               << ", \"idle\": " << idle / 1e9
+               << ", \"utilization\": " << (elapsed != 0 ? static_cast<double>(statistics->fBusy) / elapsed : 0.0)
+               << ", \"initLockWait\": " << statistics->fInitLockWait / 1e9
+               << ", \"pipeLockWait\": " << statistics->fPipeLockWait / 1e9
+               << ", \"results\": " << statistics->fResults
+               << ", \"bytes\": " << statistics->fBytes << "}";
+    }
+    stream << std::endl << "  ]," << std::endl;
+
+    stream << "  \"writer\": {\"results\": " << fWriter.fResults
+           << ", \"bytes\": " << fWriter.fBytes
+           << ", \"busy\": " << fWriter.fBusy / 1e9
+           << ", \"idle\": " << fWriter.fIdle / 1e9
+           << ", \"maxQueueDepth\": " << fMaxQueueDepth
+           << ", \"queueDepth\": ";
+    fWriter.fQueueDepth.Report(stream);
+    stream << "}," << std::endl;
+
+    stream << "  \"snapshots\": [";
+    for (size_t i = 0; i < fSnapshots.size(); ++i)
+    {
+        const TSnapshot & snapshot = fSnapshots[i];
+
+        stream << (i != 0 ? "," : "") << std::endl
+               << "    {\"time\": " << snapshot.fTime
+               << ", \"events\": " << snapshot.fEvents
+               << ", \"busy\": " << snapshot.fBusy / 1e9
+               << ", \"results\": " << snapshot.fResults
+               << ", \"bytes\": " << snapshot.fBytes
+               << ", \"queueDepth\": " << snapshot.fQueueDepth << "}";
+    }
+    stream << std::endl << "  ]" << std::endl;
+    stream << "}" << std::endl;
+}
+
+void TStatistics::WriteFile(bool final)
+{
+    std::string temporary = fPath + ".tmp";
+
+    /* Write aside and rename, so that readers never see a partial file */
+    {
+        std::ofstream file(temporary.c_str());
+        if (!file)
+        {
+            return;
+        }
+
+        Report(file, final);
+    }
+
+    rename(temporary.c_str(), fPath.c_str());
+}
+
+void * TStatistics::SnapshotThread(void * statistics)
+{
+    TStatistics * self = reinterpret_cast<TStatistics *>(statistics);
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += self->fInterval;
+
+    pthread_mutex_lock(&self->fSnapshotLock);
+    while (!self->fStopping)
+    {
+        TSnapshot snapshot;
+
+        /* Woken up before the deadline, either to stop or for nothing */
+        if (pthread_cond_timedwait(&self->fSnapshotStop, &self->fSnapshotLock, &deadline) != ETIMEDOUT || self->fStopping)
+        {
+            continue;
+        }
+        deadline.tv_sec += self->fInterval;
+
+        pthread_mutex_unlock(&self->fSnapshotLock);
+
+        self->TakeSnapshot(snapshot);
+        self->fSnapshots.push_back(snapshot);
+        self->WriteFile(false);
+
+        pthread_mutex_lock(&self->fSnapshotLock);
+    }
+    pthread_mutex_unlock(&self->fSnapshotLock);
+
+    return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TStatistics.h
+ * PURPOSE:          Run statistics
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TSTATISTICS_H__
+#define __TSTATISTICS_H__
+
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+/**
+ * Amount of sub buckets per power of two in the histograms, as a power of two.
+ * 5 gives a precision of about 3% on any recorded value
+ */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Event phases timed by the statistics
+ */
+enum TPhase
+{
+    PHASE_INIT,
+    PHASE_RUN,
+    PHASE_CLEAR,
+    PHASE_MAX
+};
+
+/**
+ * Log-linear histogram, in the spirit of HdrHistogram: each power of two is
+ * split in HISTOGRAM_SUB_BUCKETS linear buckets. Recording is a few instructions
+ * and histograms of different threads can be merged exactly.
+ * It has no constructor, a zeroed histogram is an empty one.
+ */
+struct THistogram
+{
+    /**
+     * This function records a value in the histogram.
+     * @param value The value to record
+     * @param count How many times to record it
+     */
+    inline void Record(unsigned long long value, unsigned long long count = 1)
+    {
+        unsigned int index;
+
+        if (value < HISTOGRAM_SUB_BUCKETS)
+        {
+            index = value;
+        }
+        else
+        {
+            unsigned int exponent = 63 - __builtin_clzll(value);
+            index = (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+        }
+
+        fCounts[index] += count;
+        fCount += count;
+        fSum += value * count;
+        if (value > fMax)
+        {
+            fMax = value;
+        }
+        if (fMin == 0 || value < fMin)
+        {
+            fMin = value;
+        }
+    }
+    /**
+     * This function adds another histogram to this one.
+     * @param histogram The histogram to add
+     */
+    void Merge(const THistogram & histogram);
+    /**
+     * This function returns the value below which a given percentage of the recorded values fall.
+     * @param percentile The percentage, between 0 and 100
+     * @return The highest value equivalent to the one found (within the histogram precision)
+     */
+    unsigned long long GetPercentile(double percentile) const;
+    /**
+     * This function writes the histogram summary as a JSON object.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream) const;
+
+    /**
+     * Amount of values recorded
+     */
+    unsigned long long fCount;
+    /**
+     * Sum of the values recorded
+     */
+    unsigned long long fSum;
+    /**
+     * Minimum value recorded. 0 values are not taken into account
+     */
+    unsigned long long fMin;
+    /**
+     * Maximum value recorded
+     */
+    unsigned long long fMax;
+    /**
+     * The buckets
+     */
+    unsigned long long fCounts[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Statistics of a room of the threads factory. They are only updated by the thread in the room.
+ * Times are in ns.
+ */
+struct TThreadStatistics
+{
+    /**
+     * Timing of each phase of the events
+     */
+    THistogram fPhases[PHASE_MAX];
+    /**
+     * Amount of events completed
+     */
+    unsigned long long fEvents;
+    /**
+     * Time spent in the simulation, including fPipeLockWait
+     */
+    unsigned long long fBusy;
+    /**
+     * Time spent waiting on the init lock (pilot threads only)
+     */
+    unsigned long long fInitLockWait;
+    /**
+     * Time spent waiting on the results pipe lock
+     */
+    unsigned long long fPipeLockWait;
+    /**
+     * Amount of results queued
+     */
+    unsigned long long fResults;
+    /**
+     * Bytes of results queued
+     */
+    unsigned long long fBytes;
+};
+
+/**
+ * Statistics of the writing thread. Times are in ns.
+ */
+struct TWriterStatistics
+{
+    /**
+     * Amount of results written (or reduced)
+     */
+    unsigned long long fResults;
+    /**
+     * Bytes of results written (or reduced)
+     */
+    unsigned long long fBytes;
+    /**
+     * Time spent writing (or reducing) results
+     */
+    unsigned long long fBusy;
+    /**
+     * Time spent waiting for results
+     */
+    unsigned long long fIdle;
+    /**
+     * End of the last read, to account the time spent writing
+     */
+    unsigned long long fLastRead;
+    /**
+     * Results waiting in the pipe, as seen by the writer on each read
+     */
+    THistogram fQueueDepth;
+};
+
+/**
+ * Periodic snapshot of the run
+ */
+struct TSnapshot
+{
+    /**
+     * Time of the snapshot since the run start, in s
+     */
+    double fTime;
+    /**
+     * Events completed so far
+     */
+    unsigned long long fEvents;
+    /**
+     * Time spent in the simulation so far by all the threads, in ns
+     */
+    unsigned long long fBusy;
+    /**
+     * Results written so far
+     */
+    unsigned long long fResults;
+    /**
+     * Bytes written so far
+     */
+    unsigned long long fBytes;
+    /**
+     * Results waiting in the pipe at snapshot time
+     */
+    long fQueueDepth;
+};
+
+class TStatistics
+{
+public:
+    /**
+     * This function returns a monotonic timestamp.
+     * @return The timestamp, in ns
+     */
+    static inline unsigned long long Now(void)
+    {
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000ULL + now.tv_nsec;
+    }
+    /**
+     * This function starts collecting statistics. It has to be called once the threads
+     * factory is configured and before any thread is started.
+     * @param path Path of the JSON file to write the statistics to
+     * @param threads Amount of rooms in the threads factory
+     * @param interval Period of the snapshots, in s. 0 to disable them
+     * @return true on success, false if the file cannot be written
+     */
+    bool Start(const char * path, unsigned int threads, unsigned int interval);
+    /**
+     * This function stops collecting statistics and writes them. It has to be called
+     * once all the threads, including the writer, are done.
+     * @param events Amount of events of the run
+     */
+    void Stop(unsigned long events);
+    /**
+     * This function returns the statistics of the calling thread.
+     * Threads which weren't created by the threads factory share the same statistics.
+     * @return The statistics. It cannot fail
+     */
+    TThreadStatistics * GetThread(void);
+    /**
+     * This function returns the statistics of the writing thread.
+     * @return The statistics
+     */
+    TWriterStatistics * GetWriter(void)
+    {
+        return &fWriter;
+    }
+    /**
+     * This function accounts a result sent to the writing thread. It's called with
+     * the pipe lock held.
+     * @param wait Time spent waiting on the pipe lock, in ns
+     * @param bytes Size of the result
+     */
+    void Queued(unsigned long long wait, unsigned long bytes);
+    /**
+     * This function accounts a result received by the writing thread.
+     * @param start Timestamp of the read start
+     * @param bytes Size of the result
+     */
+    void Dequeued(unsigned long long start, unsigned long bytes);
+    /**
+     * This is the static function to have the statistics. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the statistics class.
+     */
+    static TStatistics * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor.
+     */
+    ~TStatistics();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TStatistics();
+    /**
+     * Allocates the statistics of a room, from the thread in it, so that they're local to it.
+     * @param slot The room
+     * @return The statistics
+     */
+    TThreadStatistics * AllocateThread(unsigned int slot);
+    /**
+     * Takes a snapshot of the run.
+     * @param snapshot Output variable, receiving the snapshot
+     */
+    void TakeSnapshot(TSnapshot & snapshot);
+    /**
+     * Writes all the statistics, as JSON.
+     * @param stream The stream to write to
+     * @param final Whether the run is over
+     */
+    void Report(std::ostream & stream, bool final);
+    /**
+     * Writes the statistics file, atomically (so that it can be read while the run is going on).
+     * @param final Whether the run is over
+     */
+    void WriteFile(bool final);
+    /**
+     * Entry point of the snapshots thread.
+     * @param statistics The statistics class
+     */
+    static void * SnapshotThread(void * statistics);
+
+    /**
+     * Path of the JSON file
+     */
+    std::string fPath;
+    /**
+     * Statistics of each room. The extra last one is for threads out of the factory
+     */
+    std::vector<TThreadStatistics *> fThreads;
+    /**
+     * Statistics of the writing thread
+     */
+    TWriterStatistics fWriter;
+    /**
+     * Results currently in the pipe
+     */
+    volatile long fQueueDepth;
+    /**
+     * Maximum of results that were in the pipe
+     */
+    long fMaxQueueDepth;
+    /**
+     * Timestamps of the run start and end
+     */
+    unsigned long long fStart;
+    unsigned long long fEnd;
+    /**
+     * Amount of events of the run, once done
+     */
+    unsigned long fEvents;
+    /**
+     * Snapshots taken so far
+     */
+    std::vector<TSnapshot> fSnapshots;
+    /**
+     * Period of the snapshots, in s. 0 if disabled
+     */
+    unsigned int fInterval;
+    /**
+     * The snapshots thread, and what's needed to stop it
+     */
+    pthread_t fSnapshotThread;
+    pthread_mutex_t fSnapshotLock;
+    pthread_cond_t fSnapshotStop;
+    bool fStopping;
+};
+
+#endif
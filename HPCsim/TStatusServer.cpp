@@ -0,0 +1,301 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TStatusServer.cpp
+ * PURPOSE:          Live progress over a local socket
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <sstream>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "TStatusServer.h"
+#include "TThreadsFactory.h"
+
+static const char * gStateNames[STATE_MAX] = { "idle", "init", "run", "clear", "wait" };
+
+static unsigned long long Now(void)
+{
+    struct timespec now;
+
+    /* Same clock than the threads, to compare with their event start */
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+TStatusServer::TStatusServer()
+{
+    fSocket = -1;
+    fWakeUp[0] = -1;
+    fWakeUp[1] = -1;
+    fThreads = 0;
+    fThreadsCount = 0;
+    fEvents = 0;
+    fResults = 0;
+    fBytes = 0;
+    fStart = 0;
+    fLastQuery = 0;
+    fLastEvents = 0;
+}
+
+TStatusServer::~TStatusServer()
+{
+    Stop();
+    free(fThreads);
+}
+
+TStatusServer * TStatusServer::GetInstance(bool destroyInstance)
+{
+    static TStatusServer * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TStatusServer();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TStatusServer::Start(const char * path, unsigned int threads, unsigned long events)
+{
+    struct sockaddr_un address;
+    struct stat pathStat;
+    void * status;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    /* One cache line per room, they're written concurrently */
+    if (posix_memalign(&status, 64, (threads + 1) * sizeof(TThreadStatus)) != 0)
+    {
+        return false;
+    }
+    memset(status, 0, (threads + 1) * sizeof(TThreadStatus));
+    fThreads = reinterpret_cast<TThreadStatus *>(status);
+    fThreadsCount = threads;
+    fEvents = events;
+
+    /* A previous run may have left its socket, but don't remove anything else */
+    if (stat(path, &pathStat) == 0 && S_ISSOCK(pathStat.st_mode))
+    {
+        unlink(path);
+    }
+
+    fSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fSocket == -1)
+    {
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (bind(fSocket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1 ||
+        listen(fSocket, 16) == -1)
+    {
+        close(fSocket);
+        fSocket = -1;
+        return false;
+    }
+    fPath = path;
+
+    if (pipe(fWakeUp) == -1)
+    {
+        Stop();
+        return false;
+    }
+
+    fStart = Now();
+    fLastQuery = fStart;
+
+    if (pthread_create(&fMonitorThread, 0, MonitorThread, this) != 0)
+    {
+        close(fWakeUp[0]);
+        close(fWakeUp[1]);
+        fWakeUp[0] = -1;
+        Stop();
+        return false;
+    }
+
+    return true;
+}
+
+void TStatusServer::Stop(void)
+{
+    if (fSocket == -1)
+    {
+        return;
+    }
+
+    /* Wake up the monitoring thread and wait for it */
+    if (fWakeUp[0] != -1)
+    {
+        void * ret;
+        char stop = 0;
+
+        if (write(fWakeUp[1], &stop, sizeof(stop)) == sizeof(stop))
+        {
+            pthread_join(fMonitorThread, &ret);
+        }
+
+        close(fWakeUp[0]);
+        close(fWakeUp[1]);
+        fWakeUp[0] = -1;
+    }
+
+    close(fSocket);
+    fSocket = -1;
+    unlink(fPath.c_str());
+}
+
+TThreadStatus * TStatusServer::GetThread(void)
+{
+    unsigned int slot = TThreadsFactory::GetCurrentSlot();
+
+    /* Threads out of the factory share the last status */
+    if (slot >= fThreadsCount)
+    {
+        slot = fThreadsCount;
+    }
+
+    return &fThreads[slot];
+}
+
+void TStatusServer::Report(std::ostream & stream)
+{
+    unsigned long long now = Now();
+    unsigned long long done = 0;
+    unsigned int inFlight = 0;
+    double elapsed = (now - fStart) / 1e9;
+    double rate, recentRate;
+
+    for (unsigned int i = 0; i <= fThreadsCount; ++i)
+    {
+        done += fThreads[i].fEvents;
+        if (fThreads[i].fState != STATE_IDLE)
+        {
+            ++inFlight;
+        }
+    }
+
+    rate = (elapsed > 0.0 ? done / elapsed : 0.0);
+    recentRate = (now > fLastQuery ? (done - fLastEvents) / ((now - fLastQuery) / 1e9) : 0.0);
+    fLastQuery = now;
+    fLastEvents = done;
+
+    stream << "{" << std::endl;
+    stream << "  \"events\": " << fEvents << "," << std::endl;
+    stream << "  \"done\": " << done << "," << std::endl;
+    stream << "  \"inFlight\": " << inFlight << "," << std::endl;
+    stream << "  \"elapsed\": " << elapsed << "," << std::endl;
+    stream << "  \"eventsPerSecond\": " << rate << "," << std::endl;
+    stream << "  \"recentEventsPerSecond\": " << recentRate << "," << std::endl;
+    /* -1 when it cannot be estimated yet */
+    stream << "  \"eta\": " << ((rate > 0.0 && done <= fEvents) ? (fEvents - done) / rate : -1.0) << "," << std::endl;
+    stream << "  \"resultsWritten\": " << fResults << "," << std::endl;
+    stream << "  \"bytesWritten\": " << fBytes << "," << std::endl;
+    stream << "  \"threads\": [";
+    for (unsigned int i = 0; i < fThreadsCount; ++i)
+    {
+        unsigned int state = fThreads[i].fState;
+        unsigned long long eventStart = fThreads[i].fEventStart;
+
+        stream << (i != 0 ? "," : "") << std::endl
+               << "    {\"slot\": " << i
+               << ", \"state\": \"" << gStateNames[state < STATE_MAX ? state : static_cast<unsigned int>(STATE_IDLE)] << "\""
+               << ", \"events\": " << fThreads[i].fEvents;
+        /* How long the current event has been running, to spot stragglers */
+        if (state != STATE_IDLE && state != STATE_WAIT && now >= eventStart)
+        {
+            stream << ", \"eventTime\": " << (now - eventStart) / 1e9;
+        }
+        stream << "}";
+    }
+    stream << std::endl << "  ]" << std::endl;
+    stream << "}" << std::endl;
+}
+
+void * TStatusServer::MonitorThread(void * server)
+{
+    TStatusServer * self = reinterpret_cast<TStatusServer *>(server);
+    struct timeval timeout = { 1, 0 };
+    sigset_t signals;
+
+    /* Signals are for the simulation threads */
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    while (true)
+    {
+        struct pollfd fds[2];
+        std::ostringstream reply;
+        std::string text;
+        size_t sent = 0;
+        int client;
+
+        fds[0].fd = self->fSocket;
+        fds[0].events = POLLIN;
+        fds[1].fd = self->fWakeUp[0];
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        /* Asked to stop */
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+
+        client = accept(self->fSocket, 0, 0);
+        if (client == -1)
+        {
+            continue;
+        }
+
+        /* Don't let a stuck client block the monitoring */
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        self->Report(reply);
+        text = reply.str();
+        while (sent < text.size())
+        {
+            ssize_t chunk = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if (chunk <= 0)
+            {
+                break;
+            }
+
+            sent += chunk;
+        }
+
+        close(client);
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TStatusServer.h
+ * PURPOSE:          Live progress over a local socket
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TSTATUSSERVER_H__
+#define __TSTATUSSERVER_H__
+
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <ostream>
+
+/**
+ * What a thread is doing
+ */
+enum TThreadState
+{
+    STATE_IDLE,
+    STATE_INIT,
+    STATE_RUN,
+    STATE_CLEAR,
+    STATE_WAIT,
+    STATE_MAX
+};
+
+/**
+ * Status of a room of the threads factory. It's only written by the thread in the room
+ * and read on the fly by the status server, so it's kept on its own cache line.
+ */
+struct TThreadStatus
+{
+    /**
+     * This function changes the state of the thread.
+     * Entering STATE_INIT starts a new event.
+     * @param state The new state
+     */
+    inline void SetState(TThreadState state)
+    {
+        if (state == STATE_INIT)
+        {
+            struct timespec now;
+
+            /* Coarse clock is enough to find stragglers, and it's much cheaper */
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+            fEventStart = now.tv_sec * 1000000000ULL + now.tv_nsec;
+        }
+
+        fState = state;
+    }
+
+    /**
+     * Current TThreadState
+     */
+    volatile unsigned int fState;
+    /**
+     * Amount of events completed
+     */
+    volatile unsigned long long fEvents;
+    /**
+     * Start of the current event, in ns
+     */
+    volatile unsigned long long fEventStart;
+} __attribute__((aligned(64)));
+
+class TStatusServer
+{
+public:
+    /**
+     * This function creates the socket and starts serving it. It has to be called once the threads
+     * factory is configured and before any thread is started.
+     * Each client connecting to the socket receives the status of the run, as JSON, and is then disconnected.
+     * @param path Path of the Unix socket to create
+     * @param threads Amount of rooms in the threads factory
+     * @param events Amount of events of the run
+     * @return true on success, false otherwise
+     */
+    bool Start(const char * path, unsigned int threads, unsigned long events);
+    /**
+     * This function stops serving and removes the socket.
+     */
+    void Stop(void);
+    /**
+     * This function returns the status of the calling thread.
+     * Threads which weren't created by the threads factory share the same status.
+     * @return The status. It cannot fail
+     */
+    TThreadStatus * GetThread(void);
+    /**
+     * This function accounts a result written by the writing thread.
+     * @param bytes Size of the result
+     */
+    inline void Written(unsigned long bytes)
+    {
+        ++fResults;
+        fBytes += bytes;
+    }
+    /**
+     * This is the static function to have the status server. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the status server class.
+     */
+    static TStatusServer * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It stops serving, if needed.
+     */
+    ~TStatusServer();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TStatusServer();
+    /**
+     * Writes the status of the run, as JSON.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * Entry point of the monitoring thread.
+     * @param server The status server class
+     */
+    static void * MonitorThread(void * server);
+
+    /**
+     * Path of the socket
+     */
+    std::string fPath;
+    /**
+     * Listening socket. -1 if not serving
+     */
+    int fSocket;
+    /**
+     * Pipe used to wake up the monitoring thread when stopping
+     */
+    int fWakeUp[2];
+    /**
+     * The monitoring thread
+     */
+    pthread_t fMonitorThread;
+    /**
+     * Status of each room. The extra last one is for threads out of the factory
+     */
+    TThreadStatus * fThreads;
+    /**
+     * Amount of rooms
+     */
+    unsigned int fThreadsCount;
+    /**
+     * Amount of events of the run
+     */
+    unsigned long fEvents;
+    /**
+     * Results and bytes written so far
+     */
+    volatile unsigned long long fResults;
+    volatile unsigned long long fBytes;
+    /**
+     * Start of the run, in ns
+     */
+    unsigned long long fStart;
+    /**
+     * Previous query, to compute the recent throughput
+     */
+    unsigned long long fLastQuery;
+    unsigned long long fLastEvents;
+};
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TSweep.cpp
+ * PURPOSE:          Parameter sweep, several option sets run on the same threads
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "TSweep.h"
+#include "RngStream.h"
+
+/* Blanks between the output and the options of a configuration */
+#define BLANKS " \t\r\n"
+
+TSweep::TSweep()
+{
+    fEvents = 0;
+    fCurrent = 0;
+    fNext = 0;
+}
+
+TSweep::~TSweep()
+{
+    for (size_t i = 0; i < fSets.size(); ++i)
+    {
+        if (fSets[i].fOutputFD != -1)
+        {
+            close(fSets[i].fOutputFD);
+        }
+    }
+}
+
+TSweep * TSweep::GetInstance(bool destroyInstance)
+{
+    static TSweep * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TSweep();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TSweep::Load(const char * path)
+{
+    std::set<std::string> outputs;
+    char * line = 0;
+    size_t size = 0;
+    unsigned int number = 0;
+    bool loaded = true;
+    FILE * file;
+
+    file = fopen(path, "r");
+    if (file == 0)
+    {
+        fprintf(stderr, "Failed opening sweep file %s\n", path);
+        return false;
+    }
+
+    while (getline(&line, &size, file) != -1)
+    {
+        TSweepSet set;
+        size_t start;
+        size_t end;
+        std::string text(line);
+
+        ++number;
+        start = text.find_first_not_of(BLANKS);
+        if (start == std::string::npos || text[start] == '#')
+        {
+            continue;
+        }
+
+        end = text.find_first_of(BLANKS, start);
+        set.fOutput = text.substr(start, end - start);
+        start = text.find_first_not_of(BLANKS, end);
+        if (start != std::string::npos)
+        {
+            set.fOptions = text.substr(start, text.find_last_not_of(BLANKS) + 1 - start);
+        }
+
+        /* They'd overwrite each other */
+        if (!outputs.insert(set.fOutput).second)
+        {
+            fprintf(stderr, "%s:%u: output %s is already the one of another configuration\n", path, number, set.fOutput.c_str());
+            loaded = false;
+            break;
+        }
+
+        set.fIndex = fSets.size();
+        set.fContext = 0;
+        set.fInitialized = false;
+        set.fFailed = false;
+        set.fDispatched = 0;
+        set.fOutputFD = -1;
+        fSets.push_back(set);
+    }
+
+    free(line);
+    fclose(file);
+
+    if (loaded && fSets.empty())
+    {
+        fprintf(stderr, "No configuration in sweep file %s\n", path);
+        loaded = false;
+    }
+
+    return loaded;
+}
+
+void TSweep::Start(unsigned long events)
+{
+    const double * seed = RngStream::GetNextSeed();
+
+    fEvents = events;
+    for (size_t i = 0; i < fSets.size(); ++i)
+    {
+        memcpy(fSets[i].fNextSeed, seed, sizeof(fSets[i].fNextSeed));
+    }
+}
+
+bool TSweep::Reserve(unsigned int max, unsigned int & count)
+{
+    for (size_t i = 0; i < fSets.size(); ++i)
+    {
+        TSweepSet * set = &fSets[(fNext + i) % fSets.size()];
+
+        if (set->fFailed || set->fDispatched >= fEvents)
+        {
+            continue;
+        }
+
+        /* The generator goes on with the streams of this configuration, where it left them */
+        if (set != fCurrent)
+        {
+            if (fCurrent != 0)
+            {
+                memcpy(fCurrent->fNextSeed, RngStream::GetNextSeed(), sizeof(fCurrent->fNextSeed));
+            }
+            RngStream::SetNextSeed(set->fNextSeed);
+            fCurrent = set;
+        }
+
+        count = ((fEvents - set->fDispatched < max) ? fEvents - set->fDispatched : max);
+        set->fDispatched += count;
+        fNext = set->fIndex + 1;
+
+        return true;
+    }
+
+    return false;
+}
+
+bool TSweep::IsComplete(void) const
+{
+    for (size_t i = 0; i < fSets.size(); ++i)
+    {
+        if (!fSets[i].fFailed && fSets[i].fDispatched < fEvents)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TSweep::OpenOutputs(void)
+{
+    for (size_t i = 0; i < fSets.size(); ++i)
+    {
+        if (!fSets[i].fInitialized)
+        {
+            continue;
+        }
+
+        fSets[i].fOutputFD = open(fSets[i].fOutput.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fSets[i].fOutputFD == -1)
+        {
+            fprintf(stderr, "Failed creating output of configuration %u: %s\n", fSets[i].fIndex, fSets[i].fOutput.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+unsigned long TSweep::Write(unsigned int set, const TResult * result)
+{
+    ssize_t written = write(fSets[set].fOutputFD, result, offsetof(TResult, fResult) + result->fResultLength);
+
+    return ((written > 0) ? written : 0);
+}
+
+void TSweep::Report(std::ostream & stream)
+{
+    unsigned int failed = 0;
+    unsigned int stopped = 0;
+
+    for (size_t i = 0; i < fSets.size(); ++i)
+    {
+        if (fSets[i].fFailed)
+        {
+            ++failed;
+        }
+        else if (fSets[i].fDispatched < fEvents)
+        {
+            stream << "Configuration " << fSets[i].fIndex << " (" << fSets[i].fOutput << ") stopped: " << (fEvents - fSets[i].fDispatched) << " events out of " << fEvents << " were never started" << std::endl;
+            ++stopped;
+        }
+    }
+
+    stream << "Swept " << (fSets.size() - failed - stopped) << " configurations out of " << fSets.size();
+    if (failed != 0)
+    {
+        stream << ", " << failed << " failed initializing";
+    }
+    if (stopped != 0)
+    {
+        stream << ", " << stopped << " stopped";
+    }
+    stream << std::endl;
+}
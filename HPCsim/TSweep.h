@@ -0,0 +1,157 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TSweep.h
+ * PURPOSE:          Parameter sweep, several option sets run on the same threads
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TSWEEP_H__
+#define __TSWEEP_H__
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include "simulation.h"
+
+/**
+ * A configuration of the sweep: an option set, and where its results go
+ */
+struct TSweepSet
+{
+    /**
+     * Index of the configuration, in the sweep file order
+     */
+    unsigned int fIndex;
+    std::string fOutput;
+    /**
+     * Options given to SimulationInit(), empty for none
+     */
+    std::string fOptions;
+    /**
+     * Context allocated by its SimulationInit()
+     */
+    void * fContext;
+    /**
+     * Whether its SimulationInit() went through, it has to be unloaded then
+     */
+    bool fInitialized;
+    /**
+     * Whether its SimulationInit() or RunInit() failed, its events are skipped
+     */
+    bool fFailed;
+    /**
+     * Events started so far
+     */
+    unsigned long fDispatched;
+    /**
+     * Seed of its next event, while the events of the other configurations are drawn
+     */
+    double fNextSeed[6];
+    int fOutputFD;
+};
+
+class TSweep
+{
+public:
+    /**
+     * This function reads the configurations of the sweep. Each line not empty and not starting
+     * with # is one: its output, then, after blanks, its options.
+     * @param path Path of the sweep file
+     * @return true on success, false otherwise (or if there's no configuration)
+     */
+    bool Load(const char * path);
+    /**
+     * This function returns the amount of configurations.
+     * @return Amount of configurations
+     */
+    inline unsigned int GetSize(void) const
+    {
+        return fSets.size();
+    }
+    /**
+     * This function returns a configuration.
+     * @param set Index of the configuration
+     * @return The configuration
+     */
+    inline TSweepSet & GetSet(unsigned int set)
+    {
+        return fSets[set];
+    }
+    /**
+     * This function gives to each configuration the next stream of the generator as
+     * first one, as if it was run alone.
+     * @param events Amount of events of each configuration
+     */
+    void Start(unsigned long events);
+    /**
+     * This function hands the next events to run, of the next configuration with events left
+     * (one after the other), and makes the stream of its next event the next one. The events have
+     * to be drawn before calling it again. It has to be called with the init lock held.
+     * @param max Maximum amount of events
+     * @param count Output variable, receiving the amount of consecutive events, up to max
+     * @return false once there are no events left
+     */
+    bool Reserve(unsigned int max, unsigned int & count);
+    /**
+     * This function returns the configuration of the events of the last Reserve().
+     * @return The configuration
+     */
+    inline TSweepSet * GetCurrent(void) const
+    {
+        return fCurrent;
+    }
+    /**
+     * This function tells whether all the events of the configurations not skipped were started.
+     * @return true if none is left, false if the sweep was stopped
+     */
+    bool IsComplete(void) const;
+    /**
+     * This function creates the outputs of the configurations initialized.
+     * @return true on success, false otherwise
+     */
+    bool OpenOutputs(void);
+    /**
+     * This function writes a result to the output of its configuration. Only the writer calls it.
+     * @param set Index of the configuration
+     * @param result The result
+     * @return Amount of bytes written
+     */
+    unsigned long Write(unsigned int set, const TResult * result);
+    /**
+     * This function writes the configurations which didn't run all their events to the given stream.
+     * @param stream The stream to write to
+     */
+    void Report(std::ostream & stream);
+    /**
+     * This is the static function to have the sweep. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the sweep class.
+     */
+    static TSweep * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It closes the outputs.
+     */
+    ~TSweep();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TSweep();
+
+    std::vector<TSweepSet> fSets;
+    unsigned long fEvents;
+    /**
+     * Configuration whose next seed is the one of the generator
+     */
+    TSweepSet * fCurrent;
+    /**
+     * Configuration Reserve() looks at first, so that they all progress together
+     */
+    unsigned int fNext;
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TTaskGroup.cpp
+ * PURPOSE:          Fork/join of subtasks inside an event
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstring>
+
+#include "TTaskGroup.h"
+#include "TThreadsFactory.h"
+#include "Exceptions.h"
+
+TTaskGroup::TTaskGroup(const RngStream & eventRand, void * simContext) : fSubstreams(eventRand)
+{
+    fSimulationContext = simContext;
+    fSweepSet = tSweepSet;
+    fStageEvent = tStageEvent;
+    fNextTask = 0;
+    fCompleted = 0;
+    fHelpers = 0;
+    fFailed = false;
+    pthread_mutex_init(&fLock, 0);
+    pthread_cond_init(&fDone, 0);
+}
+
+TTaskGroup::~TTaskGroup()
+{
+    for (size_t i = 0; i < fTasks.size(); ++i)
+    {
+        for (size_t j = 0; j < fTasks[i]->fHeld.size(); ++j)
+            delete fTasks[i]->fHeld[j];
+        delete fTasks[i];
+    }
+
+    pthread_cond_destroy(&fDone);
+    pthread_mutex_destroy(&fLock);
+}
+
+bool TTaskGroup::Spawn(TTaskRun * function, void * argument)
+{
+    TTask * task;
+    bool needHelper;
+
+    if (function == 0)
+        return false;
+
+    /* Substreams are handed in spawn order, so that the subtask
+     * stream doesn't depend on the thread that will run it
+     */
+    fSubstreams.ResetNextSubstream();
+    task = new TTask(function, argument, fSubstreams);
+    /* Its results for the next stage wait for Wait(), which numbers them in spawn order */
+    if (fStageEvent != 0)
+    {
+        task->fStageEvent = *fStageEvent;
+        task->fStageEvent.fHeld = &task->fHeld;
+    }
+
+    pthread_mutex_lock(&fLock);
+    fTasks.push_back(task);
+    /* Only ask for a new helper if the current ones cannot absorb the queue */
+    needHelper = (fHelpers < fTasks.size() - fNextTask);
+    if (needHelper)
+        ++fHelpers;
+    pthread_mutex_unlock(&fLock);
+
+    /* If there's no idle room in the factory, the event thread will do the job in Wait() */
+    if (needHelper && !TThreadsFactory::GetInstance()->TryCreateThread(Helper, this))
+    {
+        pthread_mutex_lock(&fLock);
+        --fHelpers;
+        pthread_mutex_unlock(&fLock);
+    }
+
+    return true;
+}
+
+bool TTaskGroup::RunNext(void)
+{
+    TTask * task;
+    RngStream * previousRand;
+    TSweepSet * previousSweepSet;
+    TStageEvent * previousStageEvent;
+    jmp_buf previousEnv;
+    bool previousInTry;
+    volatile bool failed = false;
+
+    pthread_mutex_lock(&fLock);
+    if (fNextTask == fTasks.size())
+    {
+        pthread_mutex_unlock(&fLock);
+        return false;
+    }
+    task = fTasks[fNextTask++];
+    pthread_mutex_unlock(&fLock);
+
+    /* When run from Wait(), we're nested in the event try block: save it
+     * so that the event keeps its own error handling once we're done
+     */
+    previousRand = tRand;
+    previousSweepSet = tSweepSet;
+    previousStageEvent = tStageEvent;
+    previousInTry = gInTry;
+    memcpy(previousEnv, gJumpEnv, sizeof(jmp_buf));
+
+    tRand = &task->fRand;
+    tSweepSet = fSweepSet;
+    tStageEvent = ((fStageEvent != 0) ? &task->fStageEvent : 0);
+    HPCSIM_TRY
+    {
+        task->fFunction(fSimulationContext, task->fArgument);
+    }
+    HPCSIM_EXCEPT
+    {
+        failed = true;
+    }
+    HPCSIM_END
+
+    memcpy(gJumpEnv, previousEnv, sizeof(jmp_buf));
+    gInTry = previousInTry;
+    tRand = previousRand;
+    tSweepSet = previousSweepSet;
+    tStageEvent = previousStageEvent;
+
+    pthread_mutex_lock(&fLock);
+    ++fCompleted;
+    if (failed)
+        fFailed = true;
+    pthread_cond_broadcast(&fDone);
+    pthread_mutex_unlock(&fLock);
+
+    return true;
+}
+
+bool TTaskGroup::Wait(void)
+{
+    bool failed;
+
+    /* First, help ourselves */
+    while (RunNext());
+
+    /* Then, wait for the subtasks run by the helpers and for the helpers to leave */
+    pthread_mutex_lock(&fLock);
+    while (fCompleted != fTasks.size() || fHelpers != 0)
+        pthread_cond_wait(&fDone, &fLock);
+
+    /* Everything is done, we can release the subtasks. Their results go to the next stage as if queued by the event */
+    for (size_t i = 0; i < fTasks.size(); ++i)
+    {
+        if (fStageEvent != 0)
+            TPipeline::GetInstance()->Release(fStageEvent, fTasks[i]->fHeld);
+        delete fTasks[i];
+    }
+    fTasks.clear();
+    fNextTask = 0;
+    fCompleted = 0;
+
+    failed = fFailed;
+    fFailed = false;
+    pthread_mutex_unlock(&fLock);
+
+    return !failed;
+}
+
+void * TTaskGroup::Helper(void * group)
+{
+    TTaskGroup * taskGroup = reinterpret_cast<TTaskGroup *>(group);
+
+    /* Run subtasks till there are none left */
+    while (taskGroup->RunNext());
+
+    /* Leave the group. Once the lock is released, the group may be gone */
+    pthread_mutex_lock(&taskGroup->fLock);
+    --taskGroup->fHelpers;
+    pthread_cond_broadcast(&taskGroup->fDone);
+    pthread_mutex_unlock(&taskGroup->fLock);
+
+    return 0;
+}
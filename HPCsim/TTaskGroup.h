@@ -0,0 +1,140 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TTaskGroup.h
+ * PURPOSE:          Fork/join of subtasks inside an event
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TTASKGROUP_H__
+#define __TTASKGROUP_H__
+
+#include <pthread.h>
+#include <vector>
+
+#include "RngStream.h"
+#include "TPipeline.h"
+#include "simulation.h"
+
+/**
+ * The pseudo-random stream of the event (or of the subtask) running in the current thread.
+ * It is defined in hpcsim.cpp and is the one used by RandU01() and QueueResult().
+ */
+extern __thread RngStream * tRand;
+
+/**
+ * The configuration of the sweep of the event running in the current thread, 0 outside of a sweep.
+ * It is defined in hpcsim.cpp and tells QueueResult() where the results go.
+ */
+struct TSweepSet;
+extern __thread TSweepSet * tSweepSet;
+
+/**
+ * The event running in the current thread in a pipeline, 0 outside of a pipeline.
+ * It is defined in hpcsim.cpp and tells QueueResult() where the results go, and EventInput() its input.
+ */
+extern __thread TStageEvent * tStageEvent;
+
+struct TTask
+{
+    TTaskRun * fFunction;
+    void * fArgument;
+    RngStream fRand;
+    /**
+     * The event of the pipeline as seen by the subtask, and the results it holds for the next stage
+     */
+    TStageEvent fStageEvent;
+    std::vector<TStageItem *> fHeld;
+    TTask(TTaskRun * function, void * argument, const RngStream & rand) : fFunction(function), fArgument(argument), fRand(rand) { } ;
+};
+
+class TTaskGroup
+{
+public:
+    /**
+     * Constructor.
+     * @param eventRand The stream of the event forking the subtasks. Subtasks streams are derived from it
+     * @param simContext The simulation context to pass to the subtasks
+     */
+    TTaskGroup(const RngStream & eventRand, void * simContext);
+    /**
+     * Destructor. It doesn't wait for the subtasks, you have to call Wait() first.
+     */
+    ~TTaskGroup();
+    /**
+     * This function queues a subtask and lends it an idle thread of the threads factory if
+     * there's any. Otherwise, the subtask will be run by the event thread in Wait().
+     * The n-th queued subtask receives the n-th substream of the event stream,
+     * whatever the thread that will run it.
+     * @param function Function to execute
+     * @param argument Optional argument to pass to the function
+     * @return true if the subtask was queued, false otherwise
+     */
+    bool Spawn(TTaskRun * function, void * argument);
+    /**
+     * This function runs the queued subtasks in the calling thread while there are some left,
+     * and then waits for the ones being run by other threads. In a pipeline, the results the
+     * subtasks held for the next stage are then queued, in spawn order.
+     * @return true if all the subtasks succeed, false if at least one failed
+     */
+    bool Wait(void);
+    /**
+     * Thread entry point of the threads lent by the threads factory.
+     * @param group The group to help
+     */
+    static void * Helper(void * group);
+
+private:
+    /**
+     * Runs the next queued subtask, if any.
+     * @return true if a subtask was run, false if there was none left
+     */
+    bool RunNext(void);
+
+    /**
+     * Copy of the event stream, advanced to the next substream for each new subtask.
+     */
+    RngStream fSubstreams;
+    /**
+     * The simulation context to pass to the subtasks.
+     */
+    void * fSimulationContext;
+    /**
+     * The configuration of the sweep of the event, for the results of the subtasks.
+     */
+    TSweepSet * fSweepSet;
+    /**
+     * The event of the pipeline, for the input and the results of the subtasks.
+     */
+    TStageEvent * fStageEvent;
+    /**
+     * All the subtasks spawned since last Wait().
+     */
+    std::vector<TTask *> fTasks;
+    /**
+     * Index in fTasks of the next subtask to run.
+     */
+    size_t fNextTask;
+    /**
+     * Number of subtasks that were run completely.
+     */
+    size_t fCompleted;
+    /**
+     * Number of threads helping the group. The group cannot be released while they're running.
+     */
+    unsigned int fHelpers;
+    /**
+     * Set to true if a subtask failed since last Wait().
+     */
+    bool fFailed;
+    /**
+     * Protects all the members above, except fSubstreams which is only accessed by the event thread.
+     */
+    pthread_mutex_t fLock;
+    /**
+     * Signaled each time a subtask completes or a helper leaves.
+     */
+    pthread_cond_t fDone;
+};
+
+#endif
@@ -7,14 +7,24 @@
  */
 
 #include <cassert>
+#include <cerrno>
+#include <ctime>
 #include "TThreadsFactory.h"
 #include "Exceptions.h"
+#include "TStatistics.h"
+#include "TTracer.h"
+#include "TProfiler.h"
+
+/* Room of the current thread in the threads list */
+static __thread unsigned int tSlot = NO_SLOT;
 
 TThreadsFactory::TThreadsFactory()
 {
     fThreads = 0;
     fMaxThreads = 0;
     fBeingDestroyed = false;
+    fCreationLimiterWait = 0;
+    fInitLockWait = 0;
     if (sem_init(&fInitLock, 0, 1) != 0)
         assert(false);
     if (sem_init(&fThreadsLock, 0, 1) != 0)
@@ -31,7 +41,7 @@ TThreadsFactory::~TThreadsFactory()
     {
         /* Wait for all the threads to complete */
         for (unsigned int i = 0; i < fMaxThreads; ++i)
-            sem_wait(&fCreationLimiter);
+            Wait(&fCreationLimiter);
 
         /* Also cleanup any left thread */
         for (unsigned int i = 0; i < fMaxThreads; ++i)
@@ -86,6 +96,34 @@ bool TThreadsFactory::SetMaxThreads(unsigned int maxThreads)
     return true;
 }
 
+void TThreadsFactory::SetAffinity(const std::vector<int> & cpus)
+{
+    fCpus = cpus;
+}
+
+int TThreadsFactory::GetCpu(unsigned int slot)
+{
+    if (fCpus.empty())
+        return -1;
+
+    return fCpus[slot % fCpus.size()];
+}
+
+unsigned int TThreadsFactory::GetCurrentSlot(void)
+{
+    return tSlot;
+}
+
+unsigned long long TThreadsFactory::GetCreationLimiterWait(void)
+{
+    return fCreationLimiterWait;
+}
+
+unsigned long long TThreadsFactory::GetInitLockWait(void)
+{
+    return fInitLockWait;
+}
+
 TThreadsFactory * TThreadsFactory::GetInstance(bool destroyInstance)
 {
     static TThreadsFactory * gThisInstance = 0;
@@ -107,9 +145,6 @@ TThreadsFactory * TThreadsFactory::GetInstance(bool destroyInstance)
 
 bool TThreadsFactory::CreateThread(void * (* function)(void *), void * argument)
 {
-    unsigned int i = 0;
-    TThreadContext * context;
-
     /* If we weren't configured, bail out */
     if (fMaxThreads == 0)
         return false;
@@ -118,10 +153,25 @@ bool TThreadsFactory::CreateThread(void * (* function)(void *), void * argument)
     if (fBeingDestroyed)
         return false;
 
+    unsigned long long start = TStatistics::Now();
+
     /* Wait until there's a room left for another thread */
-    sem_wait(&fCreationLimiter);
+    Wait(&fCreationLimiter);
+    unsigned long long room = TStatistics::Now();
     /* We'll be the only one to spawn now */
-    sem_wait(&fInitLock);
+    Wait(&fInitLock);
+
+    unsigned long long end = TStatistics::Now();
+
+    fCreationLimiterWait += room - start;
+    fInitLockWait += end - room;
+
+    TTracer * tracer = TTracer::GetActive();
+    if (tracer != 0)
+    {
+        tracer->Wait(TRACE_CREATION_LIMITER, start, room);
+        tracer->Wait(TRACE_INIT_LOCK, room, end);
+    }
 
     /* Don't allow creation if we're in the process of dying */
     if (fBeingDestroyed)
@@ -131,8 +181,57 @@ bool TThreadsFactory::CreateThread(void * (* function)(void *), void * argument)
         return false;
     }
 
+    /* Start thread */
+    if (StartThread(function, argument))
+        return true;
+
+    /* If we reach that point, we failed to spawn thread
+     * Release everything not to deadlock
+     */
+    sem_post(&fInitLock);
+    sem_post(&fCreationLimiter);
+
+    return false;
+}
+
+bool TThreadsFactory::TryCreateThread(void * (* function)(void *), void * argument)
+{
+    /* If we weren't configured, bail out */
+    if (fMaxThreads == 0)
+        return false;
+
+    /* Don't allow creation if we're in the process of dying */
+    if (fBeingDestroyed)
+        return false;
+
+    /* Only take a room if there's one left, never wait for it */
+    if (sem_trywait(&fCreationLimiter) != 0)
+        return false;
+
+    /* Don't allow creation if we're in the process of dying */
+    if (fBeingDestroyed)
+    {
+        sem_post(&fCreationLimiter);
+        return false;
+    }
+
+    /* Start thread */
+    if (StartThread(function, argument))
+        return true;
+
+    /* Failed, give the room back */
+    sem_post(&fCreationLimiter);
+
+    return false;
+}
+
+bool TThreadsFactory::StartThread(void * (* function)(void *), void * argument)
+{
+    unsigned int i = 0;
+    TThreadContext * context;
+
     /* Ensure we're the only ones to deal with the list */
-    sem_wait(&fThreadsLock);
+    Wait(&fThreadsLock);
     /* Find a place where we can set our thread */
     for (; i < fMaxThreads; ++i)
     {
@@ -153,30 +252,44 @@ bool TThreadsFactory::CreateThread(void * (* function)(void *), void * argument)
         if (fThreads[i] == 0)
             break;
     }
-    /* Clear for the others */
-    sem_post(&fThreadsLock);
 
     /* There must exist! */
     assert(i != fMaxThreads);
 
+    /* Mark the room busy before releasing the list, threads can be
+     * created concurrently (see TryCreateThread())
+     */
+    fThreads[i] = 2;
+
+    /* Clear for the others */
+    sem_post(&fThreadsLock);
+
     /* Initialise the context for the helping function */
     context = new TThreadContext(function, argument, i);
 
+    /* Pin the thread right from its creation, so that everything it allocates is local */
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    if (!fCpus.empty())
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(GetCpu(i), &cpus);
+        pthread_attr_setaffinity_np(&attributes, sizeof(cpus), &cpus);
+    }
+
     /* Start thread */
-    int err = pthread_create(&fThreads[i], 0, ThreadHelper, context);
+    int err = pthread_create(&fThreads[i], &attributes, ThreadHelper, context);
+    pthread_attr_destroy(&attributes);
     if (err == 0)
         return true;
 
-    /* If we reach that point, we failed to spawn thread
-     * Release everything not to deadlock
-     */
+    /* If we reach that point, we failed to spawn thread */
+    delete context;
 
-    /* First, reset entry */
-     fThreads[i] = 0;
-
-    /* And then, release */
-    sem_post(&fInitLock);
-    sem_post(&fCreationLimiter);
+    /* Reset entry */
+    fThreads[i] = 0;
 
     return false;
 }
@@ -186,6 +299,11 @@ sem_t * TThreadsFactory::GetInitLock(void)
     return &fInitLock;
 }
 
+void TThreadsFactory::Wait(sem_t * semaphore)
+{
+    while (sem_wait(semaphore) == -1 && errno == EINTR);
+}
+
 void TThreadsFactory::ResetThread(unsigned int id)
 {
     /* Check we're killing a valid thread */
@@ -193,7 +311,7 @@ void TThreadsFactory::ResetThread(unsigned int id)
     assert(fThreads[id] != 0);
 
     /* Ensure we won't modify our entry while someone else is reading it */
-    sem_wait(&fThreadsLock);
+    Wait(&fThreadsLock);
     /* Mark the thread as waiting for a join */
     fThreads[id] |= 1;
     /* And open room for a new one */
@@ -208,20 +326,69 @@ void TThreadsFactory::WaitForAllThreads(void)
      * Beware, this will lock any new thread creation
      */
     for (unsigned int i = 0; i < fMaxThreads; ++i)
-        sem_wait(&fCreationLimiter);
+        Wait(&fCreationLimiter);
 
     /* Unlock everything now */
     for (unsigned int i = 0; i < fMaxThreads; ++i)
         sem_post(&fCreationLimiter);
 }
 
+bool TThreadsFactory::WaitForAllThreads(unsigned int timeout)
+{
+    struct timespec deadline;
+    unsigned int i = 0;
+
+    /* sem_timedwait() only knows about the real time clock */
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        ++deadline.tv_sec;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    /* Same as above, each room taken is a thread done */
+    while (i < fMaxThreads)
+    {
+        if (sem_timedwait(&fCreationLimiter, &deadline) == 0)
+        {
+            ++i;
+        }
+        else if (errno != EINTR)
+        {
+            break;
+        }
+    }
+
+    /* Unlock everything now */
+    for (unsigned int j = 0; j < i; ++j)
+        sem_post(&fCreationLimiter);
+
+    return i == fMaxThreads;
+}
+
 void * ThreadHelper(void * context)
 {
     void * ret;
     TThreadContext * threadContext = reinterpret_cast<TThreadContext *>(context);
 
+    tSlot = threadContext->fId;
+
+    /* Sample anything running in the room */
+    TProfiler * profiler = TProfiler::GetActive();
+    if (profiler != 0)
+    {
+        profiler->Arm(threadContext->fId);
+    }
+
     ret = threadContext->fFunction(threadContext->fArgument);
 
+    if (profiler != 0)
+    {
+        profiler->Disarm();
+    }
+
     /* We're done with user thread
      * It's time to finish ourselves and to release resources
      */
@@ -8,6 +8,12 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <vector>
+
+/**
+ * Slot of the threads which weren't created by the threads factory
+ */
+#define NO_SLOT ((unsigned int)-1)
 
 class TThreadsFactory
 {
@@ -24,6 +30,16 @@ public:
      * @return true on creation success, false otherwise
      */
     bool CreateThread(void * (* function)(void *), void * argument);
+    /**
+     * This function creates a thread only if there is a room left for it right now.
+     * Contrary to CreateThread(), it never blocks the caller and it doesn't take the
+     * init lock: the created thread must not release it.
+     * It is meant to be called from a running thread, to lend it idle rooms.
+     * @param function Function to execute as thread entry point
+     * @param argument Optional argument to pass to the function
+     * @return true on creation success, false if no room was available or creation failed
+     */
+    bool TryCreateThread(void * (* function)(void *), void * argument);
     /**
      * This function defines the maximum number of threads that the threads factory can manage
      * and have running at a time.
@@ -33,12 +49,48 @@ public:
      * @return true if it could set the limit, false otherwise.
      */
     bool SetMaxThreads(unsigned int maxThreads);
+    /**
+     * This function pins the threads to CPUs. The thread running in the room i of the threads
+     * list is pinned to the CPU i (modulo the number of CPUs).
+     * Call it before any call to CreateThread(), threads already running are left unpinned.
+     * @param cpus The CPUs to use, in placement order. Empty to disable pinning
+     */
+    void SetAffinity(const std::vector<int> & cpus);
+    /**
+     * This function returns the CPU a given room is pinned to.
+     * @param slot The room. It can be over the maximum of threads, for the threads which
+     * are not managed by the factory but want to follow the placement
+     * @return The CPU, -1 if threads are not pinned
+     */
+    int GetCpu(unsigned int slot);
+    /**
+     * This function returns the room in the threads list of the calling thread. It allows threads
+     * to keep per room data: there's only one thread at a time in a room, and a thread never changes room.
+     * @return The room, NO_SLOT if the thread wasn't created by the factory
+     */
+    static unsigned int GetCurrentSlot(void);
     /**
      * This function returns the init lock so that the thread entrypoint can release it once it's done
      * with RNG init.
      * @return The init lock. It cannot fail.
      */
     sem_t * GetInitLock(void);
+    /**
+     * This function waits on a semaphore, even if a signal interrupts the wait
+     * (threads get SIGPROF when profiling).
+     * @param semaphore The semaphore to wait on
+     */
+    static void Wait(sem_t * semaphore);
+    /**
+     * This function returns the time CreateThread() callers spent waiting for a room.
+     * @return The time, in ns
+     */
+    unsigned long long GetCreationLimiterWait(void);
+    /**
+     * This function returns the time CreateThread() callers spent waiting for the init lock.
+     * @return The time, in ns
+     */
+    unsigned long long GetInitLockWait(void);
     /**
      * This is the static function to have the thread factory. It is unique and this is the only way to
      * create and use it.
@@ -57,6 +109,12 @@ public:
      * Note that while you're waiting on said threads, any thread creation attempt will block.
      */
     void WaitForAllThreads(void);
+    /**
+     * Same as WaitForAllThreads(), but it gives up after a while.
+     * @param timeout Time to wait for, in ms
+     * @return true if all the threads completed, false on timeout
+     */
+    bool WaitForAllThreads(unsigned int timeout);
     /**
      * Destructor.
      */
@@ -68,6 +126,14 @@ private:
      * @see GetInstance()
      */
     TThreadsFactory();
+    /**
+     * Finds a room in the threads list and starts the thread in it.
+     * The caller must already own a room in fCreationLimiter.
+     * @param function Function to execute as thread entry point
+     * @param argument Optional argument to pass to the function
+     * @return true on creation success, false otherwise
+     */
+    bool StartThread(void * (* function)(void *), void * argument);
 
     /**
      * Maximum of threads that can be run at a time by the factory
@@ -96,6 +162,14 @@ private:
      * @see ResetThread()
      */
     sem_t fThreadsLock;
+    /**
+     * Time spent by CreateThread() waiting on fCreationLimiter and on fInitLock, in ns.
+     * Only updated by the thread creating the threads
+     * @see GetCreationLimiterWait()
+     * @see GetInitLockWait()
+     */
+    unsigned long long fCreationLimiterWait;
+    unsigned long long fInitLockWait;
     /**
      * This is the list containing all the threads available and/or running. It can
      * contain as many threads as fMaxThreads.
@@ -106,6 +180,11 @@ private:
      * This join effort is required to prevent any threads leak (as for SIGCHLD and zombies).
      */
     pthread_t * fThreads;
+    /**
+     * CPUs the rooms are pinned to. Empty if threads are not pinned
+     * @see SetAffinity()
+     */
+    std::vector<int> fCpus;
     /**
      * This variable is set to false most of the time.
      * When set to true, it means the class reached its destructor and any thread creation request
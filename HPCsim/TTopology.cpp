@@ -0,0 +1,408 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TTopology.cpp
+ * PURPOSE:          CPUs and NUMA nodes discovery
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "TTopology.h"
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+#define LINE_SIZE 0x1000
+
+bool TTopology::ParseList(const char * list, std::vector<unsigned int> & values)
+{
+    while (*list != '\0' && *list != '\n')
+    {
+        char * end;
+        unsigned long first, last;
+
+        first = strtoul(list, &end, 10);
+        if (end == list)
+        {
+            return false;
+        }
+
+        last = first;
+        if (*end == '-')
+        {
+            list = end + 1;
+            last = strtoul(list, &end, 10);
+            if (end == list || last < first)
+            {
+                return false;
+            }
+        }
+
+        for (; first <= last; ++first)
+        {
+            values.push_back(first);
+        }
+
+        list = end;
+        if (*list == ',')
+        {
+            ++list;
+        }
+        else if (*list != '\0' && *list != '\n')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool TTopology::ReadList(const char * path, std::vector<unsigned int> & values)
+{
+    FILE * file;
+    char line[LINE_SIZE];
+    bool ret = false;
+
+    file = fopen(path, "r");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    if (fgets(line, sizeof(line), file) != 0)
+    {
+        ret = ParseList(line, values);
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+std::vector<unsigned int> TTopology::GetOnlineNodes(void)
+{
+    std::vector<unsigned int> nodes;
+    std::vector<unsigned int> online;
+
+    ReadList("/sys/devices/system/node/online", online);
+    for (size_t i = 0; i < online.size(); ++i)
+    {
+        if (online[i] < MAX_NODES)
+        {
+            nodes.push_back(online[i]);
+        }
+    }
+
+    /* No NUMA support, consider a single node */
+    if (nodes.empty())
+    {
+        nodes.push_back(0);
+    }
+
+    return nodes;
+}
+
+unsigned int TTopology::GetCurrentNode(void)
+{
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, 0) != 0)
+    {
+        return 0;
+    }
+
+    return node;
+}
+
+bool TTopology::BindMemory(void * address, unsigned long size, int policy, unsigned long nodeMask)
+{
+    /* Avoid the libnuma dependency, the syscall is enough */
+    return (syscall(SYS_mbind, address, size, policy, &nodeMask, MAX_NODES + 1, 0) == 0);
+}
+
+void * TTopology::AllocateLocal(unsigned long size)
+{
+    void * address;
+    unsigned int node = GetCurrentNode();
+
+    address = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    /* Best effort, it's fine to fail without NUMA */
+    if (node < MAX_NODES)
+    {
+        BindMemory(address, size, MPOL_PREFERRED, 1UL << node);
+    }
+
+    return address;
+}
+
+void TTopology::FreeLocal(void * address, unsigned long size)
+{
+    munmap(address, size);
+}
+
+unsigned int TTopology::GetCgroupCpus(void)
+{
+    FILE * cgroups;
+    char line[LINE_SIZE];
+    double cpus = 0.0;
+
+    cgroups = fopen("/proc/self/cgroup", "r");
+    if (cgroups == 0)
+    {
+        return 0;
+    }
+
+    /* Lines are hierarchy-ID:controllers:path */
+    while (fgets(line, sizeof(line), cgroups) != 0)
+    {
+        char * controllers = strchr(line, ':');
+        char * path;
+        std::string base;
+        std::string cgroup;
+
+        if (controllers == 0)
+        {
+            continue;
+        }
+        ++controllers;
+
+        path = strchr(controllers, ':');
+        if (path == 0)
+        {
+            continue;
+        }
+        *path++ = '\0';
+        path[strcspn(path, "\n")] = '\0';
+
+        if (controllers[0] == '\0')
+        {
+            /* cgroup v2, the unified hierarchy */
+            base = "/sys/fs/cgroup";
+        }
+        else
+        {
+            /* cgroup v1, only the hierarchy with the cpu controller matters */
+            std::string list = std::string(",") + controllers + ",";
+            if (list.find(",cpu,") == std::string::npos)
+            {
+                continue;
+            }
+
+            base = std::string("/sys/fs/cgroup/") + controllers;
+        }
+
+        /* Walk from our cgroup up to the root, any level can set a quota.
+         * In a container, our cgroup is usually the root of the mount.
+         */
+        cgroup = path;
+        while (true)
+        {
+            FILE * limit;
+            double quota = -1.0, period = 0.0;
+
+            if (controllers[0] == '\0')
+            {
+                limit = fopen((base + cgroup + "/cpu.max").c_str(), "r");
+                if (limit != 0)
+                {
+                    char value[32];
+
+                    /* Format is "quota period", quota being "max" when unlimited */
+                    if (fscanf(limit, "%31s %lf", value, &period) == 2 && strcmp(value, "max") != 0)
+                    {
+                        quota = strtod(value, 0);
+                    }
+                    fclose(limit);
+                }
+            }
+            else
+            {
+                limit = fopen((base + cgroup + "/cpu.cfs_quota_us").c_str(), "r");
+                if (limit != 0)
+                {
+                    if (fscanf(limit, "%lf", &quota) != 1)
+                    {
+                        quota = -1.0;
+                    }
+                    fclose(limit);
+                }
+
+                limit = fopen((base + cgroup + "/cpu.cfs_period_us").c_str(), "r");
+                if (limit != 0)
+                {
+                    if (fscanf(limit, "%lf", &period) != 1)
+                    {
+                        period = 0.0;
+                    }
+                    fclose(limit);
+                }
+            }
+
+            /* Keep the most restrictive quota */
+            if (quota > 0.0 && period > 0.0 && (cpus == 0.0 || quota / period < cpus))
+            {
+                cpus = quota / period;
+            }
+
+            if (cgroup.empty() || cgroup == "/")
+            {
+                break;
+            }
+
+            cgroup.erase(cgroup.rfind('/'));
+        }
+    }
+
+    fclose(cgroups);
+
+    /* A partial CPU is still a CPU to run on */
+    if (cpus == 0.0)
+    {
+        return 0;
+    }
+
+    return static_cast<unsigned int>(cpus + 0.999);
+}
+
+unsigned int TTopology::GetAvailableCpus(void)
+{
+    cpu_set_t affinity;
+    unsigned int cpus, quota;
+
+    /* First, the CPUs we're allowed to run on */
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0)
+    {
+        cpus = CPU_COUNT(&affinity);
+    }
+    else
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    /* Then, how much of them we're allowed to use */
+    quota = GetCgroupCpus();
+    if (quota != 0 && quota < cpus)
+    {
+        cpus = quota;
+    }
+
+    return (cpus == 0 ? 1 : cpus);
+}
+
+bool TTopology::GetPlacement(const char * policy, std::vector<int> & cpus)
+{
+    cpu_set_t affinity;
+    std::vector<unsigned int> nodes;
+    std::vector< std::vector<int> > nodeCpus;
+
+    cpus.clear();
+
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) != 0)
+    {
+        return false;
+    }
+
+    /* Explicit list, the CPUs still have to be usable, or threads creation would fail */
+    if (policy[0] >= '0' && policy[0] <= '9')
+    {
+        std::vector<unsigned int> list;
+
+        if (!ParseList(policy, list) || list.empty())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            if (list[i] >= CPU_SETSIZE || !CPU_ISSET(list[i], &affinity))
+            {
+                cpus.clear();
+                return false;
+            }
+
+            cpus.push_back(list[i]);
+        }
+
+        return true;
+    }
+
+    if (strcmp(policy, "compact") != 0 && strcmp(policy, "scatter") != 0)
+    {
+        return false;
+    }
+
+    /* Sort the CPUs we can use by node */
+    nodes = GetOnlineNodes();
+    nodeCpus.resize(nodes.size());
+    for (size_t node = 0; node < nodes.size(); ++node)
+    {
+        char path[LINE_SIZE];
+        std::vector<unsigned int> list;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", nodes[node]);
+        if (!ReadList(path, list))
+        {
+            /* No NUMA support, all the CPUs are on the single node */
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                list.push_back(cpu);
+            }
+        }
+
+        for (size_t i = 0; i < list.size(); ++i)
+        {
+            if (list[i] < CPU_SETSIZE && CPU_ISSET(list[i], &affinity))
+            {
+                nodeCpus[node].push_back(list[i]);
+                CPU_CLR(list[i], &affinity);
+            }
+        }
+    }
+
+    if (policy[0] == 'c')
+    {
+        /* Compact: one node after the other */
+        for (size_t node = 0; node < nodeCpus.size(); ++node)
+        {
+            cpus.insert(cpus.end(), nodeCpus[node].begin(), nodeCpus[node].end());
+        }
+    }
+    else
+    {
+        /* Scatter: one CPU from each node in turn */
+        for (size_t i = 0; ; ++i)
+        {
+            bool found = false;
+
+            for (size_t node = 0; node < nodeCpus.size(); ++node)
+            {
+                if (i < nodeCpus[node].size())
+                {
+                    cpus.push_back(nodeCpus[node][i]);
+                    found = true;
+                }
+            }
+
+            if (!found)
+            {
+                break;
+            }
+        }
+    }
+
+    return !cpus.empty();
+}
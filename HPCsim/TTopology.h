@@ -0,0 +1,90 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TTopology.h
+ * PURPOSE:          CPUs and NUMA nodes discovery
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TTOPOLOGY_H__
+#define __TTOPOLOGY_H__
+
+#include <vector>
+
+/**
+ * Maximum number of NUMA nodes handled, they're manipulated as a bit mask
+ */
+#define MAX_NODES (8 * sizeof(unsigned long))
+
+class TTopology
+{
+public:
+    /**
+     * This function returns the number of CPUs the process can really use: the ones in its
+     * affinity mask, capped by the CPU quota of its cgroup (if any).
+     * @return The number of usable CPUs. Minimum 1
+     */
+    static unsigned int GetAvailableCpus(void);
+    /**
+     * This function computes where to place threads.
+     * @param policy "compact" (fill NUMA nodes one after the other), "scatter" (round robin
+     * over the NUMA nodes) or a list of CPUs, such as 0-3,8
+     * @param cpus Output variable, receiving the CPUs to use, in placement order
+     * @return true if the policy is valid and the CPUs usable, false otherwise
+     */
+    static bool GetPlacement(const char * policy, std::vector<int> & cpus);
+    /**
+     * This function returns the online NUMA nodes.
+     * @return The list of nodes. There's always at least one
+     */
+    static std::vector<unsigned int> GetOnlineNodes(void);
+    /**
+     * This function returns the NUMA node of the CPU the caller runs on.
+     * @return The node, 0 if unknown
+     */
+    static unsigned int GetCurrentNode(void);
+    /**
+     * This function sets the NUMA policy of a memory range, before it's touched.
+     * @param address Begin of the range
+     * @param size Size of the range
+     * @param policy MPOL_* policy to apply
+     * @param nodeMask Nodes the policy applies to
+     * @return true on success, false otherwise
+     */
+    static bool BindMemory(void * address, unsigned long size, int policy, unsigned long nodeMask);
+    /**
+     * This function allocates memory on the NUMA node of the caller, whatever thread touches it first.
+     * @param size Size to allocate
+     * @return The allocated memory, 0 on failure. Release it with FreeLocal()
+     */
+    static void * AllocateLocal(unsigned long size);
+    /**
+     * This function releases memory allocated with AllocateLocal().
+     * @param address The allocated memory
+     * @param size The size given to AllocateLocal()
+     */
+    static void FreeLocal(void * address, unsigned long size);
+
+private:
+    /**
+     * Parses a list of ranges, as found in sysfs (such as 0-1,3).
+     * @param list The list to parse
+     * @param values Output variable, receiving the values in the list
+     * @return true if the whole list was valid, false otherwise
+     */
+    static bool ParseList(const char * list, std::vector<unsigned int> & values);
+    /**
+     * Reads a list of ranges from a sysfs file.
+     * @param path The file to read
+     * @param values Output variable, receiving the values in the list
+     * @return true if the file could be read, false otherwise
+     */
+    static bool ReadList(const char * path, std::vector<unsigned int> & values);
+    /**
+     * Returns the number of CPUs allowed by the cgroup CPU quota.
+     * @return The number of CPUs, 0 if there's no quota
+     */
+    static unsigned int GetCgroupCpus(void);
+};
+
+#endif
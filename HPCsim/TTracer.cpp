@@ -0,0 +1,254 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TTracer.cpp
+ * PURPOSE:          Timeline of the run, in Chrome trace format
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "TTracer.h"
+#include "TThreadsFactory.h"
+#include "TStatistics.h"
+
+static const char * gTraceNames[TRACE_MAX] = { "init", "run", "clear", "init lock", "creation limiter", "QueueResult", "write batch" };
+
+TTracer * TTracer::fActive = 0;
+/* Lane of the thread, and the tracer it belongs to */
+static __thread TTraceLane * tLane = 0;
+static __thread TTracer * tLaneTracer = 0;
+
+TTracer::TTracer()
+{
+    fStart = 0;
+    fNextEvent = 0;
+    fLost = 0;
+    fBatchStart = 0;
+    fBatchBytes = 0;
+    fBatchResults = 0;
+}
+
+TTracer::~TTracer()
+{
+    if (fActive == this)
+    {
+        fActive = 0;
+    }
+
+    for (size_t i = 0; i < fLanes.size(); ++i)
+    {
+        TTraceChunk * chunk = fLanes[i].fFirst;
+
+        while (chunk != 0)
+        {
+            TTraceChunk * next = chunk->fNext;
+
+            free(chunk);
+            chunk = next;
+        }
+    }
+}
+
+TTracer * TTracer::GetInstance(bool destroyInstance)
+{
+    static TTracer * gThisInstance = 0;
+
+    /* If we don't exist yet, start ourselves */
+    if (gThisInstance == 0 && !destroyInstance)
+        gThisInstance = new TTracer();
+
+    /* If we're asked to delete the instance */
+    if (destroyInstance)
+    {
+        delete gThisInstance;
+        gThisInstance = 0;
+    }
+
+    /* Return the instance */
+    return gThisInstance;
+}
+
+bool TTracer::Start(const char * path, unsigned int threads, unsigned long firstEvent)
+{
+    TTraceLane empty = { 0, 0 };
+    FILE * file;
+
+    /* Make sure we'll be able to write, before the run */
+    file = fopen(path, "w");
+    if (file == 0)
+    {
+        return false;
+    }
+    fclose(file);
+
+    fPath = path;
+    fLanes.resize(threads + 2, empty);
+    fNextEvent = firstEvent;
+    fStart = TStatistics::Now();
+    fActive = this;
+
+    return true;
+}
+
+TTraceLane * TTracer::GetLane(void)
+{
+    unsigned int slot;
+
+    if (tLaneTracer == this)
+    {
+        return tLane;
+    }
+
+    /* Rooms have their own lane, all the other threads share the one after */
+    slot = TThreadsFactory::GetCurrentSlot();
+    if (slot >= fLanes.size() - 2)
+    {
+        slot = fLanes.size() - 2;
+    }
+
+    tLane = &fLanes[slot];
+    tLaneTracer = this;
+
+    return tLane;
+}
+
+void TTracer::AttachWriter(void)
+{
+    tLane = &fLanes[fLanes.size() - 1];
+    tLaneTracer = this;
+}
+
+TTraceChunk * TTracer::AddChunk(TTraceLane * lane)
+{
+    TTraceChunk * chunk = reinterpret_cast<TTraceChunk *>(malloc(sizeof(TTraceChunk)));
+
+    if (chunk == 0)
+    {
+        __sync_add_and_fetch(&fLost, 1);
+        return 0;
+    }
+
+    chunk->fNext = 0;
+    chunk->fCount = 0;
+    if (lane->fLast != 0)
+    {
+        lane->fLast->fNext = chunk;
+    }
+    else
+    {
+        lane->fFirst = chunk;
+    }
+    lane->fLast = chunk;
+
+    return chunk;
+}
+
+void TTracer::Written(unsigned long long start, unsigned long long end, unsigned long bytes)
+{
+    /* The writer waited for results (or the run is over), the batch is done */
+    if ((end - start >= TRACE_WRITER_GAP || bytes == 0) && fBatchResults != 0)
+    {
+        Record(TRACE_WRITE_BATCH, fBatchStart, start, fBatchBytes, fBatchResults);
+        fBatchResults = 0;
+    }
+
+    if (bytes == 0)
+    {
+        return;
+    }
+
+    if (fBatchResults == 0)
+    {
+        fBatchStart = end;
+        fBatchBytes = 0;
+    }
+    ++fBatchResults;
+    fBatchBytes += bytes;
+}
+
+void TTracer::Stop(void)
+{
+    FILE * file;
+    int pid = getpid();
+    bool first = true;
+
+    fActive = 0;
+
+    file = fopen(fPath.c_str(), "w");
+    if (file == 0)
+    {
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"lostChunks\": %llu}, \"traceEvents\": [\n", fLost);
+
+    for (size_t i = 0; i < fLanes.size(); ++i)
+    {
+        char name[32];
+
+        if (fLanes[i].fFirst == 0)
+        {
+            continue;
+        }
+
+        if (i + 2 < fLanes.size())
+        {
+            snprintf(name, sizeof(name), "room %u", static_cast<unsigned int>(i));
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%s", (i + 1 < fLanes.size() ? "main" : "writer"));
+        }
+
+        /* Name the lane, and keep them in order */
+        fprintf(file, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"%s\"}},\n"
+                "{\"ph\": \"M\", \"name\": \"thread_sort_index\", \"pid\": %d, \"tid\": %u, \"args\": {\"sort_index\": %u}}",
+                (first ? "" : ",\n"), pid, static_cast<unsigned int>(i), name, pid, static_cast<unsigned int>(i), static_cast<unsigned int>(i));
+        first = false;
+
+        for (TTraceChunk * chunk = fLanes[i].fFirst; chunk != 0; chunk = chunk->fNext)
+        {
+            for (unsigned int record = 0; record < chunk->fCount; ++record)
+            {
+                const TTraceRecord & span = chunk->fRecords[record];
+
+                /* Complete events, in us since the run start */
+                fprintf(file, ",\n{\"ph\": \"X\", \"name\": \"%s\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+                        gTraceNames[span.fName], pid, static_cast<unsigned int>(i),
+                        (span.fStart > fStart ? span.fStart - fStart : 0) / 1e3, (span.fEnd > span.fStart ? span.fEnd - span.fStart : 0) / 1e3);
+
+                switch (span.fName)
+                {
+                    case TRACE_INIT:
+                    case TRACE_RUN:
+                    case TRACE_CLEAR:
+                        fprintf(file, ", \"args\": {\"event\": %llu", span.fArg);
+                        if (span.fCount != 1)
+                        {
+                            fprintf(file, ", \"events\": %u", span.fCount);
+                        }
+                        fprintf(file, "}}");
+                        break;
+
+                    case TRACE_QUEUE_RESULT:
+                        fprintf(file, ", \"args\": {\"bytes\": %llu}}", span.fArg);
+                        break;
+
+                    case TRACE_WRITE_BATCH:
+                        fprintf(file, ", \"args\": {\"results\": %u, \"bytes\": %llu}}", span.fCount, span.fArg);
+                        break;
+
+                    default:
+                        fprintf(file, "}");
+                        break;
+                }
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
@@ -0,0 +1,236 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/TTracer.h
+ * PURPOSE:          Timeline of the run, in Chrome trace format
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __TTRACER_H__
+#define __TTRACER_H__
+
+#include <string>
+#include <vector>
+
+/**
+ * Amount of spans per chunk of a lane
+ */
+#define TRACE_CHUNK 4096
+/**
+ * Waits shorter than this (in ns) are not traced, they'd only be noise
+ */
+#define TRACE_MIN_WAIT 1000
+/**
+ * A writer read waiting longer than this (in ns) ends a batch of writes
+ */
+#define TRACE_WRITER_GAP 10000
+
+/**
+ * What a span is about
+ */
+enum TTraceName
+{
+    TRACE_INIT,
+    TRACE_RUN,
+    TRACE_CLEAR,
+    TRACE_INIT_LOCK,
+    TRACE_CREATION_LIMITER,
+    TRACE_QUEUE_RESULT,
+    TRACE_WRITE_BATCH,
+    TRACE_MAX
+};
+
+/**
+ * A span of the timeline. Times are in ns.
+ */
+struct TTraceRecord
+{
+    unsigned long long fStart;
+    unsigned long long fEnd;
+    /**
+     * Event index for the event phases, bytes for the results
+     */
+    unsigned long long fArg;
+    /**
+     * TTraceName
+     */
+    unsigned int fName;
+    /**
+     * Events of a batch, results of a writer batch
+     */
+    unsigned int fCount;
+};
+
+/**
+ * Spans are kept in a list of chunks, so that recording never copies them
+ */
+struct TTraceChunk
+{
+    TTraceChunk * fNext;
+    unsigned int fCount;
+    TTraceRecord fRecords[TRACE_CHUNK];
+};
+
+/**
+ * Spans of a thread (or of a room of the threads factory). A lane is only written by a single thread at a time.
+ */
+struct TTraceLane
+{
+    TTraceChunk * fFirst;
+    TTraceChunk * fLast;
+};
+
+class TTracer
+{
+public:
+    /**
+     * This function starts tracing. It has to be called once the threads factory is configured
+     * and before any thread is started.
+     * @param path Path of the JSON file to write the trace to
+     * @param threads Amount of rooms in the threads factory
+     * @param firstEvent Index of the first event the run will simulate
+     * @return true on success, false if the file cannot be written
+     */
+    bool Start(const char * path, unsigned int threads, unsigned long firstEvent);
+    /**
+     * This function stops tracing and writes the trace. It has to be called once all the threads,
+     * including the writer, are done.
+     */
+    void Stop(void);
+    /**
+     * This function returns the tracer, if tracing.
+     * @return The tracer, 0 if not tracing
+     */
+    static inline TTracer * GetActive(void)
+    {
+        return fActive;
+    }
+    /**
+     * This function makes the calling thread the writer, so that it has its own lane.
+     */
+    void AttachWriter(void);
+    /**
+     * This function reserves the indexes of the next events. It has to be called with the init lock held.
+     * @param count Amount of events
+     * @return Index of the first one
+     */
+    inline unsigned long NextEvents(unsigned int count)
+    {
+        unsigned long first = fNextEvent;
+
+        fNextEvent += count;
+        return first;
+    }
+    /**
+     * This function records a span in the lane of the calling thread.
+     * @param name What the span is about
+     * @param start Start of the span, in ns (see TStatistics::Now())
+     * @param end End of the span, in ns
+     * @param arg Event index, or bytes
+     * @param count Amount of events, or results
+     */
+    inline void Record(TTraceName name, unsigned long long start, unsigned long long end, unsigned long long arg = 0, unsigned int count = 1)
+    {
+        TTraceLane * lane = GetLane();
+        TTraceChunk * chunk = lane->fLast;
+
+        if (chunk == 0 || chunk->fCount == TRACE_CHUNK)
+        {
+            chunk = AddChunk(lane);
+            if (chunk == 0)
+            {
+                return;
+            }
+        }
+
+        TTraceRecord & record = chunk->fRecords[chunk->fCount++];
+        record.fStart = start;
+        record.fEnd = end;
+        record.fArg = arg;
+        record.fName = name;
+        record.fCount = count;
+    }
+    /**
+     * This function records a wait, if it's long enough to matter.
+     * @param name What was waited for
+     * @param start Start of the wait, in ns
+     * @param end End of the wait, in ns
+     */
+    inline void Wait(TTraceName name, unsigned long long start, unsigned long long end)
+    {
+        if (end - start >= TRACE_MIN_WAIT)
+        {
+            Record(name, start, end);
+        }
+    }
+    /**
+     * This function accounts a result read by the writing thread. Results read
+     * without waiting are gathered in a single batch span.
+     * @param start Start of the read, in ns
+     * @param end End of the read, in ns
+     * @param bytes Size of the result. 0 for the end of the run
+     */
+    void Written(unsigned long long start, unsigned long long end, unsigned long bytes);
+    /**
+     * This is the static function to have the tracer. It is unique and this is the only way to
+     * create and use it.
+     * @param destroyInstance Indicates whether the instance should be deleted instead of allocated
+     * @return A pointer to the tracer class.
+     */
+    static TTracer * GetInstance(bool destroyInstance = false);
+    /**
+     * Destructor. It releases the spans.
+     */
+    ~TTracer();
+
+private:
+    /**
+     * Constructor. Kept private to use this class only as singleton
+     * @see GetInstance()
+     */
+    TTracer();
+    /**
+     * Returns the lane of the calling thread.
+     * @return The lane. It cannot fail
+     */
+    TTraceLane * GetLane(void);
+    /**
+     * Adds a chunk at the end of a lane.
+     * @param lane The lane
+     * @return The new chunk, 0 if out of memory (the span is then lost)
+     */
+    TTraceChunk * AddChunk(TTraceLane * lane);
+
+    /**
+     * The tracer, while tracing
+     */
+    static TTracer * fActive;
+    /**
+     * Path of the JSON file
+     */
+    std::string fPath;
+    /**
+     * Lanes of each room, then of the other threads, and of the writer
+     */
+    std::vector<TTraceLane> fLanes;
+    /**
+     * Start of the run, in ns
+     */
+    unsigned long long fStart;
+    /**
+     * Index of the next event
+     */
+    unsigned long fNextEvent;
+    /**
+     * Spans lost for lack of memory
+     */
+    unsigned long long fLost;
+    /**
+     * Current batch of the writer: start, results and bytes
+     */
+    unsigned long long fBatchStart;
+    unsigned long long fBatchBytes;
+    unsigned int fBatchResults;
+};
+
+#endif
@@ -0,0 +1,4128 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/hpcsim.cpp
+ * PURPOSE:          libhpcsim, running the simulations
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <iostream>
+#include <limits>
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <cassert>
+#include <cstddef>
+#include <csignal>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <map>
+
+#include "Exceptions.h"
+#include "TThreadsFactory.h"
+#include "RngStream.h"
+#include "TTaskGroup.h"
+#include "TInputMapper.h"
+#include "TAccumulators.h"
+#include "TTopology.h"
+#include "TStatistics.h"
+#include "TStatusServer.h"
+#include "TPerfCounters.h"
+#include "TTracer.h"
+#include "TProfiler.h"
+#include "TResultCache.h"
+#include "TRankMerger.h"
+#include "TEventServer.h"
+#include "TEventClient.h"
+#include "TProcessPool.h"
+#include "TSweep.h"
+#include "TDaemon.h"
+#include "TPipeline.h"
+#include "TOutputSink.h"
+#include "TOutputSet.h"
+#include "TResultChannels.h"
+#include "simulation.h"
+#include "hpcsim.h"
+
+#define PATH_MAX 0x1000
+
+#define DEFAULT_NAME {'H', 'P', 'C', 's', 'i', 'm', '.', 'o', 'u', 't', '\0'}
+
+#define DEFAULT_BATCH_SIZE 8
+
+#define DEFAULT_CACHE_SIZE 1024
+
+#define DEFAULT_DRAIN_TIME 60
+
+#define DEFAULT_CHUNK_SIZE 100
+
+#define DEFAULT_CHUNK_TIMEOUT 60
+
+/* Results queued or run by the stages of a pipeline, per thread */
+#define DEFAULT_STAGE_QUEUE 16
+
+/* Ring of a shared memory sink, or buffer of a FIFO or socket sink, in MB */
+#define DEFAULT_SINK_BUFFER 16
+
+/* Exit status of a run stopped before its end, to be resumed */
+#define STOPPED_STATUS 3
+
+/* How often the end of the run is checked for a stop request, in ms */
+#define WAIT_SLICE 100
+
+struct TSimulationClass
+{
+    TSimulationInit * fSimulationInit;
+    TRunInit * fRunInit;
+#ifdef USE_PILOT_THREAD
+    TPilotInit * fPilotInit;
+#endif
+    TEventInit * fEventInit;
+    TEventRun * fEventRun;
+    TEventRunBatch * fEventRunBatch;
+    TEventClear * fEventClear;
+#ifdef USE_PILOT_THREAD
+    TPilotClear * fPilotClear;
+#endif
+    TReduceResult * fReduceResult;
+    TRunClear * fRunClear;
+    TSimulationUnload * fSimulationUnload;
+
+    bool fCheckPoint;
+    unsigned int fBatchSize;
+    void * fSimulationContext;
+};
+
+struct TPilotJobContext
+{
+    unsigned long fEvents;
+};
+
+/* Events run by a room, so that a stopped run knows which ones it abandoned */
+struct TInFlight
+{
+    unsigned long fFirst;
+    /* 0 when the room is idle */
+    volatile unsigned int fCount;
+    /* Output size when they started */
+    unsigned long long fWritten;
+};
+
+/* Where a stopped run is to be resumed, as written next to the output file */
+struct TResumeHint
+{
+    /* First event and events of the run, as given on the command line */
+    unsigned long fRunFirst;
+    unsigned long fRunEvents;
+    /* Events left to run */
+    unsigned long fNext;
+    unsigned long fRemaining;
+    /* Whether results of the events left may already be in the output, past fOffset */
+    bool fScan;
+    unsigned long long fOffset;
+    /* Output size when the hint was written */
+    unsigned long long fSize;
+};
+
+struct TBatchBuffers
+{
+    double fRngStates[6 * HPCSIM_MAX_BATCH];
+    TResult fResults[HPCSIM_MAX_BATCH];
+};
+
+typedef void * (TThreadRoutine)(void * Arg);
+
+/* A simulation opened by hpcsim_open(), kept for all its runs */
+struct THPCsim
+{
+    unsigned int fThreads;
+    std::vector<int> fCpus;
+    TThreadRoutine * fSimulationLoop;
+    /**
+     * Set once the first run started, nothing can be declared anymore
+     */
+    bool fSealed;
+    /**
+     * Set once a run was stopped (by a signal or the wall time limit), the stop is cleared for the next one
+     */
+    bool fStopped;
+    /**
+     * What SimulationInit() got from hpcsim_open(), and the context it allocated
+     */
+    unsigned long fFirstEvent;
+    unsigned long fEvents;
+    std::string fUserOpts;
+    void * fContext;
+    /**
+     * Contexts of the other options runs were given, by options
+     */
+    std::map<std::string, void *> fContexts;
+    char fOutput[PATH_MAX];
+    THPCsimStats fStats;
+};
+
+/* Options of hpcsim_main(), as given on its command line */
+struct TCommandLine
+{
+    unsigned int fThreads;
+    unsigned long fEvents;
+    unsigned long fFirstEvent;
+    char fOutputFile[PATH_MAX];
+    const char * fAffinity;
+    std::vector<int> fCpus;
+    const char * fStatisticsFile;
+    unsigned int fStatisticsInterval;
+    const char * fStatusSocket;
+    const char * fPerfCountersFile;
+    const char * fPerfEventsFile;
+    const char * fTraceFile;
+    unsigned int fProfileHz;
+    const char * fCacheDirectory;
+    unsigned long long fCacheSize;
+    unsigned long fWalltime;
+    unsigned int fDrainTime;
+    unsigned int fRank;
+    unsigned int fRanks;
+    bool fInterleaved;
+    bool fMerge;
+    const char * fServeAddress;
+    const char * fPullAddress;
+    unsigned int fChunkSize;
+    unsigned int fChunkTimeout;
+    unsigned int fProcesses;
+    const char * fSweepFile;
+    const char * fDaemonSocket;
+    const char * fSinkUri;
+    TSinkPolicy fSinkPolicy;
+    bool fValidSinkPolicy;
+    unsigned long long fSinkBuffer;
+    unsigned int fOutputShards;
+    unsigned long long fOutputRotate;
+    bool fValidChannels;
+#ifndef HPCSIM_STATIC_SIMULATION
+    char fSimulationFile[PATH_MAX];
+    std::vector<const char *> fStageSpecs;
+    unsigned int fStageQueue;
+#endif
+};
+
+/* A run of hpcsim_main(), its events being the ones left of the command line (see TCommandLine) */
+struct TCommandLineRun
+{
+    /* Stream of the first event, and streams from an event to the next, with an interleaved partition */
+    unsigned long fStreamOrigin;
+    unsigned long fStreamStride;
+    /* First event and events of the run as given, and the events of the run left once resumed */
+    unsigned long fRunFirst;
+    unsigned long fRunEvents;
+    unsigned long fRequestedEvents;
+    pthread_t fWritingThread;
+    /* 0 until the run is initialized */
+    TThreadRoutine * fSimulationLoop;
+    TPilotJobContext * fContexts;
+    int fStatus;
+};
+
+static pthread_mutex_t gPipeLock;
+/* Pipes to the writers, one per shard of the output */
+static int gPipes[MAX_OUTPUT_SHARDS][2];
+static TResult gNullResult;
+static TSimulationClass gSimulation;
+#ifdef USE_PILOT_THREAD
+static const unsigned char gUsingPilot = 1;
+#else
+static const unsigned char gUsingPilot = 0;
+#endif
+__thread RngStream * tRand = 0;
+static __thread RngStream * tEventRand = 0;
+static __thread TTaskGroup * tTasks = 0;
+static char * gUserOpts = 0;
+/* Batch buffers of each room of the threads factory, allocated on the node of the room */
+static TBatchBuffers ** gBatchBuffers = 0;
+/* Run statistics, 0 when not asked for */
+static TStatistics * gStatistics = 0;
+/* Status server, 0 when not asked for */
+static TStatusServer * gStatusServer = 0;
+/* Performance counters, 0 when not asked for */
+static TPerfCounters * gPerfCounters = 0;
+/* Timeline, 0 when not asked for */
+static TTracer * gTracer = 0;
+/* Sampling profiler, 0 when not asked for */
+static TProfiler * gProfiler = 0;
+/* Results cache, 0 when not asked for */
+static TResultCache * gCache = 0;
+/* Results queued by the event of the thread, when caching */
+static __thread TCacheCapture * tCapture = 0;
+/* Set by SIGTERM and SIGINT: no new event is started. A second one abandons the events in flight */
+static volatile sig_atomic_t gStopSignal = 0;
+static volatile sig_atomic_t gStopSignals = 0;
+/* End of the wall time budget (see TStatistics::Now()), 0 for none */
+static unsigned long long gWalltimeEnd = 0;
+/* Events started so far (with the init lock held), and the ones each room is running */
+static unsigned long gDispatched = 0;
+static TInFlight * gInFlight = 0;
+/* Bytes in the output file, updated by the writer */
+static volatile unsigned long long gWritten = 0;
+/* Set once the events in flight are abandoned, their results are not written anymore */
+static volatile bool gAbandoned = false;
+/* Chunks of events pulled from a coordinator, instead of the events of the command line */
+static TEventClient * gPuller = 0;
+/* Worker processes running the events, in the parent and in the workers */
+static TProcessPool * gProcesses = 0;
+/* Configurations of a sweep, and the one of the event running in the current thread */
+static TSweep * gSweep = 0;
+static THPCsim * gOpened = 0;
+__thread TSweepSet * tSweepSet = 0;
+static TPipeline * gPipeline = 0;
+__thread TStageEvent * tStageEvent = 0;
+/* Consumer the results are streamed to, instead of the output file */
+static TOutputSink * gSink = 0;
+/* Output sharded or rotated, written by a writer per shard. 0 for a single file */
+static TOutputSet * gOutputSet = 0;
+static unsigned int gShards = 1;
+static pthread_t gShardWriters[MAX_OUTPUT_SHARDS];
+/* Serializes the accounting of the writers of the shards */
+static pthread_mutex_t gWritersLock;
+/* Result channels of the simulation, once their writers run. 0 when it has none */
+static TResultChannels * gChannels = 0;
+#ifndef USE_PILOT_THREAD
+/* Event loop of the simulation, run by the first stage of the pipeline */
+static TThreadRoutine * gSourceLoop = 0;
+#endif
+#ifndef HPCSIM_STATIC_SIMULATION
+static void * gSimulationLib = 0;
+#endif
+
+#ifdef HPCSIM_STATIC_SIMULATION
+/* The simulation is linked in HPCsim, its entry points are resolved
+ * at link time. Missing ones are left to 0 thanks to weak linkage.
+ */
+extern "C"
+{
+TSimulationInit SimulationInit __attribute__((weak));
+TRunInit RunInit __attribute__((weak));
+#ifdef USE_PILOT_THREAD
+TPilotInit PilotInit __attribute__((weak));
+#endif
+TEventInit EventInit __attribute__((weak));
+TEventRun EventRun __attribute__((weak));
+TEventRunBatch EventRunBatch __attribute__((weak));
+TEventClear EventClear __attribute__((weak));
+#ifdef USE_PILOT_THREAD
+TPilotClear PilotClear __attribute__((weak));
+#endif
+TReduceResult ReduceResult __attribute__((weak));
+TRunClear RunClear __attribute__((weak));
+TSimulationUnload SimulationUnload __attribute__((weak));
+}
+
+#define LoadAndSetSimulationFunction(name)                       \
+    gSimulation.f##name = name
+
+/* Direct call, that can be inlined */
+#define SimulationFunction(name) name
+#else
+#define LoadAndSetSimulationFunction(name)                       \
+    *(void **)&gSimulation.f##name = dlsym(gSimulationLib, #name)
+
+#define SimulationFunction(name) gSimulation.f##name
+#endif
+
+/* Exported */
+extern "C" double RandU01(void)
+{
+    return tRand->RandU01();
+}
+
+/* Context of the event running in the current thread: the one of its configuration in a sweep, or of its stage in a pipeline */
+static inline void * GetSimulationContext(void)
+{
+    if (tSweepSet != 0)
+    {
+        return tSweepSet->fContext;
+    }
+
+    return ((tStageEvent != 0) ? tStageEvent->fContext : gSimulation.fSimulationContext);
+}
+
+/* Shard written by the current thread: the rooms are spread over the writers */
+static inline unsigned int GetShard(void)
+{
+    return ((gShards > 1) ? TThreadsFactory::GetCurrentSlot() % gShards : 0);
+}
+
+/* Writes a result to the pipe of the writer of a shard. In a sweep, it's followed by its configuration, in the same atomic write */
+static void WritePipe(const TResult * result, unsigned int shard)
+{
+    if (gSweep != 0)
+    {
+        unsigned int set = ((tSweepSet != 0) ? tSweepSet->fIndex : 0);
+        struct iovec record[2];
+
+        record[0].iov_base = const_cast<TResult *>(result);
+        record[0].iov_len = sizeof(TResult);
+        record[1].iov_base = &set;
+        record[1].iov_len = sizeof(set);
+        UNUSED_RETURN(writev(gPipes[shard][1], record, 2));
+        return;
+    }
+
+    UNUSED_RETURN(write(gPipes[shard][1], result, sizeof(TResult)));
+}
+
+/* Queues a marker of the puller to the writer, it isn't a result */
+static void PushMarker(TResult * marker)
+{
+    if (gAbandoned)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&gPipeLock);
+    UNUSED_RETURN(write(gPipes[0][1], marker, sizeof(TResult)));
+    pthread_mutex_unlock(&gPipeLock);
+}
+
+static void PushResult(TResult * result)
+{
+    unsigned long long start = 0;
+
+    if (gAbandoned)
+    {
+        return;
+    }
+
+    /* In a pipeline, only the results of the last stage are written, the others are its events */
+    if (tStageEvent != 0 && !gPipeline->IsLast(tStageEvent->fStage))
+    {
+        gPipeline->Push(tStageEvent, result);
+        return;
+    }
+
+    /* A worker process hands it to the writer of its parent */
+    if (gProcesses != 0 && gProcesses->IsWorker())
+    {
+        gProcesses->Push(result);
+        return;
+    }
+
+    if (gStatistics != 0 || gTracer != 0)
+    {
+        start = TStatistics::Now();
+    }
+
+    pthread_mutex_lock(&gPipeLock);
+    if (gStatistics != 0)
+    {
+        gStatistics->Queued(TStatistics::Now() - start, offsetof(TResult, fResult) + result->fResultLength);
+    }
+    /* Note regarding valgrind: valgrind will complain because of a call to write()
+     * referencing non-initialized memory. This is to be expected: the TResult is allocated
+     * from stack and is only initialized with meaningful data. Furthermore, when going to
+     * disk, only relevant bits will be written. So, for performances reasons, we don't zero
+     * the stack object, and tolerate valgrind complain.
+     */
+    WritePipe(result, GetShard());
+    pthread_mutex_unlock(&gPipeLock);
+
+    if (gTracer != 0)
+    {
+        gTracer->Record(TRACE_QUEUE_RESULT, start, TStatistics::Now(), offsetof(TResult, fResult) + result->fResultLength);
+    }
+}
+
+/* Exported */
+extern "C" void QueueResult(TResult * result)
+{
+    /* Set our ID first, and send to write thread */
+    memcpy(result->fId, tRand->GetDigest(), sizeof(TResult::fId));
+    if (tCapture != 0)
+    {
+        TResultCache::Capture(*tCapture, result->fResultLength, result->fResult);
+    }
+    PushResult(result);
+}
+
+/* Exported */
+extern "C" void QueueResultTo(int channel, TResult * result)
+{
+    /* No channel, or none available to the run: it's a result of the output */
+    if (gChannels == 0 || !gChannels->IsStarted(channel))
+    {
+        QueueResult(result);
+        return;
+    }
+
+    memcpy(result->fId, tRand->GetDigest(), sizeof(TResult::fId));
+    if (!gAbandoned)
+    {
+        gChannels->Push(channel, result);
+    }
+}
+
+/* Exported */
+extern "C" const void * EventInput(uint32_t * length)
+{
+    if (tStageEvent == 0 || tStageEvent->fInput == 0)
+    {
+        *length = 0;
+        return 0;
+    }
+
+    *length = tStageEvent->fInput->fResultLength;
+    return tStageEvent->fInput->fResult;
+}
+
+/* Exported */
+extern "C" int SpawnTask(TTaskRun * task, void * taskContext)
+{
+    /* Only the event run itself can fork */
+    if (tEventRand == 0 || tRand != tEventRand)
+    {
+        return -1;
+    }
+
+    /* Results of subtasks are not all seen by the event thread, it cannot be cached */
+    if (tCapture != 0)
+    {
+        tCapture->fDiscard = true;
+    }
+
+    /* First subtask of the event, create its group */
+    if (tTasks == 0)
+    {
+        tTasks = new TTaskGroup(*tEventRand, GetSimulationContext());
+    }
+
+    return (tTasks->Spawn(task, taskContext) ? 0 : -1);
+}
+
+/* Exported */
+extern "C" int WaitTasks(void)
+{
+    /* Nothing forked, nothing to wait for */
+    if (tTasks == 0)
+    {
+        return 0;
+    }
+
+    return (tTasks->Wait() ? 0 : -1);
+}
+
+/* Exported */
+extern "C" const void * MapInput(const char * path, unsigned int flags, unsigned long * size)
+{
+    return TInputMapper::GetInstance()->Map(path, flags, size);
+}
+
+/* Exported */
+extern "C" const void * LocalInput(const void * input)
+{
+    return TInputMapper::GetInstance()->Local(input);
+}
+
+/* Exported */
+extern "C" int HistCreate(const char * name, unsigned int bins, double min, double max)
+{
+    /* The configurations of a sweep would fill each other's */
+    if (gSweep != 0)
+    {
+        return -1;
+    }
+
+    return TAccumulators::GetInstance()->CreateHistogram(name, bins, min, max);
+}
+
+/* Exported */
+extern "C" void HistFill(int histogram, double value, double weight)
+{
+    TAccumulators::GetInstance()->Fill(histogram, value, weight);
+}
+
+/* Exported */
+extern "C" int CounterCreate(const char * name)
+{
+    if (gSweep != 0)
+    {
+        return -1;
+    }
+
+    return TAccumulators::GetInstance()->CreateCounter(name);
+}
+
+/* Exported */
+extern "C" void CounterAdd(int counter, double value)
+{
+    TAccumulators::GetInstance()->Add(counter, value);
+}
+
+/* Exported */
+extern "C" int ChannelCreate(const char * name, unsigned int flags, unsigned long bufferSize, TReduceResult * reduce)
+{
+    return TResultChannels::GetInstance()->Create(name, flags, bufferSize, reduce);
+}
+
+static void StopHandler(int signal)
+{
+    gStopSignal = signal;
+    ++gStopSignals;
+}
+
+/* Whether the run has to stop: no new event can be started then */
+static inline bool StopRequested(void)
+{
+    return gStopSignal != 0 || (gWalltimeEnd != 0 && TStatistics::Now() >= gWalltimeEnd);
+}
+
+/* Forgets a stop, and the wall time limit, for the next run */
+static void ResetStops(void)
+{
+    gStopSignal = 0;
+    gStopSignals = 0;
+    gWalltimeEnd = 0;
+    gAbandoned = false;
+}
+
+/* Whether the events are reserved one after the other (from a coordinator, among the worker processes, or among the configurations of a sweep), instead of being split upfront */
+static inline bool ReservesEvents(void)
+{
+    return gPuller != 0 || gSweep != 0 || (gProcesses != 0 && gProcesses->IsWorker());
+}
+
+/* Gets the next events reserved, up to max. It has to be called with the init lock held. Returns false once none are left */
+static bool ReserveEvents(unsigned int max, unsigned int & count)
+{
+    unsigned long first;
+
+    if (gPuller != 0)
+    {
+        return gPuller->Reserve(max, count);
+    }
+
+    if (gSweep != 0)
+    {
+        return gSweep->Reserve(max, count);
+    }
+
+    if (!gProcesses->Reserve(max, first, count))
+    {
+        return false;
+    }
+
+    /* Other workers ran the events before */
+    gDispatched = first;
+    return true;
+}
+
+/* Account the events started by the calling room, until the end of the scope. It has to be created with the init lock held */
+class TEventDispatch
+{
+public:
+    TEventDispatch(unsigned int count)
+    {
+        fInFlight = &gInFlight[TThreadsFactory::GetCurrentSlot()];
+        fInFlight->fFirst = gDispatched;
+        fInFlight->fWritten = gWritten;
+        fInFlight->fCount = count;
+        gDispatched += count;
+        fChunk = (gPuller != 0 ? gPuller->Dispatch(count) : 0);
+        fCount = count;
+        /* The events belong to the configuration reserved last */
+        if (gSweep != 0)
+        {
+            tSweepSet = gSweep->GetCurrent();
+        }
+    }
+
+    ~TEventDispatch()
+    {
+        fInFlight->fCount = 0;
+        /* Their results are queued, the chunk may be completed */
+        if (fChunk != 0)
+        {
+            gPuller->Ended(fChunk, fCount);
+        }
+    }
+
+private:
+    TInFlight * fInFlight;
+    TPulledChunk * fChunk;
+    unsigned int fCount;
+};
+
+#ifndef USE_PILOT_THREAD
+/* Gets the amount of events to hand to the next thread, up to max. Returns false once none are left */
+static bool NextDispatch(unsigned long dispatched, unsigned long events, unsigned int max, unsigned int & count)
+{
+    bool reserved;
+
+    if (StopRequested())
+    {
+        return false;
+    }
+
+    /* The events reserved are drawn by the threads, under the init lock */
+    if (ReservesEvents())
+    {
+        TThreadsFactory::Wait(TThreadsFactory::GetInstance()->GetInitLock());
+        reserved = ReserveEvents(max, count);
+        sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+
+        return reserved;
+    }
+
+    if (dispatched >= events)
+    {
+        return false;
+    }
+
+    count = ((events - dispatched < max) ? events - dispatched : max);
+    return true;
+}
+#endif
+
+/* Writes the results of an event known by the cache, instead of running it */
+static bool ReplayCached(const unsigned char * id)
+{
+    std::vector<char> records;
+    TResult result;
+
+    if (!gCache->Find(id, records))
+    {
+        return false;
+    }
+
+    for (size_t offset = 0; offset + sizeof(uint32_t) <= records.size(); offset += sizeof(uint32_t) + result.fResultLength)
+    {
+        memcpy(&result.fResultLength, &records[offset], sizeof(uint32_t));
+        if (result.fResultLength > sizeof(result.fResult) || offset + sizeof(uint32_t) + result.fResultLength > records.size())
+        {
+            break;
+        }
+
+        memcpy(result.fId, id, sizeof(result.fId));
+        memcpy(result.fResult, &records[offset + sizeof(uint32_t)], result.fResultLength);
+        PushResult(&result);
+    }
+
+    return true;
+}
+
+static void ReleaseTasks(void)
+{
+    tEventRand = 0;
+
+    /* Join any subtask the event would have left behind */
+    if (tTasks != 0)
+    {
+        tTasks->Wait();
+        delete tTasks;
+        tTasks = 0;
+    }
+}
+
+/* Instrumentation of the event loops, for the statistics, the status server,
+ * the performance counters and the trace. It only costs something when one of them is enabled
+ */
+class TEventProbe
+{
+public:
+    TEventProbe()
+    {
+        fStatistics = ((gStatistics != 0) ? gStatistics->GetThread() : 0);
+        fStatus = ((gStatusServer != 0) ? gStatusServer->GetThread() : 0);
+        fPhaseStart = 0;
+        fEvent = 0;
+        fCount = 0;
+        /* Counters only count the thread which opened them */
+        if (gPerfCounters != 0)
+        {
+            gPerfCounters->Open(fPerf);
+        }
+    }
+
+    ~TEventProbe()
+    {
+        /* Whatever way we leave the loop, the room is free */
+        if (fStatus != 0)
+        {
+            fStatus->SetState(STATE_IDLE);
+        }
+        if (gPerfCounters != 0)
+        {
+            gPerfCounters->Close(fPerf);
+        }
+    }
+
+    /* An event (or a batch of events) starts. It's called with the init lock held */
+    inline void Begin(unsigned int count = 1)
+    {
+        if (fStatistics != 0 || gTracer != 0)
+        {
+            fPhaseStart = TStatistics::Now();
+        }
+        if (gTracer != 0)
+        {
+            fEvent = gTracer->NextEvents(count);
+            fCount = count;
+        }
+        if (fStatus != 0)
+        {
+            fStatus->SetState(STATE_INIT);
+        }
+        if (gPerfCounters != 0)
+        {
+            gPerfCounters->Begin(fPerf);
+        }
+    }
+
+    /* A phase of the event ended, the next one starts. Batches only have a per event average */
+    inline void Phase(TPhase phase, TThreadState next, unsigned int count = 1)
+    {
+        if (fStatistics != 0 || gTracer != 0)
+        {
+            unsigned long long end = TStatistics::Now();
+
+            if (fStatistics != 0)
+            {
+                fStatistics->fPhases[phase].Record((end - fPhaseStart) / count, count);
+                fStatistics->fBusy += end - fPhaseStart;
+            }
+            if (gTracer != 0)
+            {
+                gTracer->Record(static_cast<TTraceName>(TRACE_INIT + phase), fPhaseStart, end, fEvent, fCount);
+            }
+            fPhaseStart = end;
+        }
+        if (fStatus != 0)
+        {
+            fStatus->SetState(next);
+        }
+        if (gPerfCounters != 0)
+        {
+            gPerfCounters->Phase(fPerf, phase);
+        }
+    }
+
+    /* The event (or the batch of events) is done. Only single events have their ID */
+    inline void End(unsigned int count = 1, const unsigned char * id = 0)
+    {
+        if (fStatistics != 0)
+        {
+            fStatistics->fEvents += count;
+        }
+        if (fStatus != 0)
+        {
+            fStatus->fEvents += count;
+            fStatus->SetState(STATE_IDLE);
+        }
+        if (gPerfCounters != 0)
+        {
+            gPerfCounters->End(fPerf, count, id);
+        }
+    }
+
+    /* The pilot waits for the init lock */
+    inline void WaitInitLock(void)
+    {
+        unsigned long long start = 0;
+
+        if (fStatus != 0)
+        {
+            fStatus->SetState(STATE_WAIT);
+        }
+        if (fStatistics != 0 || gTracer != 0)
+        {
+            start = TStatistics::Now();
+        }
+
+        TThreadsFactory::Wait(TThreadsFactory::GetInstance()->GetInitLock());
+
+        if (fStatistics != 0 || gTracer != 0)
+        {
+            unsigned long long end = TStatistics::Now();
+
+            if (fStatistics != 0)
+            {
+                fStatistics->fInitLockWait += end - start;
+            }
+            if (gTracer != 0)
+            {
+                gTracer->Wait(TRACE_INIT_LOCK, start, end);
+            }
+        }
+    }
+
+private:
+    TThreadStatistics * fStatistics;
+    TThreadStatus * fStatus;
+    unsigned long long fPhaseStart;
+    /* Index and amount of the events, for the trace */
+    unsigned long fEvent;
+    unsigned int fCount;
+    TPerfGroup fPerf;
+};
+
+/* The event loop is specialized on the optional event hooks the simulation
+ * provides, and on instrumentation, so that the missing ones cost nothing per event
+ */
+template <bool HasEventInit, bool HasEventClear, bool Instrumented>
+static void * SimulationLoop(void * Arg)
+{
+    TEventProbe probe;
+    TCacheCapture capture;
+
+    if (gCache != 0)
+    {
+        tCapture = &capture;
+    }
+
+#ifdef USE_PILOT_THREAD
+    TPilotJobContext * context = reinterpret_cast<TPilotJobContext *>(Arg);
+    void * pilotContext = 0;
+    volatile bool failed = false;
+
+    /* Init the pilot */
+    if (gSimulation.fPilotInit != 0)
+    {
+        HPCSIM_TRY
+        {
+            if (gSimulation.fPilotInit(gSimulation.fSimulationContext, &pilotContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+        }
+        HPCSIM_EXCEPT
+        {
+            sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+            return 0;
+        }
+        HPCSIM_END
+    }
+
+    for (volatile unsigned long event = 0; event < context->fEvents; ++event)
+#else
+    UNUSED_PARAMETER(Arg);
+#endif
+    {
+#ifdef USE_PILOT_THREAD
+        unsigned int pulled;
+
+        /* The run is stopping (or the chunks are over), the pilot is done. We own the init lock for the pilot clear */
+        if (StopRequested() || (ReservesEvents() && !ReserveEvents(1, pulled)))
+        {
+            break;
+        }
+#endif
+
+        TEventDispatch dispatch(1);
+
+        if (Instrumented)
+        {
+            probe.Begin();
+        }
+
+        void * eventContext = 0;
+        RngStream rand;
+
+        /* Known event, its results are replayed instead. The init lock is kept for the next one */
+        if (gCache != 0)
+        {
+            if (ReplayCached(rand.GetDigest()))
+            {
+                if (Instrumented)
+                {
+                    probe.End();
+                }
+#ifdef USE_PILOT_THREAD
+                continue;
+#else
+                sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+                return 0;
+#endif
+            }
+
+            capture.fRecords.clear();
+            capture.fDiscard = false;
+        }
+
+        tRand = &rand;
+        /* Init the event */
+        if (HasEventInit)
+        {
+            HPCSIM_TRY
+            {
+#ifdef USE_PILOT_THREAD
+                if (SimulationFunction(EventInit)(GetSimulationContext(), pilotContext, &eventContext) < 0)
+#else
+                if (SimulationFunction(EventInit)(GetSimulationContext(), &eventContext) < 0)
+#endif
+                {
+                    HPCSIM_THROW;
+                }
+           }
+           HPCSIM_EXCEPT
+           {
+#ifdef USE_PILOT_THREAD
+                failed = true;
+#else
+                sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+                return 0;
+#endif
+            }
+            HPCSIM_END
+
+#ifdef USE_PILOT_THREAD
+            /* Skip the event, we still own the init lock for the next one.
+             * This cannot be done in the except block, it would only leave the try block
+             */
+            if (failed)
+            {
+                failed = false;
+                continue;
+            }
+#endif
+        }
+
+        if (Instrumented)
+        {
+            probe.Phase(PHASE_INIT, STATE_RUN);
+        }
+
+        /* Release init lock */
+        sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+
+        /* Call the simulation */
+        tEventRand = &rand;
+        HPCSIM_TRY
+        {
+#ifdef USE_PILOT_THREAD
+            SimulationFunction(EventRun)(GetSimulationContext(), pilotContext, eventContext);
+#else
+            SimulationFunction(EventRun)(GetSimulationContext(), eventContext);
+#endif
+        }
+        HPCSIM_EXCEPT
+        {
+            ReleaseTasks();
+#ifdef USE_PILOT_THREAD
+            failed = true;
+#else
+            return 0;
+#endif
+        }
+        HPCSIM_END
+#ifdef USE_PILOT_THREAD
+        if (failed)
+        {
+            /* Get the init lock back for the pilot clear */
+            TThreadsFactory::Wait(TThreadsFactory::GetInstance()->GetInitLock());
+            break;
+        }
+#endif
+        ReleaseTasks();
+
+        if (Instrumented)
+        {
+            probe.Phase(PHASE_RUN, STATE_CLEAR);
+        }
+
+        /* Notify end of event */
+        if (HasEventClear)
+        {
+            HPCSIM_TRY
+            {
+#ifdef USE_PILOT_THREAD
+                SimulationFunction(EventClear)(GetSimulationContext(), pilotContext, eventContext);
+#else
+                SimulationFunction(EventClear)(GetSimulationContext(), eventContext);
+#endif
+            }
+            HPCSIM_EXCEPT
+            {
+#ifdef USE_PILOT_THREAD
+                failed = true;
+#else
+                return 0;
+#endif
+            }
+            HPCSIM_END
+#ifdef USE_PILOT_THREAD
+            if (failed)
+            {
+                TThreadsFactory::Wait(TThreadsFactory::GetInstance()->GetInitLock());
+                break;
+            }
+#endif
+
+            if (Instrumented)
+            {
+                probe.Phase(PHASE_CLEAR, STATE_CLEAR);
+            }
+        }
+
+        tRand = 0;
+
+        /* The event went through, its results can be replayed next time */
+        if (gCache != 0)
+        {
+            gCache->Store(rand.GetDigest(), capture);
+        }
+
+        if (Instrumented)
+        {
+            probe.End(1, rand.GetDigest());
+        }
+
+#ifdef USE_PILOT_THREAD
+        if (Instrumented)
+        {
+            probe.WaitInitLock();
+        }
+        else
+        {
+            TThreadsFactory::Wait(TThreadsFactory::GetInstance()->GetInitLock());
+        }
+#endif
+    }
+
+#ifdef USE_PILOT_THREAD
+    if (gSimulation.fPilotClear != 0)
+    {
+        HPCSIM_TRY
+        {
+            gSimulation.fPilotClear(gSimulation.fSimulationContext, pilotContext);
+        }
+        HPCSIM_END
+    }
+
+    sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+#endif
+
+    tCapture = 0;
+
+    return 0;
+}
+
+static TBatchBuffers * GetBatchBuffers(void)
+{
+    unsigned int slot = TThreadsFactory::GetCurrentSlot();
+
+    /* Threads may be pinned: allocate on first use, from the room, so that buffers are local */
+    if (gBatchBuffers[slot] == 0)
+    {
+        gBatchBuffers[slot] = reinterpret_cast<TBatchBuffers *>(TTopology::AllocateLocal(sizeof(TBatchBuffers)));
+    }
+
+    return gBatchBuffers[slot];
+}
+
+static bool RunBatch(void * pilotContext, unsigned int count)
+{
+    volatile bool ret = true;
+    TEventProbe probe;
+    TBatchBuffers * buffers = GetBatchBuffers();
+    double * rngStates;
+    TResult * results;
+
+#ifndef USE_PILOT_THREAD
+    UNUSED_PARAMETER(pilotContext);
+#endif
+
+    if (buffers == 0)
+    {
+        sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+        return false;
+    }
+
+    rngStates = buffers->fRngStates;
+    results = buffers->fResults;
+
+    TEventDispatch dispatch(count);
+    probe.Begin(count);
+
+    /* Draw the streams of the consecutive events, and spread their states */
+    for (unsigned int event = 0; event < count; ++event)
+    {
+        RngStream rand;
+        double state[6];
+
+        rand.GetState(state);
+        for (unsigned int component = 0; component < 6; ++component)
+        {
+            rngStates[component * count + event] = state[component];
+        }
+
+        /* The ID is the initial state of the stream */
+        memcpy(results[event].fId, rand.GetDigest(), sizeof(TResult::fId));
+        results[event].fResultLength = 0;
+    }
+
+    probe.Phase(PHASE_INIT, STATE_RUN, count);
+
+    /* Release init lock */
+    sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+
+    /* Call the simulation */
+    HPCSIM_TRY
+    {
+#ifdef USE_PILOT_THREAD
+        SimulationFunction(EventRunBatch)(GetSimulationContext(), pilotContext, count, rngStates, results);
+#else
+        SimulationFunction(EventRunBatch)(GetSimulationContext(), count, rngStates, results);
+#endif
+    }
+    HPCSIM_EXCEPT
+    {
+        ret = false;
+    }
+    HPCSIM_END
+
+    /* Send the results to write thread, the IDs are already set */
+    if (ret)
+    {
+        probe.Phase(PHASE_RUN, STATE_RUN, count);
+        probe.End(count);
+
+        for (unsigned int event = 0; event < count; ++event)
+        {
+            if (results[event].fResultLength != 0)
+            {
+                /* Each event of the batch hands its own result to the next stage */
+                if (tStageEvent != 0)
+                {
+                    tStageEvent->fPassed = 0;
+                }
+                PushResult(&results[event]);
+            }
+        }
+    }
+
+    return ret;
+}
+
+static void * BatchLoop(void * Arg)
+{
+#ifdef USE_PILOT_THREAD
+    TPilotJobContext * context = reinterpret_cast<TPilotJobContext *>(Arg);
+    void * pilotContext = 0;
+    volatile unsigned long events = context->fEvents;
+    volatile bool failed = false;
+    TEventProbe probe;
+
+    /* Init the pilot */
+    if (gSimulation.fPilotInit != 0)
+    {
+        HPCSIM_TRY
+        {
+            if (gSimulation.fPilotInit(gSimulation.fSimulationContext, &pilotContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+        }
+        HPCSIM_EXCEPT
+        {
+            sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+            return 0;
+        }
+        HPCSIM_END
+    }
+
+    while (events != 0 && !failed && !StopRequested())
+    {
+        unsigned int count = (events < gSimulation.fBatchSize ? events : gSimulation.fBatchSize);
+
+        /* The batch doesn't go over the chunk pulled, nor over the events left to the workers */
+        if (ReservesEvents() && !ReserveEvents(count, count))
+        {
+            break;
+        }
+
+        events -= count;
+        failed = !RunBatch(pilotContext, count);
+
+        /* Get the init lock back, for the next batch or for the pilot clear */
+        probe.WaitInitLock();
+    }
+
+    if (gSimulation.fPilotClear != 0)
+    {
+        HPCSIM_TRY
+        {
+            gSimulation.fPilotClear(gSimulation.fSimulationContext, pilotContext);
+        }
+        HPCSIM_END
+    }
+
+    sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+#else
+    /* The size of the batch is passed as argument */
+    RunBatch(0, static_cast<unsigned int>(reinterpret_cast<uintptr_t>(Arg)));
+#endif
+
+    return 0;
+}
+
+template <bool HasEventInit, bool HasEventClear>
+static TThreadRoutine * SelectInstrumentedLoop(void)
+{
+    bool instrumented = (gStatistics != 0 || gStatusServer != 0 || gPerfCounters != 0 || gTracer != 0);
+
+    return (instrumented ? SimulationLoop<HasEventInit, HasEventClear, true> : SimulationLoop<HasEventInit, HasEventClear, false>);
+}
+
+static TThreadRoutine * SelectSimulationLoop(void)
+{
+    /* Batches have their own loop */
+    if (gSimulation.fEventRunBatch != 0)
+    {
+        return BatchLoop;
+    }
+
+    if (gSimulation.fEventInit != 0)
+    {
+        return ((gSimulation.fEventClear != 0) ? SelectInstrumentedLoop<true, true>() : SelectInstrumentedLoop<true, false>());
+    }
+
+    return ((gSimulation.fEventClear != 0) ? SelectInstrumentedLoop<false, true>() : SelectInstrumentedLoop<false, false>());
+}
+
+/* Gets the next result of a shard, and its configuration in a sweep (0 otherwise) */
+static bool ReadResult(TResult * result, unsigned int & set, unsigned int shard)
+{
+    unsigned long long start = 0;
+    struct iovec record[2];
+
+    if (gStatistics != 0 || gTracer != 0)
+    {
+        start = TStatistics::Now();
+    }
+
+    record[0].iov_base = result;
+    record[0].iov_len = sizeof(TResult);
+    record[1].iov_base = &set;
+    record[1].iov_len = sizeof(set);
+    set = 0;
+
+    if ((gProcesses != 0 ? !gProcesses->Pop(result) : readv(gPipes[shard][0], record, (gSweep != 0 ? 2 : 1)) <= 0) || memcmp(result, &gNullResult, sizeof(TResult)) == 0)
+    {
+        /* Close the last batch of writes */
+        if (gTracer != 0 && shard == 0)
+        {
+            gTracer->Written(start, TStatistics::Now(), 0);
+        }
+
+        return false;
+    }
+
+    /* All the results of a chunk pulled are written, tell the coordinator and go on */
+    if (gPuller != 0 && TEventClient::IsMarker(result))
+    {
+        gPuller->Written(result);
+        return ReadResult(result, set, shard);
+    }
+
+    /* The timeline has the batches of the first shard */
+    if (gTracer != 0 && shard == 0)
+    {
+        gTracer->Written(start, TStatistics::Now(), offsetof(TResult, fResult) + result->fResultLength);
+    }
+
+    if (gShards > 1)
+    {
+        pthread_mutex_lock(&gWritersLock);
+    }
+    if (gStatistics != 0)
+    {
+        gStatistics->Dequeued(start, offsetof(TResult, fResult) + result->fResultLength);
+    }
+    if (gStatusServer != 0)
+    {
+        gStatusServer->Written(offsetof(TResult, fResult) + result->fResultLength);
+    }
+    if (gShards > 1)
+    {
+        pthread_mutex_unlock(&gWritersLock);
+    }
+
+    return true;
+}
+
+/* Writes a result to the output file, returns the bytes written. The first failure is reported, the results which fail are lost */
+static unsigned long WriteOutputFile(int outFD, const char * outputFile, const TResult * result, bool & failed)
+{
+    ssize_t written = write(outFD, result, offsetof(TResult, fResult) + result->fResultLength);
+
+    if (written > 0)
+    {
+        return written;
+    }
+
+    if (!failed)
+    {
+        std::cerr << "Failed writing to output file " << outputFile << std::endl;
+        failed = true;
+    }
+
+    return 0;
+}
+
+static void * WriteResults(void * Arg)
+{
+    TResult result;
+    unsigned int set;
+    char * outputFile = reinterpret_cast<char *>(Arg);
+
+    if (gTracer != 0)
+    {
+        gTracer->AttachWriter();
+    }
+    if (gProfiler != 0)
+    {
+        gProfiler->Arm(NO_SLOT);
+    }
+
+#define LOOP_FOR_EVENTS(f)                                        \
+    while (ReadResult(&result, set, 0))                           \
+        f
+
+    /* For performances reason (compiler optimisation, distinguish the cases) */
+    if (gSweep != 0 && gSimulation.fReduceResult == 0)
+    {
+        /* Each configuration has its own output, they were created already */
+        LOOP_FOR_EVENTS(gWritten += gSweep->Write(set, &result));
+    }
+    else if (gSweep != 0)
+    {
+        /* Each configuration reduces its own results */
+        HPCSIM_TRY
+        {
+            LOOP_FOR_EVENTS(gSimulation.fReduceResult(gSweep->GetSet(set).fContext, gSweep->GetSet(set).fOutput.c_str(), result.fId, result.fResultLength, result.fResult));
+        }
+        HPCSIM_END
+    }
+    else if (gSink != 0)
+    {
+        /* The consumer reads them as they come, instead of the output file */
+        LOOP_FOR_EVENTS(gWritten += gSink->Write(&result));
+
+        gSink->End();
+    }
+    else if (gSimulation.fReduceResult == 0)
+    {
+        bool failed = false;
+        int outFD;
+
+        /* Whatever happens, we create if needed, and we want to write */
+        int flags = O_WRONLY | O_CREAT;
+
+        /* In case we are in checkpoint mode, just append at the end of file,
+         * otherwise, erase any content
+         */
+        if (!gSimulation.fCheckPoint)
+        {
+            flags |= O_TRUNC;
+        }
+
+        /* Open the output file */
+        outFD = open(outputFile, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        assert(outFD != -1);
+
+        /* Go to the end of the file if checkpoint */
+        if (gSimulation.fCheckPoint)
+        {
+            gWritten = lseek(outFD, 0, SEEK_END);
+        }
+
+        /* Read the incoming event and write only what's needed to the output file.
+         * This loop will end on end signal event
+         */
+        LOOP_FOR_EVENTS(gWritten += WriteOutputFile(outFD, outputFile, &result, failed));
+
+        close(outFD);
+    }
+    else if (gPipeline != 0)
+    {
+        /* The last stage reduces the results of the pipeline */
+        TPipelineStage * last = &gPipeline->GetStage(gPipeline->GetSize() - 1);
+
+        HPCSIM_TRY
+        {
+            LOOP_FOR_EVENTS(last->fReduceResult(last->fContext, outputFile, result.fId, result.fResultLength, result.fResult));
+        }
+        HPCSIM_END
+    }
+    else
+    {
+        /* Read the incoming event and pass it to the simulation
+         * This loop will end on end signal event
+         */
+        HPCSIM_TRY
+        {
+            LOOP_FOR_EVENTS(gSimulation.fReduceResult(gSimulation.fSimulationContext, outputFile, result.fId, result.fResultLength, result.fResult));
+        }
+        HPCSIM_END
+    }
+
+    if (gProfiler != 0)
+    {
+        gProfiler->Disarm();
+    }
+
+    return 0;
+}
+
+/* Writes the results of a shard to its segments of the output */
+static void * WriteSegments(void * Arg)
+{
+    unsigned int shard = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(Arg));
+    TResult result;
+    unsigned int set;
+
+    /* The timeline and the profiler follow the writer of the first shard */
+    if (gTracer != 0 && shard == 0)
+    {
+        gTracer->AttachWriter();
+    }
+    if (gProfiler != 0 && shard == 0)
+    {
+        gProfiler->Arm(NO_SLOT);
+    }
+
+    /* A segment is closed, and can be consumed, once it's over the rotation size */
+    while (ReadResult(&result, set, shard))
+    {
+        __sync_fetch_and_add(&gWritten, gOutputSet->Write(shard, &result));
+    }
+
+    if (gProfiler != 0 && shard == 0)
+    {
+        gProfiler->Disarm();
+    }
+
+    return 0;
+}
+
+/* Tells the writers there are no more results */
+static void EndResults(void)
+{
+    if (gProcesses != 0)
+    {
+        gProcesses->End();
+        return;
+    }
+
+    for (unsigned int shard = 0; shard < gShards; ++shard)
+    {
+        WritePipe(&gNullResult, shard);
+    }
+}
+
+/* Waits for the writers to be done, the segments of the output are closed then */
+static void JoinWriters(pthread_t & writingThread)
+{
+    void * ret;
+
+    pthread_join(writingThread, &ret);
+    for (unsigned int shard = 1; shard < gShards; ++shard)
+    {
+        pthread_join(gShardWriters[shard], &ret);
+    }
+
+    if (gOutputSet != 0)
+    {
+        gOutputSet->Close();
+    }
+}
+
+/* Closes the pipes to the writers of the first shards */
+static void ClosePipes(unsigned int shards)
+{
+    for (unsigned int shard = 0; shard < shards; ++shard)
+    {
+        close(gPipes[shard][0]);
+        close(gPipes[shard][1]);
+    }
+}
+
+/* Waits for the events started so far (by the worker processes, in their parent). Returns false if the ones still running have to be abandoned */
+static bool WaitForEvents(unsigned int drainTime)
+{
+    bool parent = (gProcesses != 0 && !gProcesses->IsWorker());
+    unsigned long long deadline = 0;
+
+    while (!(parent ? gProcesses->WaitForWorkers(WAIT_SLICE) : TThreadsFactory::GetInstance()->WaitForAllThreads(WAIT_SLICE)))
+    {
+        if (!StopRequested())
+        {
+            continue;
+        }
+
+        /* Give some time to the events in flight to end */
+        if (deadline == 0)
+        {
+            if (parent)
+            {
+                gProcesses->Signal(SIGTERM);
+            }
+            if (gProcesses == 0 || parent)
+            {
+                std::cerr << "Stopping: no new event is started, waiting up to " << drainTime << " s for the running ones (again to abandon them)" << std::endl;
+            }
+            deadline = TStatistics::Now() + drainTime * 1000000000ULL;
+        }
+
+        if (gStopSignals > 1 || TStatistics::Now() >= deadline)
+        {
+            /* What the workers wrote so far is still read */
+            if (parent)
+            {
+                gProcesses->Signal(SIGKILL);
+                gProcesses->WaitForWorkers(std::numeric_limits<unsigned int>::max());
+                gDispatched = gProcesses->GetDispatched();
+            }
+            return false;
+        }
+    }
+
+    if (parent)
+    {
+        gDispatched = gProcesses->GetDispatched();
+    }
+
+    return true;
+}
+
+/* Size of an output, the one of all its segments when it's sharded or rotated */
+static unsigned long long GetOutputSize(const char * outputFile)
+{
+    TOutputSet output;
+
+    return (output.Open(outputFile) ? output.GetSize() : 0);
+}
+
+static std::string GetResumeFile(const char * outputFile)
+{
+    return std::string(outputFile) + ".resume";
+}
+
+static bool WriteResumeHint(const char * outputFile, const TResumeHint & hint)
+{
+    std::string hintFile = GetResumeFile(outputFile);
+    std::string tempFile = hintFile + ".tmp";
+    FILE * file;
+    bool written;
+
+    file = fopen(tempFile.c_str(), "w");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    fprintf(file, "runFirst=%lu\nrunEvents=%lu\nnext=%lu\nremaining=%lu\nscan=%d\noffset=%llu\nsize=%llu\n",
+            hint.fRunFirst, hint.fRunEvents, hint.fNext, hint.fRemaining, hint.fScan ? 1 : 0, hint.fOffset, hint.fSize);
+    written = (fflush(file) == 0 && fsync(fileno(file)) == 0);
+    written = (fclose(file) == 0 && written);
+
+    /* A reader never sees a partial hint */
+    if (!written || rename(tempFile.c_str(), hintFile.c_str()) == -1)
+    {
+        unlink(tempFile.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool ReadResumeHint(const char * outputFile, TResumeHint & hint)
+{
+    FILE * file;
+    int scan;
+    int fields;
+
+    file = fopen(GetResumeFile(outputFile).c_str(), "r");
+    if (file == 0)
+    {
+        return false;
+    }
+
+    fields = fscanf(file, "runFirst=%lu\nrunEvents=%lu\nnext=%lu\nremaining=%lu\nscan=%d\noffset=%llu\nsize=%llu\n",
+                    &hint.fRunFirst, &hint.fRunEvents, &hint.fNext, &hint.fRemaining, &scan, &hint.fOffset, &hint.fSize);
+    fclose(file);
+    hint.fScan = (scan != 0);
+
+    return fields == 7;
+}
+
+/* Writes where the run has to be resumed, once the writer is done */
+static void StopRun(const char * outputFile, unsigned long runFirst, unsigned long runEvents, unsigned long start, unsigned long events, unsigned int nThreads)
+{
+    TResumeHint hint;
+    unsigned long next = gDispatched;
+
+    hint.fScan = false;
+    hint.fOffset = 0;
+    /* Events abandoned may have written some results: resume at the first one, and look for them.
+     * With shards, the output isn't in the order of the writes, it's looked at from its start
+     */
+    for (unsigned int slot = 0; slot < nThreads; ++slot)
+    {
+        if (gInFlight[slot].fCount != 0 && gInFlight[slot].fFirst <= next)
+        {
+            if (gShards == 1 && (!hint.fScan || gInFlight[slot].fWritten < hint.fOffset))
+            {
+                hint.fOffset = gInFlight[slot].fWritten;
+            }
+            next = gInFlight[slot].fFirst;
+            hint.fScan = true;
+        }
+    }
+
+    hint.fRunFirst = runFirst;
+    hint.fRunEvents = runEvents;
+    hint.fNext = start + next;
+    hint.fRemaining = events - next;
+    hint.fSize = GetOutputSize(outputFile);
+
+    if (!WriteResumeHint(outputFile, hint))
+    {
+        std::cerr << "Failed writing resume hint: " << GetResumeFile(outputFile) << std::endl;
+    }
+
+    std::cerr << "Run stopped" << (gStopSignal != 0 ? " by signal" : " at wall time limit") << ": " << hint.fRemaining << " events remaining, from event " << hint.fNext << ". Run again with --checkpoint to resume" << std::endl;
+}
+
+/* Writes the results of the ranks (or of the workers), event after event, as a single process run would */
+static void MergeRanks(unsigned long events)
+{
+    for (unsigned long event = 0; event < events; ++event)
+    {
+        RngStream rand;
+
+        TRankMerger::GetInstance()->Replay(TRankMerger::GetInstance()->GetOutput(event), rand.GetDigest(), PushResult);
+    }
+
+    gDispatched = events;
+}
+
+/* Inits the simulation once per configuration of the sweep, with its options. The ones failing are skipped. Returns false if none went through */
+static bool InitSweep(unsigned int threads, unsigned long events, unsigned long first)
+{
+    volatile bool initialized = false;
+
+    for (volatile unsigned int index = 0; index < gSweep->GetSize(); ++index)
+    {
+        TSweepSet * volatile set = &gSweep->GetSet(index);
+
+        HPCSIM_TRY
+        {
+            if (gSimulation.fSimulationInit != 0 &&
+                gSimulation.fSimulationInit(gUsingPilot, threads, events, first, (set->fOptions.empty() ? 0 : set->fOptions.c_str()), &set->fContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+            set->fInitialized = true;
+            initialized = true;
+        }
+        HPCSIM_EXCEPT
+        {
+            std::cerr << "Failed initializing library for configuration " << index << " (" << set->fOutput << "), skipping it" << std::endl;
+            set->fFailed = true;
+        }
+        HPCSIM_END
+    }
+
+    return initialized;
+}
+
+/* Inits the run of each configuration of the sweep. The ones failing are skipped. Returns false if none went through */
+static bool RunInitSweep(void)
+{
+    volatile bool initialized = false;
+
+    for (volatile unsigned int index = 0; index < gSweep->GetSize(); ++index)
+    {
+        TSweepSet * volatile set = &gSweep->GetSet(index);
+
+        if (set->fFailed)
+        {
+            continue;
+        }
+
+        HPCSIM_TRY
+        {
+            if (gSimulation.fRunInit != 0 && gSimulation.fRunInit(set->fContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+            initialized = true;
+        }
+        HPCSIM_EXCEPT
+        {
+            std::cerr << "Failed initializing run for configuration " << index << " (" << set->fOutput << "), skipping it" << std::endl;
+            set->fFailed = true;
+        }
+        HPCSIM_END
+    }
+
+    return initialized;
+}
+
+/* Ends the run of each configuration of the sweep which started it, or unloads each one initialized */
+static void ClearSweep(bool unload)
+{
+    for (volatile unsigned int index = 0; index < gSweep->GetSize(); ++index)
+    {
+        TSweepSet * volatile set = &gSweep->GetSet(index);
+
+        HPCSIM_TRY
+        {
+            if (unload && set->fInitialized && gSimulation.fSimulationUnload != 0)
+            {
+                gSimulation.fSimulationUnload(set->fContext);
+            }
+            else if (!unload && !set->fFailed && gSimulation.fRunClear != 0)
+            {
+                gSimulation.fRunClear(set->fContext);
+            }
+        }
+        HPCSIM_END
+    }
+}
+
+/* Inits each stage following the simulation, with its options. Returns false if one failed */
+static bool InitPipeline(unsigned int threads, unsigned long events, unsigned long first)
+{
+    volatile bool initialized = true;
+
+    for (volatile unsigned int index = 1; initialized && index < gPipeline->GetSize(); ++index)
+    {
+        TPipelineStage * volatile stage = &gPipeline->GetStage(index);
+
+        HPCSIM_TRY
+        {
+            if (stage->fSimulationInit != 0 &&
+                stage->fSimulationInit(gUsingPilot, threads, events, first, (stage->fOptions.empty() ? 0 : stage->fOptions.c_str()), &stage->fContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+            stage->fInitialized = true;
+        }
+        HPCSIM_EXCEPT
+        {
+            std::cerr << "Failed initializing library of stage " << index << " (" << stage->fPath << ")" << std::endl;
+            initialized = false;
+        }
+        HPCSIM_END
+    }
+
+    return initialized;
+}
+
+/* Inits the run of each stage following the simulation. Returns false if one failed */
+static bool RunInitPipeline(void)
+{
+    volatile bool initialized = true;
+
+    for (volatile unsigned int index = 1; initialized && index < gPipeline->GetSize(); ++index)
+    {
+        TPipelineStage * volatile stage = &gPipeline->GetStage(index);
+
+        HPCSIM_TRY
+        {
+            if (stage->fRunInit != 0 && stage->fRunInit(stage->fContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+            stage->fRunning = true;
+        }
+        HPCSIM_EXCEPT
+        {
+            std::cerr << "Failed initializing run of stage " << index << " (" << stage->fPath << ")" << std::endl;
+            initialized = false;
+        }
+        HPCSIM_END
+    }
+
+    return initialized;
+}
+
+/* Ends the run of each stage following the simulation which started it, or unloads each one initialized */
+static void ClearPipeline(bool unload)
+{
+    for (volatile unsigned int index = 1; index < gPipeline->GetSize(); ++index)
+    {
+        TPipelineStage * volatile stage = &gPipeline->GetStage(index);
+
+        HPCSIM_TRY
+        {
+            if (unload && stage->fInitialized && stage->fSimulationUnload != 0)
+            {
+                stage->fSimulationUnload(stage->fContext);
+            }
+            else if (!unload && stage->fRunning && stage->fRunClear != 0)
+            {
+                stage->fRunClear(stage->fContext);
+            }
+        }
+        HPCSIM_END
+
+        if (!unload)
+        {
+            stage->fRunning = false;
+        }
+    }
+}
+
+static void UnloadSimulation(void)
+{
+#ifndef HPCSIM_STATIC_SIMULATION
+    if (gSimulationLib != 0)
+    {
+        dlclose(gSimulationLib);
+        gSimulationLib = 0;
+    }
+#endif
+}
+
+/* Loads the entry points of the simulation, opening its library first if it isn't linked in */
+static bool LoadSimulation(const char * simulationFile)
+{
+#ifndef HPCSIM_STATIC_SIMULATION
+    /* Open the simulation worker */
+    gSimulationLib = dlopen(simulationFile, RTLD_NOW | RTLD_LOCAL);
+    if (gSimulationLib == 0)
+    {
+        std::cerr << "Failed loading " << simulationFile << ", with error " << dlerror() << std::endl;
+        return false;
+    }
+#else
+    UNUSED_PARAMETER(simulationFile);
+#endif
+
+    /* Load its functions */
+    LoadAndSetSimulationFunction(SimulationInit);
+    LoadAndSetSimulationFunction(RunInit);
+#ifdef USE_PILOT_THREAD
+    LoadAndSetSimulationFunction(PilotInit);
+#endif
+    LoadAndSetSimulationFunction(EventInit);
+    LoadAndSetSimulationFunction(EventRun);
+    LoadAndSetSimulationFunction(EventRunBatch);
+    LoadAndSetSimulationFunction(EventClear);
+#ifdef USE_PILOT_THREAD
+    LoadAndSetSimulationFunction(PilotClear);
+#endif
+    LoadAndSetSimulationFunction(ReduceResult);
+    LoadAndSetSimulationFunction(RunClear);
+    LoadAndSetSimulationFunction(SimulationUnload);
+
+    /* We need at least something to run */
+    if (gSimulation.fEventRun == 0 && gSimulation.fEventRunBatch == 0)
+    {
+        std::cerr << "No EventRun() nor EventRunBatch() entry point present" << std::endl;
+        UnloadSimulation();
+        return false;
+    }
+
+    return true;
+}
+
+/* Turns the crashes of the simulation into exceptions. gHandlerLock has to be initialized */
+static void HandleErrors(void)
+{
+    struct sigaction sigHandling;
+
+    /* Initialize our signal handling */
+    memset(&sigHandling, 0, sizeof(struct sigaction));
+    sigHandling.sa_sigaction = SignalHandler;
+    /* We want it to be automatically reset and we want extended info */
+    sigHandling.sa_flags = SA_SIGINFO;
+
+    /* These are all the signals we will handle
+     * So that simulation can still use SIGUSR1/SIGUSR2 for internal sync
+     */
+    sigaction(SIGABRT, &sigHandling, NULL);
+    sigaction(SIGBUS, &sigHandling, NULL);
+    sigaction(SIGFPE, &sigHandling, NULL);
+    sigaction(SIGILL, &sigHandling, NULL);
+    sigaction(SIGSEGV, &sigHandling, NULL);
+    sigaction(SIGSYS, &sigHandling, NULL);
+    sigaction(SIGXCPU, &sigHandling, NULL);
+    sigaction(SIGXFSZ, &sigHandling, NULL);
+}
+
+/* Turns SIGTERM and SIGINT into stop requests */
+static void HandleStops(void)
+{
+    struct sigaction sigHandling;
+
+    memset(&sigHandling, 0, sizeof(struct sigaction));
+    sigHandling.sa_handler = StopHandler;
+    sigemptyset(&sigHandling.sa_mask);
+    sigHandling.sa_flags = SA_RESTART;
+    sigaction(SIGTERM, &sigHandling, NULL);
+    sigaction(SIGINT, &sigHandling, NULL);
+}
+
+/* Hands the events to the threads. With pilot jobs, it returns their contexts, to be deleted once they're done */
+static TPilotJobContext * DispatchEvents(TThreadRoutine * simulationLoop, unsigned long nEvents, unsigned int nThreads)
+{
+#ifndef USE_PILOT_THREAD
+    unsigned int count;
+
+    UNUSED_PARAMETER(nThreads);
+
+    if (gSimulation.fEventRunBatch != 0)
+    {
+        /* Events are handed by batches, the last one (of the run or of a chunk) can be partial */
+        for (unsigned long event = 0; NextDispatch(event, nEvents, gSimulation.fBatchSize, count); event += count)
+        {
+            TThreadsFactory::GetInstance()->CreateThread(simulationLoop, reinterpret_cast<void *>(static_cast<uintptr_t>(count)));
+        }
+    }
+    else
+    {
+        for (unsigned long event = 0; NextDispatch(event, nEvents, 1, count); ++event)
+        {
+            TThreadsFactory::GetInstance()->CreateThread(simulationLoop, 0);
+        }
+    }
+
+    return 0;
+#else
+    /* Alloc once, use multipe times - reduce overhead */
+    TPilotJobContext * contexts = new TPilotJobContext[nThreads];
+    /* Compute number of events required per thread */
+    unsigned long eventsPerThread = nEvents / nThreads;
+    /* Compute number of threads where we have to +1 number of events to get exact amount */
+    unsigned long padding = nEvents % nThreads;
+    /* Start at first event */
+    TPilotJobContext * context = contexts;
+
+    for (unsigned long thread = 0; thread < nThreads; ++thread)
+    {
+        /* Pilots pulling stop once the chunks are over */
+        context->fEvents = (ReservesEvents() ? std::numeric_limits<unsigned long>::max() : eventsPerThread + ((thread < padding) ? 1 : 0));
+        TThreadsFactory::GetInstance()->CreateThread(simulationLoop, context);
+
+        ++context;
+    }
+
+    return contexts;
+#endif
+}
+
+#ifndef USE_PILOT_THREAD
+/* Runs the events of the simulation, as the first stage of the pipeline */
+static void * SourceLoop(void * Arg)
+{
+    TStageEvent event;
+
+    event.fStage = 0;
+    event.fSubstream = 0;
+    event.fContext = gSimulation.fSimulationContext;
+    event.fInput = 0;
+    event.fPassed = 0;
+    event.fHeld = 0;
+
+    tStageEvent = &event;
+    gSourceLoop(Arg);
+    tStageEvent = 0;
+
+    gPipeline->Ended(0);
+
+    return 0;
+}
+
+/* Runs a result queued for a stage, as one of its events. Its numbers come from a substream of the event of the simulation */
+static void * StageLoop(void * Arg)
+{
+    TStageItem * item = reinterpret_cast<TStageItem *>(Arg);
+    TPipelineStage * volatile stage = &gPipeline->GetStage(item->fEvent.fStage);
+    RngStream rand(item->fInput.fId, item->fEvent.fSubstream);
+    void * eventContext = 0;
+    volatile bool failed = false;
+
+    tStageEvent = &item->fEvent;
+    tRand = &rand;
+
+    /* Init the event */
+    if (stage->fEventInit != 0)
+    {
+        HPCSIM_TRY
+        {
+            if (stage->fEventInit(item->fEvent.fContext, &eventContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+        }
+        HPCSIM_EXCEPT
+        {
+            failed = true;
+        }
+        HPCSIM_END
+    }
+
+    /* Release init lock */
+    sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+
+    /* Call the stage */
+    if (!failed)
+    {
+        tEventRand = &rand;
+        HPCSIM_TRY
+        {
+            stage->fEventRun(item->fEvent.fContext, eventContext);
+        }
+        HPCSIM_EXCEPT
+        {
+            failed = true;
+        }
+        HPCSIM_END
+        ReleaseTasks();
+    }
+
+    /* Notify end of event */
+    if (!failed && stage->fEventClear != 0)
+    {
+        HPCSIM_TRY
+        {
+            stage->fEventClear(item->fEvent.fContext, eventContext);
+        }
+        HPCSIM_EXCEPT
+        {
+            failed = true;
+        }
+        HPCSIM_END
+    }
+
+    tRand = 0;
+    tStageEvent = 0;
+
+    __sync_fetch_and_add((failed ? &stage->fFailed : &stage->fEvents), 1);
+    gPipeline->Ended(item);
+
+    return 0;
+}
+
+/* Hands the results queued for the stages to the threads */
+static void RunQueued(void)
+{
+    TStageItem * item;
+
+    while ((item = gPipeline->Pop()) != 0)
+    {
+        if (!TThreadsFactory::GetInstance()->CreateThread(StageLoop, item))
+        {
+            gPipeline->Ended(item);
+        }
+    }
+}
+
+/* Hands the events of the simulation, and the results they queue for the stages, to the threads.
+ * Results are run first, and no event is started while the stages are behind
+ */
+static void DispatchPipeline(TThreadRoutine * simulationLoop, unsigned long nEvents)
+{
+    unsigned int batch = ((gSimulation.fEventRunBatch != 0) ? gSimulation.fBatchSize : 1);
+    unsigned long event = 0;
+    unsigned int count;
+
+    gSourceLoop = simulationLoop;
+
+    while (true)
+    {
+        RunQueued();
+
+        if (gPipeline->IsBehind() && !StopRequested())
+        {
+            gPipeline->Wait(WAIT_SLICE);
+            continue;
+        }
+
+        if (!NextDispatch(event, nEvents, batch, count))
+        {
+            break;
+        }
+
+        /* Batches get their size as argument */
+        gPipeline->Started();
+        if (!TThreadsFactory::GetInstance()->CreateThread(SourceLoop, ((gSimulation.fEventRunBatch != 0) ? reinterpret_cast<void *>(static_cast<uintptr_t>(count)) : 0)))
+        {
+            gPipeline->Ended(0);
+        }
+        event += count;
+    }
+
+    /* Then the stages drain the pipeline, the results not run yet are dropped on stop */
+    while (!gPipeline->IsIdle())
+    {
+        if (StopRequested())
+        {
+            gPipeline->Discard();
+            break;
+        }
+
+        RunQueued();
+        gPipeline->Wait(WAIT_SLICE);
+    }
+}
+#endif
+
+/* Opens the pipes to the writers, and starts them. If the threads are pinned, they get the rooms after theirs */
+static bool StartWriter(pthread_t & writingThread, char * outputFile, bool pinned, unsigned int nThreads)
+{
+    pthread_attr_t writingAttributes;
+
+    /* Init our null event */
+    memset(&gNullResult, 0, sizeof(TResult));
+
+    /* Open the communication pipes, one per shard */
+    for (unsigned int shard = 0; shard < gShards; ++shard)
+    {
+        if (pipe(gPipes[shard]) == -1)
+        {
+            std::cerr << "Failed creating pipes" << std::endl;
+            ClosePipes(shard);
+            return false;
+        }
+    }
+
+    /* Start our background writing threads */
+    for (unsigned int shard = 0; shard < gShards; ++shard)
+    {
+        pthread_attr_init(&writingAttributes);
+        if (pinned)
+        {
+            cpu_set_t writingCpu;
+
+            /* The writers get the rooms after the computing threads */
+            CPU_ZERO(&writingCpu);
+            CPU_SET(TThreadsFactory::GetInstance()->GetCpu(nThreads + shard), &writingCpu);
+            pthread_attr_setaffinity_np(&writingAttributes, sizeof(writingCpu), &writingCpu);
+        }
+        if (pthread_create((shard == 0 ? &writingThread : &gShardWriters[shard]), &writingAttributes, (gOutputSet != 0 ? WriteSegments : WriteResults),
+                           (gOutputSet != 0 ? reinterpret_cast<void *>(static_cast<uintptr_t>(shard)) : outputFile)) != 0)
+        {
+            pthread_attr_destroy(&writingAttributes);
+            std::cerr << "Failed creating writing thread" << std::endl;
+            /* The ones started already are done at once */
+            for (unsigned int started = 0; started < shard; ++started)
+            {
+                void * ret;
+
+                WritePipe(&gNullResult, started);
+                pthread_join((started == 0 ? writingThread : gShardWriters[started]), &ret);
+            }
+            ClosePipes(gShards);
+            return false;
+        }
+        pthread_attr_destroy(&writingAttributes);
+    }
+
+    return true;
+}
+
+static void PrintUsage(char * name)
+{
+#ifdef HPCSIM_STATIC_SIMULATION
+    std::cerr << "Usage: " << name << " [--threads|-t X --first|-f X --events|-e X --output|-o name --user|-u options --checkpoint|-c --batch|-b X --affinity|-a policy --stats|-S file.json --stats-interval|-I X --status-socket|-m path --perf-counters|-P file.json --perf-events|-E file.csv --trace|-T file.json --profile|-p hz --cache|-C dir --cache-size|-Z MB --walltime|-W seconds --drain|-D seconds --rank|-R X --nranks|-N X --partition|-x policy --merge|-M --serve-events|-G address --pull-from|-F address --chunk|-k X --chunk-timeout|-K seconds --processes|-j X --sweep|-w file --daemon|-d socket --sink|-O uri --sink-policy|-y policy --sink-buffer|-z MB --output-shards|-n X --output-rotate|-r MB --channel|-l name=path]" << std::endl;
+#else
+    std::cerr << "Usage: " << name << " --simulation|-s name.so [--threads|-t X --first|-f X --events|-e X --output|-o name --user|-u options --checkpoint|-c --batch|-b X --affinity|-a policy --stats|-S file.json --stats-interval|-I X --status-socket|-m path --perf-counters|-P file.json --perf-events|-E file.csv --trace|-T file.json --profile|-p hz --cache|-C dir --cache-size|-Z MB --walltime|-W seconds --drain|-D seconds --rank|-R X --nranks|-N X --partition|-x policy --merge|-M --serve-events|-G address --pull-from|-F address --chunk|-k X --chunk-timeout|-K seconds --processes|-j X --sweep|-w file --daemon|-d socket --sink|-O uri --sink-policy|-y policy --sink-buffer|-z MB --output-shards|-n X --output-rotate|-r MB --channel|-l name=path --stage|-L \"name.so options\" --stage-queue|-Q X]" << std::endl;
+    std::cerr << "\t- Simulation: path of the shared library containing the simulation" << std::endl;
+#endif
+    std::cerr << "\t- Threads: amount of threads to use for computing (min 1), or a for all the CPUs available (affinity mask and cgroup quota). Beware an extra thread will be used for results writing" << std::endl;
+    std::cerr << "\t- First: start the event loop at this event" << std::endl;
+    std::cerr << "\t- Events: number of events to compute" << std::endl;
+    std::cerr << "\t- Output: name of the output file to write" << std::endl;
+    std::cerr << "\t- Options: user defined options line to be parsed by the simulation shared library" << std::endl;
+    std::cerr << "\t- Checkpoint: HPCsim will read existing output file to continue the simulation where it was stopped, instead of simulating everything" << std::endl;
+    std::cerr << "\t- Batch: amount of consecutive events handed at once to EventRunBatch(), when the simulation provides it (min 1, max " << HPCSIM_MAX_BATCH << ")" << std::endl;
+    std::cerr << "\t- Affinity: pin the threads, compact (fill NUMA nodes one after the other), scatter (spread over NUMA nodes) or a list of CPUs (0-3,8)" << std::endl;
+    std::cerr << "\t- Stats: write run statistics (events timings, threads utilization, locks waits, writer queue) as JSON to this file" << std::endl;
+    std::cerr << "\t- Stats interval: also update the statistics file every X seconds during the run" << std::endl;
+    std::cerr << "\t- Status socket: serve the progress of the run (as JSON) to any client connecting to this Unix socket" << std::endl;
+    std::cerr << "\t- Perf counters: write cycles, instructions, LLC and branch misses of each event phase, per thread, as JSON to this file" << std::endl;
+    std::cerr << "\t- Perf events: write the counters of each event, by ID, as CSV to this file" << std::endl;
+    std::cerr << "\t- Trace: write the timeline of the run (event phases, locks waits, results queued and written) to this file, in Chrome trace format" << std::endl;
+    std::cerr << "\t- Profile: sample the stacks of the threads this many times per second of CPU, and print the hottest functions at the end of the run" << std::endl;
+    std::cerr << "\t- Cache: reuse the results of the events already simulated by this build of the simulation with these options, from this directory, and store the new ones" << std::endl;
+    std::cerr << "\t- Cache size: size of the cache, least recently used events are evicted over it (default " << DEFAULT_CACHE_SIZE << ")" << std::endl;
+    std::cerr << "\t- Wall time: stop starting new events after this many seconds, the run can then be resumed with checkpoint. SIGTERM and SIGINT do the same" << std::endl;
+    std::cerr << "\t- Drain: how long to wait for the running events when stopping, before abandoning them (default " << DEFAULT_DRAIN_TIME << ")" << std::endl;
+    std::cerr << "\t- Rank: index of this process among the ranks of the run (from 0), it only runs its part of the events and writes to output.rankX" << std::endl;
+    std::cerr << "\t- Ranks: amount of processes the events are split over" << std::endl;
+    std::cerr << "\t- Partition: blocked (consecutive events per rank, default) or interleaved (one event out of ranks, to balance uneven events)" << std::endl;
+    std::cerr << "\t- Merge: write the results of all the ranks (or of the workers of a coordinator, without ranks) to output, in the order of a single process run, or reduce them" << std::endl;
+    std::cerr << "\t- Serve events: coordinate the run, handing out chunks of the events to the workers pulling from this Unix socket (or host:port), until they're all done. Completed chunks are journaled to output.journal" << std::endl;
+    std::cerr << "\t- Pull from: run as a worker of the coordinator at this address, writing the results of the chunks to output.pull-host-pid" << std::endl;
+    std::cerr << "\t- Chunk: amount of events per chunk handed out by the coordinator (default " << DEFAULT_CHUNK_SIZE << ")" << std::endl;
+    std::cerr << "\t- Chunk timeout: seconds without news from a worker before the coordinator hands its chunks to others (default " << DEFAULT_CHUNK_TIMEOUT << ", 0 to wait for disconnection)" << std::endl;
+    std::cerr << "\t- Processes: run the events in this many worker processes of one thread, forked once the simulation is initialized, for simulations that aren't thread safe" << std::endl;
+    std::cerr << "\t- Sweep: run the events of each configuration of this file (a line with its output, then its options) on the same threads, the simulation being loaded once" << std::endl;
+    std::cerr << "\t- Daemon: stay resident with the simulation initialized, and run the requests (first event, events, output, options) of the clients of this Unix socket, one after the other" << std::endl;
+    std::cerr << "\t- Sink: stream the results, as written to the output file, to a consumer during the run instead: shm:name (shared memory ring), fifo:path or unix:path (socket). See SDK/hpcsim_sink.h" << std::endl;
+    std::cerr << "\t- Sink policy: when the consumer is behind, block (wait for it, default), drop (lose the results) or spill (write them to output.spill). With block, the results it can't take once the run stops, or after it left, are spilled" << std::endl;
+    std::cerr << "\t- Sink buffer: size of the shared memory ring, or of the buffer of the FIFO or socket (default " << DEFAULT_SINK_BUFFER << ")" << std::endl;
+    std::cerr << "\t- Output shards: amount of writers (up to " << MAX_OUTPUT_SHARDS << "), each with its own segments output.shard.index. The output is then their manifest. The threads are spread over them" << std::endl;
+    std::cerr << "\t- Output rotate: size over which a segment is closed for the next one. Closed segments are listed as such in the manifest, and can be consumed during the run" << std::endl;
+    std::cerr << "\t- Channel: output of a result channel declared by the simulation, instead of the output with .name appended. The path can be a FIFO" << std::endl;
+#ifndef HPCSIM_STATIC_SIMULATION
+    std::cerr << "\t- Stage: run the results of the simulation (or of the previous stage) as the events of the stage in this shared library, with these options, only the results of the last stage are written. Repeat it for up to " << (MAX_STAGES - 1) << " stages" << std::endl;
+    std::cerr << "\t- Stage queue: amount of results queued or run by the stages before no new event of the simulation is started (default " << DEFAULT_STAGE_QUEUE << " per thread)" << std::endl;
+#endif
+}
+
+/* Loads the simulation, and catches its errors. Returns false if it can't be loaded */
+static bool OpenSimulation(const char * simulationFile)
+{
+#ifndef HPCSIM_STATIC_SIMULATION
+    if (simulationFile == 0 || !LoadSimulation(simulationFile))
+#else
+    if (!LoadSimulation(simulationFile))
+#endif
+    {
+        return false;
+    }
+
+    /* Init error lock */
+    pthread_mutex_init(&gHandlerLock, 0);
+    HandleErrors();
+
+    return true;
+}
+
+/* Calls SimulationInit() of the simulation with the given options. Returns false if it fails */
+static bool InitSimulation(unsigned int nThreads, unsigned long nEvents, unsigned long firstEvent, const char * userOpts, void ** context)
+{
+    volatile bool initialized = true;
+
+    if (gSimulation.fSimulationInit != 0)
+    {
+        HPCSIM_TRY
+        {
+            if (gSimulation.fSimulationInit(gUsingPilot, nThreads, nEvents, firstEvent, userOpts, context) < 0)
+            {
+                HPCSIM_THROW;
+            }
+        }
+        HPCSIM_EXCEPT
+        {
+            initialized = false;
+        }
+        HPCSIM_END
+    }
+
+    return initialized;
+}
+
+/* Calls SimulationUnload() of the simulation on a context it initialized */
+static void UnloadContext(void * context)
+{
+    if (gSimulation.fSimulationUnload != 0)
+    {
+        HPCSIM_TRY
+        {
+            gSimulation.fSimulationUnload(context);
+        }
+        HPCSIM_END
+    }
+}
+
+/* Forgets what the simulation declared, and unloads it */
+static void CloseSimulation(void)
+{
+    TAccumulators::GetInstance(true);
+    TResultChannels::GetInstance(true);
+    /* Inputs can go away now */
+    TInputMapper::GetInstance(true);
+    pthread_mutex_destroy(&gHandlerLock);
+    UnloadSimulation();
+    memset(&gSimulation, 0, sizeof(gSimulation));
+}
+
+/* Starts the threads factory, with a room per thread */
+static void StartFactory(unsigned int nThreads, const std::vector<int> & cpus)
+{
+    /* Initialize our pipe lock */
+    pthread_mutex_init(&gPipeLock, 0);
+    pthread_mutex_init(&gWritersLock, 0);
+    /* Start our threads factory */
+    TThreadsFactory::GetInstance()->SetMaxThreads(nThreads);
+    TThreadsFactory::GetInstance()->SetAffinity(cpus);
+    gBatchBuffers = new TBatchBuffers *[nThreads]();
+}
+
+/* Stops the threads factory, and frees the buffers its rooms allocated */
+static void StopFactory(unsigned int nThreads)
+{
+    TThreadsFactory::GetInstance(true);
+    if (gBatchBuffers != 0)
+    {
+        for (unsigned int slot = 0; slot < nThreads; ++slot)
+        {
+            if (gBatchBuffers[slot] != 0)
+            {
+                TTopology::FreeLocal(gBatchBuffers[slot], sizeof(TBatchBuffers));
+            }
+        }
+    }
+    delete[] gBatchBuffers;
+    gBatchBuffers = 0;
+    pthread_mutex_destroy(&gPipeLock);
+    pthread_mutex_destroy(&gWritersLock);
+}
+
+/* Calls RunInit() of the simulation (of each configuration of a sweep), then the ones of the stages. Returns false if the run can't start */
+static bool InitRun(void)
+{
+    volatile bool initialized = true;
+
+    if (gSweep != 0)
+    {
+        if (!RunInitSweep())
+        {
+            std::cerr << "Failed initializing run for all the configurations" << std::endl;
+            return false;
+        }
+    }
+    else if (gSimulation.fRunInit != 0)
+    {
+        HPCSIM_TRY
+        {
+            if (gSimulation.fRunInit(gSimulation.fSimulationContext) < 0)
+            {
+                HPCSIM_THROW;
+            }
+        }
+        HPCSIM_EXCEPT
+        {
+            std::cerr << "Failed initializing run" << std::endl;
+            initialized = false;
+        }
+        HPCSIM_END
+    }
+
+    /* The run of the simulation is cleared if the one of a stage fails */
+    if (initialized && gPipeline != 0 && !RunInitPipeline())
+    {
+        ClearPipeline(false);
+        if (gSimulation.fRunClear != 0)
+        {
+            HPCSIM_TRY
+            {
+                gSimulation.fRunClear(gSimulation.fSimulationContext);
+            }
+            HPCSIM_END
+        }
+        initialized = false;
+    }
+
+    return initialized;
+}
+
+/* Calls RunClear() of the simulation (of each configuration of a sweep), then the ones of the stages */
+static void ClearRun(void)
+{
+    if (gSweep != 0)
+    {
+        ClearSweep(false);
+    }
+    else if (gSimulation.fRunClear != 0)
+    {
+        HPCSIM_TRY
+        {
+            gSimulation.fRunClear(gSimulation.fSimulationContext);
+        }
+        HPCSIM_END
+    }
+    if (gPipeline != 0)
+    {
+        ClearPipeline(false);
+    }
+}
+
+/* Sends the end signal to the writers, and waits for them and for the ones of the channels */
+static void EndWriters(pthread_t & writingThread)
+{
+    EndResults();
+    JoinWriters(writingThread);
+    ClosePipes(gShards);
+    if (gChannels != 0)
+    {
+        gChannels->End();
+    }
+}
+
+/* Merges the histograms of all the threads next to the output, ReduceResult() may fill them too */
+static void WriteHistograms(const char * outputFile)
+{
+    std::string histogramsFile = std::string(outputFile) + ".hist";
+
+    if (!TAccumulators::GetInstance()->Write(histogramsFile.c_str()))
+    {
+        std::cerr << "Failed writing histograms file: " << histogramsFile << std::endl;
+    }
+}
+
+static void SetDefaultOptions(TCommandLine & options)
+{
+    const char defaultName[] = DEFAULT_NAME;
+
+    options.fThreads = 1;
+    options.fEvents = 100;
+    options.fFirstEvent = 0;
+    memcpy(options.fOutputFile, defaultName, sizeof(defaultName));
+    options.fAffinity = 0;
+    options.fCpus.clear();
+    options.fStatisticsFile = 0;
+    options.fStatisticsInterval = 0;
+    options.fStatusSocket = 0;
+    options.fPerfCountersFile = 0;
+    options.fPerfEventsFile = 0;
+    options.fTraceFile = 0;
+    options.fProfileHz = 0;
+    options.fCacheDirectory = 0;
+    options.fCacheSize = DEFAULT_CACHE_SIZE;
+    options.fWalltime = 0;
+    options.fDrainTime = DEFAULT_DRAIN_TIME;
+    options.fRank = 0;
+    options.fRanks = 0;
+    options.fInterleaved = false;
+    options.fMerge = false;
+    options.fServeAddress = 0;
+    options.fPullAddress = 0;
+    options.fChunkSize = DEFAULT_CHUNK_SIZE;
+    options.fChunkTimeout = DEFAULT_CHUNK_TIMEOUT;
+    options.fProcesses = 0;
+    options.fSweepFile = 0;
+    options.fDaemonSocket = 0;
+    options.fSinkUri = 0;
+    options.fSinkPolicy = SINK_BLOCK;
+    options.fValidSinkPolicy = true;
+    options.fSinkBuffer = DEFAULT_SINK_BUFFER;
+    options.fOutputShards = 1;
+    options.fOutputRotate = 0;
+    options.fValidChannels = true;
+#ifndef HPCSIM_STATIC_SIMULATION
+    options.fSimulationFile[0] = '\0';
+    options.fStageSpecs.clear();
+    options.fStageQueue = 0;
+#endif
+}
+
+/* Reads the command line. Options of the simulation itself (user options, checkpoint, batch) go to it directly */
+static void ParseOptions(int argc, char * argv[], TCommandLine & options)
+{
+    static struct option long_options[] =
+    {
+        {"threads", required_argument, 0, 't'},
+        {"events", required_argument, 0, 'e'},
+        {"output", required_argument, 0, 'o'},
+        {"first", required_argument, 0, 'f'},
+#ifndef HPCSIM_STATIC_SIMULATION
+        {"simulation", required_argument, 0, 's'},
+#endif
+        {"user", required_argument, 0, 'u'},
+        {"checkpoint", no_argument, 0, 'c'},
+        {"batch", required_argument, 0, 'b'},
+        {"affinity", required_argument, 0, 'a'},
+        {"stats", required_argument, 0, 'S'},
+        {"stats-interval", required_argument, 0, 'I'},
+        {"status-socket", required_argument, 0, 'm'},
+        {"perf-counters", required_argument, 0, 'P'},
+        {"perf-events", required_argument, 0, 'E'},
+        {"trace", required_argument, 0, 'T'},
+        {"profile", required_argument, 0, 'p'},
+        {"cache", required_argument, 0, 'C'},
+        {"cache-size", required_argument, 0, 'Z'},
+        {"walltime", required_argument, 0, 'W'},
+        {"drain", required_argument, 0, 'D'},
+        {"rank", required_argument, 0, 'R'},
+        {"nranks", required_argument, 0, 'N'},
+        {"partition", required_argument, 0, 'x'},
+        {"merge", no_argument, 0, 'M'},
+        {"serve-events", required_argument, 0, 'G'},
+        {"pull-from", required_argument, 0, 'F'},
+        {"chunk", required_argument, 0, 'k'},
+        {"chunk-timeout", required_argument, 0, 'K'},
+        {"processes", required_argument, 0, 'j'},
+        {"sweep", required_argument, 0, 'w'},
+        {"daemon", required_argument, 0, 'd'},
+        {"sink", required_argument, 0, 'O'},
+        {"sink-policy", required_argument, 0, 'y'},
+        {"sink-buffer", required_argument, 0, 'z'},
+        {"output-shards", required_argument, 0, 'n'},
+        {"output-rotate", required_argument, 0, 'r'},
+        {"channel", required_argument, 0, 'l'},
+#ifndef HPCSIM_STATIC_SIMULATION
+        {"stage", required_argument, 0, 'L'},
+        {"stage-queue", required_argument, 0, 'Q'},
+#endif
+        {0, 0, 0, 0}
+    };
+    bool usageWritten = false;
+
+    /* A previous call in the process leaves getopt behind, 0 also resets the state it keeps */
+    optind = 0;
+
+    while (true)
+    {
+        int option_index = 0;
+#ifdef HPCSIM_STATIC_SIMULATION
+        int option = getopt_long(argc, argv, "e:t:o:f:u:cb:a:S:I:m:P:E:T:p:C:Z:W:D:R:N:x:MG:F:k:K:j:w:d:O:y:z:n:r:l:", long_options, &option_index);
+#else
+        int option = getopt_long(argc, argv, "e:t:o:f:s:u:cb:a:S:I:m:P:E:T:p:C:Z:W:D:R:N:x:MG:F:k:K:j:w:d:O:y:z:n:r:l:L:Q:", long_options, &option_index);
+#endif
+        if (option == -1)
+            break;
+
+        switch (option)
+        {
+            case 't':
+                if (optarg[0] == 'a' && optarg[1] == 0)
+                {
+                    options.fThreads = TTopology::GetAvailableCpus();
+                }
+                else
+                {
+                    options.fThreads = strtoul(optarg, 0, 10);
+                }
+
+                if (options.fThreads == 0)
+                {
+                    options.fThreads = 1;
+                }
+                break;
+
+            case 'e':
+                options.fEvents = strtoul(optarg, 0, 10);
+                break;
+
+            case 'o':
+                strncpy(options.fOutputFile, optarg, PATH_MAX - 1);
+                options.fOutputFile[PATH_MAX - 1] = '\0';
+                break;
+
+            case 'f':
+                options.fFirstEvent = strtoul(optarg, 0, 10);
+                break;
+
+#ifndef HPCSIM_STATIC_SIMULATION
+            case 's':
+                strncpy(options.fSimulationFile, optarg, PATH_MAX - 1);
+                options.fSimulationFile[PATH_MAX - 1] = '\0';
+                break;
+#endif
+
+            case 'u':
+                free(gUserOpts);
+                gUserOpts = strdup(optarg);
+                break;
+
+            case 'c':
+                gSimulation.fCheckPoint = true;
+                break;
+
+            case 'b':
+                gSimulation.fBatchSize = strtoul(optarg, 0, 10);
+                if (gSimulation.fBatchSize == 0)
+                {
+                    gSimulation.fBatchSize = 1;
+                }
+                else if (gSimulation.fBatchSize > HPCSIM_MAX_BATCH)
+                {
+                    gSimulation.fBatchSize = HPCSIM_MAX_BATCH;
+                }
+                break;
+
+            case 'a':
+                options.fAffinity = optarg;
+                break;
+
+            case 'S':
+                options.fStatisticsFile = optarg;
+                break;
+
+            case 'I':
+                options.fStatisticsInterval = strtoul(optarg, 0, 10);
+                break;
+
+            case 'm':
+                options.fStatusSocket = optarg;
+                break;
+
+            case 'P':
+                options.fPerfCountersFile = optarg;
+                break;
+
+            case 'E':
+                options.fPerfEventsFile = optarg;
+                break;
+
+            case 'T':
+                options.fTraceFile = optarg;
+                break;
+
+            case 'p':
+                options.fProfileHz = strtoul(optarg, 0, 10);
+                break;
+
+            case 'C':
+                options.fCacheDirectory = optarg;
+                break;
+
+            case 'Z':
+                options.fCacheSize = strtoull(optarg, 0, 10);
+                break;
+
+            case 'W':
+                options.fWalltime = strtoul(optarg, 0, 10);
+                break;
+
+            case 'D':
+                options.fDrainTime = strtoul(optarg, 0, 10);
+                break;
+
+            case 'R':
+                options.fRank = strtoul(optarg, 0, 10);
+                break;
+
+            case 'N':
+                options.fRanks = strtoul(optarg, 0, 10);
+                break;
+
+            case 'x':
+                if (strcmp(optarg, "interleaved") == 0)
+                {
+                    options.fInterleaved = true;
+                }
+                else if (strcmp(optarg, "blocked") != 0)
+                {
+                    std::cerr << "Invalid partition: " << optarg << std::endl;
+                    options.fRanks = 0;
+                    options.fRank = 1;
+                }
+                break;
+
+            case 'M':
+                options.fMerge = true;
+                break;
+
+            case 'G':
+                options.fServeAddress = optarg;
+                break;
+
+            case 'F':
+                options.fPullAddress = optarg;
+                break;
+
+            case 'k':
+                options.fChunkSize = strtoul(optarg, 0, 10);
+                break;
+
+            case 'K':
+                options.fChunkTimeout = strtoul(optarg, 0, 10);
+                break;
+
+            case 'j':
+                options.fProcesses = strtoul(optarg, 0, 10);
+                break;
+
+            case 'w':
+                options.fSweepFile = optarg;
+                break;
+
+            case 'd':
+                options.fDaemonSocket = optarg;
+                break;
+
+            case 'O':
+                options.fSinkUri = optarg;
+                break;
+
+            case 'y':
+                options.fValidSinkPolicy = TOutputSink::GetPolicy(optarg, options.fSinkPolicy);
+                break;
+
+            case 'z':
+                options.fSinkBuffer = strtoull(optarg, 0, 10);
+                break;
+
+            case 'n':
+                options.fOutputShards = strtoul(optarg, 0, 10);
+                break;
+
+            case 'r':
+                options.fOutputRotate = strtoull(optarg, 0, 10) * 1024 * 1024;
+                break;
+
+            case 'l':
+                options.fValidChannels = (TResultChannels::GetInstance()->SetOutput(optarg) && options.fValidChannels);
+                break;
+
+#ifndef HPCSIM_STATIC_SIMULATION
+            case 'L':
+                options.fStageSpecs.push_back(optarg);
+                break;
+
+            case 'Q':
+                options.fStageQueue = strtoul(optarg, 0, 10);
+                break;
+#endif
+
+            case '?':
+                if (!usageWritten)
+                {
+                    PrintUsage(argv[0]);
+                    usageWritten = true;
+                }
+                break;
+        }
+    }
+}
+
+/* Checks the options go together, and drops the ones a mode can't use. Returns false if they're invalid */
+static bool CheckOptions(char * name, TCommandLine & options)
+{
+    const char * invalid = 0;
+    bool checkPoint = gSimulation.fCheckPoint;
+    bool coordinated = (options.fServeAddress != 0 || options.fPullAddress != 0);
+    bool observed = (options.fStatisticsFile != 0 || options.fStatusSocket != 0 || options.fPerfCountersFile != 0 || options.fPerfEventsFile != 0 ||
+                     options.fTraceFile != 0 || options.fProfileHz != 0 || options.fCacheDirectory != 0);
+
+    if ((options.fRanks == 0 && options.fRank != 0) || (options.fRanks != 0 && options.fRank >= options.fRanks) || (options.fMerge && checkPoint))
+    {
+        invalid = "Invalid ranks: --rank needs --nranks above it, --merge needs no --checkpoint";
+    }
+    else if (coordinated && (options.fRanks != 0 || options.fMerge || checkPoint || (options.fServeAddress != 0 && options.fPullAddress != 0) || options.fChunkSize == 0))
+    {
+        invalid = "Invalid coordination: --serve-events and --pull-from cannot be used together, nor with ranks, --merge or --checkpoint";
+    }
+    else if (options.fProcesses != 0 && (options.fThreads != 1 || options.fMerge || coordinated))
+    {
+        invalid = "Invalid processes: each worker process runs a single thread, --processes cannot be used with --threads, --merge, --serve-events or --pull-from";
+    }
+    else if (options.fSweepFile != 0 && (gUserOpts != 0 || checkPoint || options.fRanks != 0 || options.fMerge || coordinated || options.fProcesses != 0 || gUsingPilot))
+    {
+        invalid = "Invalid sweep: options come from the sweep file, --sweep cannot be used with --user, --checkpoint, ranks, --merge, --serve-events, --pull-from, --processes, nor with pilot threads";
+    }
+    else if (options.fDaemonSocket != 0 && (checkPoint || options.fRanks != 0 || options.fMerge || coordinated || options.fProcesses != 0 || options.fSweepFile != 0))
+    {
+        invalid = "Invalid daemon: each request tells its run, --daemon cannot be used with --checkpoint, ranks, --merge, --serve-events, --pull-from, --processes or --sweep";
+    }
+    else if (options.fSinkUri != 0 && (checkPoint || options.fRanks != 0 || options.fMerge || coordinated || options.fSweepFile != 0 || options.fDaemonSocket != 0 ||
+                                       !options.fValidSinkPolicy || options.fSinkBuffer == 0))
+    {
+        invalid = "Invalid sink: the results go to its consumer instead of the output, --sink cannot be used with --checkpoint, ranks, --merge, --serve-events, --pull-from, --sweep or --daemon. Its policy is block, drop or spill";
+    }
+    else if (options.fOutputShards == 0 || options.fOutputShards > MAX_OUTPUT_SHARDS || (options.fOutputShards > 1 && (options.fProcesses != 0 || options.fPullAddress != 0)) ||
+             ((options.fOutputShards > 1 || options.fOutputRotate != 0) && (options.fSweepFile != 0 || options.fSinkUri != 0 || options.fDaemonSocket != 0)))
+    {
+        std::cerr << "Invalid output: from 1 to " << MAX_OUTPUT_SHARDS << " shards, --output-shards cannot be used with --processes or --pull-from, --output-shards and --output-rotate cannot be used with --sweep, --sink or --daemon" << std::endl;
+        PrintUsage(name);
+        return false;
+    }
+    else if (!options.fValidChannels)
+    {
+        invalid = "Invalid channel: --channel takes name=path";
+    }
+#ifndef HPCSIM_STATIC_SIMULATION
+    else if (!options.fStageSpecs.empty() && (checkPoint || options.fRanks != 0 || options.fMerge || coordinated || options.fProcesses != 0 || options.fSweepFile != 0 ||
+                                              options.fDaemonSocket != 0 || gUsingPilot))
+    {
+        invalid = "Invalid pipeline: --stage cannot be used with --checkpoint, ranks, --merge, --serve-events, --pull-from, --processes, --sweep or --daemon, nor with pilot threads";
+    }
+#endif
+
+    if (invalid != 0)
+    {
+        std::cerr << invalid << std::endl;
+        PrintUsage(name);
+        return false;
+    }
+
+#ifndef HPCSIM_STATIC_SIMULATION
+    /* Its keys are made of the simulation alone */
+    if (!options.fStageSpecs.empty() && options.fCacheDirectory != 0)
+    {
+        std::cerr << "Cache is not available with --stage, not using it" << std::endl;
+        options.fCacheDirectory = 0;
+    }
+#endif
+
+    /* Its runs don't go through them */
+    if (options.fDaemonSocket != 0 && observed)
+    {
+        std::cerr << "Statistics, status socket, performance counters, trace, profile and cache are not available with --daemon, not using them" << std::endl;
+    }
+
+    /* Its keys are made of a single options line */
+    if (options.fSweepFile != 0 && options.fCacheDirectory != 0)
+    {
+        std::cerr << "Cache is not available with --sweep, not using it" << std::endl;
+        options.fCacheDirectory = 0;
+    }
+
+    /* They would only see the parent, which doesn't run any event */
+    if (options.fProcesses != 0 && observed)
+    {
+        std::cerr << "Statistics, status socket, performance counters, trace, profile and cache are not available with --processes, not using them" << std::endl;
+        options.fStatisticsFile = 0;
+        options.fStatusSocket = 0;
+        options.fPerfCountersFile = 0;
+        options.fPerfEventsFile = 0;
+        options.fTraceFile = 0;
+        options.fProfileHz = 0;
+        options.fCacheDirectory = 0;
+    }
+
+    return true;
+}
+
+/* The coordinator only hands out the events, and journals them */
+static void ServeEvents(const TCommandLine & options)
+{
+    std::string journal = std::string(options.fOutputFile) + ".journal";
+
+    if (!TEventServer::GetInstance()->Start(options.fServeAddress, journal.c_str(), options.fFirstEvent, options.fEvents, options.fChunkSize, options.fChunkTimeout))
+    {
+        std::cerr << "Failed starting coordinator on " << options.fServeAddress << " with journal " << journal << std::endl;
+    }
+    else if (TEventServer::GetInstance()->Serve())
+    {
+        TEventServer::GetInstance()->Report(std::cerr);
+        std::cerr << "All the events are done, run --merge with the same output to gather their results" << std::endl;
+    }
+
+    TEventServer::GetInstance(true);
+}
+
+/* The daemon keeps the simulation opened, and runs the requests of its clients with it */
+static void RunDaemon(char * name, const TCommandLine & options)
+{
+    THPCsimConfig config;
+    THPCsim * hpcsim;
+
+#ifndef HPCSIM_STATIC_SIMULATION
+    if (options.fSimulationFile[0] == '\0')
+    {
+        PrintUsage(name);
+        return;
+    }
+    config.fSimulation = options.fSimulationFile;
+#else
+    (void)name;
+    config.fSimulation = 0;
+#endif
+    config.fUserOpts = gUserOpts;
+    config.fThreads = options.fThreads;
+    config.fBatchSize = gSimulation.fBatchSize;
+    config.fAffinity = options.fAffinity;
+    config.fFirstEvent = options.fFirstEvent;
+    config.fEvents = options.fEvents;
+
+    /* A stop ends the run in progress, and the daemon */
+    HandleStops();
+    if (options.fWalltime != 0)
+    {
+        gWalltimeEnd = TStatistics::Now() + options.fWalltime * 1000000000ULL;
+    }
+
+    if (!TDaemon::GetInstance()->Start(options.fDaemonSocket))
+    {
+        std::cerr << "Failed creating daemon socket: " << options.fDaemonSocket << std::endl;
+    }
+    else if ((hpcsim = hpcsim_open(&config)) == 0)
+    {
+        std::cerr << "Failed opening simulation" << std::endl;
+    }
+    else
+    {
+        if (TDaemon::GetInstance()->Serve(hpcsim, StopRequested))
+        {
+            TDaemon::GetInstance()->Report(std::cerr);
+        }
+        hpcsim_close(hpcsim);
+    }
+
+    TDaemon::GetInstance(true);
+}
+
+/* Gives its own output to a worker pulling events, or to a rank along with its part of the events */
+static void PartitionEvents(TCommandLine & options, TCommandLineRun & run)
+{
+    /* A worker writes the chunks it pulls to its own output, reachable by the merge */
+    if (options.fPullAddress != 0)
+    {
+        char host[256] = "";
+        char directory[PATH_MAX] = "";
+        std::string pullOutput;
+
+        gethostname(host, sizeof(host) - 1);
+        if (options.fOutputFile[0] != '/' && getcwd(directory, sizeof(directory)) != 0)
+        {
+            pullOutput = std::string(directory) + "/";
+        }
+        pullOutput += options.fOutputFile;
+        snprintf(options.fOutputFile, sizeof(options.fOutputFile), "%s.pull-%s-%d", pullOutput.c_str(), host, getpid());
+    }
+
+    /* Only run the part of the events of the rank, to its own output */
+    if (options.fRanks != 0 && !options.fMerge)
+    {
+        unsigned int rank = options.fRank;
+        unsigned int nRanks = options.fRanks;
+
+        if (options.fInterleaved)
+        {
+            /* Events of the rank are counted from its first one */
+            run.fStreamOrigin = options.fFirstEvent + rank;
+            run.fStreamStride = nRanks;
+            options.fEvents = (options.fEvents > rank ? (options.fEvents - rank + nRanks - 1) / nRanks : 0);
+            options.fFirstEvent = 0;
+        }
+        else
+        {
+            unsigned long block = options.fEvents / nRanks;
+            unsigned long larger = options.fEvents % nRanks;
+
+            options.fFirstEvent += rank * block + (rank < larger ? rank : larger);
+            options.fEvents = block + (rank < larger ? 1 : 0);
+        }
+
+        snprintf(options.fOutputFile, sizeof(options.fOutputFile), "%s", TRankMerger::GetRankOutput(options.fOutputFile, rank).c_str());
+    }
+}
+
+/* Reads the configurations of a sweep, places the threads and loads the simulation. Returns false if the run can't go on */
+static bool LoadRun(char * name, TCommandLine & options)
+{
+    /* Each configuration of a sweep has its own output */
+    if (options.fSweepFile != 0)
+    {
+        gSweep = TSweep::GetInstance();
+        if (!gSweep->Load(options.fSweepFile))
+        {
+            return false;
+        }
+    }
+
+    if (options.fAffinity != 0 && !TTopology::GetPlacement(options.fAffinity, options.fCpus))
+    {
+        std::cerr << "Invalid affinity: " << options.fAffinity << std::endl;
+        PrintUsage(name);
+        return false;
+    }
+
+#ifndef HPCSIM_STATIC_SIMULATION
+    if (options.fSimulationFile[0] == '\0')
+    {
+        PrintUsage(name);
+        return false;
+    }
+
+    return OpenSimulation(options.fSimulationFile);
+#else
+    return OpenSimulation(0);
+#endif
+}
+
+/* Loads the stages, opens what the results come from or go to, and initializes the simulation. Returns false if the run can't go on */
+static bool OpenRun(TCommandLine & options)
+{
+#ifndef HPCSIM_STATIC_SIMULATION
+    /* Load the stages following the simulation. Only the last one writes (or reduces) results */
+    if (!options.fStageSpecs.empty())
+    {
+        gPipeline = TPipeline::GetInstance();
+        for (size_t stage = 0; stage < options.fStageSpecs.size(); ++stage)
+        {
+            if (!gPipeline->Load(options.fStageSpecs[stage]))
+            {
+                return false;
+            }
+        }
+
+        gPipeline->SetCapacity((options.fStageQueue != 0) ? options.fStageQueue : DEFAULT_STAGE_QUEUE * options.fThreads);
+        gSimulation.fReduceResult = gPipeline->GetStage(gPipeline->GetSize() - 1).fReduceResult;
+    }
+#endif
+
+    /* Stop requests: the run ends as soon as the running events are done. A merge just dies */
+    if (!options.fMerge)
+    {
+        HandleStops();
+    }
+    if (options.fWalltime != 0)
+    {
+        gWalltimeEnd = TStatistics::Now() + options.fWalltime * 1000000000ULL;
+    }
+
+    /* Open the results cache, if asked to. Options are part of its keys */
+    if (options.fCacheDirectory != 0)
+    {
+        if (gSimulation.fEventRunBatch != 0)
+        {
+            std::cerr << "Events run by batches cannot be cached, not using the cache" << std::endl;
+        }
+        else
+        {
+            gCache = TResultCache::GetInstance();
+#ifdef HPCSIM_STATIC_SIMULATION
+            if (!gCache->Open(options.fCacheDirectory, options.fCacheSize * 1024 * 1024, "/proc/self/exe", gUserOpts, gUsingPilot))
+#else
+            if (!gCache->Open(options.fCacheDirectory, options.fCacheSize * 1024 * 1024, options.fSimulationFile, gUserOpts, gUsingPilot))
+#endif
+            {
+                std::cerr << "Failed opening cache (or already in use): " << options.fCacheDirectory << std::endl;
+                gCache = 0;
+                return false;
+            }
+        }
+    }
+
+    /* Get the run from the coordinator, the chunks start coming already */
+    if (options.fPullAddress != 0)
+    {
+        unsigned long pullFirst;
+        unsigned long pullEvents;
+
+        gPuller = TEventClient::GetInstance();
+        if (!gPuller->Connect(options.fPullAddress, options.fOutputFile, PushMarker, StopRequested, pullFirst, pullEvents))
+        {
+            std::cerr << "Failed pulling events from " << options.fPullAddress << std::endl;
+            return false;
+        }
+
+        options.fFirstEvent = pullFirst;
+        options.fEvents = pullEvents;
+    }
+
+    /* Ranks and workers write their results, reducing them is up to the merge */
+    if ((options.fRanks != 0 || gPuller != 0) && !options.fMerge && gSimulation.fReduceResult != 0)
+    {
+        std::cerr << "Results are written to " << options.fOutputFile << ", to be reduced by --merge" << std::endl;
+        gSimulation.fReduceResult = 0;
+    }
+
+    /* Index the outputs of the ranks, they all have to be complete */
+    if (options.fMerge && options.fRanks != 0)
+    {
+        for (unsigned int other = 0; other < options.fRanks; ++other)
+        {
+            if (access(GetResumeFile(TRankMerger::GetRankOutput(options.fOutputFile, other).c_str()).c_str(), F_OK) == 0)
+            {
+                std::cerr << "Rank " << other << " was stopped, resume it with --checkpoint before merging" << std::endl;
+                return false;
+            }
+        }
+
+        if (!TRankMerger::GetInstance()->Open(options.fOutputFile, options.fRanks, options.fInterleaved, options.fEvents))
+        {
+            return false;
+        }
+    }
+    /* Or the ones of the workers, the journal of the coordinator tells the run */
+    else if (options.fMerge)
+    {
+        unsigned long journalFirst;
+        unsigned long journalEvents;
+
+        if (!TRankMerger::GetInstance()->OpenJournal(options.fOutputFile, journalFirst, journalEvents))
+        {
+            return false;
+        }
+
+        options.fFirstEvent = journalFirst;
+        options.fEvents = journalEvents;
+    }
+
+    /* Channels are written by this run, next to its output: configurations, stages, workers and merges have none, the cache couldn't replay them */
+    if (gSweep != 0 || gPipeline != 0 || options.fProcesses != 0 || options.fPullAddress != 0 || options.fMerge || gCache != 0)
+    {
+        TResultChannels::GetInstance()->Seal();
+    }
+
+    /* Init the simulation, once per configuration of a sweep */
+    if (gSweep != 0)
+    {
+        if (!InitSweep(options.fThreads, options.fEvents, options.fFirstEvent))
+        {
+            std::cerr << "Failed initializing library for all the configurations" << std::endl;
+            return false;
+        }
+    }
+    else if (!InitSimulation(options.fThreads, options.fEvents, options.fFirstEvent, gUserOpts, &gSimulation.fSimulationContext))
+    {
+        std::cerr << "Failed initializing library" << std::endl;
+        return false;
+    }
+    free(gUserOpts);
+    gUserOpts = 0;
+
+    return true;
+}
+
+/* Looks for the events of the run already in the output, and skips them */
+static void ScanOutput(const char * outputFile, off_t scanOffset, unsigned long & nEvents)
+{
+    TOutputSet input;
+
+    /* Open the previous output in read-only, with all its segments if it has some */
+    if (!input.Open(outputFile))
+    {
+        return;
+    }
+
+    /* Small optimization to process the file a bit faster:
+     * we won't keep reading events that are already validated
+     */
+    off_t offset = scanOffset;
+
+    /* So, as long as we have events to simulate, try to find them in the old file */
+    while (nEvents != 0)
+    {
+        bool found = false;
+        off_t readOff = offset;
+
+        /* Try to reach the offset were there are unhandled events,
+         * if we fail, kill the optimization and go back to the begin
+         * of the file
+         */
+        if (!input.Seek(offset))
+        {
+            input.Seek(0);
+        }
+
+        /* While we find contents in the file */
+        while (true)
+        {
+            uint32_t resultLength;
+            uint8_t id[ID_FIELD_SIZE];
+
+            /* Read the ID */
+            if (input.Read(id, sizeof(id)) != sizeof(id))
+            {
+                break;
+            }
+
+            /* Read the result length */
+            if (input.Read(&resultLength, sizeof(resultLength)) != sizeof(resultLength))
+            {
+                break;
+            }
+
+            /* Compare ID with current PRNG (this works due to the nature of RngStream init) */
+            if (memcmp(RngStream::GetNextSeed(), id, sizeof(id)) == 0)
+            {
+                /* Matching, can we optimize reading? */
+                found = true;
+                /* We read a the first offset without known ID, so we eat it */
+                if (offset == readOff)
+                {
+                    offset = offset + resultLength + sizeof(resultLength) + sizeof(id);
+                }
+
+                /* Done for this ID */
+                break;
+            }
+
+            /* Jump to the next event */
+            if (!input.Skip(resultLength))
+            {
+                break;
+            }
+
+            /* Update offset */
+            readOff = offset + resultLength + sizeof(resultLength) + sizeof(id);
+        }
+
+        /* If the current ID wasn't found in file, stop here
+         * It means we found an event that wasn't written in the
+         * file, this is where we have to start again the simulation
+         */
+        if (!found)
+        {
+            break;
+        }
+
+        /* Otherwise, the ID was found, so skip this generator */
+        RngStream::AdvanceStream(1);
+        /* And this will be one less event to generate */
+        --nEvents;
+    }
+}
+
+/* Moves the generator to the first event left to run: the one of a resume hint, then past the ones found in the output on checkpoint */
+static void ResumeRun(TCommandLine & options, TCommandLineRun & run)
+{
+    TResumeHint hint;
+    bool resumed = false;
+    off_t scanOffset = 0;
+
+    /* A stopped run says where to resume, if it's still the same output */
+    run.fRunFirst = options.fFirstEvent;
+    run.fRunEvents = options.fEvents;
+    if (gSimulation.fCheckPoint && ReadResumeHint(options.fOutputFile, hint))
+    {
+        if (hint.fRunFirst == options.fFirstEvent && hint.fRunEvents == options.fEvents && access(options.fOutputFile, F_OK) == 0 &&
+            GetOutputSize(options.fOutputFile) == hint.fSize && hint.fNext >= options.fFirstEvent &&
+            hint.fNext - options.fFirstEvent + hint.fRemaining == options.fEvents)
+        {
+            options.fFirstEvent = hint.fNext;
+            options.fEvents = hint.fRemaining;
+            scanOffset = hint.fOffset;
+            resumed = true;
+        }
+        else
+        {
+            std::cerr << "Resume hint doesn't match the run or the output, looking for the events in the output" << std::endl;
+        }
+    }
+
+    /* Advance in the generator, to the first event of the rank with an interleaved partition */
+    RngStream::AdvanceStream(run.fStreamOrigin);
+    RngStream::SetStride(run.fStreamStride);
+    RngStream::AdvanceStream(options.fFirstEvent);
+    /* Each configuration starts there, as if run alone */
+    if (gSweep != 0)
+    {
+        gSweep->Start(options.fEvents);
+    }
+    /* Checkpoint may skip some of them. Those before a resume hint were skipped already */
+    run.fRequestedEvents = run.fRunEvents - (options.fFirstEvent - run.fRunFirst);
+
+    /* Checkpoint: time to "replay" already handled events */
+    if (gSimulation.fCheckPoint && (!resumed || hint.fScan))
+    {
+        ScanOutput(options.fOutputFile, scanOffset, options.fEvents);
+    }
+}
+
+/* Starts the statistics, the status server, the performance counters, the trace and the profiler, if asked to. Returns false if one can't start */
+static bool StartObservers(const TCommandLine & options, const TCommandLineRun & run)
+{
+    /* Start collecting statistics, if asked to */
+    if (options.fStatisticsFile != 0)
+    {
+        gStatistics = TStatistics::GetInstance();
+        if (!gStatistics->Start(options.fStatisticsFile, options.fThreads, options.fStatisticsInterval))
+        {
+            std::cerr << "Failed opening statistics file: " << options.fStatisticsFile << std::endl;
+            gStatistics = 0;
+            return false;
+        }
+    }
+
+    /* Start serving the progress, if asked to */
+    if (options.fStatusSocket != 0)
+    {
+        gStatusServer = TStatusServer::GetInstance();
+        if (!gStatusServer->Start(options.fStatusSocket, options.fThreads, (gSweep != 0 ? options.fEvents * gSweep->GetSize() : options.fEvents)))
+        {
+            std::cerr << "Failed creating status socket: " << options.fStatusSocket << std::endl;
+            gStatusServer = 0;
+            return false;
+        }
+    }
+
+    /* Count the events with the performance counters, if asked to */
+    if (options.fPerfCountersFile != 0 || options.fPerfEventsFile != 0)
+    {
+        gPerfCounters = TPerfCounters::GetInstance();
+        if (!gPerfCounters->Start(options.fPerfCountersFile, options.fPerfEventsFile, options.fThreads))
+        {
+            std::cerr << "Failed opening performance counters file: " << (options.fPerfCountersFile != 0 ? options.fPerfCountersFile : options.fPerfEventsFile) << std::endl;
+            gPerfCounters = 0;
+            return false;
+        }
+    }
+
+    /* Record the timeline, if asked to */
+    if (options.fTraceFile != 0)
+    {
+        gTracer = TTracer::GetInstance();
+        if (!gTracer->Start(options.fTraceFile, options.fThreads, options.fFirstEvent + (run.fRequestedEvents - options.fEvents)))
+        {
+            std::cerr << "Failed opening trace file: " << options.fTraceFile << std::endl;
+            gTracer = 0;
+            return false;
+        }
+    }
+
+    /* Sample the threads stacks, if asked to */
+    if (options.fProfileHz != 0)
+    {
+        gProfiler = TProfiler::GetInstance();
+        if (!gProfiler->Start(options.fProfileHz, options.fThreads))
+        {
+            std::cerr << "Failed starting profiler at " << options.fProfileHz << " Hz" << std::endl;
+            gProfiler = 0;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Writes what the observers collected */
+static void StopObservers(void)
+{
+    if (gStatistics != 0)
+    {
+        gStatistics->Stop(gDispatched);
+    }
+    if (gPerfCounters != 0)
+    {
+        gPerfCounters->Stop();
+    }
+    if (gTracer != 0)
+    {
+        gTracer->Stop();
+    }
+    if (gProfiler != 0)
+    {
+        gProfiler->Stop();
+        gProfiler->Report(std::cerr);
+    }
+}
+
+static void ReleaseObservers(void)
+{
+    TStatistics::GetInstance(true);
+    gStatistics = 0;
+    TStatusServer::GetInstance(true);
+    gStatusServer = 0;
+    TPerfCounters::GetInstance(true);
+    gPerfCounters = 0;
+    TTracer::GetInstance(true);
+    gTracer = 0;
+    TProfiler::GetInstance(true);
+    gProfiler = 0;
+}
+
+/* Opens where the results go: the outputs of a sweep, the sink, or the output and its segments. Returns false if the run can't go on */
+static bool OpenOutputs(TCommandLine & options, TCommandLineRun & run)
+{
+    /* The configurations of a sweep are written by the same writer */
+    if (gSweep != 0 && gSimulation.fReduceResult == 0 && !gSweep->OpenOutputs())
+    {
+        return false;
+    }
+
+    /* Results are reduced in process, there's nothing to stream */
+    if (options.fSinkUri != 0 && gSimulation.fReduceResult != 0)
+    {
+        std::cerr << "Results are reduced by the simulation, not using the sink" << std::endl;
+    }
+    /* Or open the sink, the writer streams the results to its consumer once there */
+    else if (options.fSinkUri != 0)
+    {
+        std::string spillFile = std::string(options.fOutputFile) + ".spill";
+
+        gSink = TOutputSink::GetInstance();
+        if (!gSink->Open(options.fSinkUri, options.fSinkPolicy, options.fSinkBuffer * 1024 * 1024, spillFile.c_str()))
+        {
+            std::cerr << "Failed opening sink: " << options.fSinkUri << std::endl;
+            return false;
+        }
+
+        if (!gSink->Connect(StopRequested))
+        {
+            std::cerr << "No consumer connected to the sink: " << options.fSinkUri << std::endl;
+            run.fStatus = STOPPED_STATUS;
+            return false;
+        }
+    }
+
+    /* A checkpoint goes on with the layout of the output it resumes */
+    if (gSimulation.fCheckPoint && gSimulation.fReduceResult == 0)
+    {
+        unsigned int shards;
+        unsigned long long rotate;
+
+        if (TOutputSet::GetLayout(options.fOutputFile, shards, rotate))
+        {
+            options.fOutputShards = shards;
+            options.fOutputRotate = rotate;
+        }
+        else if ((options.fOutputShards > 1 || options.fOutputRotate != 0) && access(options.fOutputFile, F_OK) == 0)
+        {
+            std::cerr << "The output to resume is a single file, it cannot be sharded nor rotated: " << options.fOutputFile << std::endl;
+            return false;
+        }
+
+        if (options.fOutputShards > 1 && (options.fProcesses != 0 || options.fPullAddress != 0))
+        {
+            std::cerr << "The output to resume has shards, they cannot be written with --processes or --pull-from: " << options.fOutputFile << std::endl;
+            return false;
+        }
+    }
+
+    /* Results are reduced in process, there's no output to split */
+    if ((options.fOutputShards > 1 || options.fOutputRotate != 0) && gSimulation.fReduceResult != 0)
+    {
+        std::cerr << "Results are reduced by the simulation, not sharding nor rotating the output" << std::endl;
+    }
+    /* Or write the segments of the output, listed by its manifest */
+    else if (options.fOutputShards > 1 || options.fOutputRotate != 0)
+    {
+        gOutputSet = new TOutputSet;
+        gShards = options.fOutputShards;
+        if (!gOutputSet->Create(options.fOutputFile, options.fOutputShards, options.fOutputRotate, gSimulation.fCheckPoint))
+        {
+            return false;
+        }
+        gWritten = gOutputSet->GetSize();
+    }
+    /* A single file replaces the segments of a previous output */
+    else if (!gSimulation.fCheckPoint && gSimulation.fReduceResult == 0 && gSink == 0 && gSweep == 0)
+    {
+        TOutputSet::RemoveSegments(options.fOutputFile);
+    }
+
+    /* The channels have their own writers and outputs */
+    TResultChannels::GetInstance()->Seal();
+    if (TResultChannels::GetInstance()->IsUsed())
+    {
+        if (!TResultChannels::GetInstance()->Start(options.fOutputFile, gSimulation.fCheckPoint, gSimulation.fSimulationContext))
+        {
+            return false;
+        }
+        gChannels = TResultChannels::GetInstance();
+    }
+
+    return true;
+}
+
+/* Initializes the stages, moves to the events left, then starts the threads, the observers and the writers. Returns false if the run can't go on */
+static bool StartRun(TCommandLine & options, TCommandLineRun & run)
+{
+    /* The stages following the simulation have their own options */
+    if (gPipeline != 0 && !InitPipeline(options.fThreads, options.fEvents, options.fFirstEvent))
+    {
+        return false;
+    }
+
+    ResumeRun(options, run);
+    StartFactory(options.fThreads, options.fCpus);
+
+    /* The workers share the events to run, and their results go through rings to the writer */
+    if (options.fProcesses != 0)
+    {
+        gProcesses = TProcessPool::GetInstance();
+        gInFlight = reinterpret_cast<TInFlight *>(TProcessPool::AllocateShared(options.fProcesses * sizeof(TInFlight)));
+        if (gInFlight == 0 || !gProcesses->Create(options.fProcesses, options.fEvents))
+        {
+            std::cerr << "Failed allocating shared memory for " << options.fProcesses << " worker processes" << std::endl;
+            gProcesses = 0;
+            return false;
+        }
+    }
+    else
+    {
+        gInFlight = new TInFlight[options.fThreads]();
+    }
+
+    if (!StartObservers(options, run) || !OpenOutputs(options, run))
+    {
+        return false;
+    }
+
+    /* Start our background writing threads */
+    return StartWriter(run.fWritingThread, options.fOutputFile, !options.fCpus.empty(), options.fThreads);
+}
+
+/* Nothing can be cleared while events are running: writes what's done, and leaves */
+static void AbandonRun(const TCommandLine & options, TCommandLineRun & run)
+{
+    gAbandoned = true;
+    std::cerr << "Abandoning the running events" << std::endl;
+    /* The consumer isn't waited for anymore either */
+    if (gSink != 0)
+    {
+        gSink->Abandon();
+    }
+    EndWriters(run.fWritingThread);
+    if (gChannels != 0)
+    {
+        gChannels->Report(std::cerr);
+    }
+    /* Chunks pulled and not completed are handed to other workers instead, a sweep is run again, and a sink has no output to resume */
+    if (gPuller == 0 && gSweep == 0 && gPipeline == 0 && gSink == 0)
+    {
+        StopRun(options.fOutputFile, run.fRunFirst, run.fRunEvents, options.fFirstEvent + (run.fRequestedEvents - options.fEvents), options.fEvents,
+                (gProcesses != 0 ? options.fProcesses : options.fThreads));
+    }
+    else if (gSweep != 0)
+    {
+        gSweep->Report(std::cerr);
+    }
+    else if (gPipeline != 0)
+    {
+        gPipeline->Report(std::cerr);
+    }
+    if (gSink != 0)
+    {
+        gSink->Report(std::cerr);
+        TOutputSink::GetInstance(true);
+    }
+    _exit(STOPPED_STATUS);
+}
+
+/* Runs the events left (or merges the outputs of the ranks), and waits for them */
+static void RunEvents(const TCommandLine & options, TCommandLineRun & run)
+{
+    if (!InitRun())
+    {
+        return;
+    }
+
+    /* Pick the event loop matching the simulation */
+    run.fSimulationLoop = SelectSimulationLoop();
+
+    /* Inputs are now shared by the events */
+    TInputMapper::GetInstance()->Seal();
+    /* And histograms can be filled */
+    TAccumulators::GetInstance()->Seal(options.fThreads);
+    if (gSimulation.fCheckPoint && TAccumulators::GetInstance()->IsUsed())
+    {
+        std::string histogramsFile = std::string(options.fOutputFile) + ".hist";
+
+        /* The events found in the output were accounted in the previous dump */
+        if (!TAccumulators::GetInstance()->Load(histogramsFile.c_str()) && run.fRequestedEvents != options.fEvents)
+        {
+            std::cerr << "Histograms of the previous run not found in " << histogramsFile << ", they will only cover the events simulated now" << std::endl;
+        }
+    }
+    /* And the ones of the ranks (or workers) are merged */
+    if (options.fMerge && TAccumulators::GetInstance()->IsUsed())
+    {
+        for (unsigned int other = 0; other < TRankMerger::GetInstance()->GetOutputs(); ++other)
+        {
+            std::string histogramsFile = TRankMerger::GetInstance()->GetPath(other) + ".hist";
+
+            if (!TAccumulators::GetInstance()->Load(histogramsFile.c_str()))
+            {
+                std::cerr << "Histograms not found in " << histogramsFile << ", they will only cover the other outputs" << std::endl;
+            }
+        }
+    }
+    /* Events replayed from the cache wouldn't fill them */
+    if (gCache != 0 && TAccumulators::GetInstance()->IsUsed())
+    {
+        std::cerr << "Histograms and counters cannot be replayed from the cache, not using it" << std::endl;
+        gCache = 0;
+    }
+
+    /* Fork the workers, they share everything initialized so far */
+    if (gProcesses != 0 && !gProcesses->Fork())
+    {
+        std::cerr << "Failed forking worker processes" << std::endl;
+    }
+    else if (gProcesses != 0 && gProcesses->IsWorker())
+    {
+        /* Their events are in flight in the shared memory. The output offset they see is the one of the fork:
+         * it's behind the one of the parent, the scan of an abandoned run starts earlier
+         */
+        gInFlight += gProcesses->GetWorker();
+        TAccumulators::GetInstance()->ClearLoaded();
+    }
+
+    if (options.fMerge)
+    {
+        /* Nothing to simulate, the results of the ranks are written instead */
+        MergeRanks(options.fEvents);
+    }
+    else if (gProcesses != 0 && !gProcesses->IsWorker())
+    {
+        /* Nothing to simulate either, the workers run the events */
+    }
+#ifndef USE_PILOT_THREAD
+    else if (gPipeline != 0)
+    {
+        /* The results go through the stages, on the same threads */
+        DispatchPipeline(run.fSimulationLoop, options.fEvents);
+    }
+#endif
+    else
+    {
+        /* Hot loop, the simulation happens here */
+        run.fContexts = DispatchEvents(run.fSimulationLoop, options.fEvents, options.fThreads);
+    }
+
+    /* Wait for all the propagations to finish */
+    if (!WaitForEvents(options.fDrainTime))
+    {
+        /* A worker process just leaves, its parent tells where to resume */
+        if (gProcesses != 0 && gProcesses->IsWorker())
+        {
+            _exit(STOPPED_STATUS);
+        }
+
+        AbandonRun(options, run);
+    }
+
+    /* A worker process is done: its histograms go to its parent, which clears the run */
+    if (gProcesses != 0 && gProcesses->IsWorker())
+    {
+        if (TAccumulators::GetInstance()->IsUsed())
+        {
+            TAccumulators::GetInstance()->Write(TProcessPool::GetHistogramsFile(options.fOutputFile, gProcesses->GetWorker()).c_str());
+        }
+        _exit(0);
+    }
+
+    delete[] run.fContexts;
+    run.fContexts = 0;
+
+    /* Signal end of run */
+    ClearRun();
+}
+
+/* Waits for the writers, tells where to resume a stopped run, and writes the histograms and the reports */
+static void EndRun(const TCommandLine & options, TCommandLineRun & run)
+{
+    unsigned long nEvents = options.fEvents;
+
+    EndWriters(run.fWritingThread);
+
+    /* Tell where to resume if some events were never started, the hint of a complete run is stale */
+    if (run.fSimulationLoop != 0 && gSweep != 0)
+    {
+        gSweep->Report(std::cerr);
+        run.fStatus = (gSweep->IsComplete() ? 0 : STOPPED_STATUS);
+    }
+    else if (run.fSimulationLoop != 0 && gPipeline != 0)
+    {
+        /* Results of the stages aren't known upfront, a stopped pipeline is run again */
+        gPipeline->Report(std::cerr);
+        if (StopRequested() && (gDispatched < nEvents || !gPipeline->IsComplete()))
+        {
+            std::cerr << "Run stopped" << (gStopSignal != 0 ? " by signal" : " at wall time limit") << ": " << (nEvents - gDispatched) << " events of the simulation were never started, run the pipeline again" << std::endl;
+            run.fStatus = STOPPED_STATUS;
+        }
+    }
+    else if (run.fSimulationLoop != 0 && gSink != 0)
+    {
+        /* The consumer got the results as they came, there's no output to resume */
+        if (StopRequested() && gDispatched < nEvents)
+        {
+            std::cerr << "Run stopped" << (gStopSignal != 0 ? " by signal" : " at wall time limit") << ": " << (nEvents - gDispatched) << " events were never started, their results were not streamed" << std::endl;
+            run.fStatus = STOPPED_STATUS;
+        }
+    }
+    else if (run.fSimulationLoop != 0 && gPuller == 0 && StopRequested() && gDispatched < nEvents)
+    {
+        StopRun(options.fOutputFile, run.fRunFirst, run.fRunEvents, options.fFirstEvent + (run.fRequestedEvents - nEvents), nEvents,
+                (gProcesses != 0 ? options.fProcesses : options.fThreads));
+        run.fStatus = STOPPED_STATUS;
+    }
+    else if (run.fSimulationLoop != 0 && gPuller == 0)
+    {
+        unlink(GetResumeFile(options.fOutputFile).c_str());
+    }
+
+    /* Merge the histograms of the worker processes */
+    if (gProcesses != 0 && TAccumulators::GetInstance()->IsUsed() && run.fSimulationLoop != 0)
+    {
+        for (unsigned int worker = 0; worker < options.fProcesses; ++worker)
+        {
+            std::string histogramsFile = TProcessPool::GetHistogramsFile(options.fOutputFile, worker);
+
+            if (!TAccumulators::GetInstance()->Load(histogramsFile.c_str()))
+            {
+                std::cerr << "Histograms of worker process " << worker << " not found in " << histogramsFile << ", they will only cover the other workers" << std::endl;
+            }
+            unlink(histogramsFile.c_str());
+            unlink((histogramsFile + ".txt").c_str());
+        }
+    }
+
+    if (TAccumulators::GetInstance()->IsUsed() && run.fSimulationLoop != 0)
+    {
+        WriteHistograms(options.fOutputFile);
+    }
+    if (gCache != 0)
+    {
+        gCache->Report(std::cerr);
+    }
+    if (options.fMerge)
+    {
+        TRankMerger::GetInstance()->Report(std::cerr);
+    }
+    if (gPuller != 0)
+    {
+        gPuller->Report(std::cerr);
+    }
+    if (gSink != 0)
+    {
+        gSink->Report(std::cerr);
+    }
+    if (gChannels != 0)
+    {
+        gChannels->Report(std::cerr);
+    }
+
+    /* Everything is done, write the statistics */
+    StopObservers();
+}
+
+/* Stops the threads and the observers, and unloads the simulation (each configuration of a sweep) and the stages */
+static void CloseRun(const TCommandLine & options)
+{
+    StopFactory(options.fThreads);
+    if (options.fProcesses != 0)
+    {
+        if (gInFlight != 0)
+        {
+            TProcessPool::FreeShared(gInFlight, options.fProcesses * sizeof(TInFlight));
+        }
+    }
+    else
+    {
+        delete[] gInFlight;
+    }
+    gInFlight = 0;
+    TProcessPool::GetInstance(true);
+    gProcesses = 0;
+    ReleaseObservers();
+    if (gSweep != 0)
+    {
+        ClearSweep(true);
+    }
+    else
+    {
+        UnloadContext(gSimulation.fSimulationContext);
+    }
+    if (gPipeline != 0)
+    {
+        ClearPipeline(true);
+    }
+    TInputMapper::GetInstance()->Report(std::cerr);
+}
+
+/* Closes what the results came from or went to, and the simulation */
+static void ReleaseRun(void)
+{
+    free(gUserOpts);
+    gUserOpts = 0;
+    TResultCache::GetInstance(true);
+    gCache = 0;
+    TRankMerger::GetInstance(true);
+    TEventClient::GetInstance(true);
+    gPuller = 0;
+    TSweep::GetInstance(true);
+    gSweep = 0;
+    TPipeline::GetInstance(true);
+    gPipeline = 0;
+    TOutputSink::GetInstance(true);
+    gSink = 0;
+    delete gOutputSet;
+    gOutputSet = 0;
+    gShards = 1;
+    gChannels = 0;
+    CloseSimulation();
+}
+
+/* Runs the events of the command line, from loading the simulation to unloading it */
+static int RunCommandLine(char * name, TCommandLine & options)
+{
+    TCommandLineRun run;
+
+    memset(&run, 0, sizeof(run));
+    run.fStreamStride = 1;
+    PartitionEvents(options, run);
+
+    if (!LoadRun(name, options))
+    {
+        free(gUserOpts);
+        gUserOpts = 0;
+        TSweep::GetInstance(true);
+        gSweep = 0;
+        TResultChannels::GetInstance(true);
+        return 0;
+    }
+
+    if (OpenRun(options))
+    {
+        if (StartRun(options, run))
+        {
+            RunEvents(options, run);
+            EndRun(options, run);
+        }
+        CloseRun(options);
+    }
+    ReleaseRun();
+
+    return run.fStatus;
+}
+
+extern "C" int hpcsim_main(int argc, char * argv[])
+{
+    TCommandLine options;
+
+    /* The simulation and the threads factory are the ones of the opened simulation */
+    if (gOpened != 0)
+    {
+        std::cerr << "A simulation is opened with hpcsim_open(), close it first" << std::endl;
+        return 1;
+    }
+
+    /* A previous call in the process leaves its options and its run behind */
+    memset(&gSimulation, 0, sizeof(gSimulation));
+    gUserOpts = 0;
+    ResetStops();
+    gDispatched = 0;
+    gWritten = 0;
+    RngStream::SetStride(1);
+    RngStream::SetStream(0);
+    TAccumulators::GetInstance(true);
+    TResultChannels::GetInstance(true);
+
+    gSimulation.fBatchSize = DEFAULT_BATCH_SIZE;
+    SetDefaultOptions(options);
+    ParseOptions(argc, argv, options);
+
+    if (!CheckOptions(argv[0], options))
+    {
+        TResultChannels::GetInstance(true);
+    }
+    else if (options.fServeAddress != 0)
+    {
+        ServeEvents(options);
+    }
+    else if (options.fDaemonSocket != 0)
+    {
+        RunDaemon(argv[0], options);
+    }
+    else
+    {
+        /* It frees the user options once given to the simulation */
+        return RunCommandLine(argv[0], options);
+    }
+
+    free(gUserOpts);
+    gUserOpts = 0;
+    return 0;
+}
+
+/* Makes the context of the options the one of the events, initializing it on their first run */
+static bool SelectContext(THPCsim * hpcsim, const char * userOpts)
+{
+    std::map<std::string, void *>::iterator found;
+    void * context = 0;
+
+    if (userOpts == 0 || hpcsim->fUserOpts == userOpts)
+    {
+        gSimulation.fSimulationContext = hpcsim->fContext;
+        return true;
+    }
+
+    found = hpcsim->fContexts.find(userOpts);
+    if (found != hpcsim->fContexts.end())
+    {
+        gSimulation.fSimulationContext = found->second;
+        return true;
+    }
+
+    if (!InitSimulation(hpcsim->fThreads, hpcsim->fEvents, hpcsim->fFirstEvent, userOpts, &context))
+    {
+        std::cerr << "Failed initializing library with options " << userOpts << std::endl;
+        return false;
+    }
+
+    hpcsim->fContexts[userOpts] = context;
+    gSimulation.fSimulationContext = context;
+    return true;
+}
+
+extern "C" THPCsim * hpcsim_open(const THPCsimConfig * config)
+{
+    THPCsim * hpcsim;
+
+    /* There's only one simulation, and one threads factory */
+    if (config == 0 || gOpened != 0)
+    {
+        return 0;
+    }
+
+    hpcsim = new THPCsim();
+    hpcsim->fFirstEvent = config->fFirstEvent;
+    hpcsim->fEvents = config->fEvents;
+    hpcsim->fUserOpts = ((config->fUserOpts != 0) ? config->fUserOpts : "");
+    hpcsim->fThreads = ((config->fThreads != 0) ? config->fThreads : TTopology::GetAvailableCpus());
+    if (config->fAffinity != 0 && !TTopology::GetPlacement(config->fAffinity, hpcsim->fCpus))
+    {
+        std::cerr << "Invalid affinity: " << config->fAffinity << std::endl;
+        delete hpcsim;
+        return 0;
+    }
+
+    gSimulation.fBatchSize = ((config->fBatchSize == 0) ? DEFAULT_BATCH_SIZE : ((config->fBatchSize > HPCSIM_MAX_BATCH) ? HPCSIM_MAX_BATCH : config->fBatchSize));
+    /* Each run writes its output from scratch */
+    gSimulation.fCheckPoint = false;
+
+    if (!OpenSimulation(config->fSimulation))
+    {
+        delete hpcsim;
+        return 0;
+    }
+
+    /* The results of a run go to its caller only */
+    TResultChannels::GetInstance()->Seal();
+
+    if (!InitSimulation(hpcsim->fThreads, config->fEvents, config->fFirstEvent, config->fUserOpts, &gSimulation.fSimulationContext))
+    {
+        std::cerr << "Failed initializing library" << std::endl;
+        CloseSimulation();
+        delete hpcsim;
+        return 0;
+    }
+
+    /* The threads factory is kept for all the runs */
+    StartFactory(hpcsim->fThreads, hpcsim->fCpus);
+    gInFlight = new TInFlight[hpcsim->fThreads]();
+
+    /* Pick the event loop matching the simulation */
+    hpcsim->fSimulationLoop = SelectSimulationLoop();
+    hpcsim->fSealed = false;
+    hpcsim->fStopped = false;
+    hpcsim->fContext = gSimulation.fSimulationContext;
+    gOpened = hpcsim;
+
+    return hpcsim;
+}
+
+extern "C" int hpcsim_run(THPCsim * hpcsim, const THPCsimRange * range)
+{
+    pthread_t writingThread;
+    TPilotJobContext * contexts;
+    unsigned long long start;
+    int status = 0;
+
+    if (hpcsim == 0 || hpcsim != gOpened || range == 0 || range->fOutput == 0 || strlen(range->fOutput) >= sizeof(hpcsim->fOutput))
+    {
+        return -1;
+    }
+
+    /* Events get the context of their options */
+    if (!SelectContext(hpcsim, range->fUserOpts))
+    {
+        return -1;
+    }
+
+    /* The stop of the previous run ended it, this one starts all the same. One since then stops it (the daemon ends on it) */
+    if (hpcsim->fStopped)
+    {
+        ResetStops();
+        hpcsim->fStopped = false;
+    }
+
+    /* The writer keeps using it */
+    strcpy(hpcsim->fOutput, range->fOutput);
+    start = TStatistics::Now();
+    gDispatched = 0;
+    gWritten = 0;
+
+    /* The first event gets the stream it has in a command line run */
+    RngStream::SetStride(1);
+    RngStream::SetStream(range->fFirstEvent);
+    /* Histograms and counters only cover the run */
+    if (hpcsim->fSealed)
+    {
+        TAccumulators::GetInstance()->Clear();
+    }
+
+    /* Start our background writing thread */
+    if (!StartWriter(writingThread, hpcsim->fOutput, !hpcsim->fCpus.empty(), hpcsim->fThreads))
+    {
+        return -1;
+    }
+
+    if (InitRun())
+    {
+        /* Inputs are now shared by the events, and histograms can be filled: nothing can be declared anymore */
+        if (!hpcsim->fSealed)
+        {
+            TInputMapper::GetInstance()->Seal();
+            TAccumulators::GetInstance()->Seal(hpcsim->fThreads);
+            hpcsim->fSealed = true;
+        }
+
+        /* Hot loop, the simulation happens here */
+        contexts = DispatchEvents(hpcsim->fSimulationLoop, range->fEvents, hpcsim->fThreads);
+        TThreadsFactory::GetInstance()->WaitForAllThreads();
+        delete[] contexts;
+
+        /* Signal end of run */
+        ClearRun();
+    }
+    else
+    {
+        status = -1;
+    }
+
+    EndWriters(writingThread);
+    hpcsim->fStopped = StopRequested();
+
+    if (status != 0)
+    {
+        return status;
+    }
+
+    if (TAccumulators::GetInstance()->IsUsed())
+    {
+        WriteHistograms(hpcsim->fOutput);
+    }
+
+    ++hpcsim->fStats.fRuns;
+    hpcsim->fStats.fEvents = gDispatched;
+    hpcsim->fStats.fWritten = gWritten;
+    hpcsim->fStats.fSeconds = (TStatistics::Now() - start) / 1e9;
+    hpcsim->fStats.fTotalEvents += hpcsim->fStats.fEvents;
+    hpcsim->fStats.fTotalWritten += hpcsim->fStats.fWritten;
+    hpcsim->fStats.fTotalSeconds += hpcsim->fStats.fSeconds;
+
+    return 0;
+}
+
+extern "C" int hpcsim_stats(THPCsim * hpcsim, THPCsimStats * stats)
+{
+    if (hpcsim == 0 || hpcsim != gOpened || stats == 0)
+    {
+        return -1;
+    }
+
+    *stats = hpcsim->fStats;
+    return 0;
+}
+
+extern "C" void hpcsim_close(THPCsim * hpcsim)
+{
+    if (hpcsim == 0 || hpcsim != gOpened)
+    {
+        return;
+    }
+
+    StopFactory(hpcsim->fThreads);
+    delete[] gInFlight;
+    gInFlight = 0;
+
+    for (std::map<std::string, void *>::iterator context = hpcsim->fContexts.begin(); context != hpcsim->fContexts.end(); ++context)
+    {
+        UnloadContext(context->second);
+    }
+    UnloadContext(hpcsim->fContext);
+    CloseSimulation();
+
+    delete hpcsim;
+    gOpened = 0;
+}
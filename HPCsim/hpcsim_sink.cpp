@@ -0,0 +1,345 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim
+ * FILE:             HPCsim/hpcsim_sink.cpp
+ * PURPOSE:          libhpcsim_sink, the consumer end of the output sinks
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "hpcsim_sink.h"
+#include "TOutputSink.h"
+#include "TOutputSet.h"
+
+struct THPCsimSink
+{
+    TSinkKind fKind;
+    /**
+     * FIFO or socket, for the streams
+     */
+    int fFD;
+    /**
+     * Ring, and its name to remove it once read
+     */
+    TSinkShared * fShared;
+    size_t fMapped;
+    char fName[256];
+    /**
+     * Output of a run, with all its segments
+     */
+    TOutputSet * fOutput;
+};
+
+/**
+ * Reads exactly length bytes from a stream.
+ * @return 1 if they were, 0 at the end of the stream before any byte, -1 otherwise
+ */
+static int ReadStream(int fd, void * data, size_t length)
+{
+    size_t done = 0;
+
+    while (done < length)
+    {
+        ssize_t got = read(fd, reinterpret_cast<uint8_t *>(data) + done, length - done);
+
+        if (got > 0)
+        {
+            done += got;
+        }
+        else if (got == 0)
+        {
+            return ((done == 0) ? 0 : -1);
+        }
+        else if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Reads exactly length bytes from an output, same as ReadStream().
+ */
+static int ReadOutput(TOutputSet * output, void * data, size_t length)
+{
+    size_t done = 0;
+
+    while (done < length)
+    {
+        ssize_t got = output->Read(reinterpret_cast<uint8_t *>(data) + done, length - done);
+
+        if (got > 0)
+        {
+            done += got;
+        }
+        else if (got == 0)
+        {
+            return ((done == 0) ? 0 : -1);
+        }
+        else if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+static bool AttachRing(THPCsimSink * sink, const char * name)
+{
+    TSinkShared * shared;
+    uint64_t size;
+    int fd;
+
+    if (name[0] == '/')
+    {
+        snprintf(sink->fName, sizeof(sink->fName), "%s", name);
+    }
+    else
+    {
+        snprintf(sink->fName, sizeof(sink->fName), "/%s", name);
+    }
+
+    fd = shm_open(sink->fName, O_RDWR, 0);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    /* Map the state first, to know how large the ring is */
+    shared = reinterpret_cast<TSinkShared *>(mmap(0, SINK_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if (shared == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    if (shared->fMagic != SINK_MAGIC || shared->fVersion != SINK_VERSION)
+    {
+        munmap(shared, SINK_HEADER_SIZE);
+        close(fd);
+        return false;
+    }
+
+    size = shared->fSize;
+    munmap(shared, SINK_HEADER_SIZE);
+
+    sink->fMapped = SINK_HEADER_SIZE + size;
+    sink->fShared = reinterpret_cast<TSinkShared *>(mmap(0, sink->fMapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    close(fd);
+    if (sink->fShared == MAP_FAILED)
+    {
+        sink->fShared = 0;
+        return false;
+    }
+
+    /* There's a single consumer */
+    if (!__sync_bool_compare_and_swap(&sink->fShared->fAttached, 0, 1))
+    {
+        munmap(sink->fShared, sink->fMapped);
+        sink->fShared = 0;
+        return false;
+    }
+
+    return true;
+}
+
+static int ConnectSocket(const char * path)
+{
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+extern "C" THPCsimSink * hpcsim_sink_open(const char * uri)
+{
+    THPCsimSink * sink = new THPCsimSink;
+
+    sink->fFD = -1;
+    sink->fShared = 0;
+    sink->fMapped = 0;
+    sink->fName[0] = 0;
+    sink->fOutput = 0;
+
+    if (strncmp(uri, "shm:", 4) == 0)
+    {
+        sink->fKind = SINK_SHM;
+        if (!AttachRing(sink, uri + 4))
+        {
+            delete sink;
+            return 0;
+        }
+    }
+    else if (strncmp(uri, "fifo:", 5) == 0)
+    {
+        sink->fKind = SINK_FIFO;
+        sink->fFD = open(uri + 5, O_RDONLY | O_CLOEXEC);
+    }
+    else if (strncmp(uri, "unix:", 5) == 0)
+    {
+        sink->fKind = SINK_SOCKET;
+        sink->fFD = ConnectSocket(uri + 5);
+    }
+    else
+    {
+        /* An output: a single file, or the manifest of its segments */
+        sink->fKind = SINK_FILE;
+        sink->fOutput = new TOutputSet;
+        if (!sink->fOutput->Open((strncmp(uri, "file:", 5) == 0) ? uri + 5 : uri))
+        {
+            delete sink->fOutput;
+            sink->fOutput = 0;
+        }
+    }
+
+    if (sink->fShared == 0 && sink->fFD == -1 && sink->fOutput == 0)
+    {
+        delete sink;
+        return 0;
+    }
+
+    return sink;
+}
+
+extern "C" int hpcsim_sink_read(THPCsimSink * sink, TResult * result)
+{
+    TSinkShared * shared = sink->fShared;
+    uint8_t * ring;
+    uint64_t tail;
+    int status;
+
+    if (sink->fKind == SINK_FILE)
+    {
+        status = ReadOutput(sink->fOutput, result, SINK_RECORD_HEADER_SIZE);
+        if (status != 1)
+        {
+            return status;
+        }
+
+        if (result->fResultLength > sizeof(result->fResult))
+        {
+            return -1;
+        }
+
+        /* A result truncated by a crash ends the output */
+        return ((ReadOutput(sink->fOutput, result->fResult, result->fResultLength) == 1) ? 1 : -1);
+    }
+
+    if (sink->fKind != SINK_SHM)
+    {
+        status = ReadStream(sink->fFD, result, SINK_RECORD_HEADER_SIZE);
+        if (status != 1)
+        {
+            return status;
+        }
+
+        if (result->fResultLength > sizeof(result->fResult))
+        {
+            return -1;
+        }
+
+        /* The run never ends the stream in the middle of a result */
+        return ((ReadStream(sink->fFD, result->fResult, result->fResultLength) == 1) ? 1 : -1);
+    }
+
+    /* A post for each result, and a last one at the end */
+    while (sem_wait(&shared->fAvailable) == -1)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    ring = reinterpret_cast<uint8_t *>(shared) + SINK_HEADER_SIZE;
+    tail = shared->fTail;
+
+    if (shared->fHead == tail)
+    {
+        /* Let the next read see the end too */
+        if (shared->fEnded)
+        {
+            sem_post(&shared->fAvailable);
+            return 0;
+        }
+
+        return -1;
+    }
+
+    /* The result is complete once the head moved past it */
+    __sync_synchronize();
+    SinkCopyFromRing(ring, shared->fSize, tail, result, SINK_RECORD_HEADER_SIZE);
+    if (result->fResultLength > sizeof(result->fResult))
+    {
+        return -1;
+    }
+    SinkCopyFromRing(ring, shared->fSize, tail + SINK_RECORD_HEADER_SIZE, result->fResult, result->fResultLength);
+
+    __sync_synchronize();
+    shared->fTail = tail + SINK_RECORD_SIZE(result->fResultLength);
+    sem_post(&shared->fFreed);
+
+    return 1;
+}
+
+extern "C" void hpcsim_sink_close(THPCsimSink * sink)
+{
+    if (sink == 0)
+    {
+        return;
+    }
+
+    if (sink->fShared != 0)
+    {
+        /* Nobody else can read it, once it's over */
+        if (sink->fShared->fEnded && sink->fShared->fHead == sink->fShared->fTail)
+        {
+            shm_unlink(sink->fName);
+        }
+        else
+        {
+            sink->fShared->fAttached = 0;
+        }
+
+        munmap(sink->fShared, sink->fMapped);
+    }
+
+    if (sink->fFD != -1)
+    {
+        close(sink->fFD);
+    }
+
+    delete sink->fOutput;
+    delete sink;
+}
@@ -0,0 +1,131 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim SDK
+ * FILE:             SDK/hpcsim.h
+ * PURPOSE:          libhpcsim header, to drive runs from another program
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __HPCSIM_H__
+#define __HPCSIM_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * A simulation loaded and initialized, with its threads. There can only be one at a time in a process
+ */
+typedef struct THPCsim THPCsim;
+
+typedef struct THPCsimConfig
+{
+    /**
+     * Path of the shared library containing the simulation, ignored when it's linked in
+     */
+    const char * fSimulation;
+    /**
+     * Options line given to SimulationInit(), 0 for none
+     */
+    const char * fUserOpts;
+    /**
+     * Amount of threads computing the events, 0 for all the CPUs available
+     */
+    unsigned int fThreads;
+    /**
+     * Amount of consecutive events handed at once to EventRunBatch(), 0 for the default
+     */
+    unsigned int fBatchSize;
+    /**
+     * Pinning of the threads, as with --affinity, 0 for none
+     */
+    const char * fAffinity;
+    /**
+     * First event and amount of events given to SimulationInit()
+     */
+    unsigned long fFirstEvent;
+    unsigned long fEvents;
+} THPCsimConfig;
+
+typedef struct THPCsimRange
+{
+    /**
+     * First event of the run, its stream is the one of this event in a command line run
+     */
+    unsigned long fFirstEvent;
+    unsigned long fEvents;
+    /**
+     * Output of the run, also given to ReduceResult(). Histograms go to the same path, with .hist appended
+     */
+    const char * fOutput;
+    /**
+     * Options of the run, 0 for the ones given to hpcsim_open(). Other options get their own context,
+     * from SimulationInit() on their first run, kept until hpcsim_close()
+     */
+    const char * fUserOpts;
+} THPCsimRange;
+
+typedef struct THPCsimStats
+{
+    /**
+     * Runs done since hpcsim_open()
+     */
+    unsigned long fRuns;
+    /**
+     * Events run, and bytes written to the output (0 when reduced), by the last run and by all of them
+     */
+    unsigned long fEvents;
+    unsigned long long fWritten;
+    unsigned long long fTotalEvents;
+    unsigned long long fTotalWritten;
+    /**
+     * Wall time of the last run, and of all of them, in seconds
+     */
+    double fSeconds;
+    double fTotalSeconds;
+} THPCsimStats;
+
+/**
+ * Loads the simulation, calls its SimulationInit() and sets up the threads factory. They are kept
+ * for all the runs, until hpcsim_close().
+ * @param config The configuration
+ * @return The simulation, 0 in case of error (or if one is already opened)
+ */
+THPCsim * hpcsim_open(const THPCsimConfig * config);
+/**
+ * Runs a range of events: RunInit(), the events, then RunClear(), and writes their results.
+ * It returns once they're all written. Histograms and counters only cover the run, they can only be
+ * declared by the SimulationInit() of hpcsim_open().
+ * @param hpcsim The simulation
+ * @param range The events, and where to write their results
+ * @return -1 in case of error, 0 otherwise
+ */
+int hpcsim_run(THPCsim * hpcsim, const THPCsimRange * range);
+/**
+ * Gets the statistics of the runs.
+ * @param hpcsim The simulation
+ * @param stats Output variable, receiving the statistics
+ * @return -1 in case of error, 0 otherwise
+ */
+int hpcsim_stats(THPCsim * hpcsim, THPCsimStats * stats);
+/**
+ * Calls SimulationUnload(), releases the threads factory and unloads the simulation.
+ * @param hpcsim The simulation
+ */
+void hpcsim_close(THPCsim * hpcsim);
+/**
+ * Runs HPCsim as its command line would, this is what the HPCsim executable does.
+ * It cannot be called while a simulation is opened. It can be called again once it returned,
+ * nothing is kept from a call to the next one.
+ * @param argc Amount of arguments
+ * @param argv The arguments, the first being the name of the program
+ * @return The exit status
+ */
+int hpcsim_main(int argc, char * argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim SDK
+ * FILE:             SDK/hpcsim_sink.h
+ * PURPOSE:          libhpcsim_sink header, to read the results streamed by a run (see --sink), or its output
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#ifndef __HPCSIM_SINK_H__
+#define __HPCSIM_SINK_H__
+
+#include "simulation.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * The consumer end of a sink. There can only be one per sink
+ */
+typedef struct THPCsimSink THPCsimSink;
+
+/**
+ * Attaches to the sink of a run. A shared memory ring has to be created by the run already, the
+ * run waits for the consumer of a FIFO or of a socket. It can also read the output of a run, with
+ * all its segments when it was sharded or rotated (see --output-shards and --output-rotate).
+ * @param uri The sink, as given to --sink: shm:name, fifo:path or unix:path. Or the output: file:path, or its path
+ * @return The sink, 0 in case of error
+ */
+THPCsimSink * hpcsim_sink_open(const char * uri);
+/**
+ * Reads the next result, waiting for it if needed. Results are read in the order they're written
+ * by the run, and as written to its output. For an output, 0 is returned at its end, without waiting.
+ * @param sink The sink
+ * @param result Output variable, receiving the result
+ * @return 1 for a result, 0 once the run ended, -1 in case of error
+ */
+int hpcsim_sink_read(THPCsimSink * sink, TResult * result);
+/**
+ * Detaches from the sink. A shared memory ring is removed once all its results were read.
+ * @param sink The sink
+ */
+void hpcsim_sink_close(THPCsimSink * sink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
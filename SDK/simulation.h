@@ -122,6 +122,13 @@ typedef void (TRunClear)(void * simContext);
  * @param simContext The allocated buffer during SimulationInit()
  */
 typedef void (TSimulationUnload)(void * simContext);
+/**
+ * Subtask routine, forked by an event with SpawnTask(). Several can run in parallel, including with
+ * the event that forked it.
+ * @param simContext The allocated buffer during SimulationInit()
+ * @param taskContext The argument given to SpawnTask()
+ */
+typedef void (TTaskRun)(void * simContext, void * taskContext);
 
 #define ID_FIELD_SIZE (6 * sizeof(double))
 
@@ -132,6 +139,82 @@ typedef struct TResult
     uint8_t fResult[0x800];
 } TResult;
 
+/**
+ * Maximum number of events HPCsim can hand at once to EventRunBatch()
+ */
+#define HPCSIM_MAX_BATCH 64
+
+#ifdef USE_PILOT_THREAD
+/**
+ * Optional worker routine, processing several consecutive events at once so that the simulation
+ * can vectorize across events. If present, it is called instead of EventInit(), EventRun() and EventClear().
+ * RandU01() and QueueResult() cannot be used in it: draw with RandU01Batch() and fill in results instead.
+ * @param simContext The allocated buffer during SimulationInit()
+ * @param pilotContext The allocated buffer during PilotInit()
+ * @param count Number of events in the batch. At max, HPCSIM_MAX_BATCH
+ * @param rngStates The pseudo-random streams states of the events, as structure of arrays: 6 arrays of count doubles
+ * @param results count results, one per event, to be written with the ID of their event. Leave fResultLength to 0 for no result
+ */
+typedef void (TEventRunBatch)(void * simContext, void * pilotContext, unsigned int count, double * rngStates, TResult * results);
+#else
+/**
+ * Optional worker routine, processing several consecutive events at once so that the simulation
+ * can vectorize across events. If present, it is called instead of EventInit(), EventRun() and EventClear().
+ * RandU01() and QueueResult() cannot be used in it: draw with RandU01Batch() and fill in results instead.
+ * @param simContext The allocated buffer during SimulationInit()
+ * @param count Number of events in the batch. At max, HPCSIM_MAX_BATCH
+ * @param rngStates The pseudo-random streams states of the events, as structure of arrays: 6 arrays of count doubles
+ * @param results count results, one per event, to be written with the ID of their event. Leave fResultLength to 0 for no result
+ */
+typedef void (TEventRunBatch)(void * simContext, unsigned int count, double * rngStates, TResult * results);
+#endif
+
+/**
+ * Same generator as RandU01(), working on lanes of streams states. Prefer RandU01Batch().
+ * Every component of the states has its own array, so that the loop can be vectorized.
+ */
+static inline void RandU01Lanes(double * __restrict__ s0, double * __restrict__ s1, double * __restrict__ s2,
+                                double * __restrict__ s3, double * __restrict__ s4, double * __restrict__ s5,
+                                double * __restrict__ u, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        double p1, p2, d;
+
+        /* Component 1 */
+        p1 = 1403580.0 * s1[i] - 810728.0 * s0[i];
+        p1 -= (double)(long)(p1 / 4294967087.0) * 4294967087.0;
+        p1 += ((p1 < 0.0) ? 4294967087.0 : 0.0);
+        s0[i] = s1[i]; s1[i] = s2[i]; s2[i] = p1;
+
+        /* Component 2 */
+        p2 = 527612.0 * s5[i] - 1370589.0 * s3[i];
+        p2 -= (double)(long)(p2 / 4294944443.0) * 4294944443.0;
+        p2 += ((p2 < 0.0) ? 4294944443.0 : 0.0);
+        s3[i] = s4[i]; s4[i] = s5[i]; s5[i] = p2;
+
+        /* Combination, without branches, but bit to bit identical to RandU01() */
+        d = p1 - p2;
+        u[i] = (d + ((d <= 0.0) ? 4294967087.0 : 0.0)) * (1.0 / 4294967088.0);
+    }
+}
+
+/**
+ * Helper for EventRunBatch(). It draws one PRN for each event of the batch, from the
+ * stream of the event, exactly as RandU01() would have in EventRun().
+ * @param rngStates The streams states received by EventRunBatch()
+ * @param count The number of events received by EventRunBatch()
+ * @param u Output buffer of count doubles, receiving numbers between 0 & 1, uniformely distributed.
+ */
+static inline void RandU01Batch(double * rngStates, unsigned int count, double * u)
+{
+    RandU01Lanes(rngStates, rngStates + count, rngStates + 2 * count,
+                 rngStates + 3 * count, rngStates + 4 * count, rngStates + 5 * count,
+                 u, count);
+}
+
 /**
  * Exported function for the user. It allows drawing a PRN in the context
  * of an event, using the pseudo-random stream associated to the event.
@@ -148,6 +231,145 @@ double RandU01(void);
  * @param result The result to write. fId isn't to be completed by the user.
  */
 void QueueResult(TResult * result);
+/**
+ * Exported function for the user. In a stage of a pipeline (see --stage), it returns
+ * the result of the previous stage the event is run on. Results the event queues are
+ * written (or handed to the next stage) with the ID of the event of the simulation
+ * it comes from.
+ * You cannot (and have not to) call it outside an event run. It can only be
+ * called during EventInit(), EventRun(), EventClear() and the subtasks.
+ * @param length Output variable, receiving the length of the result
+ * @return The content of the result, 0 (and a length of 0) in the events of the simulation
+ */
+const void * EventInput(uint32_t * length);
+/**
+ * Exported function for the user. It allows forking a subtask from the event, that
+ * HPCsim will run on a thread left idle, or in WaitTasks() if there's none.
+ * The n-th subtask of an event draws from the n-th substream of the event
+ * stream, so that its numbers don't depend on the amount of threads. Its results
+ * are written with the ID of the event. In a pipeline, the results it hands to the next
+ * stage are queued once it's waited for, after the ones of the subtasks spawned before it.
+ * You can only call it during EventRun() (not in a subtask).
+ * @param task The routine to run
+ * @param taskContext Optional argument to pass to the routine
+ * @return -1 in case of error, 0 otherwise
+ */
+int SpawnTask(TTaskRun * task, void * taskContext);
+/**
+ * Exported function for the user. It waits for all the subtasks forked by the
+ * event, running the ones not started yet in the calling thread. Subtasks that would
+ * still be pending at the end of EventRun() are waited for by HPCsim.
+ * @return -1 if at least one subtask failed, 0 otherwise
+ */
+int WaitTasks(void);
+
+/**
+ * Flags for MapInput(). Prefault the whole mapping, so that events don't pay for page faults.
+ */
+#define HPCSIM_MAP_POPULATE 0x1
+/**
+ * Flags for MapInput(). Back the mapping with huge pages, to save TLB misses on large tables.
+ * The file is then copied in memory. If no huge page is reserved, transparent ones are used.
+ */
+#define HPCSIM_MAP_HUGETLB 0x2
+/**
+ * Flags for MapInput(). Interleave the pages of the mapping across the NUMA nodes.
+ * The file is then copied in memory.
+ */
+#define HPCSIM_MAP_INTERLEAVE 0x4
+/**
+ * Flags for MapInput(). Keep one copy of the file per NUMA node, see LocalInput().
+ */
+#define HPCSIM_MAP_REPLICATE 0x8
+
+/**
+ * Exported function for the user. It maps a file read-only, once for all the events,
+ * instead of having each of them (or each pilot) reading or copying it.
+ * The mapping is released by HPCsim after SimulationUnload().
+ * You can only call it during SimulationInit() or RunInit().
+ * @param path Path of the file to map
+ * @param flags Combination of HPCSIM_MAP_* flags, 0 for a plain mapping of the file
+ * @param size Optional output variable, receiving the size of the file
+ * @return The read-only content of the file, 0 in case of error
+ */
+const void * MapInput(const char * path, unsigned int flags, unsigned long * size);
+/**
+ * Exported function for the user. For a file mapped with HPCSIM_MAP_REPLICATE, it
+ * returns the copy local to the NUMA node the caller is running on.
+ * @param input An address in a mapping returned by MapInput()
+ * @return The same address, in the local copy. input itself if the file isn't replicated
+ */
+const void * LocalInput(const void * input);
+
+/**
+ * Exported function for the user. It declares a histogram with equal width bins, that
+ * HPCsim fills without locking (each thread has its own copy) and merges at the end of the run.
+ * Then, it's written to the output file name with .hist appended, and as text with .hist.txt appended.
+ * Sums don't depend on which thread ran which event: they are exact to 2^-64.
+ * You can only call it during SimulationInit() or RunInit().
+ * @param name Name of the histogram, unique, without blanks, up to 255 characters
+ * @param bins Number of bins, between min and max. Values out of range go to underflow and overflow bins
+ * @param min Lower edge of the first bin
+ * @param max Upper edge of the last bin
+ * @return The histogram, to pass to HistFill(), -1 in case of error
+ */
+int HistCreate(const char * name, unsigned int bins, double min, double max);
+/**
+ * Exported function for the user. It adds a value to a histogram.
+ * It can be called from the event loop on (event functions, subtasks, ReduceResult(), RunClear()).
+ * @param histogram The histogram returned by HistCreate()
+ * @param value The value, selecting the bin
+ * @param weight The weight to add to the bin, between -2^63 and 2^63
+ */
+void HistFill(int histogram, double value, double weight);
+/**
+ * Exported function for the user. It declares a counter, kept and written like histograms are.
+ * You can only call it during SimulationInit() or RunInit().
+ * @param name Name of the counter, unique, without blanks, up to 255 characters
+ * @return The counter, to pass to CounterAdd(), -1 in case of error
+ */
+int CounterCreate(const char * name);
+/**
+ * Exported function for the user. It adds a value to a counter.
+ * It can be called from the event loop on (event functions, subtasks, ReduceResult(), RunClear()).
+ * @param counter The counter returned by CounterCreate()
+ * @param value The value to add, between -2^63 and 2^63
+ */
+void CounterAdd(int counter, double value);
+
+/**
+ * Flags for ChannelCreate(). Write the results alone, back to back, without the ID of their
+ * event nor their length: a compact file of the records as the simulation gives them.
+ */
+#define HPCSIM_CHANNEL_PAYLOAD 0x1
+
+/**
+ * Exported function for the user. It declares a result channel: the results queued to it with
+ * QueueResultTo() have their own writer, and their own output instead of the output file: its name
+ * with .name appended, or the path given with --channel name=path (a FIFO streams them to a consumer).
+ * Small summaries and large records can then be written, and read, at their own pace.
+ * With --checkpoint, the output of a channel is appended to.
+ * You can only call it during SimulationInit(). Channels aren't available with --sweep,
+ * --stage, --processes, --pull-from, --merge or the cache, nor with libhpcsim.
+ * @param name Name of the channel, unique, made of letters, digits, - and _, up to 64 characters
+ * @param flags Combination of HPCSIM_CHANNEL_* flags, 0 to write the results as in the output file
+ * (read them with libhpcsim_sink, see SDK/hpcsim_sink.h)
+ * @param bufferSize Bytes of results queued for the writer of the channel, and batched in its writes.
+ * 0 for the default, 1 MB
+ * @param reduce Optional, receives the results instead of the output, as ReduceResult() would, in
+ * the writer of the channel. outputFile is then the output of the channel
+ * @return The channel, to pass to QueueResultTo(), -1 in case of error or if channels aren't available
+ */
+int ChannelCreate(const char * name, unsigned int flags, unsigned long bufferSize, TReduceResult * reduce);
+/**
+ * Exported function for the user. Same as QueueResult(), to a channel.
+ * You cannot (and have not to) call it outside an event run. It can only be
+ * called during EventInit(), EventRun(), EventClear() and the subtasks.
+ * @param channel The channel returned by ChannelCreate(). The results of -1 go to the output
+ * file, as with QueueResult()
+ * @param result The result to write. fId isn't to be completed by the user.
+ */
+void QueueResultTo(int channel, TResult * result);
 
 #define UNUSED_RETURN(f) if (f) { }
 #define UNUSED_PARAMETER(p) (void)p
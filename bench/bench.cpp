@@ -0,0 +1,464 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim benchmarks
+ * FILE:             bench/bench.cpp
+ * PURPOSE:          Benchmarks of HPCsim hot paths
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "RngStream.h"
+#include "TThreadsFactory.h"
+#include "TTopology.h"
+#include "TStatistics.h"
+
+struct TBenchResult
+{
+    /**
+     * Name of the benchmark
+     */
+    std::string fName;
+    /**
+     * Amount of threads used, 0 if meaningless
+     */
+    unsigned int fThreads;
+    /**
+     * Measured value
+     */
+    double fValue;
+    /**
+     * Unit of the value
+     */
+    const char * fUnit;
+    /**
+     * Digest of the output, empty if none
+     */
+    std::string fDigest;
+};
+
+static std::vector<TBenchResult> gResults;
+static bool gReproducible = true;
+
+static void AddResult(const char * name, unsigned int threads, double value, const char * unit, const std::string & digest = "")
+{
+    TBenchResult result;
+
+    result.fName = name;
+    result.fThreads = threads;
+    result.fValue = value;
+    result.fUnit = unit;
+    result.fDigest = digest;
+    gResults.push_back(result);
+
+    /* Keep the user informed, results go to the JSON output */
+    std::cerr << name;
+    if (threads != 0)
+    {
+        std::cerr << " (" << threads << " threads)";
+    }
+    std::cerr << ": " << value << " " << unit << std::endl;
+}
+
+/* Digest of an output file, that doesn't depend on the order of the records:
+ * the sum of their FNV-1a hashes, with their count
+ */
+static std::string GetDigest(const char * path)
+{
+    FILE * file;
+    unsigned long long sum = 0, count = 0;
+    std::ostringstream digest;
+
+    file = fopen(path, "r");
+    if (file == 0)
+    {
+        return "";
+    }
+
+    while (true)
+    {
+        uint8_t record[ID_FIELD_SIZE + sizeof(uint32_t) + sizeof(((TResult *)0)->fResult)];
+        uint32_t length;
+        unsigned long long hash = 0xcbf29ce484222325ULL;
+
+        if (fread(record, ID_FIELD_SIZE + sizeof(length), 1, file) != 1)
+        {
+            break;
+        }
+
+        memcpy(&length, &record[ID_FIELD_SIZE], sizeof(length));
+        if (length > sizeof(((TResult *)0)->fResult) ||
+            (length != 0 && fread(&record[ID_FIELD_SIZE + sizeof(length)], length, 1, file) != 1))
+        {
+            break;
+        }
+
+        for (size_t i = 0; i < ID_FIELD_SIZE + sizeof(length) + length; ++i)
+        {
+            hash = (hash ^ record[i]) * 0x100000001b3ULL;
+        }
+
+        sum += hash;
+        ++count;
+    }
+
+    fclose(file);
+
+    digest << count << ":" << std::hex << sum;
+    return digest.str();
+}
+
+/* Runs HPCsim with the benchmark simulation, returns the run time in s, negative on failure */
+static double RunHPCsim(const std::vector<std::string> & arguments)
+{
+    std::vector<char *> argv;
+    unsigned long long start;
+    pid_t child;
+    int status;
+
+    argv.push_back(const_cast<char *>(HPCSIM_BINARY));
+    argv.push_back(const_cast<char *>("-s"));
+    argv.push_back(const_cast<char *>(BENCH_SIMULATION));
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        argv.push_back(const_cast<char *>(arguments[i].c_str()));
+    }
+    argv.push_back(0);
+
+    start = TStatistics::Now();
+    child = fork();
+    if (child == -1)
+    {
+        return -1.0;
+    }
+
+    if (child == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+
+    if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return -1.0;
+    }
+
+    return (TStatistics::Now() - start) / 1e9;
+}
+
+static std::string ToString(unsigned long value)
+{
+    std::ostringstream string;
+
+    string << value;
+    return string.str();
+}
+
+/* Writes an output file as HPCsim would have for the first records events, with 8 bytes results.
+ * It has to run before anything else touches the RngStream package seed
+ */
+static bool GenerateCheckpoint(const char * path, unsigned long records)
+{
+    FILE * file = fopen(path, "w");
+
+    if (file == 0)
+    {
+        return false;
+    }
+
+    for (unsigned long event = 0; event < records; ++event)
+    {
+        RngStream rand;
+        uint32_t length = sizeof(double);
+        double value = rand.RandU01();
+
+        fwrite(rand.GetDigest(), ID_FIELD_SIZE, 1, file);
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite(&value, sizeof(value), 1, file);
+    }
+
+    return (fclose(file) == 0);
+}
+
+static void BenchCheckpoint(const char * path, unsigned long records)
+{
+    std::vector<std::string> arguments;
+    std::string before = GetDigest(path);
+    double time;
+
+    /* All the events are in the file: the run is only the replay */
+    arguments.push_back("-c");
+    arguments.push_back("-e");
+    arguments.push_back(ToString(records));
+    arguments.push_back("-o");
+    arguments.push_back(path);
+    arguments.push_back("-u");
+    arguments.push_back("results=1,size=8");
+
+    time = RunHPCsim(arguments);
+    if (time < 0.0)
+    {
+        std::cerr << "Checkpoint replay failed" << std::endl;
+        gReproducible = false;
+        return;
+    }
+
+    /* Nothing should have been simulated again */
+    if (GetDigest(path) != before)
+    {
+        std::cerr << "Checkpoint replay changed the output" << std::endl;
+        gReproducible = false;
+    }
+
+    AddResult("checkpoint_replay", 0, records / time, "records/s", before);
+}
+
+static void BenchRandU01(unsigned long iterations)
+{
+    RngStream rand;
+    volatile double sum = 0.0;
+    unsigned long long start = TStatistics::Now();
+
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        sum = sum + rand.RandU01();
+    }
+
+    AddResult("randu01", 0, (TStatistics::Now() - start) / static_cast<double>(iterations), "ns/call");
+}
+
+static void BenchAdvanceStream(unsigned long streams)
+{
+    unsigned long long start = TStatistics::Now();
+
+    RngStream::AdvanceStream(streams);
+
+    AddResult("advance_stream", 0, (TStatistics::Now() - start) / static_cast<double>(streams), "ns/stream");
+}
+
+static void * ChurnThread(void * argument)
+{
+    UNUSED_PARAMETER(argument);
+
+    sem_post(TThreadsFactory::GetInstance()->GetInitLock());
+    return 0;
+}
+
+static void BenchCreateThread(unsigned int threads, unsigned long count)
+{
+    unsigned long long start;
+
+    TThreadsFactory::GetInstance()->SetMaxThreads(threads);
+
+    start = TStatistics::Now();
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        TThreadsFactory::GetInstance()->CreateThread(ChurnThread, 0);
+    }
+    TThreadsFactory::GetInstance()->WaitForAllThreads();
+
+    AddResult("create_thread", threads, count / ((TStatistics::Now() - start) / 1e9), "threads/s");
+
+    /* Limit can only be set once, start from a new factory */
+    TThreadsFactory::GetInstance(true);
+}
+
+/* Runs the same simulation with various threads, measures it, and checks the output doesn't change */
+static void BenchResults(const char * name, const char * path, unsigned long events, const char * options, const std::vector<unsigned int> & threads, double perEvent, const char * unit)
+{
+    std::string reference;
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        std::vector<std::string> arguments;
+        std::string digest;
+        double time;
+
+        arguments.push_back("-t");
+        arguments.push_back(ToString(threads[i]));
+        arguments.push_back("-e");
+        arguments.push_back(ToString(events));
+        arguments.push_back("-o");
+        arguments.push_back(path);
+        arguments.push_back("-u");
+        arguments.push_back(options);
+
+        time = RunHPCsim(arguments);
+        if (time < 0.0)
+        {
+            std::cerr << name << " run failed" << std::endl;
+            gReproducible = false;
+            continue;
+        }
+
+        digest = GetDigest(path);
+        if (reference.empty())
+        {
+            reference = digest;
+        }
+        else if (digest != reference)
+        {
+            std::cerr << name << ": output differs with " << threads[i] << " threads" << std::endl;
+            gReproducible = false;
+        }
+
+        AddResult(name, threads[i], events * perEvent / time, unit, digest);
+    }
+
+    unlink(path);
+}
+
+static void Report(std::ostream & stream)
+{
+    stream << "{" << std::endl;
+    stream << "  \"reproducible\": " << (gReproducible ? "true" : "false") << "," << std::endl;
+    stream << "  \"results\": [";
+    for (size_t i = 0; i < gResults.size(); ++i)
+    {
+        const TBenchResult & result = gResults[i];
+
+        stream << (i != 0 ? "," : "") << std::endl
+               << "    {\"name\": \"" << result.fName << "\""
+               << ", \"threads\": " << result.fThreads
+               << ", \"value\": " << result.fValue
+               << ", \"unit\": \"" << result.fUnit << "\"";
+        if (!result.fDigest.empty())
+        {
+            stream << ", \"digest\": \"" << result.fDigest << "\"";
+        }
+        stream << "}";
+    }
+    stream << std::endl << "  ]" << std::endl;
+    stream << "}" << std::endl;
+}
+
+static void PrintUsage(char * name)
+{
+    std::cerr << "Usage: " << name << " [--threads|-t X --events|-e X --records|-r X --iterations|-i X --output|-o name]" << std::endl;
+    std::cerr << "\t- Threads: maximum amount of threads, runs are done with powers of two up to it (default: available CPUs)" << std::endl;
+    std::cerr << "\t- Events: number of events of the HPCsim runs (default 20000)" << std::endl;
+    std::cerr << "\t- Records: number of records of the checkpoint replay, 10^6 to 10^8 (default 1000000)" << std::endl;
+    std::cerr << "\t- Iterations: number of iterations of the micro benchmarks (default 10000000)" << std::endl;
+    std::cerr << "\t- Output: name of the JSON file to write (default: standard output)" << std::endl;
+}
+
+int main(int argc, char * argv[])
+{
+    int option;
+    unsigned int maxThreads = TTopology::GetAvailableCpus();
+    unsigned long events = 20000;
+    unsigned long records = 1000000;
+    unsigned long iterations = 10000000;
+    const char * output = 0;
+    std::vector<unsigned int> threads;
+    char checkpoint[] = "hpcsim_bench.XXXXXX";
+    int fd;
+
+    while (true)
+    {
+        int option_index = 0;
+        static struct option long_options[] =
+        {
+            {"threads", required_argument, 0, 't'},
+            {"events", required_argument, 0, 'e'},
+            {"records", required_argument, 0, 'r'},
+            {"iterations", required_argument, 0, 'i'},
+            {"output", required_argument, 0, 'o'},
+            {0, 0, 0, 0}
+        };
+
+        option = getopt_long(argc, argv, "t:e:r:i:o:", long_options, &option_index);
+        if (option == -1)
+            break;
+
+        switch (option)
+        {
+            case 't':
+                maxThreads = strtoul(optarg, 0, 10);
+                if (maxThreads == 0)
+                {
+                    maxThreads = 1;
+                }
+                break;
+
+            case 'e':
+                events = strtoul(optarg, 0, 10);
+                break;
+
+            case 'r':
+                records = strtoul(optarg, 0, 10);
+                break;
+
+            case 'i':
+                iterations = strtoul(optarg, 0, 10);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    for (unsigned int count = 1; count < maxThreads; count *= 2)
+    {
+        threads.push_back(count);
+    }
+    threads.push_back(maxThreads);
+
+    /* First, before any stream is created in this process */
+    fd = mkstemp(checkpoint);
+    if (fd == -1 || !GenerateCheckpoint(checkpoint, records))
+    {
+        std::cerr << "Failed generating the checkpoint file" << std::endl;
+        return 1;
+    }
+    close(fd);
+    BenchCheckpoint(checkpoint, records);
+    unlink(checkpoint);
+
+    BenchRandU01(iterations);
+    BenchAdvanceStream(iterations / 100);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        BenchCreateThread(threads[i], events);
+    }
+
+    /* Many small results: the pipe lock is the bottleneck */
+    BenchResults("queue_result", "hpcsim_bench.queue.out", events, "results=64,size=8", threads, 64.0, "results/s");
+    /* Few big results: the writer is the bottleneck */
+    BenchResults("write_results", "hpcsim_bench.write.out", events, "results=4,size=2048", threads,
+                 4.0 * (offsetof(TResult, fResult) + 2048) / (1024.0 * 1024.0), "MB/s");
+
+    if (output != 0)
+    {
+        std::ofstream file(output);
+        Report(file);
+    }
+    else
+    {
+        Report(std::cout);
+    }
+
+    return (gReproducible ? 0 : 1);
+}
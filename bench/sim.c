@@ -0,0 +1,106 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          HPCsim benchmarks
+ * FILE:             bench/sim.c
+ * PURPOSE:          Simulation stressing HPCsim results path
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "simulation.h"
+
+typedef struct _TBenchContext
+{
+    /* Results queued per event */
+    unsigned int fResults;
+    /* Size of each result */
+    unsigned int fSize;
+} TBenchContext;
+
+/* Sanity check for our entry points */
+TSimulationInit SimulationInit;
+TEventRun EventRun;
+TSimulationUnload SimulationUnload;
+
+int SimulationInit(unsigned char isPilot, unsigned int nThreads, unsigned long nEvents, unsigned long firstEvent, const char * userOpts, void ** simContext)
+{
+    TBenchContext * context;
+
+    UNUSED_PARAMETER(isPilot);
+    UNUSED_PARAMETER(nThreads);
+    UNUSED_PARAMETER(nEvents);
+    UNUSED_PARAMETER(firstEvent);
+
+    context = malloc(sizeof(TBenchContext));
+    if (context == NULL)
+    {
+        return -1;
+    }
+
+    /* Options are results=X,size=Y */
+    context->fResults = 1;
+    context->fSize = sizeof(double);
+    if (userOpts != NULL)
+    {
+        const char * option = strstr(userOpts, "results=");
+        if (option != NULL)
+        {
+            context->fResults = strtoul(option + strlen("results="), NULL, 10);
+        }
+
+        option = strstr(userOpts, "size=");
+        if (option != NULL)
+        {
+            context->fSize = strtoul(option + strlen("size="), NULL, 10);
+        }
+    }
+
+    if (context->fSize > sizeof(((TResult *)0)->fResult))
+    {
+        context->fSize = sizeof(((TResult *)0)->fResult);
+    }
+
+    *simContext = context;
+
+    return 0;
+}
+
+#ifdef USE_PILOT_THREAD
+void EventRun(void * simContext, void * pilotContext, void * eventContext)
+#else
+void EventRun(void * simContext, void * eventContext)
+#endif
+{
+    TBenchContext * context = simContext;
+    TResult result;
+    unsigned int i, j;
+
+#ifdef USE_PILOT_THREAD
+    UNUSED_PARAMETER(pilotContext);
+#endif
+    UNUSED_PARAMETER(eventContext);
+
+    /* Results only depend on the event stream, whatever the thread */
+    for (i = 0; i < context->fResults; ++i)
+    {
+        for (j = 0; j + sizeof(double) <= context->fSize; j += sizeof(double))
+        {
+            double value = RandU01();
+            memcpy(&result.fResult[j], &value, sizeof(value));
+        }
+        for (; j < context->fSize; ++j)
+        {
+            result.fResult[j] = (uint8_t)(RandU01() * 256.0);
+        }
+
+        result.fResultLength = context->fSize;
+        QueueResult(&result);
+    }
+}
+
+void SimulationUnload(void * simContext)
+{
+    free(simContext);
+}
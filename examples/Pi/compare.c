@@ -2,25 +2,81 @@
  * COPYRIGHT:        See LICENSE in the top level directory
  * PROJECT:          PI simulation
  * FILE:             examples/Pi/compare.c
- * PURPOSE:          Compare two output files
+ * PURPOSE:          Compare two outputs
  * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
  */
 
 #include "simulation.h"
+#include "hpcsim_sink.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <float.h>
 
 #define PATH_MAX 0x1000
 
+typedef struct TPiResult
+{
+    char fId[ID_FIELD_SIZE];
+    double fRes[2];
+} TPiResult;
+
+/* Reads all the results of an output, a single file or the manifest of its segments */
+static TPiResult * LoadResults(const char * path, unsigned long * count)
+{
+    THPCsimSink * output;
+    TPiResult * results = NULL;
+    unsigned long allocated = 0;
+    TResult result;
+
+    *count = 0;
+    output = hpcsim_sink_open(path);
+    if (output == NULL)
+    {
+        return NULL;
+    }
+
+    while (hpcsim_sink_read(output, &result) == 1)
+    {
+        /* Sanity check: verify we have correct length */
+        if (result.fResultLength != 2 * sizeof(double))
+        {
+            break;
+        }
+
+        if (*count == allocated)
+        {
+            TPiResult * grown;
+
+            allocated = (allocated == 0 ? 1024 : allocated * 2);
+            grown = realloc(results, allocated * sizeof(TPiResult));
+            if (grown == NULL)
+            {
+                break;
+            }
+            results = grown;
+        }
+
+        memcpy(results[*count].fId, result.fId, ID_FIELD_SIZE);
+        memcpy(results[*count].fRes, result.fResult, sizeof(results[*count].fRes));
+        ++*count;
+    }
+    hpcsim_sink_close(output);
+
+    /* An empty output is still an output */
+    if (results == NULL)
+    {
+        results = malloc(sizeof(TPiResult));
+    }
+
+    return results;
+}
+
 int main(int argc, char *argv[])
 {
-    FILE * file1, * file2;
-    char id1[ID_FIELD_SIZE];
-    char id2[ID_FIELD_SIZE];
-    uint32_t len;
-    double res1[2], res2[2];
+    TPiResult * results1, * results2;
+    unsigned long count1, count2, i;
     unsigned long total = 0, correct = 0;
 
     if (argc < 3)
@@ -28,122 +84,73 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    file1 = fopen(argv[1], "r");
-    if (file1 == NULL)
+    results1 = LoadResults(argv[1], &count1);
+    if (results1 == NULL)
     {
         fprintf(stderr, "Error while opening %s\n", argv[1]);
         return -1;
     }
 
-    file2 = fopen(argv[2], "r");
-    if (file2 == NULL)
+    results2 = LoadResults(argv[2], &count2);
+    if (results2 == NULL)
     {
-        fclose(file1);
+        free(results1);
         fprintf(stderr, "Error while opening %s\n", argv[2]);
         return -1;
     }
 
-    do
+    for (i = 0; i < count1; ++i)
     {
-        unsigned char found = 0;
+        const char * id1 = results1[i].fId;
+        const double * res1 = results1[i].fRes;
+        const double * res2 = NULL;
+        unsigned long j;
 
-        /* Read ID from first */
-        if (fread(id1, sizeof(id1), 1, file1) != 1)
-        {
-            break;
-        }
         ++total;
 
-        if (fseek(file2, 0, SEEK_SET) == -1)
-        {
-            break;
-        }
-
-        do
+        /* Look for the event in the second one */
+        for (j = 0; j < count2; ++j)
         {
-            if (fread(id2, sizeof(id2), 1, file2) != 1)
-            {
-                break;
-            }
-
-            /* Compare the ID */
-            if (memcmp(id1, id2, sizeof(id1)) == 0)
+            if (memcmp(id1, results2[j].fId, ID_FIELD_SIZE) == 0)
             {
+                res2 = results2[j].fRes;
                 ++correct;
-                found = 1;
-            }
-
-            /* Sanity check: verify we have correct length */
-            if (fread(&len, sizeof(uint32_t), 1, file2) != 1)
-            {
-                break;
-            }
-            if (len != 2 * sizeof(double))
-            {
                 break;
             }
-
-            /* Read the two doubles */
-            if (fread(res2, sizeof(double), 2, file2) != 2)
-            {
-                break;
-            }
-        /* Read till we reach EOF or till we found a matching event */
-        } while (!feof(file2) && found == 0);
+        }
 
         /* If we couldn't find the event, print */
-        if (found == 0)
+        if (res2 == NULL)
         {
-            unsigned int i;
+            unsigned int k;
             char digestStr[ID_FIELD_SIZE*2+1];
 
-            for (i = 0; i < ID_FIELD_SIZE; i++)
+            for (k = 0; k < ID_FIELD_SIZE; k++)
             {
-                sprintf(&digestStr[i * 2], "%02x", (unsigned int)id1[i]);
+                sprintf(&digestStr[k * 2], "%02x", (unsigned int)id1[k]);
             }
 
             printf("Mismatching ID: %s\n", digestStr);
         }
-
-        /* Sanity check: verify we have correct length */
-        if (fread(&len, sizeof(uint32_t), 1, file1) != 1)
-        {
-            break;
-        }
-        if (len != 2 * sizeof(double))
-        {
-            break;
-        }
-
-        /* Read the two doubles */
-        if (fread(res1, sizeof(double), 2, file1) != 2)
-        {
-            break;
-        }
-
         /* If we found matching ID, compare data */
-        if (found == 1)
+        else if (fabs(res1[0] - res2[0]) > DBL_EPSILON ||
+                 fabs(res1[1] - res2[1]) > DBL_EPSILON)
         {
-            if (fabs(res1[0] - res2[0]) > DBL_EPSILON ||
-                fabs(res1[1] - res2[1]) > DBL_EPSILON)
-            {
-                unsigned int i;
-                char digestStr[ID_FIELD_SIZE*2+1];
-
-                for (i = 0; i < ID_FIELD_SIZE; i++)
-                {
-                    sprintf(&digestStr[i * 2], "%02x", (unsigned int)id1[i]);
-                }
+            unsigned int k;
+            char digestStr[ID_FIELD_SIZE*2+1];
 
-                printf("Mismatching ID: %s\n", digestStr);
-                printf("res1[0]: %f, res1[1]: %f\nres2[0]: %f, res2[1]: %f\n", res1[0], res1[1], res2[0], res2[1]);
-                --correct;
+            for (k = 0; k < ID_FIELD_SIZE; k++)
+            {
+                sprintf(&digestStr[k * 2], "%02x", (unsigned int)id1[k]);
             }
+
+            printf("Mismatching ID: %s\n", digestStr);
+            printf("res1[0]: %f, res1[1]: %f\nres2[0]: %f, res2[1]: %f\n", res1[0], res1[1], res2[0], res2[1]);
+            --correct;
         }
     }
-    while (!feof(file1));
-    fclose(file2);
-    fclose(file1);
+    free(results2);
+    free(results1);
 
     /* Print results */
     printf("Total results: %lu\nCorrect results: %lu\n", total, correct);
@@ -7,6 +7,7 @@
  */
 
 #include "simulation.h"
+#include "hpcsim_sink.h"
 #include <string.h>
 #include <stdio.h>    
 
@@ -16,10 +17,10 @@
 
 int main(int argc, char *argv[])
 {
-    FILE * inFD;
+    THPCsimSink * output;
+    TResult result;
     char resFile[PATH_MAX] = DEFAULT_NAME;
     double inside = 0.0, total = 0.0;
-    uint32_t len;
     double res[2];
 
     if (argc > 1)
@@ -28,43 +29,30 @@ int main(int argc, char *argv[])
         resFile[PATH_MAX - 1] = '\0';
     }
 
-    inFD = fopen(resFile, "r");
-    if (inFD == NULL)
+    /* The output may be a single file, or the manifest of its segments */
+    output = hpcsim_sink_open(resFile);
+    if (output == NULL)
     {
         fprintf(stderr, "Error while opening %s\n", resFile);
         return -1;
     }
 
-    do
+    while (hpcsim_sink_read(output, &result) == 1)
     {
-        /* Skip ID */
-        if (fseek(inFD, ID_FIELD_SIZE, SEEK_CUR) == -1)
-        {
-            break;
-        }
-
         /* Sanity check: verify we have correct length */
-        if (fread(&len, sizeof(uint32_t), 1, inFD) != 1)
-        {
-            break;
-        }
-        if (len != 2 * sizeof(double))
+        if (result.fResultLength != 2 * sizeof(double))
         {
             break;
         }
 
         /* Read the two doubles */
-        if (fread(res, sizeof(double), 2, inFD) != 2)
-        {
-            break;
-        }
+        memcpy(res, result.fResult, sizeof(res));
 
         /* Adjust counts */
         total += res[0];
         inside += res[1];
     }
-    while (!feof(inFD));
-    fclose(inFD);
+    hpcsim_sink_close(output);
 
     /* Compute PI for real */
     printf("Pi: %f (with %f samples)\n", (4.0 * inside) / total, total);
@@ -0,0 +1,58 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          PI simulation
+ * FILE:             examples/PiBatch/batch.c
+ * PURPOSE:          Routines for batched events support
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <stdlib.h>
+#include "simulation.h"
+
+/* Sanity check for our entry points */
+TEventRunBatch EventRunBatch;
+
+#ifdef USE_PILOT_THREAD
+void EventRunBatch(void * simContext, void * pilotContext, unsigned int count, double * rngStates, TResult * results)
+#else
+void EventRunBatch(void * simContext, unsigned int count, double * rngStates, TResult * results)
+#endif
+{
+    double total;
+    double x[HPCSIM_MAX_BATCH], y[HPCSIM_MAX_BATCH], inside[HPCSIM_MAX_BATCH];
+    unsigned int event;
+
+    UNUSED_PARAMETER(simContext);
+#ifdef USE_PILOT_THREAD
+    UNUSED_PARAMETER(pilotContext);
+#endif
+
+    for (event = 0; event < count; ++event)
+    {
+        inside[event] = 0.0;
+    }
+
+    /* We'll compute 10,000 values for each event, all the events at once */
+    for (total = 0; total < 10000; ++total)
+    {
+        RandU01Batch(rngStates, count, x);
+        RandU01Batch(rngStates, count, y);
+
+        for (event = 0; event < count; ++event)
+        {
+            inside[event] += ((x[event] * x[event] + y[event] * y[event] < 1.0) ? 1.0 : 0.0);
+        }
+    }
+
+    /* Same results as EventRun() */
+    for (event = 0; event < count; ++event)
+    {
+        double * resultBuffer = (double *)&results[event].fResult[0];
+
+        results[event].fResultLength = 2 * sizeof(double);
+        resultBuffer[0] = total;
+        resultBuffer[1] = inside[event];
+    }
+
+    return;
+}
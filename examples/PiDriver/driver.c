@@ -0,0 +1,83 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          PI simulation
+ * FILE:             examples/PiDriver/driver.c
+ * PURPOSE:          Program driving the PI simulation with libhpcsim, for two ranges of events
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include "hpcsim.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+int main(int argc, char *argv[])
+{
+    THPCsimConfig config;
+    THPCsimRange range;
+    THPCsimStats stats;
+    THPCsim * hpcsim;
+    unsigned long events = 100;
+    int i;
+
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s simulation.so output1 output2 [events]\n", argv[0]);
+        return -1;
+    }
+
+    if (argc > 4)
+    {
+        events = strtoul(argv[4], NULL, 10);
+    }
+
+    /* Loaded and initialized once, for both ranges */
+    config.fSimulation = argv[1];
+    config.fUserOpts = NULL;
+    config.fThreads = 2;
+    config.fBatchSize = 0;
+    config.fAffinity = NULL;
+    config.fFirstEvent = 0;
+    config.fEvents = 2 * events;
+
+    hpcsim = hpcsim_open(&config);
+    if (hpcsim == NULL)
+    {
+        fprintf(stderr, "Error while opening %s\n", argv[1]);
+        return -1;
+    }
+
+    /* The first events, then the next ones: same results as HPCsim with -e events, then -f events */
+    for (i = 0; i < 2; ++i)
+    {
+        range.fFirstEvent = i * events;
+        range.fEvents = events;
+        range.fOutput = argv[2 + i];
+        range.fUserOpts = NULL;
+
+        if (hpcsim_run(hpcsim, &range) < 0)
+        {
+            fprintf(stderr, "Error while running events %lu to %lu\n", range.fFirstEvent, range.fFirstEvent + events - 1);
+            hpcsim_close(hpcsim);
+            return -1;
+        }
+    }
+
+    if (hpcsim_stats(hpcsim, &stats) < 0)
+    {
+        fprintf(stderr, "Error while getting statistics\n");
+        hpcsim_close(hpcsim);
+        return -1;
+    }
+    hpcsim_close(hpcsim);
+
+    printf("Runs: %lu, events: %llu, bytes: %llu, seconds: %f\n", stats.fRuns, stats.fTotalEvents, stats.fTotalWritten, stats.fTotalSeconds);
+
+    /* Both runs have to be counted */
+    if (stats.fRuns != 2 || stats.fEvents != events || stats.fTotalEvents != 2 * events)
+    {
+        fprintf(stderr, "Unexpected statistics\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          PI simulation
+ * FILE:             examples/PiSink/sink.c
+ * PURPOSE:          Consumer of the results of the PI simulation, streamed by a run with --sink
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include "simulation.h"
+#include "hpcsim_sink.h"
+#include <string.h>
+#include <stdio.h>
+
+int main(int argc, char *argv[])
+{
+    THPCsimSink * sink;
+    TResult result;
+    double inside = 0.0, total = 0.0;
+    double res[2];
+    unsigned int i;
+    int status;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s shm:name|fifo:path|unix:path|output\n", argv[0]);
+        return -1;
+    }
+
+    /* Waits for the run to stream, or reads its output */
+    sink = hpcsim_sink_open(argv[1]);
+    if (sink == NULL)
+    {
+        fprintf(stderr, "Error while opening %s\n", argv[1]);
+        return -1;
+    }
+
+    /* One line per result, as it comes, so that the records of two runs can be compared */
+    while ((status = hpcsim_sink_read(sink, &result)) == 1)
+    {
+        /* Sanity check: verify we have correct length */
+        if (result.fResultLength != 2 * sizeof(double))
+        {
+            status = -1;
+            break;
+        }
+
+        memcpy(res, result.fResult, sizeof(res));
+        total += res[0];
+        inside += res[1];
+
+        for (i = 0; i < ID_FIELD_SIZE; ++i)
+        {
+            printf("%02x", (unsigned int)result.fId[i]);
+        }
+        printf(" %.0f %.0f\n", res[0], res[1]);
+    }
+    hpcsim_sink_close(sink);
+
+    if (status < 0)
+    {
+        fprintf(stderr, "Error while reading %s\n", argv[1]);
+        return -1;
+    }
+
+    /* Compute PI for real, out of the records */
+    fprintf(stderr, "Pi: %f (with %f samples)\n", (4.0 * inside) / total, total);
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          PI simulation
+ * FILE:             examples/PiStage/stage.c
+ * PURPOSE:          Stage following the PI simulation, sampling again from the results it gets
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "simulation.h"
+
+#define PATH_MAX 0x1000
+
+/* Subtasks of each event, each one hands its own result on */
+#define STAGE_TASKS 2
+
+typedef struct TContext
+{
+    double fTotal;
+    double fInside;
+    char fOutput[PATH_MAX];
+} TContext;
+
+typedef struct TTaskContext
+{
+    unsigned long fSamples;
+} TTaskContext;
+
+/* Sanity check for our entry points */
+TSimulationInit SimulationInit;
+TEventRun EventRun;
+TReduceResult ReduceResult;
+TSimulationUnload SimulationUnload;
+
+int SimulationInit(unsigned char isPilot, unsigned int nThreads, unsigned long nEvents, unsigned long firstEvent, const char * userOpts, void ** simContext)
+{
+    TContext * context;
+
+    UNUSED_PARAMETER(isPilot);
+    UNUSED_PARAMETER(nThreads);
+    UNUSED_PARAMETER(nEvents);
+    UNUSED_PARAMETER(firstEvent);
+    UNUSED_PARAMETER(userOpts);
+
+    /* Allocate our own context */
+    context = malloc(sizeof(TContext));
+    if (context == NULL)
+    {
+        return -1;
+    }
+
+    /* Init it */
+    context->fTotal = 0.;
+    context->fInside = 0.;
+    context->fOutput[0] = '\0';
+
+    /* And return it */
+    *simContext = context;
+
+    return 0;
+}
+
+static void SampleTask(void * simContext, void * taskContext)
+{
+    TTaskContext * task = taskContext;
+    double total, inside;
+    TResult result;
+    double * resultBuffer;
+
+    UNUSED_PARAMETER(simContext);
+
+    /* The subtask draws from its own substream */
+    for (total = 0, inside = 0; total < task->fSamples; ++total)
+    {
+        double x = RandU01();
+        double y = RandU01();
+
+        if (x * x + y * y < 1.0)
+        {
+            ++inside;
+        }
+    }
+
+    /* Same result as the simulation: total and then inside */
+    result.fResultLength = 2 * sizeof(double);
+    resultBuffer = (double *)&result.fResult[0];
+    resultBuffer[0] = total;
+    resultBuffer[1] = inside;
+
+    /* Handed to the next stage, or reduced by the last one */
+    QueueResult(&result);
+}
+
+/* Stages are not available with pilot threads, it's only built for them */
+#ifdef USE_PILOT_THREAD
+void EventRun(void * simContext, void * pilotContext, void * eventContext)
+#else
+void EventRun(void * simContext, void * eventContext)
+#endif
+{
+    TTaskContext tasks[STAGE_TASKS];
+    const double * input;
+    uint32_t length;
+    unsigned int i;
+
+#ifdef USE_PILOT_THREAD
+    UNUSED_PARAMETER(pilotContext);
+#endif
+    UNUSED_PARAMETER(eventContext);
+
+    /* Sanity check: verify we have correct length */
+    input = EventInput(&length);
+    if (input == NULL || length != 2 * sizeof(double))
+    {
+        return;
+    }
+
+    /* The samples depend on the result: the same substream has to go with the same result, whatever the threads */
+    for (i = 0; i < STAGE_TASKS; ++i)
+    {
+        tasks[i].fSamples = 1000 + ((unsigned long)input[1] + i) % 1000;
+        if (SpawnTask(SampleTask, &tasks[i]) < 0)
+        {
+            SampleTask(simContext, &tasks[i]);
+        }
+    }
+
+    WaitTasks();
+}
+
+void ReduceResult(void * simContext, char const * outputFile, void const * id, uint32_t resultLength, void const * result)
+{
+    TContext * context = simContext;
+
+    UNUSED_PARAMETER(id);
+
+    /* Validate input size */
+    if (resultLength != 2 * sizeof(double))
+    {
+        return;
+    }
+
+    /* Increment counters, they're whole numbers: the sum doesn't depend on the order */
+    context->fTotal += ((double *)result)[0];
+    context->fInside += ((double *)result)[1];
+    strncpy(context->fOutput, outputFile, PATH_MAX - 1);
+    context->fOutput[PATH_MAX - 1] = '\0';
+}
+
+void SimulationUnload(void * simContext)
+{
+    TContext * context = simContext;
+
+    /* Only the last stage reduces, and writes its counters to compare runs */
+    if (context->fOutput[0] != '\0')
+    {
+        FILE * output = fopen(context->fOutput, "w");
+
+        if (output != NULL)
+        {
+            fprintf(output, "%.0f %.0f\n", context->fTotal, context->fInside);
+            fclose(output);
+        }
+
+        printf("Pi: %f (with %f samples)\n", (4.0 * context->fInside) / context->fTotal, context->fTotal);
+    }
+    free(context);
+}
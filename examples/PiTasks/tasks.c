@@ -0,0 +1,181 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          PI simulation
+ * FILE:             examples/PiTasks/tasks.c
+ * PURPOSE:          PI simulation splitting each event in subtasks
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "simulation.h"
+
+#define PATH_MAX 0x1000
+
+/* Subtasks of each event, they share its 10,000 values */
+#define EVENT_TASKS 4
+
+typedef struct TContext
+{
+    double fTotal;
+    double fInside;
+    char fOutput[PATH_MAX];
+} TContext;
+
+typedef struct TTaskContext
+{
+    double fTotal;
+    double fInside;
+} TTaskContext;
+
+/* Sanity check for our entry points */
+TSimulationInit SimulationInit;
+TEventRun EventRun;
+TReduceResult ReduceResult;
+TSimulationUnload SimulationUnload;
+
+int SimulationInit(unsigned char isPilot, unsigned int nThreads, unsigned long nEvents, unsigned long firstEvent, const char * userOpts, void ** simContext)
+{
+    TContext * context;
+
+    UNUSED_PARAMETER(nThreads);
+    UNUSED_PARAMETER(nEvents);
+    UNUSED_PARAMETER(firstEvent);
+    UNUSED_PARAMETER(userOpts);
+
+    /* Check we're running in the context we where built for */
+#ifdef USE_PILOT_THREAD
+    if (!isPilot)
+        return -1;
+#else
+    if (isPilot)
+        return -1;
+#endif
+
+    /* Allocate our own context */
+    context = malloc(sizeof(TContext));
+    if (context == NULL)
+    {
+        return -1;
+    }
+
+    /* Init it */
+    context->fTotal = 0.;
+    context->fInside = 0.;
+    context->fOutput[0] = '\0';
+
+    /* And return it */
+    *simContext = context;
+
+    return 0;
+}
+
+static void SampleTask(void * simContext, void * taskContext)
+{
+    TTaskContext * task = taskContext;
+    double total, inside;
+
+    UNUSED_PARAMETER(simContext);
+
+    /* Each subtask draws from its own substream of the event stream */
+    for (total = 0, inside = 0; total < 10000 / EVENT_TASKS; ++total)
+    {
+        double x = RandU01();
+        double y = RandU01();
+
+        if (x * x + y * y < 1.0)
+        {
+            ++inside;
+        }
+    }
+
+    task->fTotal = total;
+    task->fInside = inside;
+}
+
+#ifdef USE_PILOT_THREAD
+void EventRun(void * simContext, void * pilotContext, void * eventContext)
+#else
+void EventRun(void * simContext, void * eventContext)
+#endif
+{
+    TTaskContext tasks[EVENT_TASKS];
+    TResult result;
+    double * resultBuffer;
+    unsigned int i;
+
+#ifdef USE_PILOT_THREAD
+    UNUSED_PARAMETER(pilotContext);
+#endif
+    UNUSED_PARAMETER(eventContext);
+
+    /* Fork the subtasks, idle threads will help. If one can't be forked, run it now */
+    for (i = 0; i < EVENT_TASKS; ++i)
+    {
+        if (SpawnTask(SampleTask, &tasks[i]) < 0)
+        {
+            SampleTask(simContext, &tasks[i]);
+        }
+    }
+
+    /* Join them, their values are in the tasks contexts then */
+    if (WaitTasks() < 0)
+    {
+        return;
+    }
+
+    /* Same result as example 1: total and then inside */
+    result.fResultLength = 2 * sizeof(double);
+    resultBuffer = (double *)&result.fResult[0];
+    resultBuffer[0] = 0;
+    resultBuffer[1] = 0;
+    for (i = 0; i < EVENT_TASKS; ++i)
+    {
+        resultBuffer[0] += tasks[i].fTotal;
+        resultBuffer[1] += tasks[i].fInside;
+    }
+
+    /* Write the result */
+    QueueResult(&result);
+}
+
+void ReduceResult(void * simContext, char const * outputFile, void const * id, uint32_t resultLength, void const * result)
+{
+    TContext * context = simContext;
+
+    UNUSED_PARAMETER(id);
+
+    /* Validate input size */
+    if (resultLength != 2 * sizeof(double))
+    {
+        return;
+    }
+
+    /* Increment counters, they're whole numbers: the sum doesn't depend on the order */
+    context->fTotal += ((double *)result)[0];
+    context->fInside += ((double *)result)[1];
+    strncpy(context->fOutput, outputFile, PATH_MAX - 1);
+    context->fOutput[PATH_MAX - 1] = '\0';
+}
+
+void SimulationUnload(void * simContext)
+{
+    TContext * context = simContext;
+
+    /* Write the counters, to compare runs */
+    if (context->fOutput[0] != '\0')
+    {
+        FILE * output = fopen(context->fOutput, "w");
+
+        if (output != NULL)
+        {
+            fprintf(output, "%.0f %.0f\n", context->fTotal, context->fInside);
+            fclose(output);
+        }
+    }
+
+    /* Compute PI for real */
+    printf("Pi: %f (with %f samples)\n", (4.0 * context->fInside) / context->fTotal, context->fTotal);
+    free(context);
+}
@@ -0,0 +1,478 @@
+/*
+ * COPYRIGHT:        See LICENSE in the top level directory
+ * PROJECT:          Synthetic simulation
+ * FILE:             examples/Synthetic/synthetic.c
+ * PURPOSE:          Configurable workload to exercise HPCsim
+ * PROGRAMMER:       Pierre Schweitzer (pierre@reactos.org)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "simulation.h"
+
+#define PATH_MAX 0x1000
+
+typedef enum _TDistribution
+{
+    DIST_CONSTANT,
+    DIST_EXPONENTIAL,
+    DIST_PARETO
+} TDistribution;
+
+typedef struct _TSyntheticContext
+{
+    /* How the event durations are drawn */
+    TDistribution fDistribution;
+    /* Mean duration of an event, in us */
+    double fMean;
+    /* Shape of the Pareto distribution */
+    double fAlpha;
+    /* Longest event, in us, 0 for no limit */
+    double fMax;
+    /* Results queued per event */
+    unsigned int fResults;
+    /* Size of each result */
+    unsigned int fSize;
+    /* Memory allocated and touched per event, in KB */
+    unsigned long fMemory;
+    /* Probability for an event to fail */
+    double fFailure;
+    /* Histogram of the durations and counter of the failures, -1 if not asked for */
+    int fDurations;
+    int fFailed;
+    /* Size of the record queued per event to the bulk channel, 0 for none */
+    unsigned int fBulk;
+    int fBulkChannel;
+    /* Channel reducing the durations of the events, -1 if not asked for. Only its writer counts them */
+    int fSummaryChannel;
+    unsigned long fSummaryEvents;
+    double fSummaryDuration;
+    char fSummaryOutput[PATH_MAX];
+    /* File read by the events, mapped once for all of them, NULL for none */
+    const unsigned char * fInput;
+    unsigned long fInputSize;
+    /* Bytes of the file each event reads, and the counter of their sum */
+    unsigned int fLookups;
+    int fInputSum;
+} TSyntheticContext;
+
+/* Sanity check for our entry points */
+TSimulationInit SimulationInit;
+TEventInit EventInit;
+TEventRun EventRun;
+TSimulationUnload SimulationUnload;
+
+static const char * GetOption(const char * userOpts, const char * name)
+{
+    size_t length = strlen(name);
+    const char * option = userOpts;
+
+    /* Options are name=value, separated with commas */
+    while (option != NULL)
+    {
+        if (strncmp(option, name, length) == 0 && option[length] == '=')
+        {
+            return option + length + 1;
+        }
+
+        option = strchr(option, ',');
+        if (option != NULL)
+        {
+            ++option;
+        }
+    }
+
+    return NULL;
+}
+
+static void ReduceSummary(void * simContext, char const * outputFile, void const * id, uint32_t resultLength, void const * result)
+{
+    TSyntheticContext * context = simContext;
+    double duration;
+
+    UNUSED_PARAMETER(id);
+
+    /* Validate input size */
+    if (resultLength != sizeof(duration))
+    {
+        return;
+    }
+
+    /* Whole microseconds: the sum doesn't depend on the order */
+    memcpy(&duration, result, sizeof(duration));
+    ++context->fSummaryEvents;
+    context->fSummaryDuration += duration;
+    strncpy(context->fSummaryOutput, outputFile, PATH_MAX - 1);
+    context->fSummaryOutput[PATH_MAX - 1] = '\0';
+}
+
+int SimulationInit(unsigned char isPilot, unsigned int nThreads, unsigned long nEvents, unsigned long firstEvent, const char * userOpts, void ** simContext)
+{
+    TSyntheticContext * context;
+    const char * option;
+
+    UNUSED_PARAMETER(isPilot);
+    UNUSED_PARAMETER(nThreads);
+    UNUSED_PARAMETER(nEvents);
+    UNUSED_PARAMETER(firstEvent);
+
+    context = malloc(sizeof(TSyntheticContext));
+    if (context == NULL)
+    {
+        return -1;
+    }
+
+    /* Defaults: 100us constant events, with one double as result */
+    context->fDistribution = DIST_CONSTANT;
+    context->fMean = 100.0;
+    context->fAlpha = 1.5;
+    context->fMax = 0.0;
+    context->fResults = 1;
+    context->fSize = sizeof(double);
+    context->fMemory = 0;
+    context->fFailure = 0.0;
+    context->fDurations = -1;
+    context->fFailed = -1;
+    context->fBulk = 0;
+    context->fBulkChannel = -1;
+    context->fSummaryChannel = -1;
+    context->fSummaryEvents = 0;
+    context->fSummaryDuration = 0.0;
+    context->fSummaryOutput[0] = '\0';
+    context->fInput = NULL;
+    context->fInputSize = 0;
+    context->fLookups = 16;
+    context->fInputSum = -1;
+
+    option = GetOption(userOpts, "dist");
+    if (option != NULL)
+    {
+        if (strncmp(option, "constant", strlen("constant")) == 0)
+        {
+            context->fDistribution = DIST_CONSTANT;
+        }
+        else if (strncmp(option, "exponential", strlen("exponential")) == 0)
+        {
+            context->fDistribution = DIST_EXPONENTIAL;
+        }
+        else if (strncmp(option, "pareto", strlen("pareto")) == 0)
+        {
+            context->fDistribution = DIST_PARETO;
+        }
+        else
+        {
+            free(context);
+            return -1;
+        }
+    }
+
+    option = GetOption(userOpts, "mean");
+    if (option != NULL)
+    {
+        context->fMean = strtod(option, NULL);
+    }
+
+    option = GetOption(userOpts, "alpha");
+    if (option != NULL)
+    {
+        context->fAlpha = strtod(option, NULL);
+    }
+
+    option = GetOption(userOpts, "max");
+    if (option != NULL)
+    {
+        context->fMax = strtod(option, NULL);
+    }
+
+    option = GetOption(userOpts, "results");
+    if (option != NULL)
+    {
+        context->fResults = strtoul(option, NULL, 10);
+    }
+
+    option = GetOption(userOpts, "size");
+    if (option != NULL)
+    {
+        context->fSize = strtoul(option, NULL, 10);
+    }
+
+    option = GetOption(userOpts, "memory");
+    if (option != NULL)
+    {
+        context->fMemory = strtoul(option, NULL, 10);
+    }
+
+    option = GetOption(userOpts, "failure");
+    if (option != NULL)
+    {
+        context->fFailure = strtod(option, NULL);
+    }
+
+    option = GetOption(userOpts, "bulk");
+    if (option != NULL)
+    {
+        context->fBulk = strtoul(option, NULL, 10);
+    }
+
+    option = GetOption(userOpts, "lookups");
+    if (option != NULL)
+    {
+        context->fLookups = strtoul(option, NULL, 10);
+    }
+
+    /* Pareto needs a finite mean */
+    if (context->fMean < 0.0 || context->fAlpha <= 1.0 || context->fFailure < 0.0 || context->fFailure > 1.0)
+    {
+        free(context);
+        return -1;
+    }
+
+    if (context->fSize > sizeof(((TResult *)0)->fResult))
+    {
+        context->fSize = sizeof(((TResult *)0)->fResult);
+    }
+
+    if (context->fBulk > sizeof(((TResult *)0)->fResult))
+    {
+        context->fBulk = sizeof(((TResult *)0)->fResult);
+    }
+
+    /* Bulk records have their own output, the one of the run keeps the results only */
+    if (context->fBulk != 0)
+    {
+        context->fBulkChannel = ChannelCreate("bulk", 0, 0, NULL);
+        if (context->fBulkChannel < 0)
+        {
+            free(context);
+            return -1;
+        }
+    }
+
+    /* Summaries are reduced in the writer of their channel, and written to its output at the end */
+    option = GetOption(userOpts, "summary");
+    if (option != NULL && strtoul(option, NULL, 10) != 0)
+    {
+        context->fSummaryChannel = ChannelCreate("summary", 0, 0, ReduceSummary);
+        if (context->fSummaryChannel < 0)
+        {
+            free(context);
+            return -1;
+        }
+    }
+
+    /* The file is shared by the events, each NUMA node gets its own copy. Its path ends at the next comma */
+    option = GetOption(userOpts, "input");
+    if (option != NULL)
+    {
+        size_t length = strcspn(option, ",");
+        char * path = malloc(length + 1);
+
+        if (path != NULL)
+        {
+            memcpy(path, option, length);
+            path[length] = '\0';
+            context->fInput = MapInput(path, HPCSIM_MAP_POPULATE | HPCSIM_MAP_REPLICATE, &context->fInputSize);
+            free(path);
+        }
+
+        context->fInputSum = CounterCreate("input");
+        if (context->fInput == NULL || context->fInputSize == 0 || context->fInputSum < 0)
+        {
+            free(context);
+            return -1;
+        }
+    }
+
+    /* Durations up to the cap (capped ones are in the overflow bin), or to 10 times the mean */
+    option = GetOption(userOpts, "histogram");
+    if (option != NULL && strtoul(option, NULL, 10) != 0)
+    {
+        double high = (context->fMax > 0.0 ? context->fMax : 10.0 * context->fMean);
+
+        context->fDurations = HistCreate("durations", strtoul(option, NULL, 10), 0.0, (high > 0.0 ? high : 1.0));
+        context->fFailed = CounterCreate("failed");
+        if (context->fDurations < 0 || context->fFailed < 0)
+        {
+            free(context);
+            return -1;
+        }
+    }
+
+    *simContext = context;
+
+    return 0;
+}
+
+#ifdef USE_PILOT_THREAD
+int EventInit(void * simContext, void * pilotContext, void ** eventContext)
+#else
+int EventInit(void * simContext, void ** eventContext)
+#endif
+{
+    TSyntheticContext * context = simContext;
+
+#ifdef USE_PILOT_THREAD
+    UNUSED_PARAMETER(pilotContext);
+#endif
+    UNUSED_PARAMETER(eventContext);
+
+    /* Always draw, so that the following numbers don't depend on the failure probability */
+    if (RandU01() < context->fFailure)
+    {
+        CounterAdd(context->fFailed, 1.0);
+        return -1;
+    }
+
+    return 0;
+}
+
+static double GetDuration(TSyntheticContext * context)
+{
+    double duration;
+
+    switch (context->fDistribution)
+    {
+        case DIST_EXPONENTIAL:
+            duration = -context->fMean * log(1.0 - RandU01());
+            break;
+
+        case DIST_PARETO:
+            /* Scale chosen so that the mean matches */
+            duration = context->fMean * (context->fAlpha - 1.0) / context->fAlpha / pow(1.0 - RandU01(), 1.0 / context->fAlpha);
+            break;
+
+        default:
+            duration = context->fMean;
+            break;
+    }
+
+    if (context->fMax > 0.0 && duration > context->fMax)
+    {
+        duration = context->fMax;
+    }
+
+    return duration;
+}
+
+static void Spin(double duration)
+{
+    struct timespec start, now;
+    double elapsed;
+
+    /* Burn CPU time of this thread, so that oversubscription shows up */
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    do
+    {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) / 1e3;
+    } while (elapsed < duration);
+}
+
+#ifdef USE_PILOT_THREAD
+void EventRun(void * simContext, void * pilotContext, void * eventContext)
+#else
+void EventRun(void * simContext, void * eventContext)
+#endif
+{
+    TSyntheticContext * context = simContext;
+    unsigned char * memory = NULL;
+    TResult result;
+    double duration;
+    unsigned int i, j;
+
+#ifdef USE_PILOT_THREAD
+    UNUSED_PARAMETER(pilotContext);
+#endif
+    UNUSED_PARAMETER(eventContext);
+
+    /* Touch each page, so that it's really allocated */
+    if (context->fMemory != 0)
+    {
+        memory = malloc(context->fMemory * 1024);
+        if (memory != NULL)
+        {
+            unsigned long k;
+
+            for (k = 0; k < context->fMemory * 1024; k += 4096)
+            {
+                memory[k] = (unsigned char)k;
+            }
+        }
+    }
+
+    duration = GetDuration(context);
+    HistFill(context->fDurations, duration, 1.0);
+    Spin(duration);
+
+    /* Results only depend on the event stream, whatever the thread */
+    for (i = 0; i < context->fResults; ++i)
+    {
+        for (j = 0; j + sizeof(double) <= context->fSize; j += sizeof(double))
+        {
+            double value = RandU01();
+            memcpy(&result.fResult[j], &value, sizeof(value));
+        }
+        for (; j < context->fSize; ++j)
+        {
+            result.fResult[j] = (uint8_t)(RandU01() * 256.0);
+        }
+
+        result.fResultLength = context->fSize;
+        QueueResult(&result);
+    }
+
+    /* Drawn after the results, so that they're the same with or without it */
+    if (context->fBulk != 0)
+    {
+        memset(result.fResult, (uint8_t)(RandU01() * 256.0), context->fBulk);
+        result.fResultLength = context->fBulk;
+        QueueResultTo(context->fBulkChannel, &result);
+    }
+
+    /* Nothing drawn for it, the results are the same with or without it */
+    if (context->fSummaryChannel >= 0)
+    {
+        double summary = floor(duration);
+
+        memcpy(result.fResult, &summary, sizeof(summary));
+        result.fResultLength = sizeof(summary);
+        QueueResultTo(context->fSummaryChannel, &result);
+    }
+
+    /* Drawn last too, the lookups go to the copy of the file on the node of the thread */
+    if (context->fInput != NULL)
+    {
+        const unsigned char * input = LocalInput(context->fInput);
+        double sum = 0.0;
+
+        for (i = 0; i < context->fLookups; ++i)
+        {
+            sum += input[(unsigned long)(RandU01() * context->fInputSize)];
+        }
+        CounterAdd(context->fInputSum, sum);
+    }
+
+    free(memory);
+}
+
+void SimulationUnload(void * simContext)
+{
+    TSyntheticContext * context = simContext;
+
+    /* The output of the summary channel only gets the totals */
+    if (context->fSummaryOutput[0] != '\0')
+    {
+        FILE * output = fopen(context->fSummaryOutput, "w");
+
+        if (output != NULL)
+        {
+            fprintf(output, "%lu %.0f\n", context->fSummaryEvents, context->fSummaryDuration);
+            fclose(output);
+        }
+    }
+
+    free(context);
+}